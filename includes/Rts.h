@@ -206,6 +206,7 @@ void _assertFail(const char *filename, unsigned int linenum)
 #include "rts/StaticPtrTable.h"
 #include "rts/Libdw.h"
 #include "rts/LibdwPool.h"
+#include "rts/EventLogWriter.h"
 
 /* Misc stuff without a home */
 DLL_IMPORT_RTS extern char **prog_argv; /* so we can get at these from Haskell */
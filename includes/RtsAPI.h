@@ -140,6 +140,58 @@ typedef struct GCDetails_ {
   Time elapsed_ns;
 } GCDetails;
 
+//
+// A histogram of scheduling latencies (+RTS --sched-stats).  Bucket 0
+// counts the samples below 1us, and bucket i > 0 those in
+// [2^(i-1), 2^i) us; the last bucket also counts everything above.
+//
+#define SCHED_HISTOGRAM_BUCKETS 24
+
+typedef struct SchedHistogram_ {
+    // Number of samples
+  uint64_t count;
+    // Sum of the samples
+  Time total_ns;
+    // The largest sample
+  Time max_ns;
+  uint64_t buckets[SCHED_HISTOGRAM_BUCKETS];
+} SchedHistogram;
+
+// One more than the largest why_blocked value (see rts/Constants.h)
+#define SCHED_STATS_BLOCK_REASONS 15
+
+//
+// Scheduling latencies of Haskell threads, collected with
+// +RTS --sched-stats, either for one capability or for all of them.
+//
+typedef struct SchedStats_ {
+    // Time from becoming runnable to starting to run
+  SchedHistogram runnable;
+    // Length of run slices
+  SchedHistogram run;
+    // Time spent blocked, indexed by the why_blocked reason
+  SchedHistogram blocked[SCHED_STATS_BLOCK_REASONS];
+} SchedStats;
+
+//
+// Commits and aborts of STM transactions, either for one capability or
+// for all of them.
+//
+typedef struct StmStats_ {
+    // Transactions committed
+  uint64_t commits;
+    // Transactions that failed to commit, or were found invalid, and
+    // were run again
+  uint64_t aborts;
+    // The most consecutive aborts of any one committed transaction
+  uint64_t max_aborts;
+    // Times a transaction backed off before running again
+    // (+RTS --stm-backoff)
+  uint64_t backoffs;
+    // Times a transaction was run alone (+RTS --stm-serialise)
+  uint64_t serialised;
+} StmStats;
+
 //
 // Stats about the RTS currently, and since the start of execution
 //
@@ -197,11 +249,26 @@ typedef struct _RTSStats {
 
   GCDetails gc;
 
+  // -----------------------------------
+  // Scheduling latencies, summed over all capabilities.  All zero
+  // unless +RTS --sched-stats is given.
+
+  SchedStats sched;
+
+  // -----------------------------------
+  // STM transactions, summed over all capabilities
+
+  StmStats stm;
+
 } RTSStats;
 
 void getRTSStats (RTSStats *s);
 int getRTSStatsEnabled (void);
 
+// Scheduling latencies for a single capability; all zero if the
+// capability does not exist.
+void getCapabilitySchedStats (uint32_t cap, SchedStats *s);
+
 // Returns the total number of bytes allocated since the start of the program.
 // TODO: can we remove this?
 uint64_t getAllocations (void);
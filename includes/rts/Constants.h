@@ -277,6 +277,19 @@
  */
 #define TSO_ALLOC_LIMIT 256
 
+/* -----------------------------------------------------------------------------
+   Thread priorities
+
+   The range of values accepted by rts_setThreadPriority(); the default
+   priority of a new thread is 0.  A runnable thread may be overtaken by
+   higher-priority threads at most MAX_RUN_QUEUE_OVERTAKES times before
+   it is guaranteed a turn, so low-priority threads are never starved.
+   -------------------------------------------------------------------------- */
+
+#define MIN_THREAD_PRIORITY (-32767)
+#define MAX_THREAD_PRIORITY 32767
+#define MAX_RUN_QUEUE_OVERTAKES 8
+
 /*
  * The number of times we spin in a spin lock before yielding (see
  * #3758).  To tune this value, use the benchmark in #3758: run the
@@ -34,6 +34,7 @@
  * ----------
  *
  * log : EVENT_HEADER_BEGIN
+ *       [EVENT_HEADER_FLAGS Word32]  -- only if any flag is set
  *       EventType*
  *       EVENT_HEADER_END
  *       EVENT_DATA_BEGIN
@@ -58,6 +59,29 @@
  *       ... extra event-specific info ...
  *
  *
+ * The compact encoding
+ * --------------------
+ *
+ * With +RTS --eventlog-compact the header carries EVENT_HEADER_FLAGS
+ * with EVENTLOG_FLAG_COMPACT set, and events are encoded more tightly:
+ *
+ *  - The timestamp of each event except EVENT_BLOCK_MARKER is a VarInt
+ *    holding the zigzag-encoded difference from the timestamp of the
+ *    previous event in the same block (the block marker, for the first
+ *    one).  Block markers keep a full Word64 timestamp.
+ *
+ *  - Thread ids in fixed-size events are VarInts.  The extra info of
+ *    such an event type lists where they are: one Word16 per thread id,
+ *    giving its byte offset in the normal encoding of the event.
+ *
+ * A VarInt is an unsigned LEB128 number: 7 bits per byte, least
+ * significant group first, with the top bit set on every byte but the
+ * last.  Zigzag encoding maps a signed d to the unsigned
+ * (d << 1) ^ (d >> 63), so small differences of either sign are short.
+ * utils/eventlog-expand turns a compact log back into the normal
+ * encoding.
+ *
+ *
  * To add a new event
  * ------------------
  *
@@ -65,7 +89,7 @@
  *    - give it a new number, add a new #define EVENT_XXX below
  *  - In EventLog.c
  *    - add it to the EventDesc array
- *    - emit the event type in initEventLogging()
+ *    - emit the event type in postHeaderEvents()
  *    - emit the new event in postEvent_()
  *    - generate the event itself by calling postEvent() somewhere
  *  - In the Haskell code to parse the event log file:
@@ -81,6 +105,12 @@
  */
 #define EVENT_HEADER_BEGIN    0x68647262 /* 'h' 'd' 'r' 'b' */
 #define EVENT_HEADER_END      0x68647265 /* 'h' 'd' 'r' 'e' */
+#define EVENT_HEADER_FLAGS    0x68647266 /* 'h' 'd' 'r' 'f' */
+
+/*
+ * Flags in EVENT_HEADER_FLAGS
+ */
+#define EVENTLOG_FLAG_COMPACT 0x1        /* see "The compact encoding" */
 
 #define EVENT_DATA_BEGIN      0x64617462 /* 'd' 'a' 't' 'b' */
 #define EVENT_DATA_END        0xffff
@@ -178,12 +208,24 @@
 #define EVENT_HEAP_PROF_SAMPLE_BEGIN       162
 #define EVENT_HEAP_PROF_SAMPLE_COST_CENTRE 163
 #define EVENT_HEAP_PROF_SAMPLE_STRING      164
+
+#define EVENT_CAP_CPU_PLACEMENT  181 /* (cap, cpu, package, core,
+                                         cache_group)                */
+#define EVENT_MESSAGE_COUNTERS   182 /* (received, batches,
+                                         latency_total, latency_max) */
+#define EVENT_SCHED_HISTOGRAM    183 /* (kind, count, total_ns, max_ns,
+                                         24*bucket)                  */
+#define EVENT_STM_ABORT          184 /* (thread, site, tvar, aborts)  */
+#define EVENT_STM_SITE_ABORTS    185 /* (site, aborts)                */
+#define EVENT_EVENTLOG_DROPPED   186 /* (events, bytes)               */
+#define EVENT_CPU_SAMPLE         187 /* (thread, frames)              */
+#define EVENT_CPU_SAMPLE_SYMBOL  188 /* (addr, line, function, file)  */
 /*
  * The highest event code +1 that ghc itself emits. Note that some event
  * ranges higher than this are reserved but not currently emitted by ghc.
  * This must match the size of the EventDesc[] array in EventLog.c
  */
-#define NUM_GHC_EVENT_TAGS        165
+#define NUM_GHC_EVENT_TAGS        189
 
 #if 0  /* DEPRECATED EVENTS: */
 /* we don't actually need to record the thread, it's implicit */
@@ -231,6 +273,13 @@
 #define CAPSET_TYPE_OSPROCESS   2  /* caps belong to the same OS process */
 #define CAPSET_TYPE_CLOCKDOMAIN 3  /* caps share a local clock/time      */
 
+/*
+ * Histogram kinds for EVENT_SCHED_HISTOGRAM (+RTS --sched-stats)
+ */
+#define SCHED_HISTOGRAM_RUNNABLE 0  /* waiting on the run queue        */
+#define SCHED_HISTOGRAM_RUN      1  /* length of run slices            */
+#define SCHED_HISTOGRAM_BLOCKED  2  /* blocked: 2 + why_blocked        */
+
 #ifndef EVENTLOG_CONSTANTS_ONLY
 
 typedef StgWord16 EventTypeNum;
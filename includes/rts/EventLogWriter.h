@@ -0,0 +1,123 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2008-2017
+ *
+ * Support for fast binary event logging: pluggable eventlog writers.
+ *
+ * Do not #include this file directly: #include "Rts.h" instead.
+ *
+ * To understand the structure of the RTS headers, see the wiki:
+ *   http://ghc.haskell.org/trac/ghc/wiki/Commentary/SourceTree/Includes
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef RTS_EVENTLOGWRITER_H
+#define RTS_EVENTLOGWRITER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * An eventlog writer receives the binary eventlog stream, starting with
+ * the header (EVENT_HEADER_BEGIN ... EVENT_DATA_BEGIN) and ending with
+ * EVENT_DATA_END, in the format described in rts/EventLogFormat.h.
+ *
+ * The RTS calls the writer with its eventlog locks held, so a writer
+ * must not call back into the RTS.
+ */
+typedef struct {
+    // Called when logging starts, before anything is written.
+    void (* initEventLogWriter) (void);
+
+    // Write a chunk of the eventlog; return false if it could not be
+    // written (the chunk is then dropped).
+    bool (* writeEventLog) (void *eventlog, size_t eventlog_size);
+
+    // Flush anything the writer has buffered (may be NULL).
+    void (* flushEventLog) (void);
+
+    // Called when logging stops, after the last write.  Also called in
+    // the child of forkProcess, after the parent has flushed the
+    // writer, so it must not write anything itself.
+    void (* stopEventLogWriter) (void);
+} EventLogWriter;
+
+/*
+ * The default writer: <prog>.eventlog in the current directory, or
+ * <prog>.<pid>.eventlog in a forked child.
+ */
+extern const EventLogWriter FileEventLogWriter;
+
+enum EventLogStatus {
+    EVENTLOG_NOT_SUPPORTED,  // the RTS was built without eventlog support
+    EVENTLOG_NOT_CONFIGURED, // no writer is running
+    EVENTLOG_RUNNING,        // events are being written
+};
+
+enum EventLogStatus eventLogStatus (void);
+
+/*
+ * Start writing the eventlog to the given writer, with the trace classes
+ * selected by +RTS -l (or the default classes if -l was not given).  The
+ * full header is written first, so a consumer can attach to a live
+ * process.  Returns false if logging is already running or the RTS
+ * cannot log events.
+ *
+ * Like setNumCapabilities(), this stops all capabilities briefly, and
+ * must be called from a safe foreign call or from outside Haskell.
+ */
+bool startEventLogging (const EventLogWriter *writer);
+
+/*
+ * Flush all buffered events, end the stream with EVENT_DATA_END and stop
+ * the writer.  Logging can be started again afterwards.
+ */
+void endEventLogging (void);
+
+/*
+ * Built-in sinks, for streaming the eventlog to another process.  Each
+ * returns false (with errno set) if the sink cannot be opened, or if
+ * logging is already running.
+ */
+
+// Write to an already-open file descriptor.  The RTS does not close it.
+bool startEventLoggingToFd (int fd);
+
+// Write to a named pipe, creating it with mkfifo() if it does not exist.
+// Blocks until a reader opens the pipe.
+bool startEventLoggingToPipe (const char *path);
+
+// Connect to a listening Unix-domain stream socket.
+bool startEventLoggingToSocket (const char *path);
+
+/*
+ * The event classes selected by +RTS -l<classes>, as a bit set.  They can
+ * be changed while the program runs, whether or not the eventlog is
+ * running; a class that is off costs one branch where its events would be
+ * posted.
+ */
+#define EVENTLOG_CLASS_SCHEDULER      (1 << 0)  // -ls
+#define EVENTLOG_CLASS_GC             (1 << 1)  // -lg
+#define EVENTLOG_CLASS_SPARKS_SAMPLED (1 << 2)  // -lp
+#define EVENTLOG_CLASS_SPARKS_FULL    (1 << 3)  // -lf
+#define EVENTLOG_CLASS_USER           (1 << 4)  // -lu
+
+uint32_t getEventLogClasses (void);
+
+/*
+ * Select the event classes to log, returning the previous selection.
+ * If the eventlog is not running, the classes take effect when it is
+ * next started.  Stops all capabilities briefly, like startEventLogging().
+ */
+uint32_t setEventLogClasses (uint32_t classes);
+
+/*
+ * Non-zero if the traceEvent# and traceMarker# primops may do anything
+ * with their message: the user class is being traced, or the RTS was
+ * built with DTrace.  Debug.Trace reads it to avoid encoding messages
+ * that would be thrown away.
+ */
+extern int userEventsEnabled;
+
+#endif /* RTS_EVENTLOGWRITER_H */
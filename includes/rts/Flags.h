@@ -159,6 +159,16 @@ typedef struct _PROFILING_FLAGS {
 #define TRACE_EVENTLOG  1
 #define TRACE_STDERR    2
 
+#define EVENTLOG_SINK_FILE    0
+#define EVENTLOG_SINK_FD      1
+#define EVENTLOG_SINK_PIPE    2
+#define EVENTLOG_SINK_SOCKET  3
+
+#define EVENTLOG_FLUSH_SYNC   0
+#define EVENTLOG_FLUSH_BLOCK  1
+#define EVENTLOG_FLUSH_DROP   2
+#define EVENTLOG_FLUSH_GROW   3
+
 /* See Note [Synchronization of flags and base APIs] */
 typedef struct _TRACE_FLAGS {
     int tracing;
@@ -168,6 +178,13 @@ typedef struct _TRACE_FLAGS {
     bool sparks_sampled; /* trace spark events by a sampled method */
     bool sparks_full;    /* trace spark events 100% accurately */
     bool user;           /* trace user events (emitted from Haskell code) */
+    int eventlogSink;    /* where -l sends events (EVENTLOG_SINK_*) */
+    int eventlogFd;      /* +RTS --eventlog-fd=<n> */
+    const char *eventlogPath; /* +RTS --eventlog-pipe/--eventlog-socket */
+    int eventlogFlush;   /* +RTS --eventlog-flush=<policy> (EVENTLOG_FLUSH_*) */
+    bool eventlogCompact; /* +RTS --eventlog-compact */
+    Time cpuSampleInterval;   /* +RTS --cpu-sample[=<secs>], 0: off */
+    uint32_t cpuSampleIntervalTicks; /* ticks between samples (derived) */
 } TRACE_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -192,6 +209,24 @@ typedef struct _MISC_FLAGS {
     bool machineReadable;
     StgWord linkerMemBase;       /* address to ask the OS for memory
                                   * for the linker, NULL ==> off */
+    bool schedStats;             /* collect scheduling latencies
+                                  * (+RTS --sched-stats) */
+    bool ioUring;                /* I/O manager uses io_uring
+                                  * (+RTS --io-uring) */
+    Time timerWheelTick;         /* tick of the timer manager's timer
+                                  * wheel, 0 ==> use a priority queue
+                                  * (+RTS --timer-wheel) */
+    bool stmClock;               /* STM uses a global version clock
+                                  * (+RTS --stm-clock) */
+    bool stmBackoff;             /* back off before re-running an
+                                  * aborted STM transaction
+                                  * (+RTS --stm-backoff) */
+    uint32_t stmSerialiseAfter;  /* run an STM transaction alone after
+                                  * this many consecutive aborts, 0 ==> off
+                                  * (+RTS --stm-serialise) */
+    uint32_t stmWakeLimit;       /* wake at most this many threads blocked
+                                  * in retry on an updated TVar, 0 ==> all
+                                  * (+RTS --stm-wake) */
 } MISC_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -221,6 +256,18 @@ typedef struct _PAR_FLAGS {
                                   * GC (default: use all nNodes). */
 
   bool           setAffinity;    /* force thread affinity with CPUs */
+  uint32_t       affinityPolicy; /* how to place capabilities on CPUs */
+#define AFFINITY_ROUND_ROBIN 0   /* -qa: capability n on CPUs n mod N */
+#define AFFINITY_COMPACT     1   /* --affinity=compact */
+#define AFFINITY_SCATTER     2   /* --affinity=scatter */
+#define AFFINITY_CORES       3   /* --affinity=cores */
+
+  bool           elasticCapabilities;
+                                 /* adjust the number of capabilities
+                                  * to the load, up to nCapabilities */
+  Time           elasticInterval;
+                                 /* sampling interval for
+                                  * elasticCapabilities */
 } PAR_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -182,6 +182,10 @@ extern void closeCondition        ( Condition* pCond );
 extern bool broadcastCondition    ( Condition* pCond );
 extern bool signalCondition       ( Condition* pCond );
 extern bool waitCondition         ( Condition* pCond, Mutex* pMut );
+// Like waitCondition(), but give up after the timeout; returns false
+// if the timeout expired.  May also return early, like waitCondition().
+extern bool timedWaitCondition    ( Condition* pCond, Mutex* pMut,
+                                    Time timeout );
 
 //
 // Mutexes
@@ -199,6 +203,7 @@ void  freeThreadLocalKey (ThreadLocalKey *key);
 
 // Processors and affinity
 void setThreadAffinity (uint32_t n, uint32_t m);
+void setThreadCpu (uint32_t cpu);
 void setThreadNode (uint32_t node);
 void releaseThreadNode (void);
 #endif // !CMINUSMINUS
@@ -230,10 +235,18 @@ int forkOS_createThread ( HsStablePtr entry );
 void freeThreadingResources(void);
 
 //
-// Returns the number of processor cores in the machine
+// Returns the number of processor cores available to the process,
+// taking into account its CPU affinity mask and, on Linux, the CPU
+// quota of its cgroup
 //
 uint32_t getNumberOfProcessors (void);
 
+//
+// Returns the number of times the process has been throttled for
+// exceeding its CPU quota, or false if this is not known
+//
+bool getCPUThrottleCount (StgWord64 *count);
+
 //
 // Support for getting at the kernel thread Id for tracing/profiling.
 //
@@ -48,6 +48,8 @@ HsInt64 rts_getThreadAllocationCounter   (StgPtr tso);
 void    rts_setThreadAllocationCounter   (StgPtr tso, HsInt64 i);
 void    rts_enableThreadAllocationLimit  (StgPtr tso);
 void    rts_disableThreadAllocationLimit (StgPtr tso);
+HsInt   rts_getThreadPriority            (StgPtr tso);
+void    rts_setThreadPriority            (StgPtr tso, HsInt priority);
 
 #if !defined(mingw32_HOST_OS)
 pid_t  forkProcess     (HsStablePtr *entry);
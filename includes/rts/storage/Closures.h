@@ -310,6 +310,7 @@ typedef struct StgTVarWatchQueue_ {
   StgClosure                *closure; // StgTSO or StgAtomicInvariant
   struct StgTVarWatchQueue_ *next_queue_entry;
   struct StgTVarWatchQueue_ *prev_queue_entry;
+  StgWord                    woken; // by a targeted wakeup (rts/STM.c)
 } StgTVarWatchQueue;
 
 typedef struct {
@@ -366,7 +367,10 @@ struct StgTRecHeader_ {
   struct StgTRecHeader_     *enclosing_trec;
   StgTRecChunk              *current_chunk;
   StgInvariantCheckQueue    *invariants_to_check;
+  StgArrBytes               *index;       /* see Note [TRec index] in STM.c */
   TRecState                  state;
+  StgWord                    num_entries;
+  StgWord                    read_version; /* see Note [STM global clock] */
 };
 
 typedef struct {
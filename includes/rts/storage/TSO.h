@@ -174,6 +174,48 @@ typedef struct StgTSO_ {
      */
     StgWord32  tot_stack_size;
 
+    /*
+     * Scheduling priority of the thread.  Higher values are scheduled
+     * ahead of lower ones when the thread is appended to a run queue;
+     * the default is 0.  rq_overtaken counts how many times the thread
+     * has been overtaken by a higher-priority thread since it was last
+     * put on the run queue, which bounds how long it can be starved
+     * (see appendToRunQueue() in rts/Schedule.h).
+     */
+    StgInt16   priority;
+    StgWord16  rq_overtaken;
+
+    /*
+     * Used for +RTS --sched-stats only (see rts/SchedStats.c): the time
+     * (from getMonotonicNSec()) at which the thread last started
+     * running, stopped running or became runnable, and the reason it is
+     * blocked, if it is.
+     */
+    StgWord32  sched_blocked;
+
+    /*
+     * Position of the thread in the sleeping queue of the non-threaded
+     * RTS while it is BlockedOnDelay (see rts/SleepingQueue.c).
+     */
+    StgWord32  sleep_index;
+
+    StgWord64  sched_stamp;
+
+    /*
+     * Number of times the thread's current STM transaction has aborted
+     * in a row; reset when it commits or is abandoned (see
+     * Note [STM contention management] in rts/STM.c).
+     */
+    StgWord32  stm_aborts;
+
+    /*
+     * The TVar whose update woke the thread from retry, if it was woken
+     * by +RTS --stm-wake and has yet to hand the wakeup on to the other
+     * threads waiting on the TVar (see Note [Targeted STM wakeups] in
+     * rts/STM.c), or NO_WAKE_TVAR.
+     */
+    StgClosure *stm_woken_by;
+
 #ifdef TICKY_TICKY
     /* TICKY-specific stuff would go here. */
 #endif
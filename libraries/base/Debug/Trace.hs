@@ -47,6 +47,8 @@ module Debug.Trace (
 import System.IO.Unsafe
 
 import Foreign.C.String
+import Foreign.C.Types
+import Foreign.Storable
 import GHC.Base
 import qualified GHC.Foreign
 import GHC.IO.Encoding
@@ -212,7 +214,7 @@ traceStack str expr = unsafePerformIO $ do
 -- Currently only GHC provides eventlog profiling, see the GHC user guide for
 -- details on how to use it. These function exists for other Haskell
 -- implementations but no events are emitted. Note that the string message is
--- always evaluated, whether or not profiling is available or enabled.
+-- only evaluated if user events are being traced (see the @-l@ RTS option).
 
 {-# NOINLINE traceEvent #-}
 -- | The 'traceEvent' function behaves like 'trace' with the difference that
@@ -240,9 +242,11 @@ traceEvent msg expr = unsafeDupablePerformIO $ do
 --
 -- @since 4.5.0.0
 traceEventIO :: String -> IO ()
-traceEventIO msg =
-  GHC.Foreign.withCString utf8 msg $ \(Ptr p) -> IO $ \s ->
-    case traceEvent# p s of s' -> (# s', () #)
+traceEventIO msg = do
+  enabled <- peek userEventsEnabled
+  when (enabled /= 0) $
+    GHC.Foreign.withCString utf8 msg $ \(Ptr p) -> IO $ \s ->
+      case traceEvent# p s of s' -> (# s', () #)
 
 -- $markers
 --
@@ -261,7 +265,7 @@ traceEventIO msg =
 -- system, but in future it may also be supported by the heap profiling or
 -- other profiling tools. These function exists for other Haskell
 -- implementations but they have no effect. Note that the string message is
--- always evaluated, whether or not profiling is available or enabled.
+-- only evaluated if user events are being traced (see the @-l@ RTS option).
 
 {-# NOINLINE traceMarker #-}
 -- | The 'traceMarker' function emits a marker to the eventlog, if eventlog
@@ -290,6 +294,12 @@ traceMarker msg expr = unsafeDupablePerformIO $ do
 --
 -- @since 4.7.0.0
 traceMarkerIO :: String -> IO ()
-traceMarkerIO msg =
-  GHC.Foreign.withCString utf8 msg $ \(Ptr p) -> IO $ \s ->
-    case traceMarker# p s of s' -> (# s', () #)
+traceMarkerIO msg = do
+  enabled <- peek userEventsEnabled
+  when (enabled /= 0) $
+    GHC.Foreign.withCString utf8 msg $ \(Ptr p) -> IO $ \s ->
+      case traceMarker# p s of s' -> (# s', () #)
+
+-- Non-zero when the RTS is tracing user events, so that we don't encode
+-- messages that would be thrown away
+foreign import ccall "&userEventsEnabled" userEventsEnabled :: Ptr CInt
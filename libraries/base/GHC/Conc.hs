@@ -45,6 +45,8 @@ module GHC.Conc
         , yield
         , labelThread
         , mkWeakThreadId
+        , setThreadPriority
+        , getThreadPriority
 
         , ThreadStatus(..), BlockReason(..)
         , threadStatus
@@ -54,6 +54,8 @@ module GHC.Conc.Sync
         , yield
         , labelThread
         , mkWeakThreadId
+        , setThreadPriority
+        , getThreadPriority
 
         , ThreadStatus(..), BlockReason(..)
         , threadStatus
@@ -505,6 +507,34 @@ labelThread (ThreadId t) str =
     IO $ \ s ->
      case labelThread# t p s of s1 -> (# s1, () #)
 
+-- | Set the scheduling priority of a thread.  When several threads are
+-- runnable on the same capability, threads with a higher priority are
+-- run before threads with a lower one; threads of equal priority are
+-- scheduled round-robin.  New threads have priority @0@, and the
+-- priority is clamped to the range @[-32767, 32767]@.
+--
+-- Priorities are advisory: a runnable thread is overtaken by at most a
+-- small, fixed number of higher-priority threads before it gets to run,
+-- so low-priority threads cannot be starved.  The new priority takes
+-- effect the next time the thread becomes runnable.
+--
+-- @since 4.10.0.0
+setThreadPriority :: ThreadId -> Int -> IO ()
+setThreadPriority (ThreadId t) prio = rts_setThreadPriority t prio
+
+-- | Return the scheduling priority of a thread, as set by
+-- 'setThreadPriority'.
+--
+-- @since 4.10.0.0
+getThreadPriority :: ThreadId -> IO Int
+getThreadPriority (ThreadId t) = rts_getThreadPriority t
+
+foreign import ccall unsafe "rts_setThreadPriority"
+  rts_setThreadPriority :: ThreadId# -> Int -> IO ()
+
+foreign import ccall unsafe "rts_getThreadPriority"
+  rts_getThreadPriority :: ThreadId# -> IO Int
+
 --      Nota Bene: 'pseq' used to be 'seq'
 --                 but 'seq' is now defined in PrelGHC
 --
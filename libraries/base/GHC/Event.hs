@@ -27,6 +27,7 @@ module GHC.Event
     , FdKey(keyFd)
     , Lifetime(..)
     , registerFd
+    , registerFdOnce
     , unregisterFd
     , unregisterFd_
     , closeFd
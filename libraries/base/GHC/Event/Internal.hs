@@ -16,6 +16,9 @@ module GHC.Event.Internal
     , evtWrite
     , evtClose
     , eventIs
+    , packFdEvent
+    , packedFd
+    , packedEvent
     -- * Lifetimes
     , Lifetime(..)
     , EventLifetime
@@ -28,12 +31,13 @@ module GHC.Event.Internal
     , throwErrnoIfMinus1NoRetry
     ) where
 
-import Data.Bits ((.|.), (.&.))
+import Data.Bits ((.|.), (.&.), unsafeShiftL, unsafeShiftR)
 import Data.OldList (foldl', filter, intercalate, null)
 import Foreign.C.Error (eINTR, getErrno, throwErrno)
 import System.Posix.Types (Fd)
 import GHC.Base
 import GHC.Num (Num(..))
+import GHC.Real (fromIntegral)
 import GHC.Show (Show(..))
 
 -- | An I\/O event.
@@ -62,6 +66,20 @@ evtClose = Event 4
 eventIs :: Event -> Event -> Bool
 eventIs (Event a) (Event b) = a .&. b /= 0
 
+-- | Pack a file descriptor and the events that occurred on it into an
+-- 'Int', so that the event manager can queue them in an unboxed array.
+packFdEvent :: Fd -> Event -> Int
+packFdEvent fd (Event e) = (fromIntegral fd `unsafeShiftL` 3) .|. e
+{-# INLINE packFdEvent #-}
+
+packedFd :: Int -> Fd
+packedFd x = fromIntegral (x `unsafeShiftR` 3)
+{-# INLINE packedFd #-}
+
+packedEvent :: Int -> Event
+packedEvent x = Event (x .&. 0x7)
+{-# INLINE packedEvent #-}
+
 -- | @since 4.3.1.0
 instance Show Event where
     show e = '[' : (intercalate "," . filter (not . null) $
@@ -17,6 +17,10 @@
 --
 -- If an fd has only one-shot registrations then we use one-shot
 -- polling if available. Otherwise we use multi-shot polling.
+--
+-- The events returned by a poll are handled as a batch: they are
+-- queued by callback table as the backend reports them, and each table
+-- is then locked once to find the callbacks of all of its events.
 
 module GHC.Event.Manager
     ( -- * Types
@@ -49,6 +53,7 @@ module GHC.Event.Manager
     , FdKey(keyFd)
     , FdData
     , registerFd
+    , registerFdOnce
     , unregisterFd_
     , unregisterFd
     , closeFd
@@ -81,9 +86,10 @@ import GHC.Event.Control
 import GHC.Event.IntTable (IntTable)
 import GHC.Event.Internal (Backend, Event, evtClose, evtRead, evtWrite,
                            Lifetime(..), EventLifetime, Timeout(..))
-import GHC.Event.Unique (Unique, UniqueSource, newSource, newUnique)
+import GHC.Event.Unique (Unique(..), UniqueSource, newSource, newUnique)
 import System.Posix.Types (Fd)
 
+import qualified GHC.Event.Array    as A
 import qualified GHC.Event.IntTable as IT
 import qualified GHC.Event.Internal as I
 
@@ -91,6 +97,7 @@ import qualified GHC.Event.Internal as I
 import qualified GHC.Event.KQueue as KQueue
 #elif defined(HAVE_EPOLL)
 import qualified GHC.Event.EPoll  as EPoll
+import qualified GHC.Event.IOUring as IOUring
 #elif defined(HAVE_POLL)
 import qualified GHC.Event.Poll   as Poll
 #else
@@ -126,6 +133,9 @@ data State = Created
 data EventManager = EventManager
     { emBackend      :: !Backend
     , emFds          :: {-# UNPACK #-} !(Array Int (MVar (IntTable [FdData])))
+    , emBatch        :: {-# UNPACK #-} !(Array Int (A.Array Int))
+      -- ^ the events of the current poll, by callback table, packed
+      -- with 'I.packFdEvent'.  Only used by the manager thread.
     , emState        :: {-# UNPACK #-} !(IORef State)
     , emUniqueSource :: {-# UNPACK #-} !UniqueSource
     , emControl      :: {-# UNPACK #-} !Control
@@ -168,7 +178,9 @@ newDefaultBackend :: IO Backend
 #if defined(HAVE_KQUEUE)
 newDefaultBackend = KQueue.new
 #elif defined(HAVE_EPOLL)
-newDefaultBackend = EPoll.new
+newDefaultBackend = do
+  uring <- IOUring.requested
+  if uring then IOUring.new else EPoll.new
 #elif defined(HAVE_POLL)
 newDefaultBackend = Poll.new
 #else
@@ -184,6 +196,8 @@ newWith :: Backend -> IO EventManager
 newWith be = do
   iofds <- fmap (listArray (0, callbackArraySize-1)) $
            replicateM callbackArraySize (newMVar =<< IT.new 8)
+  batch <- fmap (listArray (0, callbackArraySize-1)) $
+           replicateM callbackArraySize (A.new 16)
   ctrl <- newControl False
   state <- newIORef Created
   us <- newSource
@@ -195,6 +209,7 @@ newWith be = do
   lockVar <- newMVar ()
   let mgr = EventManager { emBackend = be
                          , emFds = iofds
+                         , emBatch = batch
                          , emState = state
                          , emUniqueSource = us
                          , emControl = ctrl
@@ -291,14 +306,19 @@ step mgr@EventManager{..} = do
   state `seq` return state
   where
     waitForIO = do
-      n1 <- I.poll emBackend Nothing (onFdEvent mgr)
+      n1 <- pollBatch Nothing
       when (n1 <= 0) $ do
         yield
-        n2 <- I.poll emBackend Nothing (onFdEvent mgr)
+        n2 <- pollBatch Nothing
         when (n2 <= 0) $ do
-          _ <- I.poll emBackend (Just Forever) (onFdEvent mgr)
+          _ <- pollBatch (Just Forever)
           return ()
 
+    pollBatch timeout = do
+      n <- I.poll emBackend timeout (queueFdEvent mgr)
+      handleFdEvents mgr
+      return n
+
 ------------------------------------------------------------------------
 -- Registering interest in I/O events
 
@@ -312,10 +332,17 @@ step mgr@EventManager{..} = do
 -- is not allowed on many platforms.
 registerFd_ :: EventManager -> IOCallback -> Fd -> Event -> Lifetime
             -> IO (FdKey, Bool)
-registerFd_ mgr@(EventManager{..}) cb fd evs lt = do
-  u <- newUnique emUniqueSource
+registerFd_ mgr cb fd evs lt = do
+  u <- newUnique (emUniqueSource mgr)
+  insertFd_ mgr (FdKey fd u) cb evs lt
+{-# INLINE registerFd_ #-}
+
+-- | Add a registration with the given key to the callback table, and
+-- tell the backend about it.
+insertFd_ :: EventManager -> FdKey -> IOCallback -> Event -> Lifetime
+          -> IO (FdKey, Bool)
+insertFd_ mgr@(EventManager{..}) reg@(FdKey fd _) cb evs lt = do
   let fd'  = fromIntegral fd
-      reg  = FdKey fd u
       el = I.eventLifetime evs lt
       !fdd = FdData reg el cb
   (modify,ok) <- withMVar (callbackTableVar mgr fd) $ \tbl -> do
@@ -348,7 +375,7 @@ registerFd_ mgr@(EventManager{..}) cb fd evs lt = do
   -- i.e. just call the callback if the registration fails.
   when (not ok) (cb reg evs)
   return (reg,modify)
-{-# INLINE registerFd_ #-}
+{-# INLINE insertFd_ #-}
 
 -- | @registerFd mgr cb fd evs lt@ registers interest in the events @evs@
 -- on the file descriptor @fd@ for lifetime @lt@. @cb@ is called for
@@ -361,6 +388,26 @@ registerFd mgr cb fd evs lt = do
   return r
 {-# INLINE registerFd #-}
 
+-- | @registerFdOnce mgr cb fd evs@ registers interest in the events
+-- @evs@ on the file descriptor @fd@, and calls @cb@ for the first event
+-- that occurs.
+--
+-- This is cheaper than a 'OneShot' registration made with 'registerFd',
+-- as no key is made for it, but it cannot be unregistered: it is only
+-- dropped when it fires or the file descriptor is closed with 'closeFd'.
+-- The key passed to @cb@ is the same for every such registration on
+-- @fd@.  The callback is stored as it is, so a caller that waits
+-- repeatedly can reuse one callback and allocate nothing for it.
+registerFdOnce :: EventManager -> IOCallback -> Fd -> Event -> IO ()
+registerFdOnce mgr cb fd evs = do
+  (_, wake) <- insertFd_ mgr (FdKey fd keylessUnique) cb evs OneShot
+  when wake $ wakeManager mgr
+
+-- | The key of every registration made with 'registerFdOnce'.  As
+-- 'newUnique' counts up from 0, 'unregisterFd' never drops one of them.
+keylessUnique :: Unique
+keylessUnique = Unique (-1)
+
 {-
     Building GHC with parallel IO manager on Mac freezes when
     compiling the dph libraries in the phase 2. As workaround, we
@@ -453,64 +500,104 @@ closeFd_ mgr tbl fd = do
 ------------------------------------------------------------------------
 -- Utilities
 
--- | Call the callbacks corresponding to the given file descriptor.
-onFdEvent :: EventManager -> Fd -> Event -> IO ()
-onFdEvent mgr fd evs
+-- | Queue an event reported by the backend, to be handled with the rest
+-- of its batch by 'handleFdEvents'.  Events on the control fds are
+-- handled at once.
+queueFdEvent :: EventManager -> Fd -> Event -> IO ()
+queueFdEvent mgr fd evs
   | fd == controlReadFd (emControl mgr) || fd == wakeupReadFd (emControl mgr) =
     handleControlEvent mgr fd evs
 
-  | otherwise = do
-    fdds <- withMVar (callbackTableVar mgr fd) $ \tbl ->
-        IT.delete (fromIntegral fd) tbl >>= maybe (return []) (selectCallbacks tbl)
-    forM_ fdds $ \(FdData reg _ cb) -> cb reg evs
+  | otherwise = A.snoc (emBatch mgr ! hashFd fd) (I.packFdEvent fd evs)
+
+-- | Call the callbacks for the queued events.  Each callback table is
+-- locked once for all of its events, and the callbacks are called after
+-- every batch has been emptied, and so with no table locked, as they may
+-- well register interest in the same fd.  If anything throws, the batches
+-- are emptied all the same, so that a later 'step' does not handle the
+-- same events again.
+handleFdEvents :: EventManager -> IO ()
+handleFdEvents mgr = do
+    fired <- go 0 (return ()) `onException` clearBatches
+    fired
   where
-    -- | Here we look through the list of registrations for the fd of interest
-    -- and sort out which match the events that were triggered. We,
-    --
-    --   1. re-arm the fd as appropriate
-    --   2. reinsert registrations that weren't triggered and multishot
-    --      registrations
-    --   3. return a list containing the callbacks that should be invoked.
-    selectCallbacks :: IntTable [FdData] -> [FdData] -> IO [FdData]
-    selectCallbacks tbl fdds = do
-        let -- figure out which registrations have been triggered
-            matches :: FdData -> Bool
-            matches fd' = evs `I.eventIs` I.elEvent (fdEvents fd')
-            (triggered, notTriggered) = partition matches fdds
-
-            -- sort out which registrations we need to retain
-            isMultishot :: FdData -> Bool
-            isMultishot fd' = I.elLifetime (fdEvents fd') == MultiShot
-            saved = notTriggered ++ filter isMultishot triggered
-
-            savedEls = eventsOf saved
-            allEls = eventsOf fdds
-
-        -- Reinsert multishot registrations.
-        -- We deleted the table entry for this fd above so we there isn't a preexisting entry
-        _ <- IT.insertWith (\_ _ -> saved) (fromIntegral fd) saved tbl
-
-        case I.elLifetime allEls of
-          -- we previously armed the fd for multiple shots, no need to rearm
-          MultiShot | allEls == savedEls ->
-            return ()
-
-          -- either we previously registered for one shot or the
-          -- events of interest have changed, we must re-arm
-          _ ->
-            case I.elLifetime savedEls of
-              OneShot | haveOneShot ->
-                -- if there are no saved events and we registered with one-shot
-                -- semantics then there is no need to re-arm
-                unless (OneShot == I.elLifetime allEls
-                        && mempty == I.elEvent savedEls) $ do
-                  void $ I.modifyFdOnce (emBackend mgr) fd (I.elEvent savedEls)
-              _ ->
-                -- we need to re-arm with multi-shot semantics
-                void $ I.modifyFd (emBackend mgr) fd
-                                  (I.elEvent allEls) (I.elEvent savedEls)
-
-        return triggered
+    go !i fired
+      | i == callbackArraySize = return fired
+      | otherwise = do
+          let batch = emBatch mgr ! i
+          n <- A.length batch
+          if n == 0
+            then go (i + 1) fired
+            else do
+              fired' <- withMVar (emFds mgr ! i) $ \tbl ->
+                selectBatch tbl batch n 0 fired
+              A.clear batch
+              go (i + 1) fired'
+
+    clearBatches = forM_ [0 .. callbackArraySize - 1] $ \i ->
+      A.clear (emBatch mgr ! i)
+
+    selectBatch tbl batch n !j fired
+      | j == n    = return fired
+      | otherwise = do
+          x <- A.unsafeRead batch j
+          let fd  = I.packedFd x
+              evs = I.packedEvent x
+          fdds <- IT.delete (fromIntegral fd) tbl >>=
+                  maybe (return []) (selectCallbacks mgr tbl fd evs)
+          let fired' = case fdds of
+                []    -> fired
+                _     -> fired >> forM_ fdds (\(FdData reg _ cb) -> cb reg evs)
+          selectBatch tbl batch n (j + 1) fired'
+
+-- | Here we look through the list of registrations for the fd of interest
+-- and sort out which match the events that were triggered. We,
+--
+--   1. re-arm the fd as appropriate
+--   2. reinsert registrations that weren't triggered and multishot
+--      registrations
+--   3. return a list containing the callbacks that should be invoked.
+selectCallbacks :: EventManager -> IntTable [FdData] -> Fd -> Event -> [FdData]
+                -> IO [FdData]
+selectCallbacks mgr tbl fd evs fdds = do
+  let -- figure out which registrations have been triggered
+      matches :: FdData -> Bool
+      matches fd' = evs `I.eventIs` I.elEvent (fdEvents fd')
+      (triggered, notTriggered) = partition matches fdds
+
+      -- sort out which registrations we need to retain
+      isMultishot :: FdData -> Bool
+      isMultishot fd' = I.elLifetime (fdEvents fd') == MultiShot
+      saved = notTriggered ++ filter isMultishot triggered
+
+      savedEls = eventsOf saved
+      allEls = eventsOf fdds
+
+  -- Reinsert multishot registrations.
+  -- The caller deleted the table entry for this fd so there isn't a preexisting entry
+  _ <- IT.insertWith (\_ _ -> saved) (fromIntegral fd) saved tbl
+
+  case I.elLifetime allEls of
+    -- we previously armed the fd for multiple shots, no need to rearm
+    MultiShot | allEls == savedEls ->
+      return ()
+
+    -- either we previously registered for one shot or the
+    -- events of interest have changed, we must re-arm
+    _ ->
+      case I.elLifetime savedEls of
+        OneShot | haveOneShot ->
+          -- if there are no saved events and we registered with one-shot
+          -- semantics then there is no need to re-arm
+          unless (OneShot == I.elLifetime allEls
+                  && mempty == I.elEvent savedEls) $ do
+            void $ I.modifyFdOnce (emBackend mgr) fd (I.elEvent savedEls)
+        _ ->
+          -- we need to re-arm with multi-shot semantics
+          void $ I.modifyFd (emBackend mgr) fd
+                            (I.elEvent allEls) (I.elEvent savedEls)
+
+  return triggered
 
 nullToNothing :: [a] -> Maybe [a]
 nullToNothing []       = Nothing
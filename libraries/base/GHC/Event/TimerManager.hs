@@ -39,7 +39,7 @@ module GHC.Event.TimerManager
 -- Imports
 
 import Control.Exception (finally)
-import Data.Foldable (sequence_)
+import Data.Foldable (forM_, sequence_)
 import Data.IORef (IORef, atomicModifyIORef', mkWeakIORef, newIORef, readIORef,
                    writeIORef)
 import GHC.Base
@@ -51,12 +51,15 @@ import GHC.Event.Clock (getMonotonicTime)
 import GHC.Event.Control
 import GHC.Event.Internal (Backend, Event, evtRead, Timeout(..))
 import GHC.Event.Unique (Unique, UniqueSource, newSource, newUnique)
+import GHC.RTS.Flags (MiscFlags(..), getMiscFlags)
 import System.Posix.Types (Fd)
 
 import qualified GHC.Event.Internal as I
 import qualified GHC.Event.PSQ as Q
+import qualified GHC.Event.TimerWheel as W
 
 #if defined(HAVE_POLL)
+import qualified GHC.Event.IOUring as IOUring
 import qualified GHC.Event.Poll   as Poll
 #else
 # error not implemented for this operating system
@@ -66,7 +69,8 @@ import qualified GHC.Event.Poll   as Poll
 -- Types
 
 -- | A timeout registration cookie.
-newtype TimeoutKey   = TK Unique
+data TimeoutKey = TK !Unique       -- ^ in the priority search queue
+                | TW !W.TimerKey   -- ^ in the timer wheel
     deriving (Eq)
 
 -- | Callback invoked on timeout events.
@@ -88,6 +92,8 @@ type TimeoutEdit = TimeoutQueue -> TimeoutQueue
 data TimerManager = TimerManager
     { emBackend      :: !Backend
     , emTimeouts     :: {-# UNPACK #-} !(IORef TimeoutQueue)
+    , emWheel        :: !(Maybe W.TimerWheel)
+      -- ^ used instead of 'emTimeouts' with @+RTS --timer-wheel@
     , emState        :: {-# UNPACK #-} !(IORef State)
     , emUniqueSource :: {-# UNPACK #-} !UniqueSource
     , emControl      :: {-# UNPACK #-} !Control
@@ -106,7 +112,9 @@ handleControlEvent mgr fd _evt = do
 
 newDefaultBackend :: IO Backend
 #if defined(HAVE_POLL)
-newDefaultBackend = Poll.new
+newDefaultBackend = do
+  uring <- IOUring.requested
+  if uring then IOUring.new else Poll.new
 #else
 newDefaultBackend = errorWithoutStackTrace "no back end for this platform"
 #endif
@@ -118,6 +126,7 @@ new = newWith =<< newDefaultBackend
 newWith :: Backend -> IO TimerManager
 newWith be = do
   timeouts <- newIORef Q.empty
+  wheel <- newTimerWheel
   ctrl <- newControl True
   state <- newIORef Created
   us <- newSource
@@ -128,6 +137,7 @@ newWith be = do
                  closeControl ctrl
   let mgr = TimerManager { emBackend = be
                          , emTimeouts = timeouts
+                         , emWheel = wheel
                          , emState = state
                          , emUniqueSource = us
                          , emControl = ctrl
@@ -136,6 +146,16 @@ newWith be = do
   _ <- I.modifyFd be (wakeupReadFd ctrl) mempty evtRead
   return mgr
 
+newTimerWheel :: IO (Maybe W.TimerWheel)
+newTimerWheel = do
+  tick <- timerWheelTick `liftM` getMiscFlags
+  if tick == 0
+    then return Nothing
+    else do
+      now <- getMonotonicTime
+      -- RtsTime is in nanoseconds
+      Just `liftM` W.new (fromIntegral tick / 1000000000) now
+
 -- | Asynchronously shuts down the event manager, if running.
 shutdown :: TimerManager -> IO ()
 shutdown mgr = do
@@ -185,7 +205,13 @@ step mgr = do
   -- | Call all expired timer callbacks and return the time to the
   -- next timeout.
   mkTimeout :: IO Timeout
-  mkTimeout = do
+  mkTimeout = case emWheel mgr of
+    Just wheel -> do
+      now <- getMonotonicTime
+      (expired, timeout) <- W.expire wheel now
+      sequence_ expired
+      return timeout
+    Nothing -> do
       now <- getMonotonicTime
       (expired, timeout) <- atomicModifyIORef' (emTimeouts mgr) $ \tq ->
            let (expired, tq') = Q.atMost now tq
@@ -211,6 +237,11 @@ wakeManager mgr = sendWakeup (emControl mgr)
 -- timeout.  The timeout is automatically unregistered after the given
 -- time has passed.
 registerTimeout :: TimerManager -> Int -> TimeoutCallback -> IO TimeoutKey
+registerTimeout mgr@TimerManager{ emWheel = Just wheel } us cb | us > 0 = do
+  now <- getMonotonicTime
+  (key, wake) <- W.insert wheel now us cb
+  when wake $ wakeManager mgr
+  return $ TW key
 registerTimeout mgr us cb = do
   !key <- newUnique (emUniqueSource mgr)
   if us <= 0 then cb
@@ -227,6 +258,9 @@ unregisterTimeout :: TimerManager -> TimeoutKey -> IO ()
 unregisterTimeout mgr (TK key) = do
   editTimeouts mgr (Q.delete key)
   wakeManager mgr
+unregisterTimeout mgr (TW key) =
+  -- the manager may wake up for nothing, but it need not be told
+  forM_ (emWheel mgr) $ \wheel -> W.cancel wheel key
 
 -- | Update an active timeout to fire in the given number of
 -- microseconds.
@@ -237,6 +271,11 @@ updateTimeout mgr (TK key) us = do
 
   editTimeouts mgr (Q.adjust (const expTime) key)
   wakeManager mgr
+updateTimeout mgr (TW key) us =
+  forM_ (emWheel mgr) $ \wheel -> do
+    now <- getMonotonicTime
+    wake <- W.update wheel key now us
+    when wake $ wakeManager mgr
 
 editTimeouts :: TimerManager -> TimeoutEdit -> IO ()
 editTimeouts mgr g = atomicModifyIORef' (emTimeouts mgr) $ \tq -> (g tq, ())
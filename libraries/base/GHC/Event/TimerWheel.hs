@@ -0,0 +1,205 @@
+{-# LANGUAGE Trustworthy #-}
+{-# LANGUAGE BangPatterns, NoImplicitPrelude #-}
+
+-- | A hashed timer wheel, which the timer manager uses instead of the
+-- priority search queue in "GHC.Event.PSQ" with @+RTS --timer-wheel@.
+--
+-- Time is divided into ticks, and a timer that is due in tick @t@ is
+-- kept in slot @t `mod` wheelSize@.  As time passes the manager visits
+-- the slots in turn, runs the timers that are due, and puts back those
+-- that are due in a later turn of the wheel.
+--
+-- * Registering a timer conses it onto its slot, under the wheel's lock.
+--
+-- * Postponing a timer, which servers do to their idle timeouts on
+--   every request, only writes its new deadline.  The timer stays in
+--   its old slot, and is moved on when the manager comes across it
+--   there.  Bringing a timer forward replaces it with a new one in an
+--   earlier slot.
+--
+-- * Cancelling a timer marks it, and it is dropped when its slot is
+--   visited.
+--
+-- All of these take constant time.  Timers run up to one tick late,
+-- but never early.
+module GHC.Event.TimerWheel
+    (
+      TimerWheel
+    , TimerKey
+    , new
+    , insert
+    , update
+    , cancel
+    , expire
+    ) where
+
+import Control.Concurrent.MVar (MVar, newMVar, withMVar)
+import Data.IORef (IORef, atomicModifyIORef', newIORef, readIORef, writeIORef)
+import GHC.Base
+import GHC.Enum (maxBound)
+import GHC.Event.Internal (Timeout(..))
+import GHC.Float ()
+import GHC.List (reverse)
+import GHC.Num (Num(..))
+import GHC.Real (ceiling, floor, fromIntegral, mod, (/))
+
+import qualified GHC.Event.Arr as A
+
+data Timer = Timer {
+      tmDeadline :: {-# UNPACK #-} !(IORef Int)
+      -- ^ the tick the timer is due in, 'cancelled' or 'moved'
+    , tmCallback :: IO ()
+    }
+
+-- | Identifies a registered timer.
+newtype TimerKey = TK (IORef Timer)
+    deriving (Eq)
+
+data TimerWheel = TimerWheel {
+      twTick   :: {-# UNPACK #-} !Double
+      -- ^ length of a tick, in seconds
+    , twSlots  :: {-# UNPACK #-} !(A.Arr [Timer])
+    , twLock   :: {-# UNPACK #-} !(MVar ())
+      -- ^ protects the slots, 'twCursor' and 'twNext'
+    , twCursor :: {-# UNPACK #-} !(IORef Int)
+      -- ^ the last tick whose timers have been run
+    , twNext   :: {-# UNPACK #-} !(IORef Int)
+      -- ^ the tick the manager will wake up in, 'maxBound' if never
+    }
+
+wheelSize :: Int
+wheelSize = 1024
+
+-- | The deadline of a timer that has run or has been cancelled.
+cancelled :: Int
+cancelled = -1
+
+-- | The deadline of a timer that is being replaced by 'update'.
+moved :: Int
+moved = -2
+
+-- | Create a timer wheel with ticks of the given length in seconds,
+-- starting at the given time.
+new :: Double -> Double -> IO TimerWheel
+new tick now = do
+  slots <- A.new [] wheelSize
+  lock <- newMVar ()
+  cursor <- newIORef (floor (now / tick))
+  next <- newIORef maxBound
+  return $! TimerWheel tick slots lock cursor next
+
+deadlineTick :: TimerWheel -> Double -> Int -> Int
+deadlineTick tw now us =
+  ceiling ((now + fromIntegral us / 1000000) / twTick tw)
+
+-- | Register a callback to run @us@ microseconds after @now@.  Also
+-- returns whether the manager must be woken up to run it in time.
+insert :: TimerWheel -> Double -> Int -> IO () -> IO (TimerKey, Bool)
+insert tw now us cb = do
+  tm <- newTimer cb
+  ref <- newIORef tm
+  wake <- withMVar (twLock tw) $ \_ -> schedule tw tm (deadlineTick tw now us)
+  return (TK ref, wake)
+
+newTimer :: IO () -> IO Timer
+newTimer cb = do
+  deadline <- newIORef cancelled
+  return $! Timer deadline cb
+
+-- | Put a timer in the slot for tick @t@, or the next tick to expire if
+-- that has passed.  Must hold 'twLock'.
+schedule :: TimerWheel -> Timer -> Int -> IO Bool
+schedule tw tm t0 = do
+  cursor <- readIORef (twCursor tw)
+  let !t = max t0 (cursor + 1)
+  writeIORef (tmDeadline tm) t
+  addToSlot tw tm t
+  next <- readIORef (twNext tw)
+  if t < next
+    then writeIORef (twNext tw) t >> return True
+    else return False
+
+-- | Must hold 'twLock'.
+addToSlot :: TimerWheel -> Timer -> Int -> IO ()
+addToSlot tw tm t = do
+  let !i = t `mod` wheelSize
+  tms <- A.read (twSlots tw) i
+  A.write (twSlots tw) i (tm : tms)
+
+data Edit = Gone | Postponed | Advanced | Busy
+
+-- | Make a timer run @us@ microseconds after @now@ instead.  Does
+-- nothing if it has already run or been cancelled.  Returns whether the
+-- manager must be woken up.
+update :: TimerWheel -> TimerKey -> Double -> Int -> IO Bool
+update tw key@(TK ref) now us = do
+  tm <- readIORef ref
+  let !t = deadlineTick tw now us
+  edit <- atomicModifyIORef' (tmDeadline tm) $ \d ->
+    if d == moved then (d, Busy)
+    else if d == cancelled then (d, Gone)
+    else if t >= d then (t, Postponed)
+    else (moved, Advanced)
+  case edit of
+    Advanced -> withMVar (twLock tw) $ \_ -> do
+      tm' <- newTimer (tmCallback tm)
+      writeIORef ref tm'
+      schedule tw tm' t
+    Busy -> waitForUpdate tw >> update tw key now us
+    _    -> return False
+
+-- | Unregister a timer.
+cancel :: TimerWheel -> TimerKey -> IO ()
+cancel tw key@(TK ref) = do
+  tm <- readIORef ref
+  busy <- atomicModifyIORef' (tmDeadline tm) $ \d ->
+    if d == moved then (d, True) else (cancelled, False)
+  when busy $ waitForUpdate tw >> cancel tw key
+
+-- | Another thread is replacing the timer in 'update', while holding
+-- the lock.
+waitForUpdate :: TimerWheel -> IO ()
+waitForUpdate tw = withMVar (twLock tw) $ \_ -> return ()
+
+-- | Remove the timers that are due at @now@, returning their callbacks
+-- and the time until the next slot that has timers in it.
+expire :: TimerWheel -> Double -> IO ([IO ()], Timeout)
+expire tw now = withMVar (twLock tw) $ \_ -> do
+  cursor <- readIORef (twCursor tw)
+  let !cur  = max cursor (floor (now / twTick tw))
+      !from = max (cursor + 1) (cur - wheelSize + 1)
+  fired <- expireTicks from cur []
+  writeIORef (twCursor tw) cur
+  next <- nextTick (cur + 1) (cur + wheelSize)
+  writeIORef (twNext tw) next
+  let timeout
+        | next == maxBound = Forever
+        | otherwise        = Timeout (fromIntegral next * twTick tw - now)
+  return (reverse fired, timeout)
+ where
+  expireTicks !t !cur fired
+    | t > cur   = return fired
+    | otherwise = do
+        let !i = t `mod` wheelSize
+        tms <- A.read (twSlots tw) i
+        A.write (twSlots tw) i []
+        fired' <- expireSlot cur fired tms
+        expireTicks (t + 1) cur fired'
+
+  expireSlot _ fired [] = return fired
+  expireSlot !cur fired (tm:tms) = do
+    d <- atomicModifyIORef' (tmDeadline tm) $ \d ->
+      if d >= 0 && d <= cur then (cancelled, d) else (d, d)
+    if d < 0
+      then expireSlot cur fired tms
+      else if d <= cur
+        then expireSlot cur (tmCallback tm : fired) tms
+        else addToSlot tw tm d >> expireSlot cur fired tms
+
+  nextTick !t !end
+    | t > end   = return maxBound
+    | otherwise = do
+        tms <- A.read (twSlots tw) (t `mod` wheelSize)
+        case tms of
+          [] -> nextTick (t + 1) end
+          _  -> return t
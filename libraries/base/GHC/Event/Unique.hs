@@ -28,7 +28,8 @@ instance Show Unique where
 newSource :: IO UniqueSource
 newSource = IO $ \s ->
   case newByteArray# size s of
-    (# s', mba #) -> (# s', US mba #)
+    (# s', mba #) -> case writeIntArray# mba 0# 0# s' of
+      s'' -> (# s'', US mba #)
   where
     !(I# size) = SIZEOF_HSINT
 
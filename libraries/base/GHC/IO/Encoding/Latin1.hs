@@ -2,6 +2,7 @@
 {-# LANGUAGE NoImplicitPrelude
            , BangPatterns
            , NondecreasingIndentation
+           , ForeignFunctionInterface
   #-}
 {-# OPTIONS_GHC  -funbox-strict-fields #-}
 
@@ -41,6 +42,9 @@ import GHC.Num
 import GHC.IO.Buffer
 import GHC.IO.Encoding.Failure
 import GHC.IO.Encoding.Types
+import GHC.Ptr
+import GHC.Word
+import Foreign.C.Types (CSize(..))
 
 -- -----------------------------------------------------------------------------
 -- Latin1
@@ -152,8 +156,10 @@ latin1_decode
                                   if ir == iw then input{ bufL=0, bufR=0 }
                                               else input{ bufL=ir },
                                   output{ bufR=ow })
-    in
-    loop ir0 ow0
+    in do
+    n <- bulk (\ip op k -> c_latin1_decode ip op k >> return k)
+              iraw ir0 iw oraw ow0 os 1 charSize
+    loop (ir0 + n) (ow0 + n)
 
 ascii_decode :: DecodeBuffer
 ascii_decode
@@ -176,8 +182,9 @@ ascii_decode
                                   if ir == iw then input{ bufL=0, bufR=0 }
                                               else input{ bufL=ir },
                                   output{ bufR=ow })
-    in
-    loop ir0 ow0
+    in do
+    n <- bulk c_ascii_decode iraw ir0 iw oraw ow0 os 1 charSize
+    loop (ir0 + n) (ow0 + n)
 
 latin1_encode :: EncodeBuffer
 latin1_encode
@@ -195,8 +202,11 @@ latin1_encode
            (c,ir') <- readCharBuf iraw ir
            writeWord8Buf oraw ow (fromIntegral (ord c))
            loop ir' (ow+1)
-    in
-    loop ir0 ow0
+    in do
+    -- no character is above 0x10ffff, so this truncates them all
+    n <- bulk (\ip op k -> c_latin1_encode ip op k 0x10ffff)
+              iraw ir0 iw oraw ow0 os charSize 1
+    loop (ir0 + n) (ow0 + n)
 
 latin1_checked_encode :: EncodeBuffer
 latin1_checked_encode input output
@@ -225,6 +235,39 @@ single_byte_checked_encode max_legal_char
            loop ir' (ow+1)
         where
            invalid = done InvalidSequence ir ow
-    in
-    loop ir0 ow0
+    in do
+    let !max_legal = fromIntegral max_legal_char
+    n <- bulk (\ip op k -> c_latin1_encode ip op k max_legal)
+              iraw ir0 iw oraw ow0 os charSize 1
+    loop (ir0 + n) (ow0 + n)
 {-# INLINE single_byte_checked_encode #-}
+
+-- | Convert as much of the input as a kernel in cbits/textcodec.c will.
+-- As every character is a single byte, the kernel returns the number
+-- of elements converted, and the loop of the codec carries on from
+-- there.
+bulk :: (Ptr a -> Ptr b -> CSize -> IO CSize)
+     -> RawBuffer a -> Int -> Int   -- input, and its bufL and bufR
+     -> RawBuffer b -> Int -> Int   -- output, and its bufR and bufSize
+     -> Int -> Int                  -- sizes of an input and output element
+     -> IO Int
+bulk kernel iraw ir iw oraw ow os isz osz
+  | n <= 0    = return 0
+  | otherwise =
+    withRawBuffer iraw $ \ip ->
+    withRawBuffer oraw $ \op ->
+    fromIntegral `fmap` kernel (ip `plusPtr` (ir * isz))
+                               (op `plusPtr` (ow * osz)) (fromIntegral n)
+  where
+    n = min (iw - ir) (os - ow)
+{-# INLINE bulk #-}
+
+foreign import ccall unsafe "HsTextCodec.h hs_latin1_decode"
+    c_latin1_decode :: Ptr Word8 -> Ptr CharBufElem -> CSize -> IO ()
+
+foreign import ccall unsafe "HsTextCodec.h hs_ascii_decode"
+    c_ascii_decode :: Ptr Word8 -> Ptr CharBufElem -> CSize -> IO CSize
+
+foreign import ccall unsafe "HsTextCodec.h hs_latin1_encode"
+    c_latin1_encode :: Ptr CharBufElem -> Ptr Word8 -> CSize -> Word32
+                    -> IO CSize
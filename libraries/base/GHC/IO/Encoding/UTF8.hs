@@ -3,6 +3,7 @@
            , BangPatterns
            , NondecreasingIndentation
            , MagicHash
+           , ForeignFunctionInterface
   #-}
 {-# OPTIONS_GHC -funbox-strict-fields #-}
 
@@ -38,7 +39,11 @@ import GHC.IO.Buffer
 import GHC.IO.Encoding.Failure
 import GHC.IO.Encoding.Types
 import GHC.Word
+import GHC.Ptr
 import Data.Bits
+import Foreign.C.Types (CSize(..))
+import Foreign.Marshal.Alloc (alloca)
+import Foreign.Storable (peek, poke)
 
 utf8 :: TextEncoding
 utf8 = mkUTF8 ErrorOnCodingFailure
@@ -208,8 +213,9 @@ utf8_decode
                                   if ir == iw then input{ bufL=0, bufR=0 }
                                               else input{ bufL=ir },
                                   output{ bufR=ow })
-   in
-   loop ir0 ow0
+   in do
+   (ir1, ow1) <- bulk c_utf8_decode iraw ir0 iw oraw ow0 os 1 charSize
+   loop ir1 ow1
 
 utf8_encode :: EncodeBuffer
 utf8_encode
@@ -250,8 +256,39 @@ utf8_encode
                     writeWord8Buf oraw (ow+2) c3
                     writeWord8Buf oraw (ow+3) c4
                     loop ir' (ow+4)
-   in
-   loop ir0 ow0
+   in do
+   (ir1, ow1) <- bulk c_utf8_encode iraw ir0 iw oraw ow0 os charSize 1
+   loop ir1 ow1
+
+-- | Convert the start of the input in C, see cbits/textcodec.c.  The
+-- kernel stops at anything it cannot convert (an invalid or incomplete
+-- sequence, or a character that does not fit in the output), leaving
+-- it to the loop of the codec.
+bulk :: (Ptr a -> Ptr CSize -> Ptr b -> CSize -> IO CSize)
+     -> RawBuffer a -> Int -> Int   -- input, and its bufL and bufR
+     -> RawBuffer b -> Int -> Int   -- output, and its bufR and bufSize
+     -> Int -> Int                  -- sizes of an input and output element
+     -> IO (Int, Int)
+bulk kernel iraw ir iw oraw ow os isz osz
+  | ir >= iw || ow >= os = return (ir, ow)
+  | otherwise =
+    withRawBuffer iraw $ \ip ->
+    withRawBuffer oraw $ \op ->
+    alloca $ \lenp -> do
+      poke lenp (fromIntegral (iw - ir))
+      m <- kernel (ip `plusPtr` (ir * isz)) lenp
+                  (op `plusPtr` (ow * osz)) (fromIntegral (os - ow))
+      n <- peek lenp
+      return (ir + fromIntegral n, ow + fromIntegral m)
+{-# INLINE bulk #-}
+
+foreign import ccall unsafe "HsTextCodec.h hs_utf8_decode"
+    c_utf8_decode :: Ptr Word8 -> Ptr CSize -> Ptr CharBufElem -> CSize
+                  -> IO CSize
+
+foreign import ccall unsafe "HsTextCodec.h hs_utf8_encode"
+    c_utf8_encode :: Ptr CharBufElem -> Ptr CSize -> Ptr Word8 -> CSize
+                  -> IO CSize
 
 -- -----------------------------------------------------------------------------
 -- UTF-8 primitives, lifted from Data.Text.Fusion.Utf8
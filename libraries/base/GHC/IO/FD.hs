@@ -395,17 +395,21 @@ setNonBlockingMode fd set = do
 ready :: FD -> Bool -> Int -> IO Bool
 ready fd write msecs = do
   r <- throwErrnoIfMinus1Retry "GHC.IO.FD.ready" $
-          fdReady (fdFD fd) (fromIntegral $ fromEnum $ write)
-                            (fromIntegral msecs)
+          fdReady (fdFD fd) (fromIntegral $ fromEnum $ write) nsecs
 #if defined(mingw32_HOST_OS)
                           (fromIntegral $ fromEnum $ fdIsSocket fd)
 #else
                           0
 #endif
   return (toEnum (fromIntegral r))
+ where
+  -- fdReady takes nanoseconds, and waits forever if given a negative
+  -- timeout
+  nsecs | msecs < 0 = -1
+        | otherwise = fromIntegral msecs * 1000000
 
 foreign import ccall safe "fdReady"
-  fdReady :: CInt -> CInt -> CInt -> CInt -> IO CInt
+  fdReady :: CInt -> CInt -> Int64 -> CInt -> IO CInt
 
 -- ---------------------------------------------------------------------------
 -- Terminal-related stuff
@@ -566,7 +570,7 @@ isNonBlocking :: FD -> Bool
 isNonBlocking fd = fdIsNonBlocking fd /= 0
 
 foreign import ccall unsafe "fdReady"
-  unsafe_fdReady :: CInt -> CInt -> CInt -> CInt -> IO CInt
+  unsafe_fdReady :: CInt -> CInt -> Int64 -> CInt -> IO CInt
 
 #else /* mingw32_HOST_OS.... */
 
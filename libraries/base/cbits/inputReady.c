@@ -6,6 +6,11 @@
 
 /* select and supporting types is not Posix */
 /* #include "PosixSource.h" */
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+/* for ppoll() with glibc */
+#define _GNU_SOURCE 1
+#endif
+#include "Rts.h"
 #include "HsBase.h"
 #if !defined(_WIN32)
 #include <poll.h>
@@ -13,21 +18,20 @@
 
 /*
  * inputReady(fd) checks to see whether input is available on the file
- * descriptor 'fd'.  Input meaning 'can I safely read at least a
+ * descriptor 'fd' within 'nsecs' nanoseconds (or indefinitely if 'nsecs'
+ * is negative).  Input meaning 'can I safely read at least a
  * *character* from this file object without blocking?'
  */
 int
-fdReady(int fd, int write, int msecs, int isSock)
+fdReady(int fd, int write, int64_t nsecs, int isSock)
 {
 
 #if !defined(_WIN32)
 
-    // We only handle msecs == 0 on non-Windows, because this is the
-    // only case we need.  Non-zero waiting is handled by the IO manager.
-    if (msecs != 0) {
-        fprintf(stderr, "fdReady: msecs != 0, this shouldn't happen");
-        abort();
-    }
+    // poll() rather than select(), so that there is no limit on the fd
+    // number.  If the wait is interrupted by a signal we carry on with
+    // whatever is left of the timeout, measured against the monotonic
+    // clock, rather than starting it again.
 
     struct pollfd fds[1];
 
@@ -35,11 +39,50 @@ fdReady(int fd, int write, int msecs, int isSock)
     fds[0].events = write ? POLLOUT : POLLIN;
     fds[0].revents = 0;
 
+    StgWord64 deadline = 0;
+    int64_t remaining = nsecs;
+    if (nsecs > 0) {
+        deadline = getMonotonicNSec() + (StgWord64)nsecs;
+    }
+
     int res;
-    while ((res = poll(fds, 1, 0)) < 0) {
-        if (errno != EINTR) {
+    while (1) {
+#if defined(HAVE_PPOLL)
+        struct timespec ts, *tsp = NULL;
+        if (remaining >= 0) {
+            ts.tv_sec  = remaining / 1000000000;
+            ts.tv_nsec = remaining % 1000000000;
+            tsp = &ts;
+        }
+        res = ppoll(fds, 1, tsp, NULL);
+#else
+        // poll() only takes milliseconds: round up, so that we never
+        // return early, and clamp very long timeouts (the loop below
+        // waits again for the rest).
+        int msecs;
+        if (remaining < 0) {
+            msecs = -1;
+        } else if (remaining / 1000000 >= INT_MAX) {
+            msecs = INT_MAX;
+        } else {
+            msecs = (int)((remaining + 999999) / 1000000);
+        }
+        res = poll(fds, 1, msecs);
+#endif
+        if (res < 0 && errno != EINTR) {
             return (-1);
         }
+        if (res > 0 || (res == 0 && nsecs == 0)) {
+            break;
+        }
+        if (nsecs > 0) {
+            StgWord64 now = getMonotonicNSec();
+            if (now >= deadline) {
+                res = 0;
+                break;
+            }
+            remaining = (int64_t)(deadline - now);
+        }
     }
 
     // res is the number of FDs with events
@@ -47,6 +90,15 @@ fdReady(int fd, int write, int msecs, int isSock)
 
 #else
 
+    // WaitForSingleObject() takes milliseconds; round up, so that we
+    // never return early.
+    DWORD msecs;
+    if (nsecs < 0 || nsecs / 1000000 >= INFINITE) {
+        msecs = INFINITE;
+    } else {
+        msecs = (DWORD)((nsecs + 999999) / 1000000);
+    }
+
     if (isSock) {
 	int maxfd, ready;
 	fd_set rfd, wfd;
@@ -67,10 +119,11 @@ fdReady(int fd, int write, int msecs, int isSock)
 	 * (maxfd-1) 
 	 */
 	maxfd = fd + 1;
-	tv.tv_sec  = msecs / 1000;
-	tv.tv_usec = (msecs % 1000) * 1000;
+	tv.tv_sec  = (long)(((nsecs + 999) / 1000) / 1000000);
+	tv.tv_usec = (long)(((nsecs + 999) / 1000) % 1000000);
 	
-	while ((ready = select(maxfd, &rfd, &wfd, NULL, &tv)) < 0 ) {
+	while ((ready = select(maxfd, &rfd, &wfd, NULL,
+	                       nsecs < 0 ? NULL : &tv)) < 0 ) {
 	    if (errno != EINTR ) {
 		return -1;
 	    }
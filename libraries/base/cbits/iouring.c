@@ -0,0 +1,537 @@
+/*
+ * (c) The GHC Team, 2017
+ *
+ * The io_uring rings behind GHC.Event.IOUring.
+ *
+ * The backend watches fds with IORING_OP_POLL_ADD requests.  A poll
+ * request completes once, so for a multi-shot registration we queue a
+ * new one when it completes; these re-arms are not submitted straight
+ * away but together with the next hs_uring_wait(), in the same
+ * io_uring_enter() call that waits for completions.  Registrations
+ * made from other threads are submitted immediately, because the
+ * manager thread may be blocked in io_uring_enter() and would not
+ * otherwise see them.
+ *
+ * Each fd has a generation number, bumped whenever its registration
+ * changes, which is part of the user_data of its poll requests.
+ * Completions of superseded requests are dropped when reaped.
+ *
+ * The kernel refuses new requests (EBUSY) while it holds completions
+ * that did not fit in the completion queue.  So when the submission
+ * queue is full and cannot be submitted, getSqe() makes room by moving
+ * the completions to r->pending, from where hs_uring_wait() returns
+ * them.  If that happens on a thread other than the manager's, we also
+ * submit a no-op, whose completion wakes the manager up in case it is
+ * waiting in the kernel for completions we took.
+ *
+ * We talk to the kernel with raw system calls, since liburing is not
+ * something base can depend on.
+ */
+
+#include "HsBase.h"
+#include "HsIOUring.h"
+
+#if defined(HAVE_IO_URING)
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#define URING_TIMEOUT_DATA UINT64_C(0xffffffffffffffff)
+#define URING_REMOVE_DATA  UINT64_C(0xfffffffffffffffe)
+#define URING_WAKE_DATA    UINT64_C(0xfffffffffffffffd)
+
+#define URING_USER_DATA(fd,gen) (((uint64_t)(gen) << 32) | (uint32_t)(fd))
+
+typedef struct {
+    uint32_t events;   /* the poll(2) events we are watching for */
+    uint32_t gen;      /* bumped whenever the registration changes */
+    uint8_t  active;   /* a poll request is outstanding */
+    uint8_t  oneshot;  /* don't re-arm when it completes */
+} UringFd;
+
+/* A completion of a poll request, reaped but not yet returned */
+typedef struct {
+    uint32_t fd;
+    uint32_t gen;
+    int32_t  res;
+} UringCompletion;
+
+struct HsUring_ {
+    int fd;
+
+    /* submission queue */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+
+    /* completion queue */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void  *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+
+    /* protects the submission queue, fds[] and pending[] */
+    pthread_mutex_t lock;
+
+    UringFd *fds;
+    uint32_t n_fds;
+
+    /* completions taken from the completion queue to make room, in
+     * pending[pending_start..pending_end) */
+    UringCompletion *pending;
+    uint32_t pending_start, pending_end, pending_size;
+    /* completions were taken while the manager may be waiting for them */
+    int wake;
+
+    /* the timeout of hs_uring_wait(): the kernel reads it only when the
+     * request is submitted, which may be after hs_uring_wait() returns
+     * if io_uring_enter() fails or submits only some of the queue */
+    struct __kernel_timespec timeout;
+};
+
+static int
+uring_setup (unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+uring_enter (int fd, unsigned to_submit, unsigned min_complete,
+             unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+int
+hs_uring_supported (void)
+{
+    struct io_uring_params p;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+    fd = uring_setup(1, &p);
+    if (fd < 0) return 0;
+    close(fd);
+    /* Without IORING_FEAT_NODROP (Linux 5.5) completions can be lost
+     * when the completion queue overflows, and with them fd events. */
+    return (p.features & IORING_FEAT_NODROP) != 0;
+}
+
+HsUring *
+hs_uring_new (unsigned int entries)
+{
+    struct io_uring_params p;
+    HsUring *r;
+    char *sq, *cq;
+    int err;
+
+    r = calloc(1, sizeof(HsUring));
+    if (r == NULL) return NULL;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = uring_setup(entries, &p);
+    if (r->fd < 0) goto fail;
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes
+                      + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size    = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) goto fail;
+    r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_ring == MAP_FAILED) goto fail;
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) goto fail;
+
+    sq = r->sq_ring;
+    r->sq_head    = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail    = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask    = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array   = (unsigned *)(sq + p.sq_off.array);
+    r->sq_entries = p.sq_entries;
+
+    cq = r->cq_ring;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes    = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    fcntl(r->fd, F_SETFD, FD_CLOEXEC);
+    pthread_mutex_init(&r->lock, NULL);
+    return r;
+
+fail:
+    err = errno;
+    if (r->sqes != NULL && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED)
+        munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED)
+        munmap(r->sq_ring, r->sq_ring_size);
+    if (r->fd >= 0) close(r->fd);
+    free(r);
+    errno = err;
+    return NULL;
+}
+
+void
+hs_uring_free (HsUring *r)
+{
+    munmap(r->sqes, r->sqes_size);
+    munmap(r->cq_ring, r->cq_ring_size);
+    munmap(r->sq_ring, r->sq_ring_size);
+    close(r->fd);
+    pthread_mutex_destroy(&r->lock);
+    free(r->fds);
+    free(r->pending);
+    free(r);
+}
+
+/* The number of queued requests that the kernel has not consumed yet */
+static unsigned
+unsubmitted (HsUring *r)
+{
+    return *r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static int
+submit (HsUring *r)
+{
+    unsigned n;
+    int ret;
+
+    while ((n = unsubmitted(r)) > 0) {
+        ret = uring_enter(r->fd, n, 0, 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            /* EBUSY: the completion queue is full; it is drained by
+             * hs_uring_wait(), or by getSqe() if it needs the room */
+            if (errno == EBUSY || errno == EAGAIN) return 0;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int drain (HsUring *r);
+
+static int
+sqFull (HsUring *r)
+{
+    return *r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE)
+           >= r->sq_entries;
+}
+
+/* Get a free submission queue entry, submitting what is queued if the
+ * queue is full, and making room in the completion queue if the kernel
+ * will not take it.  Must hold r->lock. */
+static struct io_uring_sqe *
+getSqe (HsUring *r)
+{
+    struct io_uring_sqe *sqe;
+    int n;
+
+    while (sqFull(r)) {
+        if (submit(r) < 0) return NULL;
+        if (!sqFull(r)) break;
+        n = drain(r);
+        if (n < 0) return NULL;
+        if (n > 0) {
+            r->wake = 1;
+            continue;
+        }
+        /* The completions are held by the kernel: have it flush them to
+         * the completion queue, where we can take them */
+        if (uring_enter(r->fd, 0, 0, IORING_ENTER_GETEVENTS) < 0
+            && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+            return NULL;
+        }
+        if (*r->cq_head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)
+            && submit(r) == 0 && sqFull(r)) {
+            /* no progress to be made */
+            errno = EAGAIN;
+            return NULL;
+        }
+    }
+    sqe = &r->sqes[*r->sq_tail & *r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/* Make a filled-in entry visible to the kernel.  Must hold r->lock. */
+static void
+pushSqe (HsUring *r, struct io_uring_sqe *sqe)
+{
+    unsigned tail = *r->sq_tail;
+
+    r->sq_array[tail & *r->sq_mask] = (unsigned)(sqe - r->sqes);
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int
+queuePoll (HsUring *r, int fd)
+{
+    struct io_uring_sqe *sqe = getSqe(r);
+
+    if (sqe == NULL) return -1;
+    sqe->opcode      = IORING_OP_POLL_ADD;
+    sqe->fd          = fd;
+    sqe->poll_events = (uint16_t)r->fds[fd].events;
+    sqe->user_data   = URING_USER_DATA(fd, r->fds[fd].gen);
+    pushSqe(r, sqe);
+    return 0;
+}
+
+static int
+queuePollRemove (HsUring *r, int fd)
+{
+    struct io_uring_sqe *sqe = getSqe(r);
+
+    if (sqe == NULL) return -1;
+    sqe->opcode    = IORING_OP_POLL_REMOVE;
+    sqe->fd        = -1;
+    sqe->addr      = URING_USER_DATA(fd, r->fds[fd].gen);
+    sqe->user_data = URING_REMOVE_DATA;
+    pushSqe(r, sqe);
+    return 0;
+}
+
+static int
+queueWake (HsUring *r)
+{
+    struct io_uring_sqe *sqe = getSqe(r);
+
+    if (sqe == NULL) return -1;
+    sqe->opcode    = IORING_OP_NOP;
+    sqe->fd        = -1;
+    sqe->user_data = URING_WAKE_DATA;
+    pushSqe(r, sqe);
+    r->wake = 0;
+    return 0;
+}
+
+static int
+growFds (HsUring *r, int fd)
+{
+    uint32_t n;
+    UringFd *fds;
+
+    if ((uint32_t)fd < r->n_fds) return 0;
+    n = r->n_fds ? r->n_fds : 64;
+    while (n <= (uint32_t)fd) n *= 2;
+    fds = realloc(r->fds, n * sizeof(UringFd));
+    if (fds == NULL) return -1;
+    memset(fds + r->n_fds, 0, (n - r->n_fds) * sizeof(UringFd));
+    r->fds = fds;
+    r->n_fds = n;
+    return 0;
+}
+
+/* Replace the registration of fd with 'events' (poll(2) events; 0 to
+ * unregister), and submit the change. */
+int
+hs_uring_modify (HsUring *r, int fd, uint32_t events, int oneshot)
+{
+    UringFd *f;
+    int ret = -1;
+
+    pthread_mutex_lock(&r->lock);
+    if (growFds(r, fd) < 0) {
+        errno = ENOMEM;
+        goto out;
+    }
+    f = &r->fds[fd];
+    if (f->active && queuePollRemove(r, fd) < 0) goto out;
+    f->gen++;
+    f->events  = events;
+    f->oneshot = oneshot != 0;
+    f->active  = 0;
+    if (events != 0) {
+        if (queuePoll(r, fd) < 0) goto out;
+        f->active = 1;
+    }
+    if (r->wake && queueWake(r) < 0) goto out;
+    ret = submit(r);
+out:
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+/* Move the completions of current poll requests from the completion
+ * queue to r->pending.  Returns the number of entries taken from the
+ * queue.  Must hold r->lock. */
+static int
+drain (HsUring *r)
+{
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        uint64_t data = cqe->user_data;
+        uint32_t fd, gen;
+        UringFd *f;
+
+        if (r->pending_end == r->pending_size) {
+            if (r->pending_start > 0) {
+                memmove(r->pending, r->pending + r->pending_start,
+                        (r->pending_end - r->pending_start)
+                        * sizeof(UringCompletion));
+                r->pending_end -= r->pending_start;
+                r->pending_start = 0;
+            } else {
+                uint32_t size = r->pending_size ? 2 * r->pending_size : 64;
+                UringCompletion *p =
+                    realloc(r->pending, size * sizeof(UringCompletion));
+                if (p == NULL) {
+                    if (n == 0) {
+                        errno = ENOMEM;
+                        n = -1;
+                    }
+                    break;
+                }
+                r->pending = p;
+                r->pending_size = size;
+            }
+        }
+
+        head++;
+        n++;
+        if (data == URING_TIMEOUT_DATA || data == URING_REMOVE_DATA
+            || data == URING_WAKE_DATA) {
+            continue;
+        }
+
+        fd  = (uint32_t)data;
+        gen = (uint32_t)(data >> 32);
+        if (fd >= r->n_fds) continue;
+        f = &r->fds[fd];
+        if (!f->active || f->gen != gen) continue;   /* superseded */
+
+        /* On an error (e.g. the fd has been closed) the request is not
+         * re-armed either */
+        if (cqe->res < 0 || f->oneshot) {
+            f->active = 0;
+        }
+        r->pending[r->pending_end].fd  = fd;
+        r->pending[r->pending_end].gen = gen;
+        r->pending[r->pending_end].res = cqe->res;
+        r->pending_end++;
+    }
+
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+/* Move up to 'max' of the pending completions to evs[], re-arming the
+ * multi-shot registrations.  Must hold r->lock. */
+static int
+reap (HsUring *r, HsUringEvent *evs, int max)
+{
+    int n = 0;
+
+    while (r->pending_start != r->pending_end && n < max) {
+        /* a copy, as queuePoll() may add to pending[] */
+        UringCompletion c = r->pending[r->pending_start++];
+        UringFd *f = &r->fds[c.fd];
+        int res = c.res;
+
+        if (f->gen != c.gen) continue;   /* superseded since */
+
+        if (res < 0) {
+            /* report an error, which wakes up everyone waiting on it */
+            res = POLLERR;
+        } else if (f->active && queuePoll(r, (int)c.fd) < 0) {
+            f->active = 0;
+        }
+
+        evs[n].fd = (int)c.fd;
+        evs[n].events = (uint32_t)res;
+        n++;
+    }
+
+    if (r->pending_start == r->pending_end) {
+        r->pending_start = r->pending_end = 0;
+    }
+    return n;
+}
+
+/* Submit what is queued, wait for up to timeout_ms milliseconds (-1:
+ * forever) for a completion, and return up to 'max' ready fds in
+ * evs[].  Only the thread that owns the ring may call this. */
+int
+hs_uring_wait (HsUring *r, int timeout_ms, HsUringEvent *evs, int max)
+{
+    struct io_uring_sqe *sqe;
+    unsigned to_submit, min_complete = 0, flags = 0;
+    int n, ret;
+
+    pthread_mutex_lock(&r->lock);
+
+    /* we are about to return whatever was taken from the queue */
+    r->wake = 0;
+    if (*r->cq_head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)
+        || r->pending_start != r->pending_end) {
+        /* completions are waiting already */
+        timeout_ms = 0;
+    }
+
+    if (timeout_ms > 0) {
+        /* completes after the timeout, or when one other request does */
+        sqe = getSqe(r);
+        if (sqe == NULL) goto fail;
+        r->timeout.tv_sec  = timeout_ms / 1000;
+        r->timeout.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        sqe->opcode    = IORING_OP_TIMEOUT;
+        sqe->fd        = -1;
+        sqe->addr      = (uint64_t)(uintptr_t)&r->timeout;
+        sqe->len       = 1;
+        sqe->off       = 1;
+        sqe->user_data = URING_TIMEOUT_DATA;
+        pushSqe(r, sqe);
+        if (r->pending_start != r->pending_end) {
+            /* getSqe() took some completions */
+            timeout_ms = 0;
+        }
+    }
+
+    to_submit = unsubmitted(r);
+    pthread_mutex_unlock(&r->lock);
+
+    if (timeout_ms != 0) {
+        min_complete = 1;
+        flags = IORING_ENTER_GETEVENTS;
+    }
+    if (to_submit > 0 || min_complete > 0) {
+        ret = uring_enter(r->fd, to_submit, min_complete, flags);
+        if (ret < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&r->lock);
+    if (drain(r) < 0 && r->pending_start == r->pending_end) goto fail;
+    n = reap(r, evs, max);
+    pthread_mutex_unlock(&r->lock);
+    return n;
+
+fail:
+    pthread_mutex_unlock(&r->lock);
+    return -1;
+}
+
+#endif /* HAVE_IO_URING */
@@ -15,6 +15,14 @@
  * will fill a supplied 16-byte array with the digest.
  */
 
+/*
+ * Changes for GHC: on little-endian machines the input is hashed in
+ * place, without the byte swapping and copying into the context, and
+ * runs of whole blocks are hashed by one call that keeps the state in
+ * registers.  __hsbase_MD5Many hashes several messages at once, side by
+ * side in the lanes of SIMD vectors.  The digests are the same as ever.
+ */
+
 #include "HsFFI.h"
 #include "md5.h"
 #include <string.h>
@@ -23,8 +31,11 @@ void __hsbase_MD5Init(struct MD5Context *context);
 void __hsbase_MD5Update(struct MD5Context *context, byte const *buf, int len);
 void __hsbase_MD5Final(byte digest[16], struct MD5Context *context);
 void __hsbase_MD5Transform(word32 buf[4], word32 const in[16]);
+void __hsbase_MD5Many(int n, byte const *const bufs[], int const lens[],
+		      byte digests[]);
 
 
+#if defined(WORDS_BIGENDIAN)
 /*
  * Shuffle the bytes into little-endian order within words, as per the
  * MD5 spec.  Note: this code works regardless of the byte order.
@@ -40,6 +51,34 @@ byteSwap(word32 *buf, unsigned words)
 		p += 4;
 	} while (--words);
 }
+#else
+#define byteSwap(buf, words)	/* nothing */
+#endif
+
+/* Load and store little-endian words at any alignment. */
+static inline word32
+load32(byte const *p)
+{
+#if defined(WORDS_BIGENDIAN)
+	return (word32)((unsigned)p[3] << 8 | p[2]) << 16 |
+		((unsigned)p[1] << 8 | p[0]);
+#else
+	word32 w;
+	memcpy(&w, p, 4);
+	return w;
+#endif
+}
+
+static inline void
+store32(byte *p, word32 w)
+{
+	p[0] = (byte)w;
+	p[1] = (byte)(w >> 8);
+	p[2] = (byte)(w >> 16);
+	p[3] = (byte)(w >> 24);
+}
+
+static void md5Blocks(word32 buf[4], byte const *data, size_t blocks);
 
 /*
  * Start MD5 accumulation.  Set bit count to 0 and buffer to mysterious
@@ -78,21 +117,19 @@ __hsbase_MD5Update(struct MD5Context *ctx, byte const *buf, int len)
 		return;
 	}
 	/* First chunk is an odd size */
-	memcpy((byte *)ctx->in + 64 - (unsigned)t, buf, (unsigned)t);
-	byteSwap(ctx->in, 16);
-        __hsbase_MD5Transform(ctx->buf, ctx->in);
-	buf += (unsigned)t;
-	len -= (unsigned)t;
-
-	/* Process data in 64-byte chunks */
-	while (len >= 64) {
-		memcpy(ctx->in, buf, 64);
+	if (t < 64) {
+		memcpy((byte *)ctx->in + 64 - (unsigned)t, buf, (unsigned)t);
 		byteSwap(ctx->in, 16);
-                __hsbase_MD5Transform(ctx->buf, ctx->in);
-		buf += 64;
-		len -= 64;
+		__hsbase_MD5Transform(ctx->buf, ctx->in);
+		buf += (unsigned)t;
+		len -= (unsigned)t;
 	}
 
+	/* Process data in 64-byte chunks, straight from the buffer */
+	md5Blocks(ctx->buf, buf, (unsigned)len / 64);
+	buf += len & ~0x3f;
+	len &= 0x3f;
+
 	/* Handle any remaining bytes of data. */
 	memcpy(ctx->in, buf, len);
 }
@@ -138,7 +175,10 @@ __hsbase_MD5Final(byte digest[16], struct MD5Context *ctx)
 
 /* #define F1(x, y, z) (x & y | ~x & z) */
 #define F1(x, y, z) (z ^ (x & (y ^ z)))
-#define F2(x, y, z) F1(z, x, y)
+/* #define F2(x, y, z) F1(z, x, y) */
+/* the two halves have no bits in common, and can be added in either
+   order, which shortens the chain of dependent operations */
+#define F2(x, y, z) ((x & z) + (y & ~z))
 #define F3(x, y, z) (x ^ y ^ z)
 #define F4(x, y, z) (y ^ (x | ~z))
 
@@ -146,6 +186,79 @@ __hsbase_MD5Final(byte digest[16], struct MD5Context *ctx)
 #define MD5STEP(f,w,x,y,z,in,s) \
 	 (w += f(x,y,z) + in, w = (w<<s | w>>(32-s)) + x)
 
+/*
+ * The 64 steps on one block.  They also work on vectors of words (see
+ * __hsbase_MD5Many below), as the operators apply lane by lane.
+ */
+#define MD5ROUNDS(a, b, c, d, in) \
+	MD5STEP(F1, a, b, c, d, in[0] + 0xd76aa478, 7); \
+	MD5STEP(F1, d, a, b, c, in[1] + 0xe8c7b756, 12); \
+	MD5STEP(F1, c, d, a, b, in[2] + 0x242070db, 17); \
+	MD5STEP(F1, b, c, d, a, in[3] + 0xc1bdceee, 22); \
+	MD5STEP(F1, a, b, c, d, in[4] + 0xf57c0faf, 7); \
+	MD5STEP(F1, d, a, b, c, in[5] + 0x4787c62a, 12); \
+	MD5STEP(F1, c, d, a, b, in[6] + 0xa8304613, 17); \
+	MD5STEP(F1, b, c, d, a, in[7] + 0xfd469501, 22); \
+	MD5STEP(F1, a, b, c, d, in[8] + 0x698098d8, 7); \
+	MD5STEP(F1, d, a, b, c, in[9] + 0x8b44f7af, 12); \
+	MD5STEP(F1, c, d, a, b, in[10] + 0xffff5bb1, 17); \
+	MD5STEP(F1, b, c, d, a, in[11] + 0x895cd7be, 22); \
+	MD5STEP(F1, a, b, c, d, in[12] + 0x6b901122, 7); \
+	MD5STEP(F1, d, a, b, c, in[13] + 0xfd987193, 12); \
+	MD5STEP(F1, c, d, a, b, in[14] + 0xa679438e, 17); \
+	MD5STEP(F1, b, c, d, a, in[15] + 0x49b40821, 22); \
+	\
+	MD5STEP(F2, a, b, c, d, in[1] + 0xf61e2562, 5); \
+	MD5STEP(F2, d, a, b, c, in[6] + 0xc040b340, 9); \
+	MD5STEP(F2, c, d, a, b, in[11] + 0x265e5a51, 14); \
+	MD5STEP(F2, b, c, d, a, in[0] + 0xe9b6c7aa, 20); \
+	MD5STEP(F2, a, b, c, d, in[5] + 0xd62f105d, 5); \
+	MD5STEP(F2, d, a, b, c, in[10] + 0x02441453, 9); \
+	MD5STEP(F2, c, d, a, b, in[15] + 0xd8a1e681, 14); \
+	MD5STEP(F2, b, c, d, a, in[4] + 0xe7d3fbc8, 20); \
+	MD5STEP(F2, a, b, c, d, in[9] + 0x21e1cde6, 5); \
+	MD5STEP(F2, d, a, b, c, in[14] + 0xc33707d6, 9); \
+	MD5STEP(F2, c, d, a, b, in[3] + 0xf4d50d87, 14); \
+	MD5STEP(F2, b, c, d, a, in[8] + 0x455a14ed, 20); \
+	MD5STEP(F2, a, b, c, d, in[13] + 0xa9e3e905, 5); \
+	MD5STEP(F2, d, a, b, c, in[2] + 0xfcefa3f8, 9); \
+	MD5STEP(F2, c, d, a, b, in[7] + 0x676f02d9, 14); \
+	MD5STEP(F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20); \
+	\
+	MD5STEP(F3, a, b, c, d, in[5] + 0xfffa3942, 4); \
+	MD5STEP(F3, d, a, b, c, in[8] + 0x8771f681, 11); \
+	MD5STEP(F3, c, d, a, b, in[11] + 0x6d9d6122, 16); \
+	MD5STEP(F3, b, c, d, a, in[14] + 0xfde5380c, 23); \
+	MD5STEP(F3, a, b, c, d, in[1] + 0xa4beea44, 4); \
+	MD5STEP(F3, d, a, b, c, in[4] + 0x4bdecfa9, 11); \
+	MD5STEP(F3, c, d, a, b, in[7] + 0xf6bb4b60, 16); \
+	MD5STEP(F3, b, c, d, a, in[10] + 0xbebfbc70, 23); \
+	MD5STEP(F3, a, b, c, d, in[13] + 0x289b7ec6, 4); \
+	MD5STEP(F3, d, a, b, c, in[0] + 0xeaa127fa, 11); \
+	MD5STEP(F3, c, d, a, b, in[3] + 0xd4ef3085, 16); \
+	MD5STEP(F3, b, c, d, a, in[6] + 0x04881d05, 23); \
+	MD5STEP(F3, a, b, c, d, in[9] + 0xd9d4d039, 4); \
+	MD5STEP(F3, d, a, b, c, in[12] + 0xe6db99e5, 11); \
+	MD5STEP(F3, c, d, a, b, in[15] + 0x1fa27cf8, 16); \
+	MD5STEP(F3, b, c, d, a, in[2] + 0xc4ac5665, 23); \
+	\
+	MD5STEP(F4, a, b, c, d, in[0] + 0xf4292244, 6); \
+	MD5STEP(F4, d, a, b, c, in[7] + 0x432aff97, 10); \
+	MD5STEP(F4, c, d, a, b, in[14] + 0xab9423a7, 15); \
+	MD5STEP(F4, b, c, d, a, in[5] + 0xfc93a039, 21); \
+	MD5STEP(F4, a, b, c, d, in[12] + 0x655b59c3, 6); \
+	MD5STEP(F4, d, a, b, c, in[3] + 0x8f0ccc92, 10); \
+	MD5STEP(F4, c, d, a, b, in[10] + 0xffeff47d, 15); \
+	MD5STEP(F4, b, c, d, a, in[1] + 0x85845dd1, 21); \
+	MD5STEP(F4, a, b, c, d, in[8] + 0x6fa87e4f, 6); \
+	MD5STEP(F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10); \
+	MD5STEP(F4, c, d, a, b, in[6] + 0xa3014314, 15); \
+	MD5STEP(F4, b, c, d, a, in[13] + 0x4e0811a1, 21); \
+	MD5STEP(F4, a, b, c, d, in[4] + 0xf7537e82, 6); \
+	MD5STEP(F4, d, a, b, c, in[11] + 0xbd3af235, 10); \
+	MD5STEP(F4, c, d, a, b, in[2] + 0x2ad7d2bb, 15); \
+	MD5STEP(F4, b, c, d, a, in[9] + 0xeb86d391, 21)
+
 /*
  * The core of the MD5 algorithm, this alters an existing MD5 hash to
  * reflect the addition of 16 longwords of new data.  MD5Update blocks
@@ -162,73 +275,7 @@ __hsbase_MD5Transform(word32 buf[4], word32 const in[16])
 	c = buf[2];
 	d = buf[3];
 
-	MD5STEP(F1, a, b, c, d, in[0] + 0xd76aa478, 7);
-	MD5STEP(F1, d, a, b, c, in[1] + 0xe8c7b756, 12);
-	MD5STEP(F1, c, d, a, b, in[2] + 0x242070db, 17);
-	MD5STEP(F1, b, c, d, a, in[3] + 0xc1bdceee, 22);
-	MD5STEP(F1, a, b, c, d, in[4] + 0xf57c0faf, 7);
-	MD5STEP(F1, d, a, b, c, in[5] + 0x4787c62a, 12);
-	MD5STEP(F1, c, d, a, b, in[6] + 0xa8304613, 17);
-	MD5STEP(F1, b, c, d, a, in[7] + 0xfd469501, 22);
-	MD5STEP(F1, a, b, c, d, in[8] + 0x698098d8, 7);
-	MD5STEP(F1, d, a, b, c, in[9] + 0x8b44f7af, 12);
-	MD5STEP(F1, c, d, a, b, in[10] + 0xffff5bb1, 17);
-	MD5STEP(F1, b, c, d, a, in[11] + 0x895cd7be, 22);
-	MD5STEP(F1, a, b, c, d, in[12] + 0x6b901122, 7);
-	MD5STEP(F1, d, a, b, c, in[13] + 0xfd987193, 12);
-	MD5STEP(F1, c, d, a, b, in[14] + 0xa679438e, 17);
-	MD5STEP(F1, b, c, d, a, in[15] + 0x49b40821, 22);
-
-	MD5STEP(F2, a, b, c, d, in[1] + 0xf61e2562, 5);
-	MD5STEP(F2, d, a, b, c, in[6] + 0xc040b340, 9);
-	MD5STEP(F2, c, d, a, b, in[11] + 0x265e5a51, 14);
-	MD5STEP(F2, b, c, d, a, in[0] + 0xe9b6c7aa, 20);
-	MD5STEP(F2, a, b, c, d, in[5] + 0xd62f105d, 5);
-	MD5STEP(F2, d, a, b, c, in[10] + 0x02441453, 9);
-	MD5STEP(F2, c, d, a, b, in[15] + 0xd8a1e681, 14);
-	MD5STEP(F2, b, c, d, a, in[4] + 0xe7d3fbc8, 20);
-	MD5STEP(F2, a, b, c, d, in[9] + 0x21e1cde6, 5);
-	MD5STEP(F2, d, a, b, c, in[14] + 0xc33707d6, 9);
-	MD5STEP(F2, c, d, a, b, in[3] + 0xf4d50d87, 14);
-	MD5STEP(F2, b, c, d, a, in[8] + 0x455a14ed, 20);
-	MD5STEP(F2, a, b, c, d, in[13] + 0xa9e3e905, 5);
-	MD5STEP(F2, d, a, b, c, in[2] + 0xfcefa3f8, 9);
-	MD5STEP(F2, c, d, a, b, in[7] + 0x676f02d9, 14);
-	MD5STEP(F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20);
-
-	MD5STEP(F3, a, b, c, d, in[5] + 0xfffa3942, 4);
-	MD5STEP(F3, d, a, b, c, in[8] + 0x8771f681, 11);
-	MD5STEP(F3, c, d, a, b, in[11] + 0x6d9d6122, 16);
-	MD5STEP(F3, b, c, d, a, in[14] + 0xfde5380c, 23);
-	MD5STEP(F3, a, b, c, d, in[1] + 0xa4beea44, 4);
-	MD5STEP(F3, d, a, b, c, in[4] + 0x4bdecfa9, 11);
-	MD5STEP(F3, c, d, a, b, in[7] + 0xf6bb4b60, 16);
-	MD5STEP(F3, b, c, d, a, in[10] + 0xbebfbc70, 23);
-	MD5STEP(F3, a, b, c, d, in[13] + 0x289b7ec6, 4);
-	MD5STEP(F3, d, a, b, c, in[0] + 0xeaa127fa, 11);
-	MD5STEP(F3, c, d, a, b, in[3] + 0xd4ef3085, 16);
-	MD5STEP(F3, b, c, d, a, in[6] + 0x04881d05, 23);
-	MD5STEP(F3, a, b, c, d, in[9] + 0xd9d4d039, 4);
-	MD5STEP(F3, d, a, b, c, in[12] + 0xe6db99e5, 11);
-	MD5STEP(F3, c, d, a, b, in[15] + 0x1fa27cf8, 16);
-	MD5STEP(F3, b, c, d, a, in[2] + 0xc4ac5665, 23);
-
-	MD5STEP(F4, a, b, c, d, in[0] + 0xf4292244, 6);
-	MD5STEP(F4, d, a, b, c, in[7] + 0x432aff97, 10);
-	MD5STEP(F4, c, d, a, b, in[14] + 0xab9423a7, 15);
-	MD5STEP(F4, b, c, d, a, in[5] + 0xfc93a039, 21);
-	MD5STEP(F4, a, b, c, d, in[12] + 0x655b59c3, 6);
-	MD5STEP(F4, d, a, b, c, in[3] + 0x8f0ccc92, 10);
-	MD5STEP(F4, c, d, a, b, in[10] + 0xffeff47d, 15);
-	MD5STEP(F4, b, c, d, a, in[1] + 0x85845dd1, 21);
-	MD5STEP(F4, a, b, c, d, in[8] + 0x6fa87e4f, 6);
-	MD5STEP(F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10);
-	MD5STEP(F4, c, d, a, b, in[6] + 0xa3014314, 15);
-	MD5STEP(F4, b, c, d, a, in[13] + 0x4e0811a1, 21);
-	MD5STEP(F4, a, b, c, d, in[4] + 0xf7537e82, 6);
-	MD5STEP(F4, d, a, b, c, in[11] + 0xbd3af235, 10);
-	MD5STEP(F4, c, d, a, b, in[2] + 0x2ad7d2bb, 15);
-	MD5STEP(F4, b, c, d, a, in[9] + 0xeb86d391, 21);
+	MD5ROUNDS(a, b, c, d, in);
 
 	buf[0] += a;
 	buf[1] += b;
@@ -236,3 +283,233 @@ __hsbase_MD5Transform(word32 buf[4], word32 const in[16])
 	buf[3] += d;
 }
 
+/*
+ * Hash whole 64-byte blocks of bytes, reading the words straight from
+ * the buffer.
+ */
+static void
+md5Blocks(word32 buf[4], byte const *data, size_t blocks)
+{
+	word32 a, b, c, d, in[16];
+	unsigned i;
+
+	a = buf[0];
+	b = buf[1];
+	c = buf[2];
+	d = buf[3];
+
+	for (; blocks > 0; blocks--, data += 64) {
+		word32 aa = a, bb = b, cc = c, dd = d;
+
+		for (i = 0; i < 16; i++)
+			in[i] = load32(data + 4 * i);
+
+		MD5ROUNDS(a, b, c, d, in);
+
+		a += aa;
+		b += bb;
+		c += cc;
+		d += dd;
+	}
+
+	buf[0] = a;
+	buf[1] = b;
+	buf[2] = c;
+	buf[3] = d;
+}
+
+/*
+ * Hashing many small messages
+ *
+ * The steps of one MD5 depend on each other, so a single message
+ * cannot make use of SIMD; but independent messages can be hashed side
+ * by side, one in each lane of a vector.  __hsbase_MD5Many does this
+ * for 4 messages at a time with SSE2 or NEON, and 8 at a time with
+ * AVX2 where the CPU has it.  Each lane is fed the same blocks as
+ * MD5Update and MD5Final would feed it, including the padding.  The
+ * vector code is written with the GCC vector extensions, in which the
+ * MD5ROUNDS operators work lane by lane.
+ */
+
+#if defined(__GNUC__) \
+    && (defined(__SSE2__) || defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define USE_LANES
+typedef word32 vec4 __attribute__((vector_size(16)));
+#endif
+
+#if defined(USE_LANES) && (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__clang__) || __GNUC__ >= 5)
+#define USE_AVX2
+typedef word32 vec8 __attribute__((vector_size(32)));
+
+static int has_avx2 = -1;
+
+static int
+haveAvx2(void)
+{
+	/* racy, but every thread computes the same answer */
+	if (has_avx2 < 0) {
+		__builtin_cpu_init();
+		has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	}
+	return has_avx2;
+}
+#endif
+
+#if defined(USE_LANES)
+
+struct Lane {
+	byte const *data;	/* the message */
+	size_t full;		/* number of whole blocks in it */
+	size_t blocks;		/* number of blocks, with the padding */
+	byte tail[128];		/* the last one or two blocks, padded */
+};
+
+static const byte zeroBlock[64];
+
+static void
+laneInit(struct Lane *l, byte const *buf, int len)
+{
+	unsigned rest = (unsigned)len & 0x3f;
+	unsigned pad = rest < 56 ? 64 : 128;
+
+	l->data = buf;
+	l->full = (unsigned)len / 64;
+	l->blocks = l->full + pad / 64;
+	memset(l->tail, 0, sizeof(l->tail));
+	memcpy(l->tail, buf + len - rest, rest);
+	l->tail[rest] = 0x80;
+	/* Append length in bits */
+	store32(l->tail + pad - 8, (word32)len << 3);
+	store32(l->tail + pad - 4, (word32)len >> 29);
+}
+
+static void
+laneEmpty(struct Lane *l)
+{
+	l->full = 0;
+	l->blocks = 0;
+}
+
+static inline byte const *
+laneBlock(struct Lane const *l, size_t i)
+{
+	if (i < l->full)
+		return l->data + 64 * i;
+	if (i < l->blocks)
+		return l->tail + 64 * (i - l->full);
+	return zeroBlock;
+}
+
+/*
+ * Hash the messages of LANES lanes, writing the digest of each
+ * non-empty lane to digests[16*k ..].  A lane goes on hashing zeroes
+ * after its message is done, and the result is ignored.
+ */
+#define MD5_LANES(name, vec, LANES)					\
+static void								\
+name(struct Lane const *lanes, byte *digests)				\
+{									\
+	vec a = (vec){0} + 0x67452301;					\
+	vec b = (vec){0} + 0xefcdab89;					\
+	vec c = (vec){0} + 0x98badcfe;					\
+	vec d = (vec){0} + 0x10325476;					\
+	vec in[16];							\
+	size_t blocks = 0, i;						\
+	unsigned j, k;							\
+									\
+	for (k = 0; k < LANES; k++)					\
+		if (lanes[k].blocks > blocks)				\
+			blocks = lanes[k].blocks;			\
+									\
+	for (i = 0; i < blocks; i++) {					\
+		vec aa = a, bb = b, cc = c, dd = d;			\
+									\
+		for (k = 0; k < LANES; k++) {				\
+			byte const *p = laneBlock(&lanes[k], i);	\
+			for (j = 0; j < 16; j++)			\
+				in[j][k] = load32(p + 4 * j);		\
+		}							\
+									\
+		MD5ROUNDS(a, b, c, d, in);				\
+									\
+		a += aa;						\
+		b += bb;						\
+		c += cc;						\
+		d += dd;						\
+									\
+		for (k = 0; k < LANES; k++) {				\
+			if (lanes[k].blocks == i + 1) {			\
+				byte *p = digests + 16 * k;		\
+				store32(p, a[k]);			\
+				store32(p + 4, b[k]);			\
+				store32(p + 8, c[k]);			\
+				store32(p + 12, d[k]);			\
+			}						\
+		}							\
+	}								\
+}
+
+MD5_LANES(md5Lanes4, vec4, 4)
+
+#if defined(USE_AVX2)
+__attribute__((target("avx2")))
+MD5_LANES(md5Lanes8, vec8, 8)
+#endif
+
+#endif /* USE_LANES */
+
+/*
+ * Compute the digests of n messages, bufs[i] of lens[i] bytes, into
+ * digests[16*i .. 16*i+15].
+ */
+void
+__hsbase_MD5Many(int n, byte const *const bufs[], int const lens[],
+		 byte digests[])
+{
+	int i = 0;
+
+	while (i < n) {
+#if defined(USE_LANES)
+		struct Lane lanes[8];
+		int m = n - i, k;
+
+#if defined(USE_AVX2)
+		if (m > 4 && haveAvx2()) {
+			if (m > 8)
+				m = 8;
+			for (k = 0; k < 8; k++) {
+				if (k < m)
+					laneInit(&lanes[k], bufs[i+k], lens[i+k]);
+				else
+					laneEmpty(&lanes[k]);
+			}
+			md5Lanes8(lanes, digests + 16 * i);
+			i += m;
+			continue;
+		}
+#endif
+		if (m > 1) {
+			if (m > 4)
+				m = 4;
+			for (k = 0; k < 4; k++) {
+				if (k < m)
+					laneInit(&lanes[k], bufs[i+k], lens[i+k]);
+				else
+					laneEmpty(&lanes[k]);
+			}
+			md5Lanes4(lanes, digests + 16 * i);
+			i += m;
+			continue;
+		}
+#endif
+		{
+			struct MD5Context ctx;
+
+			__hsbase_MD5Init(&ctx);
+			__hsbase_MD5Update(&ctx, bufs[i], lens[i]);
+			__hsbase_MD5Final(digests + 16 * i, &ctx);
+			i++;
+		}
+	}
+}
@@ -0,0 +1,342 @@
+/*
+ * (c) The GHC Team, 2017
+ *
+ * Bulk kernels for the UTF-8, Latin-1 and ASCII codecs in
+ * GHC.IO.Encoding.
+ *
+ * The codecs convert one character at a time, which makes text Handle
+ * I/O far slower than copying bytes.  Most text is mainly ASCII, so the
+ * kernels here convert runs of ASCII 16 or 32 characters at a time,
+ * with SSE2 on x86 and AVX2 where the CPU has it, or a word at a time
+ * elsewhere.  The UTF-8 kernels also validate and convert multi-byte
+ * sequences in C, so that only the awkward cases (invalid or
+ * incomplete sequences, full buffers) are left to the Haskell loops.
+ */
+
+#include "HsTextCodec.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define USE_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(USE_AVX2)
+
+static int has_avx2 = -1;
+
+static bool
+haveAvx2 (void)
+{
+    // racy, but every thread computes the same answer
+    if (has_avx2 < 0) {
+        __builtin_cpu_init();
+        has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return has_avx2;
+}
+
+// Widen 32 bytes at a time, stopping at a block with a byte above 0x7f
+// if check is set.  Returns the number of bytes widened.
+__attribute__((target("avx2")))
+static size_t
+widenAvx2 (const uint8_t *src, uint32_t *dst, size_t n, bool check)
+{
+    size_t i;
+    for (i = 0; i + 32 <= n; i += 32) {
+        if (check) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+            if (_mm256_movemask_epi8(v) != 0) break;
+        }
+        for (int k = 0; k < 32; k += 8) {
+            __m128i b = _mm_loadl_epi64((const __m128i *)(src + i + k));
+            _mm256_storeu_si256((__m256i *)(dst + i + k),
+                                _mm256_cvtepu8_epi32(b));
+        }
+    }
+    return i;
+}
+
+// Narrow 32 characters at a time, stopping at a block with a character
+// above max if check is set.  Returns the number of characters narrowed.
+__attribute__((target("avx2")))
+static size_t
+narrowAvx2 (const uint32_t *src, uint8_t *dst, size_t n,
+            uint32_t max, bool check)
+{
+    const __m256i vmax  = _mm256_set1_epi32((int)max);
+    const __m256i mask  = _mm256_set1_epi32(0xff);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        const __m256i *p = (const __m256i *)(src + i);
+        __m256i a = _mm256_loadu_si256(p);
+        __m256i b = _mm256_loadu_si256(p + 1);
+        __m256i c = _mm256_loadu_si256(p + 2);
+        __m256i d = _mm256_loadu_si256(p + 3);
+        if (check) {
+            // code points fit in 21 bits, so a signed compare will do
+            __m256i over = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpgt_epi32(a, vmax),
+                                _mm256_cmpgt_epi32(b, vmax)),
+                _mm256_or_si256(_mm256_cmpgt_epi32(c, vmax),
+                                _mm256_cmpgt_epi32(d, vmax)));
+            if (!_mm256_testz_si256(over, over)) break;
+        }
+        // the packs work within 128-bit lanes, leaving the 4-byte groups
+        // in the order a0 b0 c0 d0 a1 b1 c1 d1, which we then permute
+        __m256i ab = _mm256_packs_epi32(_mm256_and_si256(a, mask),
+                                        _mm256_and_si256(b, mask));
+        __m256i cd = _mm256_packs_epi32(_mm256_and_si256(c, mask),
+                                        _mm256_and_si256(d, mask));
+        __m256i bytes = _mm256_permutevar8x32_epi32(
+                            _mm256_packus_epi16(ab, cd), order);
+        _mm256_storeu_si256((__m256i *)(dst + i), bytes);
+    }
+    return i;
+}
+
+#endif /* USE_AVX2 */
+
+// Widen the bytes src[0 .. n) to characters, stopping at the first byte
+// above 0x7f if check is set.  Returns the number of bytes widened.
+static size_t
+widen (const uint8_t *src, uint32_t *dst, size_t n, bool check)
+{
+    size_t i = 0;
+
+#if defined(USE_AVX2)
+    if (n >= 32 && haveAvx2()) {
+        i = widenAvx2(src, dst, n, check);
+    }
+#endif
+
+#if defined(__SSE2__)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            if (check && _mm_movemask_epi8(v) != 0) break;
+            __m128i lo = _mm_unpacklo_epi8(v, zero);
+            __m128i hi = _mm_unpackhi_epi8(v, zero);
+            __m128i *q = (__m128i *)(dst + i);
+            _mm_storeu_si128(q,     _mm_unpacklo_epi16(lo, zero));
+            _mm_storeu_si128(q + 1, _mm_unpackhi_epi16(lo, zero));
+            _mm_storeu_si128(q + 2, _mm_unpacklo_epi16(hi, zero));
+            _mm_storeu_si128(q + 3, _mm_unpackhi_epi16(hi, zero));
+        }
+    }
+#else
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, src + i, 8);
+        if (check && (w & UINT64_C(0x8080808080808080)) != 0) break;
+        for (int k = 0; k < 8; k++) dst[i + k] = src[i + k];
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (check && src[i] > 0x7f) break;
+        dst[i] = src[i];
+    }
+    return i;
+}
+
+// Narrow the characters src[0 .. n) to bytes, stopping at the first
+// character above max.  Returns the number of characters narrowed.
+static size_t
+narrow (const uint32_t *src, uint8_t *dst, size_t n, uint32_t max)
+{
+    bool check = max < 0x10ffff;
+    size_t i = 0;
+
+#if defined(USE_AVX2)
+    if (n >= 32 && haveAvx2()) {
+        i = narrowAvx2(src, dst, n, max, check);
+    }
+#endif
+
+#if defined(__SSE2__)
+    {
+        const __m128i vmax = _mm_set1_epi32((int)max);
+        const __m128i mask = _mm_set1_epi32(0xff);
+        for (; i + 16 <= n; i += 16) {
+            const __m128i *p = (const __m128i *)(src + i);
+            __m128i a = _mm_loadu_si128(p);
+            __m128i b = _mm_loadu_si128(p + 1);
+            __m128i c = _mm_loadu_si128(p + 2);
+            __m128i d = _mm_loadu_si128(p + 3);
+            if (check) {
+                __m128i over = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpgt_epi32(a, vmax),
+                                 _mm_cmpgt_epi32(b, vmax)),
+                    _mm_or_si128(_mm_cmpgt_epi32(c, vmax),
+                                 _mm_cmpgt_epi32(d, vmax)));
+                if (_mm_movemask_epi8(over) != 0) break;
+            }
+            __m128i ab = _mm_packs_epi32(_mm_and_si128(a, mask),
+                                         _mm_and_si128(b, mask));
+            __m128i cd = _mm_packs_epi32(_mm_and_si128(c, mask),
+                                         _mm_and_si128(d, mask));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(ab, cd));
+        }
+    }
+#else
+    for (; i + 4 <= n; i += 4) {
+        if (check && (src[i] > max || src[i+1] > max ||
+                      src[i+2] > max || src[i+3] > max)) {
+            break;
+        }
+        dst[i]   = (uint8_t)src[i];
+        dst[i+1] = (uint8_t)src[i+1];
+        dst[i+2] = (uint8_t)src[i+2];
+        dst[i+3] = (uint8_t)src[i+3];
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (check && src[i] > max) break;
+        dst[i] = (uint8_t)src[i];
+    }
+    return i;
+}
+
+void
+hs_latin1_decode (const uint8_t *src, uint32_t *dst, size_t n)
+{
+    widen(src, dst, n, false);
+}
+
+size_t
+hs_ascii_decode (const uint8_t *src, uint32_t *dst, size_t n)
+{
+    return widen(src, dst, n, true);
+}
+
+size_t
+hs_latin1_encode (const uint32_t *src, uint8_t *dst, size_t n, uint32_t max)
+{
+    return narrow(src, dst, n, max);
+}
+
+static inline bool
+isCont (uint8_t c)
+{
+    return (c & 0xc0) == 0x80;
+}
+
+static inline size_t
+minSize (size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
+
+// The same checks as validate3 and validate4 in GHC.IO.Encoding.UTF8:
+// no overlong forms, surrogates or code points above 0x10ffff.
+static inline bool
+valid3 (uint8_t c0, uint8_t c1, uint8_t c2)
+{
+    if (!isCont(c2)) return false;
+    if (c0 == 0xe0) return c1 >= 0xa0 && c1 <= 0xbf;
+    if (c0 == 0xed) return c1 >= 0x80 && c1 <= 0x9f;
+    return isCont(c1);
+}
+
+static inline bool
+valid4 (uint8_t c0, uint8_t c1, uint8_t c2, uint8_t c3)
+{
+    if (!isCont(c2) || !isCont(c3)) return false;
+    if (c0 == 0xf0) return c1 >= 0x90 && c1 <= 0xbf;
+    if (c0 == 0xf4) return c1 >= 0x80 && c1 <= 0x8f;
+    return c0 <= 0xf3 && isCont(c1);
+}
+
+size_t
+hs_utf8_decode (const uint8_t *src, size_t *src_len,
+                uint32_t *dst, size_t dst_len)
+{
+    size_t n = *src_len, i = 0, j = 0;
+
+    while (i < n && j < dst_len) {
+        uint8_t c0 = src[i];
+
+        if (c0 <= 0x7f) {
+            size_t k = widen(src + i, dst + j,
+                             minSize(n - i, dst_len - j), true);
+            i += k;
+            j += k;
+        } else if (c0 >= 0xc2 && c0 <= 0xdf) {
+            if (n - i < 2 || !isCont(src[i+1])) break;
+            dst[j++] = ((uint32_t)(c0 & 0x1f) << 6) | (src[i+1] & 0x3f);
+            i += 2;
+        } else if (c0 >= 0xe0 && c0 <= 0xef) {
+            if (n - i < 3 || !valid3(c0, src[i+1], src[i+2])) break;
+            dst[j++] = ((uint32_t)(c0 & 0x0f) << 12)
+                     | ((uint32_t)(src[i+1] & 0x3f) << 6)
+                     | (src[i+2] & 0x3f);
+            i += 3;
+        } else if (c0 >= 0xf0 && c0 <= 0xf4) {
+            if (n - i < 4 || !valid4(c0, src[i+1], src[i+2], src[i+3])) break;
+            dst[j++] = ((uint32_t)(c0 & 0x07) << 18)
+                     | ((uint32_t)(src[i+1] & 0x3f) << 12)
+                     | ((uint32_t)(src[i+2] & 0x3f) << 6)
+                     | (src[i+3] & 0x3f);
+            i += 4;
+        } else {
+            break;
+        }
+    }
+
+    *src_len = i;
+    return j;
+}
+
+size_t
+hs_utf8_encode (const uint32_t *src, size_t *src_len,
+                uint8_t *dst, size_t dst_len)
+{
+    size_t n = *src_len, i = 0, j = 0;
+
+    while (i < n && j < dst_len) {
+        uint32_t c = src[i];
+
+        if (c <= 0x7f) {
+            size_t k = narrow(src + i, dst + j,
+                              minSize(n - i, dst_len - j), 0x7f);
+            i += k;
+            j += k;
+        } else if (c <= 0x7ff) {
+            if (dst_len - j < 2) break;
+            dst[j]   = (uint8_t)(0xc0 | (c >> 6));
+            dst[j+1] = (uint8_t)(0x80 | (c & 0x3f));
+            i += 1;
+            j += 2;
+        } else if (c <= 0xffff) {
+            if ((c >= 0xd800 && c <= 0xdfff) || dst_len - j < 3) break;
+            dst[j]   = (uint8_t)(0xe0 | (c >> 12));
+            dst[j+1] = (uint8_t)(0x80 | ((c >> 6) & 0x3f));
+            dst[j+2] = (uint8_t)(0x80 | (c & 0x3f));
+            i += 1;
+            j += 3;
+        } else {
+            if (dst_len - j < 4) break;
+            dst[j]   = (uint8_t)(0xf0 | (c >> 18));
+            dst[j+1] = (uint8_t)(0x80 | ((c >> 12) & 0x3f));
+            dst[j+2] = (uint8_t)(0x80 | ((c >> 6) & 0x3f));
+            dst[j+3] = (uint8_t)(0x80 | (c & 0x3f));
+            i += 1;
+            j += 4;
+        }
+    }
+
+    *src_len = i;
+    return j;
+}
@@ -153,7 +153,7 @@ extern HsWord64 getMonotonicUSec(void);
 #endif
 
 /* in inputReady.c */
-extern int fdReady(int fd, int write, int msecs, int isSock);
+extern int fdReady(int fd, int write, int64_t nsecs, int isSock);
 
 /* -----------------------------------------------------------------------------
    INLINE functions.
@@ -0,0 +1,34 @@
+/*
+ * (c) The GHC Team, 2017
+ *
+ * io_uring support for the GHC.Event.IOUring backend
+ */
+
+#ifndef __HS_IO_URING_H__
+#define __HS_IO_URING_H__
+
+#include "EventConfig.h"
+
+#if defined(HAVE_IO_URING)
+
+#include <stdint.h>
+
+/* An fd and the poll(2) events that are ready on it */
+typedef struct {
+    int      fd;
+    uint32_t events;
+} HsUringEvent;
+
+typedef struct HsUring_ HsUring;
+
+int      hs_uring_supported (void);
+HsUring *hs_uring_new       (unsigned int entries);
+void     hs_uring_free      (HsUring *ring);
+int      hs_uring_modify    (HsUring *ring, int fd, uint32_t events,
+                             int oneshot);
+int      hs_uring_wait      (HsUring *ring, int timeout_ms,
+                             HsUringEvent *evs, int max);
+
+#endif /* HAVE_IO_URING */
+
+#endif /* __HS_IO_URING_H__ */
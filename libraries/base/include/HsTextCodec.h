@@ -0,0 +1,51 @@
+/*
+ * (c) The GHC Team, 2017
+ *
+ * Bulk kernels for the built-in codecs in GHC.IO.Encoding
+ */
+
+#ifndef __HS_TEXT_CODEC_H__
+#define __HS_TEXT_CODEC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Characters are UTF-32 code points, as in the CharBuffers of the IO
+ * library (CHARBUF_UTF32 in GHC.IO.Buffer).
+ *
+ * Each kernel converts the longest prefix of its input that it can,
+ * stopping at the first unit it cannot handle; the codec loop in
+ * Haskell then deals with that unit, reporting an invalid sequence or
+ * underflow as usual.
+ */
+
+/* Widen n bytes to characters. */
+void   hs_latin1_decode (const uint8_t *src, uint32_t *dst, size_t n);
+
+/* Widen up to n bytes, stopping at the first byte above 0x7f.  Returns
+ * the number of bytes converted. */
+size_t hs_ascii_decode  (const uint8_t *src, uint32_t *dst, size_t n);
+
+/* Narrow up to n characters to bytes, stopping at the first character
+ * above max; with max >= 0x10ffff nothing is checked, and characters
+ * are truncated to 8 bits.  Returns the number of characters
+ * converted. */
+size_t hs_latin1_encode (const uint32_t *src, uint8_t *dst, size_t n,
+                         uint32_t max);
+
+/* Decode the complete and valid UTF-8 sequences at the start of
+ * src[0 .. *src_len) into at most dst_len characters.  Sets *src_len to
+ * the number of bytes consumed, and returns the number of characters
+ * written. */
+size_t hs_utf8_decode   (const uint8_t *src, size_t *src_len,
+                         uint32_t *dst, size_t dst_len);
+
+/* Encode src[0 .. *src_len) as UTF-8 into at most dst_len bytes,
+ * stopping at a surrogate or a character that does not fit.  Sets
+ * *src_len to the number of characters consumed, and returns the number
+ * of bytes written. */
+size_t hs_utf8_encode   (const uint32_t *src, size_t *src_len,
+                         uint8_t *dst, size_t dst_len);
+
+#endif /* __HS_TEXT_CODEC_H__ */
@@ -0,0 +1,29 @@
+-- Text-mode Handle I/O of log lines, which are mostly ASCII, in UTF-8 and
+-- Latin-1: write about 6MB, check its size on disk, and check that it
+-- reads back unchanged.
+
+import Control.Monad
+import System.IO
+
+logLine :: Int -> String
+logLine i
+  | i `mod` 10 == 0 = "naïve café " ++ entry
+  | otherwise       = entry
+  where
+    entry = "GET /index.html?request=" ++ show i ++
+            " HTTP/1.1 200 OK 1234 bytes in 0.5ms"
+
+main :: IO ()
+main = do
+  let block = unlines (map logLine [1..100 :: Int])
+      reps  = 1000
+  forM_ [("UTF-8", utf8), ("ISO-8859-1", latin1)] $ \(name, enc) -> do
+    withFile "HandleThroughput.data" WriteMode $ \h -> do
+      hSetEncoding h enc
+      replicateM_ reps (hPutStr h block)
+    size <- withBinaryFile "HandleThroughput.data" ReadMode hFileSize
+    ok <- withFile "HandleThroughput.data" ReadMode $ \h -> do
+      hSetEncoding h enc
+      s <- hGetContents h
+      return $! s == concat (replicate reps block)
+    print (name, size, ok)
@@ -0,0 +1,7 @@
+-- hWaitForInput with a timeout returns False once the timeout has
+-- passed, when nothing arrives on the pipe
+import System.IO
+
+main = do
+  hWaitForInput stdin 100 >>= print
+  hWaitForInput stdin 0 >>= print
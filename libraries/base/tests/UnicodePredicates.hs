@@ -0,0 +1,41 @@
+{-# LANGUAGE BangPatterns #-}
+-- The Unicode predicates, case conversions and general categories of
+-- every code point, summarised as counts and weighted sums that were
+-- checked against the block tables WCsubst.c used before the two-stage
+-- tables; then the predicates over mixed-script text.
+
+import Data.Char
+import Data.List (foldl')
+
+preds :: [Char -> Bool]
+preds = [isAlpha, isAlphaNum, isControl, isPrint, isUpper, isLower, isSpace]
+
+-- Weight each code point, so that results swapped between neighbouring
+-- characters change the sum
+weighted :: (Char -> Int) -> Integer
+weighted f = foldl' (\ !s c -> s + toInteger (f c * (ord c `mod` 7 + 1)))
+                    0 [minBound .. maxBound]
+
+text :: String
+text = "The quick brown fox, 42 times — Η γρήγορη καφέ αλεπού; " ++
+       "Быстрая бурая лиса! 敏捷的棕色狐狸。\n"
+
+data Counts = Counts !Int !Int !Int !Int
+
+count :: Counts -> Char -> Counts
+count (Counts a u p s) c =
+  Counts (if isAlpha c then a + 1 else a)
+         (if isUpper (toUpper c) then u + 1 else u)
+         (if generalCategory c == OtherPunctuation then p + 1 else p)
+         (if isSpace c then s + 1 else s)
+
+main :: IO ()
+main = do
+  print [length (filter p [minBound .. maxBound]) | p <- preds]
+  print [ weighted (\c -> ord (toUpper c) - ord c)
+        , weighted (\c -> ord (toLower c) - ord c)
+        , weighted (\c -> ord (toTitle c) - ord c)
+        , weighted (fromEnum . generalCategory) ]
+  let Counts a u p s = foldl' count (Counts 0 0 0 0)
+                              (concat (replicate 1000 text))
+  print (a, u, p, s)
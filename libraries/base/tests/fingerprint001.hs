@@ -0,0 +1,19 @@
+-- GHC.Fingerprint: MD5 test vectors, and fingerprintDataMany agrees
+-- with fingerprintData
+import Foreign
+import GHC.Fingerprint
+
+main :: IO ()
+main = do
+  mapM_ (\s -> withArrayLen (map (fromIntegral . fromEnum) s) $ \n p ->
+                 fingerprintData p n >>= print)
+    ["", "abc", "message digest", replicate 80 '7']
+  let lens = [0 .. 200] ++ [1000, 4096, 55, 56, 63, 64, 65]
+  -- Room for the largest length at the largest offset
+  withArray [ fromIntegral i :: Word8 | i <- [0 .. 4096 + 6 :: Int] ] $ \p -> do
+    let bufs = [ (p `plusPtr` (n `mod` 7), n) | n <- lens ]
+    one  <- mapM (uncurry fingerprintData) bufs
+    many <- fingerprintDataMany bufs
+    print (one == many)
+    many' <- mapM (fingerprintDataMany . flip take bufs) [0 .. 9]
+    print (many' == map (flip take one) [0 .. 9])
@@ -1,27 +1,43 @@
 #include "Rts.h"
 
+// Fall-back implementations for the byte-swap primops.  BSWAP is part
+// of every x86 CPU we support, and GCC and Clang emit it (or REV on ARM)
+// for __builtin_bswap*(), so there is nothing to choose at run time.
+
 extern StgWord16 hs_bswap16(StgWord16 x);
 StgWord16
 hs_bswap16(StgWord16 x)
 {
+#if defined(__GNUC__)
+  return __builtin_bswap16(x);
+#else
   return ((x >> 8) | (x << 8));
+#endif
 }
 
 extern StgWord32 hs_bswap32(StgWord32 x);
 StgWord32
 hs_bswap32(StgWord32 x)
 {
+#if defined(__GNUC__)
+  return __builtin_bswap32(x);
+#else
   return ((x >> 24) | ((x >> 8) & 0xff00) |
           (x << 24) | ((x & 0xff00) << 8));
+#endif
 }
 
 extern StgWord64 hs_bswap64(StgWord64 x);
 StgWord64
 hs_bswap64(StgWord64 x)
 {
+#if defined(__GNUC__)
+  return __builtin_bswap64(x);
+#else
   return ( (x >> 56)                | (x << 56)
          | ((x >> 40) & 0xff00)     | ((x & 0xff00) << 40)
          | ((x >> 24) & 0xff0000)   | ((x & 0xff0000) << 24)
          | ((x >> 8)  & 0xff000000) | ((x & 0xff000000) << 8)
          );
+#endif
 }
@@ -1,27 +1,72 @@
 #include "MachDeps.h"
 #include "Rts.h"
+#include "cpu.h"
 #include <stdint.h>
 
 // Fall-back implementations for count-leading-zeros primop
 //
 // __builtin_clz*() is supported by GCC and Clang
+//
+// On x86 we use LZCNT if the CPU has it (see cpu.h), which is defined
+// for 0, so that there is no test and branch.
+
+#if defined(CPU_DISPATCH)
+#include <immintrin.h>
+
+static int have_lzcnt;
+
+static void initClz(void) __attribute__((constructor));
+static void
+initClz(void)
+{
+  have_lzcnt = (cpuFeatures() & CPU_LZCNT) != 0;
+}
+
+__attribute__((target("lzcnt")))
+static StgWord
+clz32Insn(uint32_t x)
+{
+  return _lzcnt_u32(x);
+}
+
+__attribute__((target("lzcnt")))
+static StgWord
+clz64Insn(StgWord64 x)
+{
+#if defined(x86_64_HOST_ARCH)
+  return _lzcnt_u64(x);
+#else
+  return (uint32_t)(x >> 32) ? _lzcnt_u32(x >> 32)
+                             : _lzcnt_u32((uint32_t)x) + 32;
+#endif
+}
+#endif
 
 #if SIZEOF_UNSIGNED_INT == 4
 StgWord
 hs_clz8(StgWord x)
 {
+#if defined(CPU_DISPATCH)
+  if (have_lzcnt) return clz32Insn((uint8_t)x) - 24;
+#endif
   return (uint8_t)x ? __builtin_clz((uint8_t)x)-24 : 8;
 }
 
 StgWord
 hs_clz16(StgWord x)
 {
+#if defined(CPU_DISPATCH)
+  if (have_lzcnt) return clz32Insn((uint16_t)x) - 16;
+#endif
   return (uint16_t)x ? __builtin_clz((uint16_t)x)-16 : 16;
 }
 
 StgWord
 hs_clz32(StgWord x)
 {
+#if defined(CPU_DISPATCH)
+  if (have_lzcnt) return clz32Insn((uint32_t)x);
+#endif
   return (uint32_t)x ? __builtin_clz((uint32_t)x) : 32;
 }
 #else
@@ -31,6 +76,9 @@ hs_clz32(StgWord x)
 StgWord
 hs_clz64(StgWord64 x)
 {
+#if defined(CPU_DISPATCH)
+  if (have_lzcnt) return clz64Insn(x);
+#endif
 #if SIZEOF_UNSIGNED_LONG == 8
   return x ? __builtin_clzl(x) : 64;
 #elif SIZEOF_UNSIGNED_LONG_LONG == 8
@@ -0,0 +1,73 @@
+/* ----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * Detecting the instructions the bit primitives can use
+ *
+ * Unless a module is compiled with -msse4.2 or -mbmi2, the code generator
+ * implements popCnt#, clz#, ctz# and friends by calling the hs_* functions
+ * in this directory.  On x86 each of them checks once, when the library
+ * is loaded, whether the CPU has the POPCNT, LZCNT, TZCNT (BMI1) or
+ * PDEP/PEXT (BMI2) instruction, and uses it if so; otherwise it falls
+ * back to portable C.
+ *
+ * We don't use GNU ifuncs for this, as the RTS linker cannot load objects
+ * that contain them.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef GHC_PRIM_CPU_H
+#define GHC_PRIM_CPU_H
+
+#if (defined(x86_64_HOST_ARCH) || defined(i386_HOST_ARCH)) \
+    && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+
+#define CPU_DISPATCH 1
+
+#include <cpuid.h>
+
+#define CPU_POPCNT      (1 << 0)
+#define CPU_LZCNT       (1 << 1)
+#define CPU_BMI1        (1 << 2)
+#define CPU_BMI2        (1 << 3)
+/* PDEP and PEXT are fast (as opposed to microcoded, and taking hundreds of
+ * cycles on some masks, as on AMD CPUs before Zen 3) */
+#define CPU_FAST_PDEP   (1 << 4)
+
+static int
+cpuFeatures (void)
+{
+    unsigned int max, eax, ebx, ecx, edx, vendor;
+    unsigned int family;
+    int features = 0;
+
+    max = __get_cpuid_max(0, &vendor);
+    if (max < 1) return 0;
+
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (ecx & (1 << 23)) features |= CPU_POPCNT;
+    family = (eax >> 8) & 0xf;
+    if (family == 0xf) family += (eax >> 20) & 0xff;
+
+    if (max >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if (ebx & (1 << 3)) features |= CPU_BMI1;
+        if (ebx & (1 << 8)) {
+            features |= CPU_BMI2;
+            if (vendor != signature_AMD_ebx || family >= 0x19) {
+                features |= CPU_FAST_PDEP;
+            }
+        }
+    }
+
+    if (__get_cpuid_max(0x80000000, NULL) >= 0x80000001) {
+        __cpuid(0x80000001, eax, ebx, ecx, edx);
+        if (ecx & (1 << 5)) features |= CPU_LZCNT;  /* ABM */
+    }
+
+    return features;
+}
+
+#endif
+
+#endif /* GHC_PRIM_CPU_H */
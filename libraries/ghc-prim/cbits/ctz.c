@@ -1,27 +1,72 @@
 #include "MachDeps.h"
 #include "Rts.h"
+#include "cpu.h"
 #include <stdint.h>
 
 // Fall-back implementations for count-trailing-zeros primop
 //
 // __builtin_ctz*() is supported by GCC and Clang
+//
+// On x86 we use TZCNT if the CPU has it (see cpu.h), which is defined
+// for 0, so that there is no test and branch.
+
+#if defined(CPU_DISPATCH)
+#include <immintrin.h>
+
+static int have_tzcnt;
+
+static void initCtz(void) __attribute__((constructor));
+static void
+initCtz(void)
+{
+  have_tzcnt = (cpuFeatures() & CPU_BMI1) != 0;
+}
+
+__attribute__((target("bmi")))
+static StgWord
+ctz32Insn(uint32_t x)
+{
+  return _tzcnt_u32(x);
+}
+
+__attribute__((target("bmi")))
+static StgWord
+ctz64Insn(StgWord64 x)
+{
+#if defined(x86_64_HOST_ARCH)
+  return _tzcnt_u64(x);
+#else
+  return (uint32_t)x ? _tzcnt_u32((uint32_t)x)
+                     : _tzcnt_u32(x >> 32) + 32;
+#endif
+}
+#endif
 
 #if SIZEOF_UNSIGNED_INT == 4
 StgWord
 hs_ctz8(StgWord x)
 {
+#if defined(CPU_DISPATCH)
+  if (have_tzcnt) return ctz32Insn((uint8_t)x | 0x100);
+#endif
   return (uint8_t)x ? __builtin_ctz(x) : 8;
 }
 
 StgWord
 hs_ctz16(StgWord x)
 {
+#if defined(CPU_DISPATCH)
+  if (have_tzcnt) return ctz32Insn((uint16_t)x | 0x10000);
+#endif
   return (uint16_t)x ? __builtin_ctz(x) : 16;
 }
 
 StgWord
 hs_ctz32(StgWord x)
 {
+#if defined(CPU_DISPATCH)
+  if (have_tzcnt) return ctz32Insn((uint32_t)x);
+#endif
   return (uint32_t)x ? __builtin_ctz(x) : 32;
 }
 #else
@@ -31,6 +76,9 @@ hs_ctz32(StgWord x)
 StgWord
 hs_ctz64(StgWord64 x)
 {
+#if defined(CPU_DISPATCH)
+  if (have_tzcnt) return ctz64Insn(x);
+#endif
 #if defined(__GNUC__) && (defined(i386_HOST_ARCH) || defined(powerpc_HOST_ARCH))
   /* On Linux/i386, the 64bit `__builtin_ctzll()` instrinsic doesn't
      get inlined by GCC but rather a short `__ctzdi2` runtime function
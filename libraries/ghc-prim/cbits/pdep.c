@@ -0,0 +1,87 @@
+#include "Rts.h"
+#include "MachDeps.h"
+#include "cpu.h"
+
+// Parallel bit deposit: the low bits of src, in order, go to the
+// positions of the set bits of mask, and the other bits of the result
+// are 0.
+//
+// There are no primops for this yet, so libraries call these functions
+// through the FFI.
+// On x86-64 we use the BMI2 instruction if the CPU has a fast one (see
+// cpu.h); otherwise we loop over the set bits of the mask.
+
+static StgWord64
+pdepSoft(StgWord64 src, StgWord64 mask)
+{
+  StgWord64 result = 0;
+  StgWord64 bit;
+
+  for (bit = 1; mask != 0; bit <<= 1) {
+    if (src & bit) {
+      result |= mask & -mask;
+    }
+    mask &= mask - 1;
+  }
+  return result;
+}
+
+#if defined(CPU_DISPATCH) && defined(x86_64_HOST_ARCH)
+#include <immintrin.h>
+
+static int have_pdep;
+
+static void initPdep(void) __attribute__((constructor));
+static void
+initPdep(void)
+{
+  have_pdep = (cpuFeatures() & CPU_FAST_PDEP) != 0;
+}
+
+__attribute__((target("bmi2")))
+static StgWord64
+pdepInsn(StgWord64 src, StgWord64 mask)
+{
+  return _pdep_u64(src, mask);
+}
+
+#define PDEP(src, mask) \
+  (have_pdep ? pdepInsn(src, mask) : pdepSoft(src, mask))
+#else
+#define PDEP(src, mask) pdepSoft(src, mask)
+#endif
+
+extern StgWord64 hs_pdep64(StgWord64 src, StgWord64 mask);
+StgWord64
+hs_pdep64(StgWord64 src, StgWord64 mask)
+{
+  return PDEP(src, mask);
+}
+
+extern StgWord hs_pdep32(StgWord src, StgWord mask);
+StgWord
+hs_pdep32(StgWord src, StgWord mask)
+{
+  return PDEP(src, (StgWord32)mask);
+}
+
+extern StgWord hs_pdep16(StgWord src, StgWord mask);
+StgWord
+hs_pdep16(StgWord src, StgWord mask)
+{
+  return PDEP(src, (StgWord16)mask);
+}
+
+extern StgWord hs_pdep8(StgWord src, StgWord mask);
+StgWord
+hs_pdep8(StgWord src, StgWord mask)
+{
+  return PDEP(src, (StgWord8)mask);
+}
+
+extern StgWord hs_pdep(StgWord src, StgWord mask);
+StgWord
+hs_pdep(StgWord src, StgWord mask)
+{
+  return PDEP(src, mask);
+}
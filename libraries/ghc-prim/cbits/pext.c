@@ -0,0 +1,87 @@
+#include "Rts.h"
+#include "MachDeps.h"
+#include "cpu.h"
+
+// Parallel bit extract: the bits of src at the positions of the set
+// bits of mask go, in order, to the low bits of the result, and the
+// other bits of the result are 0.
+//
+// There are no primops for this yet, so libraries call these functions
+// through the FFI.
+// On x86-64 we use the BMI2 instruction if the CPU has a fast one (see
+// cpu.h); otherwise we loop over the set bits of the mask.
+
+static StgWord64
+pextSoft(StgWord64 src, StgWord64 mask)
+{
+  StgWord64 result = 0;
+  StgWord64 bit;
+
+  for (bit = 1; mask != 0; bit <<= 1) {
+    if (src & mask & -mask) {
+      result |= bit;
+    }
+    mask &= mask - 1;
+  }
+  return result;
+}
+
+#if defined(CPU_DISPATCH) && defined(x86_64_HOST_ARCH)
+#include <immintrin.h>
+
+static int have_pext;
+
+static void initPext(void) __attribute__((constructor));
+static void
+initPext(void)
+{
+  have_pext = (cpuFeatures() & CPU_FAST_PDEP) != 0;
+}
+
+__attribute__((target("bmi2")))
+static StgWord64
+pextInsn(StgWord64 src, StgWord64 mask)
+{
+  return _pext_u64(src, mask);
+}
+
+#define PEXT(src, mask) \
+  (have_pext ? pextInsn(src, mask) : pextSoft(src, mask))
+#else
+#define PEXT(src, mask) pextSoft(src, mask)
+#endif
+
+extern StgWord64 hs_pext64(StgWord64 src, StgWord64 mask);
+StgWord64
+hs_pext64(StgWord64 src, StgWord64 mask)
+{
+  return PEXT(src, mask);
+}
+
+extern StgWord hs_pext32(StgWord src, StgWord mask);
+StgWord
+hs_pext32(StgWord src, StgWord mask)
+{
+  return PEXT(src, (StgWord32)mask);
+}
+
+extern StgWord hs_pext16(StgWord src, StgWord mask);
+StgWord
+hs_pext16(StgWord src, StgWord mask)
+{
+  return PEXT(src, (StgWord16)mask);
+}
+
+extern StgWord hs_pext8(StgWord src, StgWord mask);
+StgWord
+hs_pext8(StgWord src, StgWord mask)
+{
+  return PEXT(src, (StgWord8)mask);
+}
+
+extern StgWord hs_pext(StgWord src, StgWord mask);
+StgWord
+hs_pext(StgWord src, StgWord mask)
+{
+  return PEXT(src, mask);
+}
@@ -1,55 +1,91 @@
 #include "Rts.h"
 #include "MachDeps.h"
+#include "cpu.h"
 
-static const unsigned char popcount_tab[] =
+// Fall-back implementations for the population count primops, used
+// unless the code generator can emit the POPCNT instruction itself
+// (with -msse4.2).  On x86 we use POPCNT anyway if the CPU has it, see
+// cpu.h; otherwise we add up the bits in ever wider fields.
+
+static StgWord
+popcnt32Soft(StgWord32 x)
+{
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0f0f0f0f;
+  return (x * 0x01010101) >> 24;
+}
+
+static StgWord
+popcnt64Soft(StgWord64 x)
+{
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (x * 0x0101010101010101ULL) >> 56;
+}
+
+#if defined(CPU_DISPATCH)
+
+static int have_popcnt;
+
+static void initPopcnt(void) __attribute__((constructor));
+static void
+initPopcnt(void)
+{
+  have_popcnt = (cpuFeatures() & CPU_POPCNT) != 0;
+}
+
+__attribute__((target("popcnt")))
+static StgWord
+popcnt32Insn(StgWord32 x)
+{
+  return __builtin_popcount(x);
+}
+
+__attribute__((target("popcnt")))
+static StgWord
+popcnt64Insn(StgWord64 x)
 {
-    0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,
-    1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
-    1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
-    2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
-    1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
-    2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
-    2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
-    3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,4,5,5,6,5,6,6,7,5,6,6,7,6,7,7,8,
-};
+  return __builtin_popcountll(x);
+}
+
+#define POPCNT32(x) (have_popcnt ? popcnt32Insn(x) : popcnt32Soft(x))
+#define POPCNT64(x) (have_popcnt ? popcnt64Insn(x) : popcnt64Soft(x))
+
+#else
+
+#define POPCNT32(x) popcnt32Soft(x)
+#define POPCNT64(x) popcnt64Soft(x)
+
+#endif
 
 extern StgWord hs_popcnt8(StgWord x);
 StgWord
 hs_popcnt8(StgWord x)
 {
-  return popcount_tab[(unsigned char)x];
+  return POPCNT32((StgWord8)x);
 }
 
 extern StgWord hs_popcnt16(StgWord x);
 StgWord
 hs_popcnt16(StgWord x)
 {
-  return popcount_tab[(unsigned char)x] +
-      popcount_tab[(unsigned char)(x >> 8)];
+  return POPCNT32((StgWord16)x);
 }
 
 extern StgWord hs_popcnt32(StgWord x);
 StgWord
 hs_popcnt32(StgWord x)
 {
-  return popcount_tab[(unsigned char)x] +
-      popcount_tab[(unsigned char)(x >> 8)] +
-      popcount_tab[(unsigned char)(x >> 16)] +
-      popcount_tab[(unsigned char)(x >> 24)];
+  return POPCNT32((StgWord32)x);
 }
 
 extern StgWord hs_popcnt64(StgWord64 x);
 StgWord
 hs_popcnt64(StgWord64 x)
 {
-  return popcount_tab[(unsigned char)x] +
-      popcount_tab[(unsigned char)(x >> 8)] +
-      popcount_tab[(unsigned char)(x >> 16)] +
-      popcount_tab[(unsigned char)(x >> 24)] +
-      popcount_tab[(unsigned char)(x >> 32)] +
-      popcount_tab[(unsigned char)(x >> 40)] +
-      popcount_tab[(unsigned char)(x >> 48)] +
-      popcount_tab[(unsigned char)(x >> 56)];
+  return POPCNT64(x);
 }
 
 #if WORD_SIZE_IN_BITS == 32
@@ -58,10 +94,7 @@ extern StgWord hs_popcnt(StgWord x);
 StgWord
 hs_popcnt(StgWord x)
 {
-  return popcount_tab[(unsigned char)x] +
-      popcount_tab[(unsigned char)(x >> 8)] +
-      popcount_tab[(unsigned char)(x >> 16)] +
-      popcount_tab[(unsigned char)(x >> 24)];
+  return POPCNT32(x);
 }
 
 #elif WORD_SIZE_IN_BITS == 64
@@ -70,14 +103,7 @@ extern StgWord hs_popcnt(StgWord x);
 StgWord
 hs_popcnt(StgWord x)
 {
-  return popcount_tab[(unsigned char)x] +
-      popcount_tab[(unsigned char)(x >> 8)] +
-      popcount_tab[(unsigned char)(x >> 16)] +
-      popcount_tab[(unsigned char)(x >> 24)] +
-      popcount_tab[(unsigned char)(x >> 32)] +
-      popcount_tab[(unsigned char)(x >> 40)] +
-      popcount_tab[(unsigned char)(x >> 48)] +
-      popcount_tab[(unsigned char)(x >> 56)];
+  return POPCNT64(x);
 }
 
 #else
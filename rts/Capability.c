@@ -20,6 +20,8 @@
 #include "Rts.h"
 
 #include "Capability.h"
+#include "CpuTopology.h"
+#include "SchedStats.h"
 #include "Schedule.h"
 #include "Sparks.h"
 #include "Trace.h"
@@ -97,7 +99,7 @@ findSpark (Capability *cap)
   Capability *robbed;
   StgClosurePtr spark;
   bool retry;
-  uint32_t i = 0;
+  uint32_t i = 0, pass;
 
   if (!emptyRunQueue(cap) || cap->n_returning_tasks != 0) {
       // If there are other threads, don't try to run any new
@@ -139,35 +141,42 @@ findSpark (Capability *cap)
                  "cap %d: Trying to steal work from other capabilities",
                  cap->no);
 
-      /* visit cap.s 0..n-1 in sequence until a theft succeeds. We could
-      start at a random place instead of 0 as well.  */
-      for ( i=0 ; i < n_capabilities ; i++ ) {
-          robbed = capabilities[i];
-          if (cap == robbed)  // ourselves...
-              continue;
+      /* visit cap.s 0..n-1 in sequence until a theft succeeds, first
+      the ones sharing our last-level cache and then the rest. We could
+      start at a random place instead of 0 as well.  With a single cache
+      group the first pass visits them all.  */
+      for ( pass = 0 ; pass < (n_cache_groups > 1 ? 2 : 1) ; pass++ ) {
+          for ( i=0 ; i < n_capabilities ; i++ ) {
+              robbed = capabilities[i];
+              if (cap == robbed)  // ourselves...
+                  continue;
 
-          if (emptySparkPoolCap(robbed)) // nothing to steal here
-              continue;
+              if ((robbed->cache_group == cap->cache_group) != (pass == 0))
+                  continue;
 
-          spark = tryStealSpark(robbed->sparks);
-          while (spark != NULL && fizzledSpark(spark)) {
-              cap->spark_stats.fizzled++;
-              traceEventSparkFizzle(cap);
-              spark = tryStealSpark(robbed->sparks);
-          }
-          if (spark == NULL && !emptySparkPoolCap(robbed)) {
-              // we conflicted with another thread while trying to steal;
-              // try again later.
-              retry = true;
-          }
+              if (emptySparkPoolCap(robbed)) // nothing to steal here
+                  continue;
 
-          if (spark != NULL) {
-              cap->spark_stats.converted++;
-              traceEventSparkSteal(cap, robbed->no);
-
-              return spark;
+              spark = tryStealSpark(robbed->sparks);
+              while (spark != NULL && fizzledSpark(spark)) {
+                  cap->spark_stats.fizzled++;
+                  traceEventSparkFizzle(cap);
+                  spark = tryStealSpark(robbed->sparks);
+              }
+              if (spark == NULL && !emptySparkPoolCap(robbed)) {
+                  // we conflicted with another thread while trying to steal;
+                  // try again later.
+                  retry = true;
+              }
+
+              if (spark != NULL) {
+                  cap->spark_stats.converted++;
+                  traceEventSparkSteal(cap, robbed->no);
+
+                  return spark;
+              }
+              // otherwise: no success, try next one
           }
-          // otherwise: no success, try next one
       }
   } while (retry);
 
@@ -247,6 +256,7 @@ initCapability (Capability *cap, uint32_t i)
 
     cap->no = i;
     cap->node = capNoToNumaNode(i);
+    cap->cache_group = capabilityCacheGroup(i);
     cap->in_haskell        = false;
     cap->idle              = 0;
     cap->disabled          = false;
@@ -266,6 +276,7 @@ initCapability (Capability *cap, uint32_t i)
     cap->returning_tasks_tl = NULL;
     cap->n_returning_tasks  = 0;
     cap->inbox              = (Message*)END_TSO_QUEUE;
+    cap->inbox_since        = 0;
     cap->putMVars           = NULL;
     cap->sparks             = allocSparkPool();
     cap->spark_stats.created    = 0;
@@ -274,11 +285,16 @@ initCapability (Capability *cap, uint32_t i)
     cap->spark_stats.converted  = 0;
     cap->spark_stats.gcd        = 0;
     cap->spark_stats.fizzled    = 0;
+    cap->message_stats.received      = 0;
+    cap->message_stats.batches       = 0;
+    cap->message_stats.latency_total = 0;
+    cap->message_stats.latency_max   = 0;
 #if !defined(mingw32_HOST_OS)
     cap->io_manager_control_wr_fd = -1;
 #endif
 #endif
     cap->total_allocated        = 0;
+    memset(&cap->sched_stats, 0, sizeof(SchedStats));
 
     cap->f.stgEagerBlackholeInfo = (W_)&__stg_EAGER_BLACKHOLE_info;
     cap->f.stgGCEnter1     = (StgFunPtr)__stg_gc_enter_1;
@@ -302,7 +318,11 @@ initCapability (Capability *cap, uint32_t i)
     cap->free_trec_chunks = END_STM_CHUNK_LIST;
     cap->free_trec_headers = NO_TREC;
     cap->transaction_tokens = 0;
+    memset(&cap->stm_stats, 0, sizeof(StmStats));
+    cap->stm_conflict = NULL;
+    cap->stm_sites = NULL;
     cap->context_switch = 0;
+    cap->cpu_sample = 0;
     cap->pinned_object_block = NULL;
     cap->pinned_object_blocks = NULL;
 
@@ -319,8 +339,10 @@ initCapability (Capability *cap, uint32_t i)
     traceCapCreate(cap);
     traceCapsetAssignCap(CAPSET_OSPROCESS_DEFAULT, i);
     traceCapsetAssignCap(CAPSET_CLOCKDOMAIN_DEFAULT, i);
+    traceCapabilityPlacement(i);
 #if defined(THREADED_RTS)
     traceSparkCounters(cap);
+    traceMessageCounters(cap);
 #endif
 }
 
@@ -859,6 +881,7 @@ yieldCapability (Capability** pCap, Task *task, bool gcAllowed)
                 gcWorkerThread(cap);
                 traceEventGcEnd(cap);
                 traceSparkCounters(cap);
+                traceMessageCounters(cap);
                 // See Note [migrated bound threads 2]
                 if (task->cap == cap) {
                     return true;
@@ -1092,6 +1115,7 @@ shutdownCapability (Capability *cap USED_IF_THREADS,
         }
 
         traceSparkCounters(cap);
+        traceMessageCounters(cap);
         RELEASE_LOCK(&cap->lock);
         break;
     }
@@ -1126,6 +1150,7 @@ freeCapability (Capability *cap)
 #if defined(THREADED_RTS)
     freeSparkPool(cap->sparks);
 #endif
+    traceSchedStats(cap);
     traceCapsetRemoveCap(CAPSET_OSPROCESS_DEFAULT, cap->no);
     traceCapsetRemoveCap(CAPSET_CLOCKDOMAIN_DEFAULT, cap->no);
     traceCapDelete(cap);
@@ -1134,6 +1159,7 @@ freeCapability (Capability *cap)
 void
 freeCapabilities (void)
 {
+    traceStmSites(capabilities[0]);
 #if defined(THREADED_RTS)
     uint32_t i;
     for (i=0; i < n_capabilities; i++) {
@@ -1182,8 +1208,12 @@ markCapability (evac_fn evac, void *user, Capability *cap,
     }
 #endif
 
-    // Free STM structures for this Capability
+    // Keep this Capability's pools of STM structures, once trimmed
+    // (see Note [STM pools] in STM.c)
     stmPreGCHook(cap);
+    evac(user, (StgClosure **)(void *)&cap->free_trec_headers);
+    evac(user, (StgClosure **)(void *)&cap->free_trec_chunks);
+    evac(user, (StgClosure **)(void *)&cap->free_tvar_watch_queues);
 }
 
 void
@@ -27,6 +27,17 @@
 
 #include "BeginPrivate.h"
 
+// Statistics on the messages received in a Capability's inbox, see
+// Note [Lock-free inbox] in Messages.c.  Latencies are in nanoseconds,
+// and are only collected when tracing scheduler events (+RTS -ls).
+typedef struct {
+    StgWord   received;      // messages executed
+    StgWord   batches;       // number of times the inbox was drained
+    StgWord64 latency_total; // sum over batches of the latency of the
+                             // oldest message in the batch
+    StgWord64 latency_max;   // maximum of the above
+} MessageCounters;
+
 struct Capability_ {
     // State required by the STG virtual machine when running Haskell
     // code.  During STG execution, the BaseReg register always points
@@ -45,6 +56,11 @@ struct Capability_ {
     // NUMA node balanced.
     uint32_t node;
 
+    // Capabilities whose OS threads are pinned to CPUs sharing a
+    // last-level cache have the same cache_group (see CpuTopology.c).
+    // Always 0 unless +RTS --affinity is used.
+    uint32_t cache_group;
+
     // The Task currently holding this Capability.  This task has
     // exclusive access to the contents of this Capability (apart from
     // returning_tasks_hd/returning_tasks_tl).
@@ -109,10 +125,19 @@ struct Capability_ {
     // reset after we have executed the context switch.
     int interrupt;
 
+    // CPU sample flag, set by the timer for +RTS --cpu-sample.  Like
+    // the interrupt flag it stops the running thread, which is sampled
+    // when it returns to the scheduler (see CpuSample.c), and it is
+    // reset before we start running Haskell code.
+    int cpu_sample;
+
     // Total words allocated by this cap since rts start
     // See [Note allocation accounting] in Storage.c
     W_ total_allocated;
 
+    // Scheduling latencies, for +RTS --sched-stats (see SchedStats.c)
+    SchedStats sched_stats;
+
 #if defined(THREADED_RTS)
     // Worker Tasks waiting in the wings.  Singly-linked.
     Task *spare_workers;
@@ -122,7 +147,6 @@ struct Capability_ {
     //    running_task
     //    returning_tasks_{hd,tl}
     //    wakeup_queue
-    //    inbox
     //    putMVars
     Mutex lock;
 
@@ -135,10 +159,17 @@ struct Capability_ {
     Task *returning_tasks_tl;
     uint32_t n_returning_tasks;
 
-    // Messages, or END_TSO_QUEUE.
-    // Locks required: cap->lock
+    // Messages, or END_TSO_QUEUE.  Most recently sent first.
+    // Lock-free: pushed with cas(), drained with xchg().
+    // See Note [Lock-free inbox] in Messages.c.
     Message *inbox;
 
+    // When a message was last sent to an empty inbox, as given by
+    // getMonotonicNSec(); only maintained when tracing.
+    StgWord64 inbox_since;
+
+    MessageCounters message_stats;
+
     // putMVars are really messages, but they're allocated with malloc() so they
     // can't go on the inbox queue: the GC would get confused.
     struct PutMVar_ *putMVars;
@@ -159,6 +190,13 @@ struct Capability_ {
     StgTRecChunk *free_trec_chunks;
     StgTRecHeader *free_trec_headers;
     uint32_t transaction_tokens;
+    StmStats stm_stats;
+    // The TVar that made the last transaction on this Capability
+    // fail, if known; only used to name it in the eventlog
+    StgTVar *stm_conflict;
+    // Aborts per atomically site on this Capability, counted only while
+    // the eventlog is running (see traceStmSites)
+    struct hashtable *stm_sites;
 } // typedef Capability is defined in RtsAPI.h
   // We never want a Capability to overlap a cache line with anything
   // else, so round it up to a cache line size:
@@ -0,0 +1,248 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * Sampling the stacks of running Haskell threads (+RTS --cpu-sample)
+ *
+ * ---------------------------------------------------------------------------*/
+
+/*
+ * A CPU profile of a program built without -prof.  Every --cpu-sample
+ * interval, the timer sets cap->cpu_sample on each capability that is
+ * running Haskell code, and stops it the way a context switch does, by
+ * setting HpLim to NULL.  At its next heap check the thread returns to
+ * the scheduler, which calls cpuSample(): the stack is then in a
+ * consistent state, so we can walk it and write up to
+ * CPU_SAMPLE_MAX_FRAMES return addresses to the eventlog as an
+ * EVENT_CPU_SAMPLE.  The thread is put back at the front of the run
+ * queue, so sampling does not change the schedule.
+ *
+ * Sampling from the timer signal itself would see code that does not
+ * allocate, but the Haskell stack pointer is in a register there, and
+ * the stack is not walkable in the middle of a heap check or a call.
+ * Here, as with context switches, a loop that does not allocate is not
+ * sampled until it does (compile with -fno-omit-yields to fix that), and
+ * a sample can occasionally be lost when the timer's write to HpLim
+ * races with the thread's own.
+ *
+ * The innermost frame is usually the one pushed by the failed heap
+ * check: for a function (a RET_FUN frame) or a closure about to be
+ * entered (stg_enter_info) we record the info pointer of the function
+ * or closure instead, so that the sample names the code that was
+ * running.  With tables-next-to-code the info pointers are code
+ * addresses.
+ *
+ * In an RTS built with libdw, the first time each address is sampled
+ * we look it up in the DWARF information of the program (see Libdw.c)
+ * and write its function name and source location as an
+ * EVENT_CPU_SAMPLE_SYMBOL.  Otherwise consumers resolve the addresses
+ * with the program's symbol table.
+ */
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "CpuSample.h"
+#include "Capability.h"
+#include "Trace.h"
+#include "Hash.h"
+
+#if defined(TRACING)
+
+// Ticks left until the next sample
+static int ticks_to_cpu_sample;
+
+#if USE_LIBDW
+// Addresses whose symbols have been written to the eventlog
+static HashTable *cpu_sample_symbols = NULL;
+
+#ifdef THREADED_RTS
+static Mutex cpu_sample_symbols_mutex;
+#endif
+#endif
+
+void
+initCpuSampling (void)
+{
+    ticks_to_cpu_sample = RtsFlags.TraceFlags.cpuSampleIntervalTicks;
+#if USE_LIBDW
+    cpu_sample_symbols = allocHashTable();
+#ifdef THREADED_RTS
+    initMutex(&cpu_sample_symbols_mutex);
+#endif
+#endif
+}
+
+void
+exitCpuSampling (void)
+{
+#if USE_LIBDW
+    if (cpu_sample_symbols != NULL) {
+        freeHashTable(cpu_sample_symbols, NULL);
+        cpu_sample_symbols = NULL;
+    }
+#ifdef THREADED_RTS
+    closeMutex(&cpu_sample_symbols_mutex);
+#endif
+#endif
+}
+
+void
+handleCpuSampleTick (void)
+{
+    uint32_t n;
+
+    if (RtsFlags.TraceFlags.cpuSampleIntervalTicks == 0) {
+        return;
+    }
+    ticks_to_cpu_sample--;
+    if (ticks_to_cpu_sample > 0) {
+        return;
+    }
+    ticks_to_cpu_sample = RtsFlags.TraceFlags.cpuSampleIntervalTicks;
+
+    if (eventLogStatus() != EVENTLOG_RUNNING) {
+        return;
+    }
+    for (n = 0; n < n_capabilities; n++) {
+        Capability *cap = capabilities[n];
+        if (cap->in_haskell) {
+            cap->cpu_sample = 1;
+            stopCapability(cap);
+        }
+    }
+}
+
+void
+resetCpuSampleSymbols (void)
+{
+#if USE_LIBDW
+    ACQUIRE_LOCK(&cpu_sample_symbols_mutex);
+    if (cpu_sample_symbols != NULL) {
+        freeHashTable(cpu_sample_symbols, NULL);
+        cpu_sample_symbols = allocHashTable();
+    }
+    RELEASE_LOCK(&cpu_sample_symbols_mutex);
+#endif
+}
+
+// Write the return addresses of the frames on the stack of tso to
+// frames[], innermost first, returning how many there were
+static uint32_t
+sampleStack (StgTSO *tso, StgWord *frames, uint32_t max_frames)
+{
+    StgStack *stack = tso->stackobj;
+    StgPtr sp = stack->sp;
+    uint32_t n = 0;
+
+    while (n < max_frames) {
+        StgClosure *frame = (StgClosure *)sp;
+        StgWord addr = (StgWord)frame->header.info;
+
+        switch (get_ret_itbl(frame)->i.type) {
+        case UNDERFLOW_FRAME:
+            stack = ((StgUnderflowFrame *)frame)->next_chunk;
+            sp = stack->sp;
+            continue;
+
+        case STOP_FRAME:
+            return n;
+
+        case RET_FUN:
+            // A function stopped by its heap check
+            addr = (StgWord)UNTAG_CLOSURE(((StgRetFun *)frame)->fun)
+                       ->header.info;
+            break;
+
+        default:
+            if (sp[0] == (W_)&stg_enter_info) {
+                // A closure stopped before it was entered
+                addr = (StgWord)UNTAG_CLOSURE((StgClosure *)sp[1])
+                           ->header.info;
+            }
+            break;
+        }
+
+        frames[n++] = addr;
+        sp += stack_frame_sizeW(frame);
+    }
+    return n;
+}
+
+#if USE_LIBDW
+// Write the symbols of the addresses that have not been seen before
+static void
+traceSymbols (Capability *cap, const StgWord *frames, uint32_t n_frames)
+{
+    LibdwSession *session = NULL;
+    Location loc;
+    uint32_t i;
+
+    ACQUIRE_LOCK(&cpu_sample_symbols_mutex);
+    for (i = 0; i < n_frames; i++) {
+        if (lookupHashTable(cpu_sample_symbols, frames[i]) != NULL) {
+            continue;
+        }
+        if (session == NULL) {
+            session = libdwPoolTake();
+            if (session == NULL) {
+                break; // try again with the next sample
+            }
+        }
+        if (libdwLookupLocation(session, &loc, (StgPtr)frames[i]) == 0
+            && loc.function != NULL) {
+            if (loc.source_file != NULL) {
+                traceCpuSampleSymbol(cap, frames[i], loc.lineno,
+                                     loc.function, loc.source_file);
+            } else {
+                traceCpuSampleSymbol(cap, frames[i], 0, loc.function, "");
+            }
+        }
+        // Remember unknown addresses too, so we look them up only once
+        insertHashTable(cpu_sample_symbols, frames[i], (void *)frames[i]);
+    }
+    RELEASE_LOCK(&cpu_sample_symbols_mutex);
+
+    if (session != NULL) {
+        libdwPoolRelease(session);
+    }
+}
+#endif
+
+void
+cpuSample_ (Capability *cap, StgTSO *tso)
+{
+    StgWord frames[CPU_SAMPLE_MAX_FRAMES];
+    uint32_t n_frames;
+
+    cap->cpu_sample = 0;
+
+    if (tso->what_next == ThreadComplete || tso->what_next == ThreadKilled) {
+        return;
+    }
+    n_frames = sampleStack(tso, frames, CPU_SAMPLE_MAX_FRAMES);
+    if (n_frames == 0) {
+        return;
+    }
+#if USE_LIBDW
+    traceSymbols(cap, frames, n_frames);
+#endif
+    traceCpuSample(cap, tso, frames, n_frames);
+}
+
+#else /* !TRACING */
+
+void initCpuSampling (void) { }
+
+void exitCpuSampling (void) { }
+
+void handleCpuSampleTick (void) { }
+
+void resetCpuSampleSymbols (void) { }
+
+void cpuSample_ (Capability *cap, StgTSO *tso STG_UNUSED)
+{
+    cap->cpu_sample = 0;
+}
+
+#endif /* TRACING */
@@ -0,0 +1,43 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * Sampling the stacks of running Haskell threads (+RTS --cpu-sample)
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef CPUSAMPLE_H
+#define CPUSAMPLE_H
+
+#include "Capability.h"
+
+#include "BeginPrivate.h"
+
+// The most frames recorded in a sample, innermost first
+#define CPU_SAMPLE_MAX_FRAMES 32
+
+void initCpuSampling (void);
+void exitCpuSampling (void);
+
+// Called by the timer at each tick: every --cpu-sample interval, ask
+// the capabilities running Haskell code to stop and be sampled
+void handleCpuSampleTick (void);
+
+// Forget which addresses have had their symbols written, because the
+// eventlog is being stopped
+void resetCpuSampleSymbols (void);
+
+void cpuSample_ (Capability *cap, StgTSO *tso);
+
+// tso has stopped running on cap: write a sample of its stack to the
+// eventlog if the timer asked for one
+INLINE_HEADER void cpuSample (Capability *cap, StgTSO *tso)
+{
+    if (RTS_UNLIKELY(cap->cpu_sample)) {
+        cpuSample_(cap, tso);
+    }
+}
+
+#include "EndPrivate.h"
+
+#endif /* CPUSAMPLE_H */
@@ -0,0 +1,323 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * CPU topology and placement of capabilities on CPUs (+RTS --affinity)
+ *
+ * ---------------------------------------------------------------------------*/
+
+/*
+ * With +RTS -qa the OS threads of capability n are pinned to CPUs n,
+ * n+N, n+2N, ...  That ignores how the CPUs are related: capabilities 0
+ * and 1 may end up on the two hardware threads of one core while other
+ * cores stay idle, and CPUs outside our cpuset may be chosen.
+ *
+ * With +RTS --affinity=<policy> we instead read the CPU topology, build
+ * an ordered list of the CPUs we are allowed to run on, and pin
+ * capability n to the (n mod #cpus)'th CPU in that list:
+ *
+ *   compact   fill the hardware threads of a core, then the cores
+ *             sharing a last-level cache, then the next package
+ *
+ *   scatter   spread out over the packages first, and use the second
+ *             hardware thread of a core only once every core has one
+ *             capability
+ *
+ *   cores     like compact, but use only one hardware thread per core
+ *
+ * Capabilities placed on CPUs that share a last-level (L3) cache get the
+ * same cache group, which the scheduler uses to prefer nearby
+ * capabilities when pushing threads and stealing sparks.
+ *
+ * On Linux the topology is read from /sys/devices/system/cpu.  Elsewhere
+ * we treat every processor as a separate core on a single package.
+ */
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "CpuTopology.h"
+#include "RtsUtils.h"
+#include "Trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(HAVE_SCHED_H)
+#include <sched.h>
+#endif
+
+#if defined(THREADED_RTS)
+
+typedef struct {
+    uint32_t cpu;        // OS processor number
+    uint32_t package;    // physical package (socket)
+    uint32_t core;       // core id, unique within the package
+    uint32_t core_rank;  // index of the core within its package
+    uint32_t smt;        // index of this CPU among its core's threads
+    uint32_t llc;        // dense id of the last-level cache it uses
+} CpuInfo;
+
+static CpuInfo *cpus = NULL;
+static uint32_t n_cpus = 0;
+
+// The CPUs in placement order, as indices into cpus[]
+static uint32_t *placement = NULL;
+static uint32_t n_placement = 0;
+
+uint32_t n_cache_groups = 1;
+
+#if defined(linux_HOST_OS)
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+static bool
+readSysfsInt (const char *fmt, uint32_t cpu, uint32_t index, long *result)
+{
+    char path[128];
+    char buf[32];
+    FILE *f;
+    bool ok;
+
+    snprintf(path, sizeof(path), fmt, cpu, index);
+    f = fopen(path, "r");
+    if (f == NULL) return false;
+    ok = fgets(buf, sizeof(buf), f) != NULL;
+    fclose(f);
+    if (ok) *result = strtol(buf, NULL, 10);
+    return ok;
+}
+
+// We identify a last-level cache by the lowest-numbered CPU sharing it,
+// which is the first number in its shared_cpu_list.
+static long
+lastLevelCacheKey (uint32_t cpu)
+{
+    long level, max_level = -1, key = cpu, k;
+    uint32_t index;
+
+    for (index = 0;
+         readSysfsInt(SYSFS_CPU "/cpu%u/cache/index%u/level",
+                      cpu, index, &level);
+         index++) {
+        if (level > max_level &&
+            readSysfsInt(SYSFS_CPU "/cpu%u/cache/index%u/shared_cpu_list",
+                         cpu, index, &k)) {
+            max_level = level;
+            key = k;
+        }
+    }
+    return key;
+}
+
+#endif /* linux_HOST_OS */
+
+static void
+discoverCpus (void)
+{
+    long *llc_keys;
+    uint32_t i, j, n_llc, max_cpus;
+#if defined(linux_HOST_OS)
+    long v;
+#endif
+
+#if defined(HAVE_SCHED_H) && defined(HAVE_SCHED_GETAFFINITY)
+    max_cpus = stg_max(CPU_SETSIZE, getNumberOfProcessors());
+#else
+    max_cpus = getNumberOfProcessors();
+#endif
+    cpus = stgMallocBytes(sizeof(CpuInfo) * max_cpus, "discoverCpus");
+    n_cpus = 0;
+
+#if defined(HAVE_SCHED_H) && defined(HAVE_SCHED_GETAFFINITY)
+    {
+        cpu_set_t cs;
+        CPU_ZERO(&cs);
+        if (sched_getaffinity(0, sizeof(cpu_set_t), &cs) == 0) {
+            for (i = 0; i < CPU_SETSIZE; i++) {
+                if (CPU_ISSET(i, &cs)) cpus[n_cpus++].cpu = i;
+            }
+        }
+    }
+#endif
+    if (n_cpus == 0) {
+        for (i = 0; i < getNumberOfProcessors(); i++) {
+            cpus[n_cpus++].cpu = i;
+        }
+    }
+
+    llc_keys = stgMallocBytes(sizeof(long) * n_cpus, "discoverCpus");
+    n_llc = 0;
+
+    for (i = 0; i < n_cpus; i++) {
+        CpuInfo *c = &cpus[i];
+        long llc_key = 0;
+
+        c->package = 0;
+        c->core = c->cpu;
+#if defined(linux_HOST_OS)
+        if (readSysfsInt(SYSFS_CPU "/cpu%u/topology/physical_package_id",
+                         c->cpu, 0, &v) && v >= 0) {
+            c->package = (uint32_t)v;
+        }
+        if (readSysfsInt(SYSFS_CPU "/cpu%u/topology/core_id",
+                         c->cpu, 0, &v) && v >= 0) {
+            c->core = (uint32_t)v;
+        }
+        llc_key = lastLevelCacheKey(c->cpu);
+#endif
+
+        // number the hardware threads of each core, and the cores of
+        // each package, in order of CPU number
+        c->smt = 0;
+        c->core_rank = 0;
+        for (j = 0; j < i; j++) {
+            if (cpus[j].package != c->package) continue;
+            if (cpus[j].core == c->core) {
+                c->smt++;
+                c->core_rank = cpus[j].core_rank;
+            }
+        }
+        if (c->smt == 0) {
+            for (j = 0; j < i; j++) {
+                if (cpus[j].package == c->package && cpus[j].smt == 0) {
+                    c->core_rank++;
+                }
+            }
+        }
+
+        for (j = 0; j < n_llc && llc_keys[j] != llc_key; j++) {}
+        if (j == n_llc) llc_keys[n_llc++] = llc_key;
+        c->llc = j;
+    }
+
+    stgFree(llc_keys);
+}
+
+static int
+cmpCompact (const void *a, const void *b)
+{
+    const CpuInfo *x = &cpus[*(const uint32_t *)a];
+    const CpuInfo *y = &cpus[*(const uint32_t *)b];
+    if (x->package != y->package) return x->package < y->package ? -1 : 1;
+    if (x->llc != y->llc) return x->llc < y->llc ? -1 : 1;
+    if (x->core_rank != y->core_rank) return x->core_rank < y->core_rank ? -1 : 1;
+    if (x->smt != y->smt) return x->smt < y->smt ? -1 : 1;
+    return 0;
+}
+
+static int
+cmpScatter (const void *a, const void *b)
+{
+    const CpuInfo *x = &cpus[*(const uint32_t *)a];
+    const CpuInfo *y = &cpus[*(const uint32_t *)b];
+    if (x->smt != y->smt) return x->smt < y->smt ? -1 : 1;
+    if (x->core_rank != y->core_rank) return x->core_rank < y->core_rank ? -1 : 1;
+    if (x->package != y->package) return x->package < y->package ? -1 : 1;
+    return 0;
+}
+
+void
+initCpuTopology (void)
+{
+    uint32_t i;
+
+    if (!RtsFlags.ParFlags.setAffinity
+        || RtsFlags.ParFlags.affinityPolicy == AFFINITY_ROUND_ROBIN) {
+        return;
+    }
+
+    discoverCpus();
+
+    placement = stgMallocBytes(sizeof(uint32_t) * n_cpus, "initCpuTopology");
+    n_placement = 0;
+    for (i = 0; i < n_cpus; i++) {
+        if (RtsFlags.ParFlags.affinityPolicy == AFFINITY_CORES
+            && cpus[i].smt != 0) {
+            continue;
+        }
+        placement[n_placement++] = i;
+    }
+
+    qsort(placement, n_placement, sizeof(uint32_t),
+          RtsFlags.ParFlags.affinityPolicy == AFFINITY_SCATTER
+              ? cmpScatter : cmpCompact);
+
+    n_cache_groups = 0;
+    for (i = 0; i < n_placement; i++) {
+        uint32_t j;
+        for (j = 0; j < i; j++) {
+            if (cpus[placement[j]].llc == cpus[placement[i]].llc) break;
+        }
+        if (j == i) n_cache_groups++;
+    }
+    if (n_cache_groups == 0) n_cache_groups = 1;
+
+    IF_DEBUG(scheduler,
+             for (i = 0; i < n_placement; i++) {
+                 CpuInfo *c = &cpus[placement[i]];
+                 debugBelch("placement %d: cpu %d (package %d, core %d, "
+                            "thread %d, cache group %d)\n",
+                            i, c->cpu, c->package, c->core, c->smt, c->llc);
+             });
+}
+
+void
+freeCpuTopology (void)
+{
+    if (cpus != NULL) {
+        stgFree(cpus);
+        cpus = NULL;
+    }
+    if (placement != NULL) {
+        stgFree(placement);
+        placement = NULL;
+    }
+    n_cpus = n_placement = 0;
+    n_cache_groups = 1;
+}
+
+void
+setCapabilityAffinity (uint32_t n, uint32_t m)
+{
+    if (n_placement == 0) {
+        setThreadAffinity(n, m);
+    } else {
+        setThreadCpu(cpus[placement[n % n_placement]].cpu);
+    }
+}
+
+uint32_t
+capabilityCacheGroup (uint32_t n)
+{
+    if (n_placement == 0) return 0;
+    return cpus[placement[n % n_placement]].llc;
+}
+
+void
+traceCapabilityPlacement (uint32_t n)
+{
+    CpuInfo *c;
+
+    if (n_placement == 0) return;
+    c = &cpus[placement[n % n_placement]];
+    traceCapCpuPlacement(n, c->cpu, c->package, c->core, c->llc);
+}
+
+#else /* !THREADED_RTS */
+
+void initCpuTopology (void) { /* nothing */ }
+void freeCpuTopology (void) { /* nothing */ }
+
+void setCapabilityAffinity (uint32_t n STG_UNUSED, uint32_t m STG_UNUSED)
+{
+    /* nothing */
+}
+
+uint32_t n_cache_groups = 1;
+
+uint32_t capabilityCacheGroup (uint32_t n STG_UNUSED) { return 0; }
+
+void traceCapabilityPlacement (uint32_t n STG_UNUSED) { /* nothing */ }
+
+#endif /* THREADED_RTS */
@@ -0,0 +1,35 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * CPU topology and placement of capabilities on CPUs (+RTS --affinity)
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef CPUTOPOLOGY_H
+#define CPUTOPOLOGY_H
+
+#include "BeginPrivate.h"
+
+void initCpuTopology (void);
+void freeCpuTopology (void);
+
+// Pin the calling OS thread according to the chosen affinity policy,
+// for capability n of m.  Only used when RtsFlags.ParFlags.setAffinity.
+void setCapabilityAffinity (uint32_t n, uint32_t m);
+
+// Capabilities with the same cache group are placed on CPUs that share
+// a last-level cache.  Always 0 when no placement policy is in use.
+uint32_t capabilityCacheGroup (uint32_t n);
+
+// The number of distinct cache groups; 1 when no placement policy is in
+// use, in which case there is no point preferring capabilities that
+// share our cache group.
+extern uint32_t n_cache_groups;
+
+// Emit the CPU chosen for capability n to the eventlog, if any.
+void traceCapabilityPlacement (uint32_t n);
+
+#include "EndPrivate.h"
+
+#endif /* CPUTOPOLOGY_H */
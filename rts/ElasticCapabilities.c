@@ -0,0 +1,161 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * Adjusting the number of capabilities to the available CPU (+RTS -qe)
+ *
+ * ---------------------------------------------------------------------------*/
+
+/*
+ * With +RTS -qe the RTS runs a controller thread that periodically
+ * samples the load on the capabilities and calls setNumCapabilities()
+ * to shrink or grow the number of enabled capabilities between 1 and
+ * the value given by -N.  On each sampling interval:
+ *
+ *   - if the cgroup CPU quota has been exhausted since the last sample
+ *     (see getCPUThrottleCount()), we are using more OS threads than we
+ *     have CPU for, so we drop a capability;
+ *
+ *   - otherwise, if every enabled capability is busy and there are
+ *     threads waiting on the run queues, we add a capability;
+ *
+ *   - otherwise, if at least two capabilities have been idle for
+ *     ELASTIC_IDLE_SAMPLES consecutive samples, we drop a capability.
+ *
+ * We change the number of capabilities by at most one per interval,
+ * because setNumCapabilities() has to stop the world.
+ *
+ * The samples are taken without locking: they are only a heuristic, and
+ * stale values are harmless.  The controller assumes that it is the only
+ * caller of setNumCapabilities() while it is running.
+ */
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "ElasticCapabilities.h"
+#include "Capability.h"
+#include "RtsUtils.h"
+#include "Task.h"
+#include "Trace.h"
+
+#if defined(THREADED_RTS)
+
+#define ELASTIC_IDLE_SAMPLES 10
+
+static bool elastic_running = false;
+static volatile bool elastic_stop = false;
+static Mutex elastic_mutex;
+static Condition elastic_stopped;
+static Condition elastic_wakeup;   // signalled to stop the controller
+
+// Wait for the sampling interval, or until we are asked to stop
+static void
+elasticSleep (Time t)
+{
+    ACQUIRE_LOCK(&elastic_mutex);
+    if (!elastic_stop) {
+        timedWaitCondition(&elastic_wakeup, &elastic_mutex, t);
+    }
+    RELEASE_LOCK(&elastic_mutex);
+}
+
+static void *
+elasticCapabilitiesLoop (void *arg STG_UNUSED)
+{
+    uint32_t max_caps = RtsFlags.ParFlags.nCapabilities;
+    uint32_t idle_samples = 0;
+    bool have_throttle;
+    StgWord64 throttled, last_throttled = 0;
+
+    have_throttle = getCPUThrottleCount(&last_throttled);
+
+    while (!elastic_stop) {
+        uint32_t i, n, target, busy = 0, runnable = 0;
+
+        elasticSleep(RtsFlags.ParFlags.elasticInterval);
+        if (elastic_stop) break;
+
+        n = enabled_capabilities;
+        for (i = 0; i < n; i++) {
+            Capability *cap = capabilities[i];
+            runnable += cap->n_run_queue;
+            if (cap->running_task != NULL) busy++;
+        }
+
+        target = n;
+        if (have_throttle && getCPUThrottleCount(&throttled)
+            && throttled > last_throttled) {
+            last_throttled = throttled;
+            if (n > 1) target = n - 1;
+        } else if (busy == n && runnable > 0) {
+            if (n < max_caps) target = n + 1;
+        } else if (busy + 1 < n) {
+            if (++idle_samples >= ELASTIC_IDLE_SAMPLES) target = n - 1;
+        } else {
+            idle_samples = 0;
+        }
+
+        if (target != n) {
+            debugTrace(DEBUG_sched,
+                       "elastic capabilities: %d busy, %d runnable, "
+                       "changing from %d to %d capabilities",
+                       busy, runnable, n, target);
+            setNumCapabilities(target);
+            idle_samples = 0;
+        }
+    }
+
+    freeMyTask();
+
+    ACQUIRE_LOCK(&elastic_mutex);
+    elastic_running = false;
+    signalCondition(&elastic_stopped);
+    RELEASE_LOCK(&elastic_mutex);
+    return NULL;
+}
+
+void
+startElasticCapabilities (void)
+{
+    OSThreadId tid;
+
+    if (!RtsFlags.ParFlags.elasticCapabilities) return;
+
+    initMutex(&elastic_mutex);
+    initCondition(&elastic_stopped);
+    initCondition(&elastic_wakeup);
+    elastic_stop = false;
+    elastic_running = true;
+
+    if (createOSThread(&tid, "ghc_elastic",
+                       (OSThreadProc*)elasticCapabilitiesLoop, NULL) != 0) {
+        sysErrorBelch("warning: cannot start the -qe controller");
+        elastic_running = false;
+    }
+}
+
+void
+stopElasticCapabilities (void)
+{
+    if (!RtsFlags.ParFlags.elasticCapabilities) return;
+
+    ACQUIRE_LOCK(&elastic_mutex);
+    elastic_stop = true;
+    signalCondition(&elastic_wakeup);
+    while (elastic_running) {
+        waitCondition(&elastic_stopped, &elastic_mutex);
+    }
+    RELEASE_LOCK(&elastic_mutex);
+
+    closeCondition(&elastic_stopped);
+    closeCondition(&elastic_wakeup);
+    closeMutex(&elastic_mutex);
+}
+
+#else /* !THREADED_RTS */
+
+void startElasticCapabilities (void) { /* nothing */ }
+void stopElasticCapabilities  (void) { /* nothing */ }
+
+#endif /* THREADED_RTS */
@@ -0,0 +1,19 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * Adjusting the number of capabilities to the available CPU (+RTS -qe)
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef ELASTICCAPABILITIES_H
+#define ELASTICCAPABILITIES_H
+
+#include "BeginPrivate.h"
+
+void startElasticCapabilities (void);
+void stopElasticCapabilities  (void);
+
+#include "EndPrivate.h"
+
+#endif /* ELASTICCAPABILITIES_H */
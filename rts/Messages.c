@@ -21,9 +21,44 @@
 
 #ifdef THREADED_RTS
 
+/* Note [Lock-free inbox]
+   ~~~~~~~~~~~~~~~~~~~~~~
+   cap->inbox is a multiple-producer single-consumer stack of Messages.
+   Any Capability may push a message with cas() (sendMessage()), and
+   only the Capability's owner takes messages off, by swapping the
+   whole stack for END_TSO_QUEUE with xchg() (scheduleProcessInbox()).
+   The owner then reverses the batch it took, so that messages are
+   executed in the order they were sent.  There is no ABA problem since
+   nobody but the owner ever removes anything.
+
+   A Capability must not go idle while its inbox is non-empty, and
+   before this was lock-free that was ensured by taking cap->lock on
+   every send.  Now only a message sent to an *empty* inbox takes the
+   lock, to wake up or interrupt the Capability:
+
+     - releaseCapability_() checks the inbox under cap->lock before it
+       sets cap->running_task to NULL, so either it sees our message and
+       keeps a worker running, or we see running_task == NULL after
+       taking the lock and wake the Capability up ourselves.
+
+     - if the inbox was non-empty, the sender of the message that is at
+       the bottom of the stack has done (or is doing) the above, and the
+       Capability will eventually drain the inbox; the xchg() that takes
+       that message also takes ours, since ours is above it.
+
+   So under load, when the receiver is busy and messages queue up, we
+   send without taking any locks and the receiver processes them in
+   batches.
+
+   While tracing, the sender of a message to an empty inbox records the
+   time in cap->inbox_since, so the receiver can compute the latency of
+   the oldest message in each batch (see MessageCounters).  This is only
+   approximate: several senders may race to set it.
+*/
+
 void sendMessage(Capability *from_cap, Capability *to_cap, Message *msg)
 {
-    ACQUIRE_LOCK(&to_cap->lock);
+    Message *old;
 
 #ifdef DEBUG
     {
@@ -38,11 +73,27 @@ void sendMessage(Capability *from_cap, Capability *to_cap, Message *msg)
     }
 #endif
 
-    msg->link = to_cap->inbox;
-    to_cap->inbox = msg;
+    do {
+        old = (Message *)VOLATILE_LOAD(&to_cap->inbox);
+#ifdef TRACING
+        if (old == (Message*)END_TSO_QUEUE && RTS_UNLIKELY(TRACE_sched)) {
+            to_cap->inbox_since = getMonotonicNSec();
+        }
+#endif
+        msg->link = old;
+    } while (cas((StgVolatilePtr)&to_cap->inbox,
+                 (StgWord)old, (StgWord)msg) != (StgWord)old);
 
     recordClosureMutated(from_cap,(StgClosure*)msg);
 
+    if (old != (Message*)END_TSO_QUEUE) {
+        // to_cap has already been told about the inbox, see
+        // Note [Lock-free inbox]
+        return;
+    }
+
+    ACQUIRE_LOCK(&to_cap->lock);
+
     if (to_cap->running_task == NULL) {
         to_cap->running_task = myTask();
             // precond for releaseCapability_()
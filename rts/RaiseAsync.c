@@ -713,7 +713,7 @@ removeFromQueues(Capability *cap, StgTSO *tso)
 #if defined(mingw32_HOST_OS)
   case BlockedOnDoProc:
 #endif
-      removeThreadFromDeQueue(cap, &blocked_queue_hd, &blocked_queue_tl, tso);
+      removeFromBlockedQueue(cap, tso);
 #if defined(mingw32_HOST_OS)
       /* (Cooperatively) signal that the worker thread should abort
        * the request.
@@ -723,7 +723,7 @@ removeFromQueues(Capability *cap, StgTSO *tso)
       goto done;
 
   case BlockedOnDelay:
-        removeThreadFromQueue(cap, &sleeping_queue, tso);
+        removeSleepingThread(tso);
         goto done;
 #endif
 
@@ -1043,6 +1043,7 @@ raiseAsync(Capability *cap, StgTSO *tso, StgClosure *exception,
                               "raiseAsync: freezing atomically frame")
                 stmAbortTransaction(cap, trec);
                 stmFreeAbortedTRec(cap, trec);
+                stmAbandonTransaction(cap, tso);
                 tso->trec = outer;
 
                 atomically = (StgThunk*)allocate(cap,sizeofW(StgThunk)+1);
@@ -1673,6 +1673,7 @@ inner_loop:
         retainClosure(tso->blocked_exceptions, c, c_child_r);
         retainClosure(tso->bq,                 c, c_child_r);
         retainClosure(tso->trec,               c, c_child_r);
+        retainClosure(tso->stm_woken_by,       c, c_child_r);
         if (   tso->why_blocked == BlockedOnMVar
                || tso->why_blocked == BlockedOnMVarRead
                || tso->why_blocked == BlockedOnBlackHole
@@ -106,6 +106,8 @@ static bool read_heap_profiling_flag(const char *arg);
 
 #ifdef TRACING
 static void read_trace_flags(const char *arg);
+static void read_eventlog_sink_flag(void);
+static bool read_eventlog_flush_flag(const char *arg);
 #endif
 
 static void errorUsage (void) GNU_ATTRIBUTE(__noreturn__);
@@ -210,6 +212,13 @@ void initRtsFlagsDefaults(void)
     RtsFlags.TraceFlags.sparks_sampled= false;
     RtsFlags.TraceFlags.sparks_full   = false;
     RtsFlags.TraceFlags.user          = false;
+    RtsFlags.TraceFlags.eventlogSink  = EVENTLOG_SINK_FILE;
+    RtsFlags.TraceFlags.eventlogFd    = -1;
+    RtsFlags.TraceFlags.eventlogPath  = NULL;
+    RtsFlags.TraceFlags.eventlogFlush = EVENTLOG_FLUSH_SYNC;
+    RtsFlags.TraceFlags.eventlogCompact = false;
+    RtsFlags.TraceFlags.cpuSampleInterval = 0;
+    RtsFlags.TraceFlags.cpuSampleIntervalTicks = 0;
 #endif
 
 #ifdef PROFILING
@@ -223,6 +232,13 @@ void initRtsFlagsDefaults(void)
     RtsFlags.MiscFlags.install_signal_handlers = true;
     RtsFlags.MiscFlags.machineReadable = false;
     RtsFlags.MiscFlags.linkerMemBase    = 0;
+    RtsFlags.MiscFlags.schedStats       = false;
+    RtsFlags.MiscFlags.ioUring          = false;
+    RtsFlags.MiscFlags.timerWheelTick   = 0;
+    RtsFlags.MiscFlags.stmClock         = false;
+    RtsFlags.MiscFlags.stmBackoff       = false;
+    RtsFlags.MiscFlags.stmSerialiseAfter = 0;
+    RtsFlags.MiscFlags.stmWakeLimit     = 0;
 
 #ifdef THREADED_RTS
     RtsFlags.ParFlags.nCapabilities     = 1;
@@ -234,6 +250,9 @@ void initRtsFlagsDefaults(void)
     RtsFlags.ParFlags.parGcNoSyncWithIdle   = 0;
     RtsFlags.ParFlags.parGcThreads      = 0; /* defaults to -N */
     RtsFlags.ParFlags.setAffinity       = 0;
+    RtsFlags.ParFlags.affinityPolicy    = AFFINITY_ROUND_ROBIN;
+    RtsFlags.ParFlags.elasticCapabilities = false;
+    RtsFlags.ParFlags.elasticInterval   = USToTime(100000); // 100ms
 #endif
 
 #if defined(THREADED_RTS)
@@ -347,6 +366,27 @@ usage_text[] = {
 #  endif
 "               -x    disable an event class, for any flag above",
 "             the initial enabled event classes are 'sgpu'",
+"  --eventlog-fd=<n>",
+"            Write the eventlog to file descriptor <n> instead of a file",
+"  --eventlog-pipe=<path>",
+"            Write the eventlog to a named pipe (created if it is missing)",
+"  --eventlog-socket=<path>",
+"            Write the eventlog to a listening Unix-domain socket",
+"             each of these implies -l if it is not given",
+#  if defined(THREADED_RTS)
+"  --eventlog-flush=<policy>",
+"            Write full eventlog buffers from a background thread; when",
+"            it falls behind, <policy> is 'block', 'drop' (counting the",
+"            lost events in the log) or 'grow' (default: 'sync', written",
+"            by the thread that filled the buffer)",
+#  endif
+"  --eventlog-compact",
+"            Use the compact eventlog encoding (delta timestamps and",
+"            variable-length thread ids; see utils/eventlog-expand)",
+"  --cpu-sample[=<secs>]",
+"            Sample the stacks of the running Haskell threads into the",
+"            eventlog every <secs> (default: 0.01); implies -l if it is",
+"            not given",
 #endif
 
 #if !defined(PROFILING)
@@ -404,6 +444,12 @@ usage_text[] = {
 "             -qb alone turns off load-balancing)",
 "  -qn<n>    Use <n> threads for parallel GC (defaults to value of -N)",
 "  -qa       Use the OS to set thread affinity (experimental)",
+"  --affinity=<policy>",
+"            Pin capabilities to CPUs based on the CPU topology; <policy>",
+"            is compact, scatter or cores (one per physical core)",
+"  -qe[<s>]  Adjust the number of capabilities to the load and to the",
+"            CPU quota, between 1 and -N, sampling every <s> seconds",
+"            (default: 0.1)",
 "  -qm       Don't automatically migrate threads between CPUs",
 "  -qi<n>    If a processor has been idle for the last <n> GCs, do not",
 "            wake it up for a non-load-balancing parallel GC.",
@@ -419,6 +465,30 @@ usage_text[] = {
 #endif
 "  --install-signal-handlers=<yes|no>",
 "            Install signal handlers (default: yes)",
+"  --sched-stats",
+"            Collect histograms of how long threads wait on the run queue,",
+"            run, and stay blocked (see GHC.Stats and the eventlog)",
+#if defined(linux_HOST_OS)
+"  --io-uring",
+"            Use io_uring rather than epoll in the I/O manager, if the",
+"            kernel supports it (-threaded only)",
+#endif
+"  --timer-wheel[=<secs>]",
+"            Keep the timer manager's timeouts in a timer wheel with ticks",
+"            of <secs> seconds (default: 0.001) (-threaded only)",
+"  --stm-clock",
+"            Version TVars with a global clock, so that STM transactions",
+"            always see a consistent snapshot and read-only ones commit",
+"            without locking (-threaded only)",
+"  --stm-backoff",
+"            Back off for a random, exponentially growing time before",
+"            re-running an aborted STM transaction (-threaded only)",
+"  --stm-serialise=<n>",
+"            Run an STM transaction alone once it has aborted <n> times",
+"            in a row (default: 0, never)",
+"  --stm-wake=<k>",
+"            Wake at most <k> of the threads blocked in retry on a TVar",
+"            when it is updated (default: 0, all of them)",
 #if defined(THREADED_RTS)
 "  -e<n>     Maximum number of outstanding local sparks (default: 4096)",
 #endif
@@ -762,6 +832,137 @@ error = true;
                       OPTION_UNSAFE;
                       RtsFlags.MiscFlags.machineReadable = true;
                   }
+                  else if (strequal("sched-stats",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.MiscFlags.schedStats = true;
+                  }
+                  else if (strequal("io-uring",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.MiscFlags.ioUring = true;
+                  }
+                  else if (!strncmp("timer-wheel", &rts_argv[arg][2], 11)) {
+                      OPTION_SAFE;
+                      if (rts_argv[arg][13] == '\0') {
+                          RtsFlags.MiscFlags.timerWheelTick = USToTime(1000);
+                      } else if (rts_argv[arg][13] == '=') {
+                          Time t = fsecondsToTime(atof(rts_argv[arg]+14));
+                          if (t <= 0) {
+                              errorBelch("%s: tick must be positive",
+                                         rts_argv[arg]);
+                              error = true;
+                          } else {
+                              RtsFlags.MiscFlags.timerWheelTick = t;
+                          }
+                      } else {
+                          errorBelch("unknown RTS option: %s",rts_argv[arg]);
+                          error = true;
+                      }
+                  }
+                  else if (strequal("stm-clock",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.MiscFlags.stmClock = true;
+                  }
+                  else if (strequal("stm-backoff",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.MiscFlags.stmBackoff = true;
+                  }
+                  else if (!strncmp("stm-serialise", &rts_argv[arg][2], 13)) {
+                      OPTION_SAFE;
+                      if (rts_argv[arg][15] == '=' &&
+                          isdigit(rts_argv[arg][16])) {
+                          RtsFlags.MiscFlags.stmSerialiseAfter =
+                              (uint32_t)strtol(rts_argv[arg]+16,
+                                               (char **) NULL, 10);
+                      } else {
+                          errorBelch("%s: missing number of aborts",
+                                     rts_argv[arg]);
+                          error = true;
+                      }
+                  }
+                  else if (!strncmp("stm-wake", &rts_argv[arg][2], 8)) {
+                      OPTION_SAFE;
+                      if (rts_argv[arg][10] == '=' &&
+                          isdigit(rts_argv[arg][11])) {
+                          RtsFlags.MiscFlags.stmWakeLimit =
+                              (uint32_t)strtol(rts_argv[arg]+11,
+                                               (char **) NULL, 10);
+                      } else {
+                          errorBelch("%s: missing number of threads",
+                                     rts_argv[arg]);
+                          error = true;
+                      }
+                  }
+                  else if (!strncmp("eventlog-fd=", &rts_argv[arg][2], 12)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          if (isdigit(rts_argv[arg][14])) {
+                              RtsFlags.TraceFlags.eventlogSink =
+                                  EVENTLOG_SINK_FD;
+                              RtsFlags.TraceFlags.eventlogFd =
+                                  (int)strtol(rts_argv[arg]+14,
+                                              (char **) NULL, 10);
+                              read_eventlog_sink_flag();
+                          } else {
+                              errorBelch("%s: missing file descriptor",
+                                         rts_argv[arg]);
+                              error = true;
+                          }
+                          );
+                  }
+                  else if (!strncmp("eventlog-flush=", &rts_argv[arg][2], 15)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          if (read_eventlog_flush_flag(rts_argv[arg]+17)) {
+                              errorBelch("%s: expected sync, block, drop or grow",
+                                         rts_argv[arg]);
+                              error = true;
+                          }
+                          );
+                  }
+                  else if (strequal("eventlog-compact",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.eventlogCompact = true;
+                          );
+                  }
+                  else if (!strncmp("cpu-sample", &rts_argv[arg][2], 10) &&
+                           (rts_argv[arg][12] == '\0' ||
+                            rts_argv[arg][12] == '=')) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          if (rts_argv[arg][12] == '\0') {
+                              RtsFlags.TraceFlags.cpuSampleInterval =
+                                  DEFAULT_TICK_INTERVAL;
+                          } else {
+                              RtsFlags.TraceFlags.cpuSampleInterval =
+                                  fsecondsToTime(atof(rts_argv[arg]+13));
+                          }
+                          read_eventlog_sink_flag();
+                          );
+                  }
+                  else if (!strncmp("eventlog-pipe=", &rts_argv[arg][2], 14)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.eventlogSink =
+                              EVENTLOG_SINK_PIPE;
+                          RtsFlags.TraceFlags.eventlogPath = rts_argv[arg]+16;
+                          read_eventlog_sink_flag();
+                          );
+                  }
+                  else if (!strncmp("eventlog-socket=", &rts_argv[arg][2], 16)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.eventlogSink =
+                              EVENTLOG_SINK_SOCKET;
+                          RtsFlags.TraceFlags.eventlogPath = rts_argv[arg]+18;
+                          read_eventlog_sink_flag();
+                          );
+                  }
                   else if (strequal("info",
                                &rts_argv[arg][2])) {
                       OPTION_SAFE;
@@ -788,6 +989,24 @@ error = true;
                       RtsFlags.GcFlags.numa = true;
                       RtsFlags.GcFlags.numaMask = mask;
                   }
+                  else if (!strncmp("affinity=", &rts_argv[arg][2], 9)) {
+                      OPTION_SAFE;
+                      const char *policy = &rts_argv[arg][11];
+                      if (strequal(policy, "compact")) {
+                          RtsFlags.ParFlags.affinityPolicy = AFFINITY_COMPACT;
+                      } else if (strequal(policy, "scatter")) {
+                          RtsFlags.ParFlags.affinityPolicy = AFFINITY_SCATTER;
+                      } else if (strequal(policy, "cores")) {
+                          RtsFlags.ParFlags.affinityPolicy = AFFINITY_CORES;
+                      } else {
+                          errorBelch("%s: unknown affinity policy, expected "
+                                     "compact, scatter or cores",
+                                     rts_argv[arg]);
+                          error = true;
+                          break;
+                      }
+                      RtsFlags.ParFlags.setAffinity = true;
+                  }
 #endif
 #if defined(DEBUG) && defined(THREADED_RTS)
                   else if (!strncmp("debug-numa", &rts_argv[arg][2], 10)) {
@@ -1230,6 +1449,17 @@ error = true;
                     case 'a':
                         RtsFlags.ParFlags.setAffinity = true;
                         break;
+                    case 'e':
+                        RtsFlags.ParFlags.elasticCapabilities = true;
+                        if (rts_argv[arg][3] != '\0') {
+                            RtsFlags.ParFlags.elasticInterval =
+                                fsecondsToTime(atof(rts_argv[arg]+3));
+                            if (RtsFlags.ParFlags.elasticInterval <= 0) {
+                                errorBelch("bad value for -qe");
+                                error = true;
+                            }
+                        }
+                        break;
                     case 'm':
                         RtsFlags.ParFlags.migrate = false;
                         break;
@@ -1422,6 +1652,9 @@ static void normaliseRtsOpts (void)
         RtsFlags.ConcFlags.ctxtSwitchTime  = 0;
         RtsFlags.GcFlags.idleGCDelayTime   = 0;
         RtsFlags.ProfFlags.heapProfileInterval = 0;
+#if defined(TRACING)
+        RtsFlags.TraceFlags.cpuSampleInterval = 0;
+#endif
     }
 
     // Determine what tick interval we should use for the RTS timer
@@ -1445,6 +1678,14 @@ static void normaliseRtsOpts (void)
                     RtsFlags.MiscFlags.tickInterval);
     }
 
+#if defined(TRACING)
+    if (RtsFlags.TraceFlags.cpuSampleInterval > 0) {
+        RtsFlags.MiscFlags.tickInterval =
+            stg_min(RtsFlags.TraceFlags.cpuSampleInterval,
+                    RtsFlags.MiscFlags.tickInterval);
+    }
+#endif
+
     if (RtsFlags.ConcFlags.ctxtSwitchTime > 0) {
         RtsFlags.ConcFlags.ctxtSwitchTicks =
             RtsFlags.ConcFlags.ctxtSwitchTime /
@@ -1461,6 +1702,16 @@ static void normaliseRtsOpts (void)
         RtsFlags.ProfFlags.heapProfileIntervalTicks = 0;
     }
 
+#if defined(TRACING)
+    if (RtsFlags.TraceFlags.cpuSampleInterval > 0) {
+        RtsFlags.TraceFlags.cpuSampleIntervalTicks =
+            RtsFlags.TraceFlags.cpuSampleInterval /
+            RtsFlags.MiscFlags.tickInterval;
+    } else {
+        RtsFlags.TraceFlags.cpuSampleIntervalTicks = 0;
+    }
+#endif
+
     if (RtsFlags.GcFlags.stkChunkBufferSize >
         RtsFlags.GcFlags.stkChunkSize / 2) {
         errorBelch("stack chunk buffer size (-kb) must be less than 50%%\n"
@@ -1807,6 +2058,36 @@ static bool read_heap_profiling_flag(const char *arg)
 #endif
 
 #if defined(TRACING)
+/* --eventlog-fd, --eventlog-pipe, --eventlog-socket and --cpu-sample imply
+ * -l, with the default trace classes, unless tracing has been asked for
+ * already.
+ */
+static void read_eventlog_sink_flag(void)
+{
+    if (RtsFlags.TraceFlags.tracing == TRACE_NONE) {
+        RtsFlags.TraceFlags.tracing = TRACE_EVENTLOG;
+        read_trace_flags("");
+    }
+}
+
+// Parse the policy of --eventlog-flush=<policy>, returning whether the
+// parse resulted in an error.
+static bool read_eventlog_flush_flag(const char *arg)
+{
+    if (strequal(arg, "sync")) {
+        RtsFlags.TraceFlags.eventlogFlush = EVENTLOG_FLUSH_SYNC;
+    } else if (strequal(arg, "block")) {
+        RtsFlags.TraceFlags.eventlogFlush = EVENTLOG_FLUSH_BLOCK;
+    } else if (strequal(arg, "drop")) {
+        RtsFlags.TraceFlags.eventlogFlush = EVENTLOG_FLUSH_DROP;
+    } else if (strequal(arg, "grow")) {
+        RtsFlags.TraceFlags.eventlogFlush = EVENTLOG_FLUSH_GROW;
+    } else {
+        return true;
+    }
+    return false;
+}
+
 static void read_trace_flags(const char *arg)
 {
     const char *c;
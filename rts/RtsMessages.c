@@ -176,7 +176,7 @@ rtsFatalInternalErrorFn(const char *s, va_list ap)
   }
 
 #ifdef TRACING
-  if (RtsFlags.TraceFlags.tracing == TRACE_EVENTLOG) endEventLogging();
+  closeEventLogAfterError();
 #endif
 
   abort();
@@ -16,6 +16,8 @@
 #include "Prelude.h"
 #include "Printer.h"    /* DEBUG_LoadSymbols */
 #include "Schedule.h"   /* initScheduler */
+#include "ElasticCapabilities.h"
+#include "CpuTopology.h"
 #include "Stats.h"      /* initStats */
 #include "STM.h"        /* initSTM */
 #include "RtsSignals.h"
@@ -35,6 +37,7 @@
 #include "FileLock.h"
 #include "LinkerInternals.h"
 #include "LibdwPool.h"
+#include "CpuSample.h"
 #include "sm/CNF.h"
 #include "TopHandler.h"
 
@@ -198,6 +201,14 @@ hs_init_ghc(int *argc, char **argv[], RtsConfig rts_config)
     /* Initialise libdw session pool */
     libdwPoolInit();
 
+    /* +RTS --cpu-sample (needs the libdw session pool) */
+    initCpuSampling();
+
+    /* work out where to place capabilities for +RTS --affinity (needs
+     * to be done before the capabilities are created in initScheduler())
+     */
+    initCpuTopology();
+
     /* initialise scheduler data structures (needs to be done before
      * initStorage()).
      */
@@ -285,6 +296,9 @@ hs_init_ghc(int *argc, char **argv[], RtsConfig rts_config)
     ioManagerStart();
 #endif
 
+    /* start adjusting the number of capabilities, if +RTS -qe */
+    startElasticCapabilities();
+
     /* Record initialization times */
     stat_endInit();
 }
@@ -344,6 +358,9 @@ hs_exit_(bool wait_foreign)
 
     rtsConfig.onExitHook();
 
+    // must be before anything that stops the capabilities
+    stopElasticCapabilities();
+
     flushStdHandles();
 
     // sanity check
@@ -406,6 +423,9 @@ hs_exit_(bool wait_foreign)
     /* free the tasks */
     freeScheduler();
 
+    /* free the CPU topology used for +RTS --affinity */
+    freeCpuTopology();
+
     /* free shared Typeable store */
     exitGlobalStore();
 
@@ -448,6 +468,8 @@ hs_exit_(bool wait_foreign)
     freeTracing();
 #endif
 
+    exitCpuSampling();
+
 #if defined(TICKY_TICKY)
     if (RtsFlags.TickyFlags.showTickyStats) PrintTickyInfo();
 
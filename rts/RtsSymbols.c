@@ -596,6 +596,7 @@
       SymI_HasProto(getOrSetLibHSghcFastStringTable)                    \
       SymI_HasProto(getRTSStats)                                        \
       SymI_HasProto(getRTSStatsEnabled)                                 \
+      SymI_HasProto(getCapabilitySchedStats)                            \
       SymI_HasProto(getOrSetLibHSghcPersistentLinkerState)              \
       SymI_HasProto(getOrSetLibHSghcInitLinkerDone)                     \
       SymI_HasProto(getOrSetLibHSghcGlobalDynFlags)                     \
@@ -691,6 +692,16 @@
       SymI_HasProto(stg_readTVarIOzh)                                   \
       SymI_HasProto(resumeThread)                                       \
       SymI_HasProto(setNumCapabilities)                                 \
+      SymI_HasProto(startEventLogging)                                  \
+      SymI_HasProto(startEventLoggingToFd)                              \
+      SymI_HasProto(startEventLoggingToPipe)                            \
+      SymI_HasProto(startEventLoggingToSocket)                          \
+      SymI_HasProto(getEventLogClasses)                                 \
+      SymI_HasProto(setEventLogClasses)                                 \
+      SymI_HasProto(userEventsEnabled)                                  \
+      SymI_HasProto(endEventLogging)                                    \
+      SymI_HasProto(eventLogStatus)                                     \
+      SymI_HasProto(FileEventLogWriter)                                 \
       SymI_HasProto(getNumberOfProcessors)                              \
       SymI_HasProto(resolveObjs)                                        \
       SymI_HasProto(stg_retryzh)                                        \
@@ -748,6 +759,8 @@
       SymI_HasProto(rts_getThreadAllocationCounter)                     \
       SymI_HasProto(rts_setThreadAllocationCounter)                     \
       SymI_HasProto(rts_enableThreadAllocationLimit)                    \
+      SymI_HasProto(rts_getThreadPriority)                              \
+      SymI_HasProto(rts_setThreadPriority)                              \
       SymI_HasProto(rts_disableThreadAllocationLimit)                   \
       SymI_HasProto(rts_setMainThread)                                  \
       SymI_HasProto(setProgArgv)                                        \
@@ -93,8 +93,10 @@
 #include "Threads.h"
 #include "sm/Storage.h"
 #include "SMPClosureOps.h"
+#include "Hash.h"
 
 #include <stdio.h>
+#include <string.h>
 
 // ACQ_ASSERT is used for assertions which are only required for
 // THREADED_RTS builds with fine-grained locking.
@@ -163,6 +165,34 @@ static int shake(void) {
 
 #define REUSE_MEMORY
 
+/*
+ * Note [STM pools]
+ * ~~~~~~~~~~~~~~~~
+ *
+ * TRec headers and chunks are freed when a transaction commits or is
+ * aborted, and watch queue entries when a thread stops waiting, onto
+ * per-Capability free lists (cap->free_trec_headers and so on) from
+ * which the next transactions allocate.  A free header keeps its first
+ * chunk, so a transaction of up to TREC_CHUNK_NUM_ENTRIES TVars
+ * allocates nothing once the pool has a header in it.
+ *
+ * The free lists are GC roots (markCapability), so that the pools
+ * survive garbage collection; before each GC, stmPreGCHook trims them to
+ * the sizes below, so that a burst of nested or waiting transactions
+ * does not keep memory alive for good.  Because the GC traverses free
+ * objects, freeing one clears its pointers to anything the transaction
+ * used (the entries of chunks, and the closure and prev_queue_entry of
+ * watch queue entries).  A free header keeps its index (Note [TRec
+ * index]) for the next transaction to reuse, but stmPreGCHook drops it,
+ * so that a large index does not live in the pool for good.  All three
+ * kinds of object are always on the mutable list once they are in an
+ * old generation, so reusing them needs no write barrier.
+ */
+
+#define STM_POOL_TREC_HEADERS   16
+#define STM_POOL_TREC_CHUNKS    32
+#define STM_POOL_WATCH_QUEUES  128
+
 /*......................................................................*/
 
 #define IF_STM_UNIPROC(__X)  do { } while (0)
@@ -360,6 +390,18 @@ static StgBool watcher_is_invariant(StgTVarWatchQueue *q) {
 
 // Helper functions for thread blocking and unblocking
 
+// If a targeted wakeup set q->woken, make tso responsible for handing it
+// on: only tso's own Capability may write to the TSO, as it must put it
+// on its mutable list (see Note [Targeted STM wakeups])
+static void take_wakeup(Capability *cap, StgTSO *tso,
+                        StgTVarWatchQueue *q, StgTVar *s) {
+  if (q -> woken) {
+    q -> woken = 0;
+    tso -> stm_woken_by = (StgClosure *)s;
+    dirty_TSO(cap, tso);
+  }
+}
+
 static void park_tso(StgTSO *tso) {
   ASSERT(tso -> why_blocked == NotBlocked);
   tso -> why_blocked = BlockedOnSTM;
@@ -367,7 +409,13 @@ static void park_tso(StgTSO *tso) {
   TRACE("park_tso on tso=%p", tso);
 }
 
-static void unpark_tso(Capability *cap, StgTSO *tso) {
+// Wake tso if it is blocked in retry, and return whether we did.  If q,
+// the entry of tso in a watch queue, is not NULL, tso becomes responsible
+// for handing the wakeup on (see Note [Targeted STM wakeups]).
+static StgBool unpark_tso(Capability *cap, StgTSO *tso,
+                          StgTVarWatchQueue *q) {
+    StgBool woken = false;
+
     // We will continue unparking threads while they remain on one of the wait
     // queues: it's up to the thread itself to remove it from the wait queues
     // if it decides to do so when it is scheduled.
@@ -385,16 +433,25 @@ static void unpark_tso(Capability *cap, StgTSO *tso) {
     } else if (tso -> why_blocked == BlockedOnSTM) {
       TRACE("unpark_tso on tso=%p", tso);
       tso->block_info.closure = &stg_STM_AWOKEN_closure;
+      if (q != NULL) {
+        // Not a pointer, so any Capability may set it; tso's own
+        // Capability moves it to the TSO (take_wakeup)
+        q->woken = 1;
+      }
+      woken = true;
       tryWakeupThread(cap,tso);
     } else {
       TRACE("spurious unpark_tso on tso=%p", tso);
     }
     unlockTSO(tso);
+    return woken;
 }
 
 static void unpark_waiters_on(Capability *cap, StgTVar *s) {
   StgTVarWatchQueue *q;
   StgTVarWatchQueue *trail;
+  uint32_t limit = RtsFlags.MiscFlags.stmWakeLimit;
+  uint32_t woken = 0;
   TRACE("unpark_waiters_on tvar=%p", s);
   // unblock TSOs in reverse order, to be a bit fairer (#2319)
   for (q = s -> first_watch_queue_entry, trail = q;
@@ -407,11 +464,67 @@ static void unpark_waiters_on(Capability *cap, StgTVar *s) {
        q != END_STM_WATCH_QUEUE;
        q = q -> prev_queue_entry) {
     if (watcher_is_tso(q)) {
-      unpark_tso(cap, (StgTSO *)(q -> closure));
+      if (limit == 0) {
+        unpark_tso(cap, (StgTSO *)(q -> closure), NULL);
+      } else if (unpark_tso(cap, (StgTSO *)(q -> closure), q) &&
+                 ++woken == limit) {
+        TRACE("unpark_waiters_on tvar=%p woke %d", s, woken);
+        break;
+      }
     }
   }
 }
 
+/*
+ * Note [Targeted STM wakeups]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * By default a commit that updates a TVar wakes every thread blocked in
+ * retry on it.  When many threads wait on one TVar, e.g. consumers
+ * waiting for a queue to become non-empty, each push wakes all of them,
+ * and all but one re-run their transaction only to retry again.
+ *
+ * With +RTS --stm-wake=<k>, unpark_waiters_on wakes at most k threads
+ * that are not already awake, oldest waiter first, like signalling a
+ * condition variable rather than broadcasting.  The other waiters stay
+ * asleep, and each woken thread is then responsible for the next wakeup.
+ * It discharges that responsibility (hand_on_wakeup)
+ *
+ *   - by committing an update to the TVar, which wakes the next k
+ *     waiters in the usual way;
+ *
+ *   - by committing without updating the TVar: it did not use up what
+ *     it was woken for, so we wake the next k waiters on its behalf;
+ *
+ *   - by giving up the transaction because of an exception
+ *     (stmAbandonTransaction), which also wakes the next k waiters;
+ *
+ *   - by blocking in retry again, with no further wakeup: it has seen
+ *     the TVar's new value and still cannot proceed, and we assume that
+ *     nor can the other waiters.
+ *
+ * The waker cannot record the TVar in the TSO of a thread on another
+ * Capability, as that needs a write barrier that only the owner may
+ * apply (dirty_TSO).  Instead it sets the woken flag of the thread's
+ * entry in the TVar's watch queue, which is not a pointer and so needs
+ * no barrier, and the thread itself moves the TVar to tso->stm_woken_by
+ * (take_wakeup) when it runs again (stmReWait), or when its entries are
+ * removed because it is interrupted.  So threads on every Capability
+ * count towards the k.
+ *
+ * The last assumption only holds if all the threads waiting on a TVar
+ * wait for the same condition, which is why this is not the default:
+ * if some wait for a queue to become non-empty and others for it to
+ * become non-full, a wakeup can go to the wrong kind of waiter and the
+ * right one is never woken.
+ *
+ * A woken thread first checks, without locking anything, whether any
+ * TVar it read has changed (read_set_changed in stmReWait), and only
+ * locks its read set if none has, to go back to sleep safely.
+ */
+
+/*......................................................................*/
+
 /*......................................................................*/
 
 // Helper functions for downstream allocation and initialization
@@ -432,6 +545,7 @@ static StgTVarWatchQueue *new_stg_tvar_watch_queue(Capability *cap,
   result = (StgTVarWatchQueue *)allocate(cap, sizeofW(StgTVarWatchQueue));
   SET_HDR (result, &stg_TVAR_WATCH_QUEUE_info, CCS_SYSTEM);
   result -> closure = closure;
+  result -> woken = 0;
   return result;
 }
 
@@ -453,6 +567,9 @@ static StgTRecHeader *new_stg_trec_header(Capability *cap,
   result -> enclosing_trec = enclosing_trec;
   result -> current_chunk = new_stg_trec_chunk(cap);
   result -> invariants_to_check = END_INVARIANT_CHECK_QUEUE;
+  result -> index = NO_TREC_INDEX;
+  result -> num_entries = 0;
+  result -> read_version = 0;
 
   if (enclosing_trec == NO_TREC) {
     result -> state = TREC_ACTIVE;
@@ -467,6 +584,290 @@ static StgTRecHeader *new_stg_trec_header(Capability *cap,
 
 /*......................................................................*/
 
+/*
+ * Note [TRec index]
+ * ~~~~~~~~~~~~~~~~~
+ *
+ * Each TVar has at most one entry in a TRec, and finding it (on every
+ * readTVar and writeTVar, and when merging a nested transaction into its
+ * parent) used to mean scanning all of the TRec's chunks, so a
+ * transaction that touched n TVars took O(n^2) time.
+ *
+ * Once a TRec has more than TREC_INDEX_THRESHOLD entries we keep an
+ * index alongside it: an open-addressing hash table, with linear
+ * probing, from TVar addresses to the TRec's entries.  It lives in the
+ * payload of an ARR_WORDS hanging off the TRec header (NO_TREC_INDEX
+ * when there is none), so that it is freed along with the TRec.  The
+ * table is kept at most half full, and doubles when it gets fuller.
+ *
+ * The GC moves both the TVars, whose addresses we hash, and the chunks
+ * that hold the entries, and it does not look inside an ARR_WORDS.  So
+ * rather than updating indexes during GC, we stamp each one with the
+ * value of trec_index_epoch when it was built; stmPreGCHook bumps the
+ * epoch, and an index with an old stamp is rebuilt the next time it is
+ * needed.  Small transactions never build an index, and pay only for
+ * maintaining num_entries.
+ *
+ * The index also lets stmValidateNestOfTransactions skip the entries of
+ * an enclosing TRec that are shadowed by an entry in a nested one: the
+ * nested entry holds the same expected value (see merge_read_into and
+ * stmReadTVar), and has been checked already.
+ */
+
+#define TREC_INDEX_THRESHOLD 32
+#define TREC_INDEX_MIN_BITS 6
+
+typedef struct {
+  StgWord epoch;
+  StgWord bits;     // the table has 2^bits slots
+  StgWord used;
+  TRecEntry *slots[];
+} TRecIndex;
+
+static volatile StgWord trec_index_epoch = 0;
+
+#define TREC_INDEX_INVALID ((StgWord)-1)
+
+static void invalidate_index(StgTRecHeader *t) {
+  if (t -> index != NO_TREC_INDEX) {
+    ((TRecIndex *)(t -> index -> payload)) -> epoch = TREC_INDEX_INVALID;
+  }
+}
+
+// The index of t, or NULL if it has none that is up to date
+static TRecIndex *valid_index(StgTRecHeader *t) {
+  TRecIndex *idx;
+  if (t -> index == NO_TREC_INDEX) {
+    return NULL;
+  }
+  idx = (TRecIndex *)(t -> index -> payload);
+  return (idx -> epoch == trec_index_epoch) ? idx : NULL;
+}
+
+static StgWord index_slot(TRecIndex *idx, StgTVar *tvar) {
+#if SIZEOF_VOID_P == 8
+  return ((StgWord)tvar * UINT64_C(0x9e3779b97f4a7c15)) >> (64 - idx -> bits);
+#else
+  return ((StgWord)tvar * 0x9e3779b9U) >> (32 - idx -> bits);
+#endif
+}
+
+static void index_insert(TRecIndex *idx, TRecEntry *e) {
+  StgWord mask = ((StgWord)1 << idx -> bits) - 1;
+  StgWord i = index_slot(idx, e -> tvar);
+  while (idx -> slots[i] != NULL) {
+    i = (i + 1) & mask;
+  }
+  idx -> slots[i] = e;
+  idx -> used ++;
+}
+
+static TRecEntry *index_lookup(TRecIndex *idx, StgTVar *tvar) {
+  StgWord mask = ((StgWord)1 << idx -> bits) - 1;
+  StgWord i = index_slot(idx, tvar);
+  TRecEntry *e;
+  while ((e = idx -> slots[i]) != NULL) {
+    if (e -> tvar == tvar) {
+      return e;
+    }
+    i = (i + 1) & mask;
+  }
+  return NULL;
+}
+
+// (Re)build the index of t, with room for it to double in size before it
+// needs growing.  The old ARR_WORDS is reused if it is big enough.
+static TRecIndex *build_index(Capability *cap, StgTRecHeader *t) {
+  StgWord bits = TREC_INDEX_MIN_BITS;
+  StgWord bytes;
+  TRecIndex *idx;
+
+  while (((StgWord)1 << bits) < 4 * t -> num_entries) {
+    bits ++;
+  }
+  bytes = sizeof(TRecIndex) + (sizeof(TRecEntry *) << bits);
+
+  if (t -> index == NO_TREC_INDEX || t -> index -> bytes < bytes) {
+    StgArrBytes *arr;
+    arr = (StgArrBytes *)allocate(cap, sizeofW(StgArrBytes) +
+                                       ROUNDUP_BYTES_TO_WDS(bytes));
+    SET_ARR_HDR(arr, &stg_ARR_WORDS_info, CCS_SYSTEM, bytes);
+    t -> index = arr;
+  } else {
+    // Use all of the space we have
+    while (sizeof(TRecIndex) + (sizeof(TRecEntry *) << (bits + 1))
+           <= t -> index -> bytes) {
+      bits ++;
+    }
+  }
+
+  idx = (TRecIndex *)(t -> index -> payload);
+  idx -> epoch = trec_index_epoch;
+  idx -> bits = bits;
+  idx -> used = 0;
+  memset(idx -> slots, 0, sizeof(TRecEntry *) << bits);
+  FOR_EACH_ENTRY(t, e, {
+    index_insert(idx, e);
+  });
+
+  TRACE("%p : built index of %ld slots for %ld entries",
+        t, (long)1 << bits, (long)t -> num_entries);
+  return idx;
+}
+
+/*......................................................................*/
+
+/*
+ * Note [STM global clock]
+ * ~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * By default a transaction can read TVars written by transactions that
+ * commit while it runs, and so see an inconsistent view of memory.  This
+ * is harmless in the end, because it will fail to commit, but until then
+ * it may loop or raise an exception, so the scheduler validates every
+ * transaction each time its thread stops running (schedulePostRunThread),
+ * and commits must re-check every TVar that was read (check_read_only).
+ *
+ * With +RTS --stm-clock we do as TL2 does instead.  A commit that updates
+ * TVars increments stm_clock once it has locked them, and stamps them
+ * with the new time in num_updates as it unlocks them.  A transaction
+ * notes the time when it starts, in the read_version of its TRec, and
+ * each TVar it reads from memory must have been written no later: its
+ * reads then all come from the snapshot of memory at that time.  If a
+ * TVar is newer, we try to move the snapshot forward to the current time,
+ * which we may if nothing the transaction has read so far has changed
+ * (extend_snapshot).  If that fails the TRec is condemned, and
+ * stg_readTVarzh returns to the scheduler, which restarts the
+ * transaction, before its code sees the inconsistent value.
+ *
+ * So a transaction never sees an inconsistent view of memory, and
+ *
+ *   - the scheduler need not validate it (stmValidateNestOfTransactions
+ *     just checks whether it has been condemned);
+ *
+ *   - a transaction that has not updated any TVar commits without locking
+ *     or checking anything: it happened at the time of its snapshot;
+ *
+ *   - a transaction that has updated TVars need not check its reads at
+ *     commit if no other transaction has committed an update since it
+ *     started, i.e. if the clock only moved on for its own commit.
+ *
+ * Nested TRecs share the snapshot of their enclosing TRec, and moving it
+ * forward moves it for the whole nest.
+ *
+ * This only applies to STM_FG_LOCKS; with the other schemes there are no
+ * concurrent commits, and the flag has no effect.
+ */
+
+static volatile StgWord stm_clock = 0;
+
+#if defined(STM_FG_LOCKS)
+#define STM_CLOCK_MODE (RtsFlags.MiscFlags.stmClock)
+#else
+#define STM_CLOCK_MODE false
+#endif
+
+// Move the snapshot of trec's nest forward to the current time, if
+// nothing it has read has changed since the snapshot was taken.
+static StgBool extend_snapshot(StgTRecHeader *trec) {
+  StgTRecHeader *t;
+  StgBool result = true;
+  StgWord now;
+
+  // Read the clock before any TVar, so that we see every update stamped
+  // with a time up to now
+  now = stm_clock;
+  load_load_barrier();
+  for (t = trec; result && t != NO_TREC; t = t -> enclosing_trec) {
+    FOR_EACH_ENTRY(t, e, {
+      StgTVar *s = e -> tvar;
+      // The value must be the one we saw, and not have been written back
+      // after the time we want to move to
+      if (s -> current_value != e -> expected_value) {
+        result = false;
+        BREAK_FOR_EACH;
+      }
+      load_load_barrier();
+      if ((StgWord)s -> num_updates > now) {
+        result = false;
+        BREAK_FOR_EACH;
+      }
+    });
+  }
+
+  if (result) {
+    TRACE("%p : extending snapshot from %ld to %ld",
+          trec, (long)trec -> read_version, (long)now);
+    for (t = trec; t != NO_TREC; t = t -> enclosing_trec) {
+      t -> read_version = now;
+    }
+  }
+  return result;
+}
+
+/*......................................................................*/
+
+/*
+ * Note [STM contention management]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * A transaction that fails to commit, or that the scheduler finds to be
+ * invalid, is re-run straight away by stmRestartTransaction.  Under high
+ * contention the same transactions then keep colliding, and a long
+ * transaction can lose to shorter ones indefinitely.  Two remedies can be
+ * turned on:
+ *
+ *   - +RTS --stm-backoff: before re-running, spin for a random number of
+ *     iterations below 2^n, where n is the number of consecutive aborts
+ *     of the transaction (tso->stm_aborts).  We spin rather than yield,
+ *     as yielding would let the thread that just won run again on our
+ *     Capability; and we only spin when other Capabilities can make
+ *     progress meanwhile.
+ *
+ *   - +RTS --stm-serialise=<n>: once a transaction has aborted n times in
+ *     a row its thread takes the serial token (stm_serial_owner), if
+ *     nobody else holds it.  While the token is held by another thread,
+ *     stmCommitTransaction fails any commit that would update a TVar, so
+ *     the owner can only be invalidated by commits that were already
+ *     under way.  Read-only commits cannot invalidate it and go ahead.
+ *     The token is released when the owner commits, blocks in retry
+ *     (stmWait: it could otherwise wait for a commit that cannot happen)
+ *     or abandons the transaction because of an exception
+ *     (stmAbandonTransaction).
+ *
+ * Whatever the policy, we count commits and aborts per Capability
+ * (cap->stm_stats, summed by getRTSStats), post an EVENT_STM_ABORT for
+ * each abort, and, while the eventlog is running, count aborts per
+ * atomically site in a table on the Capability.  The site is the
+ * info pointer of the STM action passed to atomically#, which the
+ * symbol table maps back to the code.  The TVar named in the event is
+ * the one whose check failed most recently on the Capability
+ * (note_conflict); it is a hint only, and is forgotten at GC, which may
+ * move the TVar.
+ */
+
+static volatile StgWord stm_serial_owner = 0;
+
+static void note_conflict(Capability *cap, StgTVar *tvar) {
+  cap -> stm_conflict = tvar;
+}
+
+// Is the serial token held by a thread other than tso?
+static StgBool serialised_by_other(StgTSO *tso) {
+  StgWord owner = stm_serial_owner;
+  return owner != 0 && owner != (StgWord)tso -> id;
+}
+
+static void release_serial_token(StgTSO *tso) {
+  if (stm_serial_owner == (StgWord)tso -> id) {
+    TRACE("thread %ld releasing the serial token", (long)tso -> id);
+    write_barrier();
+    stm_serial_owner = 0;
+  }
+}
+
+/*......................................................................*/
+
 // Allocation / deallocation functions that retain per-capability lists
 // of closures that can be re-used
 
@@ -492,6 +893,7 @@ static StgTVarWatchQueue *alloc_stg_tvar_watch_queue(Capability *cap,
   } else {
     result = cap -> free_tvar_watch_queues;
     result -> closure = closure;
+    result -> woken = 0;
     cap -> free_tvar_watch_queues = result -> next_queue_entry;
   }
   return result;
@@ -500,6 +902,8 @@ static StgTVarWatchQueue *alloc_stg_tvar_watch_queue(Capability *cap,
 static void free_stg_tvar_watch_queue(Capability *cap,
                                       StgTVarWatchQueue *wq) {
 #if defined(REUSE_MEMORY)
+  wq -> closure = (StgClosure *)END_TSO_QUEUE;
+  wq -> prev_queue_entry = END_STM_WATCH_QUEUE;
   wq -> next_queue_entry = cap -> free_tvar_watch_queues;
   cap -> free_tvar_watch_queues = wq;
 #endif
@@ -521,6 +925,7 @@ static StgTRecChunk *alloc_stg_trec_chunk(Capability *cap) {
 static void free_stg_trec_chunk(Capability *cap,
                                 StgTRecChunk *c) {
 #if defined(REUSE_MEMORY)
+  c -> next_entry_idx = 0;
   c -> prev_chunk = cap -> free_trec_chunks;
   cap -> free_trec_chunks = c;
 #endif
@@ -537,6 +942,8 @@ static StgTRecHeader *alloc_stg_trec_header(Capability *cap,
     result -> enclosing_trec = enclosing_trec;
     result -> current_chunk -> next_entry_idx = 0;
     result -> invariants_to_check = END_INVARIANT_CHECK_QUEUE;
+    result -> num_entries = 0;
+    invalidate_index(result);
     if (enclosing_trec == NO_TREC) {
       result -> state = TREC_ACTIVE;
     } else {
@@ -558,6 +965,8 @@ static void free_stg_trec_header(Capability *cap,
     chunk = prev_chunk;
   }
   trec -> current_chunk -> prev_chunk = END_STM_CHUNK_LIST;
+  trec -> current_chunk -> next_entry_idx = 0;
+  trec -> invariants_to_check = END_INVARIANT_CHECK_QUEUE;
   trec -> enclosing_trec = cap -> free_trec_headers;
   cap -> free_trec_headers = trec;
 #endif
@@ -619,6 +1028,7 @@ static void remove_watch_queue_entries_for_trec(Capability *cap,
           trec,
           q -> closure,
           s);
+    take_wakeup(cap, (StgTSO *)(q -> closure), q, s);
     ACQ_ASSERT(s -> current_value == (StgClosure *)trec);
     nq = q -> next_queue_entry;
     pq = q -> prev_queue_entry;
@@ -666,6 +1076,58 @@ static TRecEntry *get_new_entry(Capability *cap,
   return result;
 }
 
+// Add an entry for tvar to t, which must not have one already
+static TRecEntry *new_entry(Capability *cap,
+                            StgTRecHeader *t,
+                            StgTVar *tvar,
+                            StgClosure *expected_value,
+                            StgClosure *new_value) {
+  TRecEntry *result;
+  TRecIndex *idx;
+
+  result = get_new_entry(cap, t);
+  result -> tvar = tvar;
+  result -> expected_value = expected_value;
+  result -> new_value = new_value;
+  t -> num_entries ++;
+
+  // Keep an up-to-date index up to date; otherwise leave it to
+  // find_entry to build one when it needs it.
+  idx = valid_index(t);
+  if (idx != NULL) {
+    if (2 * (idx -> used + 1) > ((StgWord)1 << idx -> bits)) {
+      build_index(cap, t);
+    } else {
+      index_insert(idx, result);
+    }
+  }
+
+  return result;
+}
+
+// Find the entry for tvar in t itself, not in its enclosing TRecs
+static TRecEntry *find_entry(Capability *cap,
+                             StgTRecHeader *t,
+                             StgTVar *tvar) {
+  TRecEntry *result = NULL;
+
+  if (t -> num_entries > TREC_INDEX_THRESHOLD) {
+    TRecIndex *idx = valid_index(t);
+    if (idx == NULL) {
+      idx = build_index(cap, t);
+    }
+    return index_lookup(idx, tvar);
+  }
+
+  FOR_EACH_ENTRY(t, e, {
+    if (e -> tvar == tvar) {
+      result = e;
+      BREAK_FOR_EACH;
+    }
+  });
+  return result;
+}
+
 /*......................................................................*/
 
 static void merge_update_into(Capability *cap,
@@ -675,30 +1137,19 @@ static void merge_update_into(Capability *cap,
                               StgClosure *new_value)
 {
   // Look for an entry in this trec
-  bool found = false;
-  FOR_EACH_ENTRY(t, e, {
-    StgTVar *s;
-    s = e -> tvar;
-    if (s == tvar) {
-      found = true;
-      if (e -> expected_value != expected_value) {
-        // Must abort if the two entries start from different values
-        TRACE("%p : update entries inconsistent at %p (%p vs %p)",
-              t, tvar, e -> expected_value, expected_value);
-        t -> state = TREC_CONDEMNED;
-      }
-      e -> new_value = new_value;
-      BREAK_FOR_EACH;
+  TRecEntry *e = find_entry(cap, t, tvar);
+  if (e != NULL) {
+    if (e -> expected_value != expected_value) {
+      // Must abort if the two entries start from different values
+      TRACE("%p : update entries inconsistent at %p (%p vs %p)",
+            t, tvar, e -> expected_value, expected_value);
+      note_conflict(cap, tvar);
+      t -> state = TREC_CONDEMNED;
     }
-  });
-
-  if (!found) {
+    e -> new_value = new_value;
+  } else {
     // No entry so far in this trec
-    TRecEntry *ne;
-    ne = get_new_entry(cap, t);
-    ne -> tvar = tvar;
-    ne -> expected_value = expected_value;
-    ne -> new_value = new_value;
+    new_entry(cap, t, tvar, expected_value, new_value);
   }
 }
 
@@ -735,27 +1186,22 @@ static void merge_read_into(Capability *cap,
   //
   for (t = trec; !found && t != NO_TREC; t = t -> enclosing_trec)
   {
-    FOR_EACH_ENTRY(t, e, {
-      if (e -> tvar == tvar) {
-        found = true;
-        if (e -> expected_value != expected_value) {
-            // Must abort if the two entries start from different values
-            TRACE("%p : read entries inconsistent at %p (%p vs %p)",
-                  t, tvar, e -> expected_value, expected_value);
-            t -> state = TREC_CONDEMNED;
-        }
-        BREAK_FOR_EACH;
+    TRecEntry *e = find_entry(cap, t, tvar);
+    if (e != NULL) {
+      found = true;
+      if (e -> expected_value != expected_value) {
+          // Must abort if the two entries start from different values
+          TRACE("%p : read entries inconsistent at %p (%p vs %p)",
+                t, tvar, e -> expected_value, expected_value);
+          note_conflict(cap, tvar);
+          t -> state = TREC_CONDEMNED;
       }
-    });
+    }
   }
 
   if (!found) {
     // No entry found
-    TRecEntry *ne;
-    ne = get_new_entry(cap, trec);
-    ne -> tvar = tvar;
-    ne -> expected_value = expected_value;
-    ne -> new_value = expected_value;
+    new_entry(cap, trec, tvar, expected_value, expected_value);
   }
 }
 
@@ -819,9 +1265,29 @@ static void revert_ownership(Capability *cap STG_UNUSED,
 //     stashed in the TRec entries and are then checked in check_read_only
 //     to ensure that an atomic snapshot of all of these locations has been
 //     seen.
+//
+// If inner is not NO_TREC then trec encloses it, and entries for TVars
+// that also have an entry in inner, or in a TRec between the two, are
+// skipped (see Note [TRec index]).
+
+static StgBool entry_is_shadowed(Capability *cap,
+                                 StgTRecHeader *inner,
+                                 StgTRecHeader *trec,
+                                 StgTVar *tvar) {
+  StgTRecHeader *t;
+  for (t = inner; t != trec; t = t -> enclosing_trec) {
+    // Only worth a lookup if t has an index
+    if (t -> num_entries > TREC_INDEX_THRESHOLD &&
+        find_entry(cap, t, tvar) != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
 
 static StgBool validate_and_acquire_ownership (Capability *cap,
                                                StgTRecHeader *trec,
+                                               StgTRecHeader *inner,
                                                int acquire_all,
                                                int retain_ownership) {
   StgBool result;
@@ -839,10 +1305,13 @@ static StgBool validate_and_acquire_ownership (Capability *cap,
     FOR_EACH_ENTRY(trec, e, {
       StgTVar *s;
       s = e -> tvar;
-      if (acquire_all || entry_is_update(e)) {
+      if (inner != NO_TREC && entry_is_shadowed(cap, inner, trec, s)) {
+        TRACE("%p : %p checked in nested trec", trec, s);
+      } else if (acquire_all || entry_is_update(e)) {
         TRACE("%p : trying to acquire %p", trec, s);
         if (!cond_lock_tvar(trec, s, e -> expected_value)) {
           TRACE("%p : failed to acquire %p", trec, s);
+          note_conflict(cap, s);
           result = false;
           BREAK_FOR_EACH;
         }
@@ -852,12 +1321,14 @@ static StgBool validate_and_acquire_ownership (Capability *cap,
           TRACE("%p : will need to check %p", trec, s);
           if (s -> current_value != e -> expected_value) {
             TRACE("%p : doesn't match", trec);
+            note_conflict(cap, s);
             result = false;
             BREAK_FOR_EACH;
           }
           e -> num_updates = s -> num_updates;
           if (s -> current_value != e -> expected_value) {
             TRACE("%p : doesn't match (race)", trec);
+            note_conflict(cap, s);
             result = false;
             BREAK_FOR_EACH;
           } else {
@@ -886,7 +1357,8 @@ static StgBool validate_and_acquire_ownership (Capability *cap,
 // Keir Fraser's PhD dissertation "Practical lock-free programming" discuss
 // this kind of algorithm.
 
-static StgBool check_read_only(StgTRecHeader *trec STG_UNUSED) {
+static StgBool check_read_only(Capability *cap STG_UNUSED,
+                               StgTRecHeader *trec STG_UNUSED) {
   StgBool result = true;
 
   ASSERT(config_use_read_phase);
@@ -903,6 +1375,7 @@ static StgBool check_read_only(StgTRecHeader *trec STG_UNUSED) {
         if (s -> current_value != e -> expected_value ||
             s -> num_updates != e -> num_updates) {
           TRACE("%p : mismatch", trec);
+          note_conflict(cap, s);
           result = false;
           BREAK_FOR_EACH;
         }
@@ -913,15 +1386,87 @@ static StgBool check_read_only(StgTRecHeader *trec STG_UNUSED) {
   return result;
 }
 
+/*......................................................................*/
+
+// Discharge tso's responsibility for a targeted wakeup, if it has one:
+// see Note [Targeted STM wakeups].  trec is the transaction that tso
+// has just committed, or a fresh TRec used only to lock the TVar.
+// Called with the STM lock held.
+
+static void hand_on_wakeup(Capability *cap,
+                           StgTRecHeader *trec,
+                           StgTSO *tso) {
+  StgTVar *s;
+  TRecEntry *e;
+
+  if (tso -> stm_woken_by == NO_WAKE_TVAR) {
+    return;
+  }
+  s = (StgTVar *)tso -> stm_woken_by;
+  tso -> stm_woken_by = NO_WAKE_TVAR;
+
+  e = find_entry(cap, trec, s);
+  if (e != NULL && entry_is_update(e)) {
+    // Our own commit woke the next waiters
+    return;
+  }
+
+  TRACE("%p : handing on wakeup for %p", trec, s);
+  StgClosure *v = lock_tvar(trec, s);
+  unpark_waiters_on(cap, s);
+  unlock_tvar(cap, trec, s, v, false);
+}
+
+// Has any TVar read by trec changed?  This needs no locks, but a false
+// answer must be confirmed by validate_and_acquire_ownership.
+
+static StgBool read_set_changed(StgTRecHeader *trec) {
+  StgBool result = false;
+  FOR_EACH_ENTRY(trec, e, {
+    if (e -> tvar -> current_value != e -> expected_value) {
+      result = true;
+      BREAK_FOR_EACH;
+    }
+  });
+  return result;
+}
 
 /************************************************************************/
 
 void stmPreGCHook (Capability *cap) {
+  StgTVarWatchQueue *q;
+  StgTRecChunk *c;
+  StgTRecHeader *t;
+  uint32_t n;
+
   lock_stm(NO_TREC);
   TRACE("stmPreGCHook");
-  cap->free_tvar_watch_queues = END_STM_WATCH_QUEUE;
-  cap->free_trec_chunks = END_STM_CHUNK_LIST;
-  cap->free_trec_headers = NO_TREC;
+
+  // Trim the pools, which the GC keeps: see Note [STM pools]
+  q = cap->free_tvar_watch_queues;
+  for (n = 1; q != END_STM_WATCH_QUEUE; n++, q = q->next_queue_entry) {
+    if (n == STM_POOL_WATCH_QUEUES) {
+      q->next_queue_entry = END_STM_WATCH_QUEUE;
+    }
+  }
+  c = cap->free_trec_chunks;
+  for (n = 1; c != END_STM_CHUNK_LIST; n++, c = c->prev_chunk) {
+    if (n == STM_POOL_TREC_CHUNKS) {
+      c->prev_chunk = END_STM_CHUNK_LIST;
+    }
+  }
+  t = cap->free_trec_headers;
+  for (n = 1; t != NO_TREC; n++, t = t->enclosing_trec) {
+    // An index would be stale after the GC anyway
+    t->index = NO_TREC_INDEX;
+    if (n == STM_POOL_TREC_HEADERS) {
+      t->enclosing_trec = NO_TREC;
+    }
+  }
+
+  cap->stm_conflict = NULL;
+  // The GC is about to move TVars and TRec chunks: see Note [TRec index]
+  atomic_inc(&trec_index_epoch, 1);
   unlock_stm(NO_TREC);
 }
 
@@ -974,12 +1519,154 @@ StgTRecHeader *stmStartTransaction(Capability *cap,
   getToken(cap);
 
   t = alloc_stg_trec_header(cap, outer);
+  if (outer == NO_TREC) {
+    // The snapshot must be taken before any TVar is read
+    t -> read_version = stm_clock;
+    load_load_barrier();
+  } else {
+    t -> read_version = outer -> read_version;
+  }
   TRACE("%p : stmStartTransaction()=%p", outer, t);
   return t;
 }
 
 /*......................................................................*/
 
+// Count an abort of the atomically site, keyed by the info pointer of its
+// STM action, for the EVENT_STM_SITE_ABORTS events; see Note [STM
+// contention management].  Each Capability has its own table, so this
+// needs no lock; traceStmSites sums them.
+static void count_site_abort(Capability *cap, StgWord site) {
+  if (eventLogStatus() != EVENTLOG_RUNNING) {
+    return;
+  }
+  if (cap -> stm_sites == NULL) {
+    cap -> stm_sites = allocHashTable();
+  }
+  StgWord n = (StgWord)lookupHashTable(cap -> stm_sites, site);
+  if (n != 0) {
+    removeHashTable(cap -> stm_sites, site, NULL);
+  }
+  insertHashTable(cap -> stm_sites, site, (void *)(n + 1));
+}
+
+#if defined(THREADED_RTS)
+// Spin for a random time below 2^min(aborts,14) iterations
+static void backoff(Capability *cap, StgTSO *tso) {
+  StgWord32 shift = stg_min(tso -> stm_aborts, 14);
+  StgWord64 x = ((StgWord64)tso -> id << 32) ^ cap -> stm_stats.aborts;
+  StgWord i, spins;
+
+  x *= 0x9e3779b97f4a7c15ULL;
+  spins = (StgWord)(x >> 40) & (((StgWord)1 << shift) - 1);
+  TRACE("thread %ld backing off for %ld spins", (long)tso -> id, (long)spins);
+  for (i = 0; i < spins; i++) {
+    busy_wait_nop();
+  }
+  cap -> stm_stats.backoffs ++;
+}
+#endif
+
+StgTRecHeader *stmRestartTransaction(Capability *cap,
+                                     StgTSO *tso,
+                                     StgClosure *code) {
+  StgWord site = (StgWord)GET_INFO(UNTAG_CLOSURE(code));
+  StgTVar *tvar = cap -> stm_conflict;
+
+  cap -> stm_conflict = NULL;
+  tso -> stm_aborts ++;
+  cap -> stm_stats.aborts ++;
+  count_site_abort(cap, site);
+  traceEventStmAbort(cap, tso, site, (StgWord)tvar, tso -> stm_aborts);
+
+  StgWord32 serialise = RtsFlags.MiscFlags.stmSerialiseAfter;
+  if (serialise != 0 && tso -> stm_aborts >= serialise &&
+      stm_serial_owner != (StgWord)tso -> id &&
+      cas(&stm_serial_owner, 0, (StgWord)tso -> id) == 0) {
+    TRACE("thread %ld took the serial token after %ld aborts",
+          (long)tso -> id, (long)tso -> stm_aborts);
+    cap -> stm_stats.serialised ++;
+  }
+
+#if defined(THREADED_RTS)
+  if (RtsFlags.MiscFlags.stmBackoff && n_capabilities > 1 &&
+      stm_serial_owner != (StgWord)tso -> id) {
+    backoff(cap, tso);
+  }
+#endif
+
+  return stmStartTransaction(cap, NO_TREC);
+}
+
+void stmAbandonTransaction(Capability *cap, StgTSO *tso) {
+  TRACE("thread %ld abandoning transaction", (long)tso -> id);
+  tso -> stm_aborts = 0;
+  release_serial_token(tso);
+
+  if (tso -> stm_woken_by != NO_WAKE_TVAR) {
+    StgTRecHeader *t = alloc_stg_trec_header(cap, NO_TREC);
+    lock_stm(t);
+    hand_on_wakeup(cap, t, tso);
+    unlock_stm(t);
+    free_stg_trec_header(cap, t);
+  }
+}
+
+void sumStmStats(StmStats *s) {
+  uint32_t i;
+
+  memset(s, 0, sizeof(StmStats));
+  for (i = 0; i < n_capabilities; i++) {
+    const StmStats *c = &capabilities[i] -> stm_stats;
+    s -> commits += c -> commits;
+    s -> aborts += c -> aborts;
+    s -> max_aborts = stg_max(s -> max_aborts, c -> max_aborts);
+    s -> backoffs += c -> backoffs;
+    s -> serialised += c -> serialised;
+  }
+}
+
+typedef struct {
+  Capability *cap;   // to write the events on
+  uint32_t table;    // the Capability whose table we are walking
+} SiteTraceState;
+
+static void trace_site(void *data, StgWord site, const void *value) {
+  SiteTraceState *st = (SiteTraceState *)data;
+  StgWord n = (StgWord)value;
+  uint32_t i;
+
+  // Add the counts of the later Capabilities, removing them there so that
+  // each site is written once
+  for (i = st -> table + 1; i < n_capabilities; i++) {
+    HashTable *sites = capabilities[i] -> stm_sites;
+    if (sites != NULL) {
+      n += (StgWord)removeHashTable(sites, site, NULL);
+    }
+  }
+  traceStmSiteAborts(st -> cap, site, (StgWord64)n);
+}
+
+// Write the aborts per site, summed over every Capability, and forget
+// them.  All the Capabilities must be stopped.
+void traceStmSites(Capability *cap) {
+  SiteTraceState st;
+  uint32_t i;
+
+  st.cap = cap;
+  for (i = 0; i < n_capabilities; i++) {
+    HashTable *sites = capabilities[i] -> stm_sites;
+    if (sites != NULL) {
+      st.table = i;
+      mapHashTable(sites, &st, trace_site);
+      freeHashTable(sites, NULL);
+      capabilities[i] -> stm_sites = NULL;
+    }
+  }
+}
+
+/*......................................................................*/
+
 void stmAbortTransaction(Capability *cap,
                          StgTRecHeader *trec) {
   StgTRecHeader *et;
@@ -1066,12 +1753,27 @@ StgBool stmValidateNestOfTransactions(Capability *cap, StgTRecHeader *trec) {
          (trec -> state == TREC_WAITING) ||
          (trec -> state == TREC_CONDEMNED));
 
+  if (STM_CLOCK_MODE) {
+    // The nest has a consistent snapshot unless it has been condemned:
+    // see Note [STM global clock]
+    StgBool result = true;
+    for (t = trec; t != NO_TREC; t = t -> enclosing_trec) {
+      if (t -> state == TREC_CONDEMNED) {
+        result = false;
+      }
+    }
+    TRACE("%p : stmValidateNestOfTransactions()=%d", trec, result);
+    return result;
+  }
+
   lock_stm(trec);
 
   t = trec;
   StgBool result = true;
   while (t != NO_TREC) {
-    result &= validate_and_acquire_ownership(cap, t, true, false);
+    result &= validate_and_acquire_ownership(cap, t,
+                                             (t == trec) ? NO_TREC : trec,
+                                             true, false);
     t = t -> enclosing_trec;
   }
 
@@ -1087,22 +1789,18 @@ StgBool stmValidateNestOfTransactions(Capability *cap, StgTRecHeader *trec) {
 
 /*......................................................................*/
 
-static TRecEntry *get_entry_for(StgTRecHeader *trec, StgTVar *tvar, StgTRecHeader **in) {
+static TRecEntry *get_entry_for(Capability *cap, StgTRecHeader *trec,
+                                StgTVar *tvar, StgTRecHeader **in) {
   TRecEntry *result = NULL;
 
   TRACE("%p : get_entry_for TVar %p", trec, tvar);
   ASSERT(trec != NO_TREC);
 
   do {
-    FOR_EACH_ENTRY(trec, e, {
-      if (e -> tvar == tvar) {
-        result = e;
-        if (in != NULL) {
-          *in = trec;
-        }
-        BREAK_FOR_EACH;
-      }
-    });
+    result = find_entry(cap, trec, tvar);
+    if (result != NULL && in != NULL) {
+      *in = trec;
+    }
     trec = trec -> enclosing_trec;
   } while (result == NULL && trec != NO_TREC);
 
@@ -1171,7 +1869,7 @@ static void connect_invariant_to_trec(Capability *cap,
     // We leave "last_execution" holding the values that will be
     // in the heap after the transaction we're in the process
     // of committing has finished.
-    TRecEntry *entry = get_entry_for(my_execution -> enclosing_trec, s, NULL);
+    TRecEntry *entry = get_entry_for(cap, my_execution -> enclosing_trec, s, NULL);
     if (entry != NULL) {
       e -> expected_value = entry -> new_value;
       e -> new_value = entry -> new_value;
@@ -1303,6 +2001,29 @@ StgInvariantCheckQueue *stmGetInvariantsToCheck(Capability *cap, StgTRecHeader *
 
 /*......................................................................*/
 
+static StgBool trec_is_read_only(StgTRecHeader *trec) {
+  StgBool result = true;
+  FOR_EACH_ENTRY(trec, e, {
+    if (entry_is_update(e)) {
+      result = false;
+      BREAK_FOR_EACH;
+    }
+  });
+  return result;
+}
+
+// Account for a successful commit by the current thread: see
+// Note [STM contention management]
+static void note_commit(Capability *cap) {
+  StgTSO *tso = cap -> r.rCurrentTSO;
+  cap -> stm_stats.commits ++;
+  if (tso -> stm_aborts > cap -> stm_stats.max_aborts) {
+    cap -> stm_stats.max_aborts = tso -> stm_aborts;
+  }
+  tso -> stm_aborts = 0;
+  release_serial_token(tso);
+}
+
 StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
   StgInt64 max_commits_at_start = max_commits;
   StgBool touched_invariants;
@@ -1322,6 +2043,27 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
 
   touched_invariants = (trec -> invariants_to_check != END_INVARIANT_CHECK_QUEUE);
 
+  // A read-only transaction with a consistent snapshot is done: see
+  // Note [STM global clock]
+  if (STM_CLOCK_MODE && !touched_invariants &&
+      trec -> state == TREC_ACTIVE && trec_is_read_only(trec)) {
+    TRACE("%p : read-only commit", trec);
+    hand_on_wakeup(cap, trec, cap -> r.rCurrentTSO);
+    unlock_stm(trec);
+    free_stg_trec_header(cap, trec);
+    note_commit(cap);
+    return true;
+  }
+
+  // Another thread is running alone: only read-only commits may go ahead
+  // (see Note [STM contention management])
+  if (serialised_by_other(cap -> r.rCurrentTSO) && !trec_is_read_only(trec)) {
+    TRACE("%p : deferring to serialised transaction", trec);
+    unlock_stm(trec);
+    free_stg_trec_header(cap, trec);
+    return false;
+  }
+
   // If we have touched invariants then (i) lock the invariant, and (ii) add
   // the invariant's read set to our own.  Step (i) is needed to serialize
   // concurrent transactions that attempt to make conflicting updates
@@ -1374,16 +2116,27 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
 
   use_read_phase = ((config_use_read_phase) && (!touched_invariants));
 
-  bool result = validate_and_acquire_ownership(cap, trec, (!use_read_phase), true);
+  bool result = validate_and_acquire_ownership(cap, trec, NO_TREC,
+                                               (!use_read_phase), true);
   if (result) {
+    StgWord write_version = 0;
+
     // We now know that all the updated locations hold their expected values.
     ASSERT(trec -> state == TREC_ACTIVE);
 
-    if (use_read_phase) {
+    if (STM_CLOCK_MODE) {
+      write_version = atomic_inc(&stm_clock, 1);
+    }
+
+    if (STM_CLOCK_MODE && write_version == trec -> read_version + 1) {
+      // Nothing else has committed since our snapshot, which is
+      // consistent, so our reads are still good
+      TRACE("%p : no commits since snapshot, skipping read check", trec);
+    } else if (use_read_phase) {
       StgInt64 max_commits_at_end;
       StgInt64 max_concurrent_commits;
       TRACE("%p : doing read check", trec);
-      result = check_read_only(trec);
+      result = check_read_only(cap, trec);
       TRACE("%p : read-check %s", trec, result ? "succeeded" : "failed");
 
       max_commits_at_end = max_commits;
@@ -1432,7 +2185,13 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
           TRACE("%p : writing %p to %p, waking waiters", trec, e -> new_value, s);
           unpark_waiters_on(cap,s);
           IF_STM_FG_LOCKS({
-            s -> num_updates ++;
+            if (STM_CLOCK_MODE) {
+              s -> num_updates = write_version;
+              // A reader that sees the new value must see its version
+              write_barrier();
+            } else {
+              s -> num_updates ++;
+            }
           });
           unlock_tvar(cap, trec, s, e -> new_value, true);
         }
@@ -1443,10 +2202,18 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
     }
   }
 
+  if (result) {
+    hand_on_wakeup(cap, trec, cap -> r.rCurrentTSO);
+  }
+
   unlock_stm(trec);
 
   free_stg_trec_header(cap, trec);
 
+  if (result) {
+    note_commit(cap);
+  }
+
   TRACE("%p : stmCommitTransaction()=%d", trec, result);
 
   return result;
@@ -1463,13 +2230,14 @@ StgBool stmCommitNestedTransaction(Capability *cap, StgTRecHeader *trec) {
   lock_stm(trec);
 
   et = trec -> enclosing_trec;
-  bool result = validate_and_acquire_ownership(cap, trec, (!config_use_read_phase), true);
+  bool result = validate_and_acquire_ownership(cap, trec, NO_TREC,
+                                               (!config_use_read_phase), true);
   if (result) {
     // We now know that all the updated locations hold their expected values.
 
     if (config_use_read_phase) {
       TRACE("%p : doing read check", trec);
-      result = check_read_only(trec);
+      result = check_read_only(cap, trec);
     }
     if (result) {
       // We now know that all of the read-only locations held their exepcted values
@@ -1513,7 +2281,8 @@ StgBool stmWait(Capability *cap, StgTSO *tso, StgTRecHeader *trec) {
          (trec -> state == TREC_CONDEMNED));
 
   lock_stm(trec);
-  bool result = validate_and_acquire_ownership(cap, trec, true, true);
+  bool result = validate_and_acquire_ownership(cap, trec, NO_TREC,
+                                               true, true);
   if (result) {
     // The transaction is valid so far so we can actually start waiting.
     // (Otherwise the transaction was not valid and the thread will have to
@@ -1526,6 +2295,13 @@ StgBool stmWait(Capability *cap, StgTSO *tso, StgTRecHeader *trec) {
     park_tso(tso);
     trec -> state = TREC_WAITING;
 
+    // Whatever we are waiting for may need a commit that the serial
+    // token would hold back: see Note [STM contention management]
+    release_serial_token(tso);
+
+    // Still no progress: see Note [Targeted STM wakeups]
+    tso -> stm_woken_by = NO_WAKE_TVAR;
+
     // We haven't released ownership of the transaction yet.  The TSO
     // has been put on the wait queue for the TVars it is waiting for,
     // but we haven't yet tidied up the TSO's stack and made it safe
@@ -1562,13 +2338,23 @@ StgBool stmReWait(Capability *cap, StgTSO *tso) {
          (trec -> state == TREC_CONDEMNED));
 
   lock_stm(trec);
-  bool result = validate_and_acquire_ownership(cap, trec, true, true);
+  if (trec -> state == TREC_WAITING) {
+    FOR_EACH_ENTRY(trec, e, {
+      take_wakeup(cap, tso, (StgTVarWatchQueue *)(e -> new_value), e -> tvar);
+    });
+  }
+  // Usually something we read has changed, which we can see without
+  // locking our whole read set: see Note [Targeted STM wakeups]
+  bool result = !read_set_changed(trec) &&
+                validate_and_acquire_ownership(cap, trec, NO_TREC,
+                                               true, true);
   TRACE("%p : validation %s", trec, result ? "succeeded" : "failed");
   if (result) {
     // The transaction remains valid -- do nothing because it is already on
     // the wait queues
     ASSERT(trec -> state == TREC_WAITING);
     park_tso(tso);
+    tso -> stm_woken_by = NO_WAKE_TVAR;
     revert_ownership(cap, trec, true);
   } else {
     // The transcation has become invalid.  We can now remove it from the wait
@@ -1601,6 +2387,33 @@ static StgClosure *read_current_value(StgTRecHeader *trec STG_UNUSED, StgTVar *t
   return result;
 }
 
+// Read the current value of tvar for trec from its snapshot of memory,
+// condemning trec if the snapshot cannot be made to include the value
+// (see Note [STM global clock])
+static StgClosure *read_snapshot_value(Capability *cap,
+                                       StgTRecHeader *trec,
+                                       StgTVar *tvar) {
+  StgClosure *result;
+
+  for (;;) {
+    result = read_current_value(trec, tvar);
+    if (!STM_CLOCK_MODE) {
+      return result;
+    }
+    // The version is written before the value, so we read it after
+    load_load_barrier();
+    if ((StgWord)tvar -> num_updates <= trec -> read_version) {
+      return result;
+    }
+    if (!extend_snapshot(trec)) {
+      TRACE("%p : %p is newer than snapshot, condemning", trec, tvar);
+      note_conflict(cap, tvar);
+      trec -> state = TREC_CONDEMNED;
+      return result;
+    }
+  }
+}
+
 /*......................................................................*/
 
 StgClosure *stmReadTVar(Capability *cap,
@@ -1614,7 +2427,7 @@ StgClosure *stmReadTVar(Capability *cap,
   ASSERT(trec -> state == TREC_ACTIVE ||
          trec -> state == TREC_CONDEMNED);
 
-  entry = get_entry_for(trec, tvar, &entry_in);
+  entry = get_entry_for(cap, trec, tvar, &entry_in);
 
   if (entry != NULL) {
     if (entry_in == trec) {
@@ -1622,19 +2435,13 @@ StgClosure *stmReadTVar(Capability *cap,
       result = entry -> new_value;
     } else {
       // Entry found in another trec
-      TRecEntry *new_entry = get_new_entry(cap, trec);
-      new_entry -> tvar = tvar;
-      new_entry -> expected_value = entry -> expected_value;
-      new_entry -> new_value = entry -> new_value;
-      result = new_entry -> new_value;
+      new_entry(cap, trec, tvar, entry -> expected_value, entry -> new_value);
+      result = entry -> new_value;
     }
   } else {
     // No entry found
-    StgClosure *current_value = read_current_value(trec, tvar);
-    TRecEntry *new_entry = get_new_entry(cap, trec);
-    new_entry -> tvar = tvar;
-    new_entry -> expected_value = current_value;
-    new_entry -> new_value = current_value;
+    StgClosure *current_value = read_snapshot_value(cap, trec, tvar);
+    new_entry(cap, trec, tvar, current_value, current_value);
     result = current_value;
   }
 
@@ -1656,7 +2463,7 @@ void stmWriteTVar(Capability *cap,
   ASSERT(trec -> state == TREC_ACTIVE ||
          trec -> state == TREC_CONDEMNED);
 
-  entry = get_entry_for(trec, tvar, &entry_in);
+  entry = get_entry_for(cap, trec, tvar, &entry_in);
 
   if (entry != NULL) {
     if (entry_in == trec) {
@@ -1664,18 +2471,12 @@ void stmWriteTVar(Capability *cap,
       entry -> new_value = new_value;
     } else {
       // Entry found in another trec
-      TRecEntry *new_entry = get_new_entry(cap, trec);
-      new_entry -> tvar = tvar;
-      new_entry -> expected_value = entry -> expected_value;
-      new_entry -> new_value = new_value;
+      new_entry(cap, trec, tvar, entry -> expected_value, new_value);
     }
   } else {
     // No entry found
-    StgClosure *current_value = read_current_value(trec, tvar);
-    TRecEntry *new_entry = get_new_entry(cap, trec);
-    new_entry -> tvar = tvar;
-    new_entry -> expected_value = current_value;
-    new_entry -> new_value = new_value;
+    StgClosure *current_value = read_snapshot_value(cap, trec, tvar);
+    new_entry(cap, trec, tvar, current_value, new_value);
   }
 
   TRACE("%p : stmWriteTVar done", trec);
@@ -72,6 +72,26 @@ StgTRecHeader *stmStartNestedTransaction(Capability *cap, StgTRecHeader *outer
 void stmAbortTransaction(Capability *cap, StgTRecHeader *trec);
 void stmFreeAbortedTRec(Capability *cap, StgTRecHeader *trec);
 
+/*
+ * Start a fresh top-level transaction for tso, whose last attempt at
+ * running code (the STM action of its atomically#) has aborted.  This
+ * counts the abort and applies +RTS --stm-backoff and --stm-serialise.
+ * stmAbandonTransaction is called instead when tso gives up on the
+ * transaction because of an exception.
+ */
+
+StgTRecHeader *stmRestartTransaction(Capability *cap, StgTSO *tso,
+                                     StgClosure *code);
+void stmAbandonTransaction(Capability *cap, StgTSO *tso);
+
+/*
+ * Sum the STM statistics of all Capabilities, and post the aborts per
+ * atomically site to the eventlog (at shutdown).
+ */
+
+void sumStmStats(StmStats *s);
+void traceStmSites(Capability *cap);
+
 /*
  * Ensure that a subsequent commit / validation will fail.  We use this 
  * in our current handling of transactions that may have become invalid
@@ -214,6 +234,8 @@ void stmWriteTVar(Capability *cap,
 #define END_STM_CHUNK_LIST ((StgTRecChunk *)(void *)&stg_END_STM_CHUNK_LIST_closure)
 
 #define NO_TREC ((StgTRecHeader *)(void *)&stg_NO_TREC_closure)
+#define NO_TREC_INDEX ((StgArrBytes *)(void *)&stg_NO_TREC_closure)
+#define NO_WAKE_TVAR ((StgClosure *)(void *)&stg_NO_TREC_closure)
 
 /*----------------------------------------------------------------------*/
 
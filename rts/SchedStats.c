@@ -0,0 +1,179 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * Scheduling latency statistics (+RTS --sched-stats)
+ *
+ * ---------------------------------------------------------------------------*/
+
+/*
+ * To find out whether the latency of a program is due to threads
+ * waiting on the run queue, to long run slices, or to threads being
+ * blocked, +RTS --sched-stats makes the scheduler timestamp every
+ * change of state of a thread:
+ *
+ *   - when a thread is put on the run queue (schedStatsRunnable()), the
+ *     time since it blocked, if it was blocked, is added to the blocked
+ *     histogram for its why_blocked reason;
+ *
+ *   - when it starts to run (schedStatsStartRun()), the time since it
+ *     became runnable is added to the runnable histogram;
+ *
+ *   - when it stops running (schedStatsStopRun()), the length of the run
+ *     slice is added to the run histogram, and we remember why it
+ *     blocked, if it did.
+ *
+ * The timestamp and the blocking reason are kept in the TSO
+ * (sched_stamp, sched_blocked), and the histograms per Capability
+ * (cap->sched_stats), which is always owned by the thread recording a
+ * sample, so no synchronisation is needed.  Samples go to the
+ * Capability on which the thread runs, or is put on the run queue.
+ *
+ * A foreign call counts as being blocked with BlockedOnCCall or
+ * BlockedOnCCall_Interruptible.
+ *
+ * The statistics are available through getRTSStats() (summed over the
+ * capabilities) and getCapabilitySchedStats(), and are written to the
+ * eventlog, if it is enabled, when the capabilities are freed.  This
+ * does not need any event classes: the cost of collecting them is
+ * paid with --sched-stats whether we trace or not.
+ */
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "SchedStats.h"
+#include "Capability.h"
+#include "Trace.h"
+
+#include <string.h>
+
+static void
+recordSample (SchedHistogram *h, StgWord64 ns)
+{
+    StgWord64 us = ns / 1000;
+    uint32_t b = 0;
+
+    h->count++;
+    h->total_ns += ns;
+    if ((Time)ns > h->max_ns) h->max_ns = ns;
+
+    // bucket i > 0 holds [2^(i-1), 2^i) us
+    while (us != 0 && b < SCHED_HISTOGRAM_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    h->buckets[b]++;
+}
+
+static void
+endBlocked (Capability *cap, StgTSO *tso, StgWord64 now)
+{
+    if (tso->sched_blocked != NotBlocked) {
+        if (tso->sched_blocked < SCHED_STATS_BLOCK_REASONS
+            && tso->sched_stamp != 0 && now > tso->sched_stamp) {
+            recordSample(&cap->sched_stats.blocked[tso->sched_blocked],
+                         now - tso->sched_stamp);
+        }
+        tso->sched_blocked = NotBlocked;
+        tso->sched_stamp = now;
+    }
+}
+
+void
+schedStatsRunnable_ (Capability *cap, StgTSO *tso)
+{
+    StgWord64 now = getMonotonicNSec();
+
+    endBlocked(cap, tso, now);
+
+    // A new thread: it has been runnable from now.  A thread that
+    // yielded has been runnable since it stopped running.
+    if (tso->sched_stamp == 0) {
+        tso->sched_stamp = now;
+    }
+}
+
+void
+schedStatsStartRun_ (Capability *cap, StgTSO *tso)
+{
+    StgWord64 now = getMonotonicNSec();
+
+    // in case the thread was woken up without going through the run
+    // queue, e.g. returning from a foreign call
+    endBlocked(cap, tso, now);
+
+    if (tso->sched_stamp != 0 && now > tso->sched_stamp) {
+        recordSample(&cap->sched_stats.runnable, now - tso->sched_stamp);
+    }
+    tso->sched_stamp = now;
+}
+
+void
+schedStatsStopRun_ (Capability *cap, StgTSO *tso, uint32_t why_blocked)
+{
+    StgWord64 now = getMonotonicNSec();
+
+    if (tso->sched_stamp != 0 && now > tso->sched_stamp) {
+        recordSample(&cap->sched_stats.run, now - tso->sched_stamp);
+    }
+    tso->sched_stamp = now;
+    tso->sched_blocked = why_blocked;
+}
+
+static void
+addHistogram (SchedHistogram *to, const SchedHistogram *from)
+{
+    uint32_t b;
+
+    to->count    += from->count;
+    to->total_ns += from->total_ns;
+    if (from->max_ns > to->max_ns) to->max_ns = from->max_ns;
+    for (b = 0; b < SCHED_HISTOGRAM_BUCKETS; b++) {
+        to->buckets[b] += from->buckets[b];
+    }
+}
+
+void
+sumSchedStats (SchedStats *s)
+{
+    uint32_t i, r;
+
+    memset(s, 0, sizeof(SchedStats));
+    for (i = 0; i < n_capabilities; i++) {
+        const SchedStats *c = &capabilities[i]->sched_stats;
+        addHistogram(&s->runnable, &c->runnable);
+        addHistogram(&s->run, &c->run);
+        for (r = 0; r < SCHED_STATS_BLOCK_REASONS; r++) {
+            addHistogram(&s->blocked[r], &c->blocked[r]);
+        }
+    }
+}
+
+void
+getCapabilitySchedStats (uint32_t cap, SchedStats *s)
+{
+    if (cap < n_capabilities) {
+        *s = capabilities[cap]->sched_stats;
+    } else {
+        memset(s, 0, sizeof(SchedStats));
+    }
+}
+
+void
+traceSchedStats (Capability *cap)
+{
+    uint32_t r;
+    const SchedStats *s = &cap->sched_stats;
+
+    if (!RtsFlags.MiscFlags.schedStats) return;
+
+    traceSchedHistogram(cap, SCHED_HISTOGRAM_RUNNABLE, &s->runnable);
+    traceSchedHistogram(cap, SCHED_HISTOGRAM_RUN, &s->run);
+    for (r = 0; r < SCHED_STATS_BLOCK_REASONS; r++) {
+        if (s->blocked[r].count != 0) {
+            traceSchedHistogram(cap, SCHED_HISTOGRAM_BLOCKED + r,
+                                &s->blocked[r]);
+        }
+    }
+}
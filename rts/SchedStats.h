@@ -0,0 +1,46 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * Scheduling latency statistics (+RTS --sched-stats)
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SCHEDSTATS_H
+#define SCHEDSTATS_H
+
+#include "BeginPrivate.h"
+
+// tso has been put on cap's run queue.  Called from appendToRunQueue()
+// and pushOnRunQueue() when RtsFlags.MiscFlags.schedStats is set.
+void schedStatsRunnable_ (Capability *cap, StgTSO *tso);
+void schedStatsStartRun_ (Capability *cap, StgTSO *tso);
+void schedStatsStopRun_  (Capability *cap, StgTSO *tso, uint32_t why_blocked);
+
+// Add up the statistics of all the capabilities
+void sumSchedStats (SchedStats *s);
+
+// Write the statistics of a capability to the eventlog
+void traceSchedStats (Capability *cap);
+
+// tso is about to run on cap
+INLINE_HEADER void schedStatsStartRun (Capability *cap, StgTSO *tso)
+{
+    if (RTS_UNLIKELY(RtsFlags.MiscFlags.schedStats)) {
+        schedStatsStartRun_(cap, tso);
+    }
+}
+
+// tso has stopped running on cap, and is now blocked for the given
+// reason, or NotBlocked
+INLINE_HEADER void schedStatsStopRun (Capability *cap, StgTSO *tso,
+                                      uint32_t why_blocked)
+{
+    if (RTS_UNLIKELY(RtsFlags.MiscFlags.schedStats)) {
+        schedStatsStopRun_(cap, tso, why_blocked);
+    }
+}
+
+#include "EndPrivate.h"
+
+#endif /* SCHEDSTATS_H */
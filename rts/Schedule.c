@@ -43,6 +43,8 @@
 #include "Messages.h"
 #include "Stable.h"
 #include "TopHandler.h"
+#include "CpuSample.h"
+#include "CpuTopology.h"
 
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
@@ -70,7 +72,6 @@
 // Blocked/sleeping thrads
 StgTSO *blocked_queue_hd = NULL;
 StgTSO *blocked_queue_tl = NULL;
-StgTSO *sleeping_queue = NULL;    // perhaps replace with a hash table?
 #endif
 
 // Bytes allocated since the last time a HeapOverflow exception was thrown by
@@ -417,6 +418,7 @@ run_thread:
 
     // reset the interrupt flag before running Haskell code
     cap->interrupt = 0;
+    cap->cpu_sample = 0;
 
     cap->in_haskell = true;
     cap->idle = 0;
@@ -449,6 +451,7 @@ run_thread:
     }
 
     traceEventRunThread(cap, t);
+    schedStatsStartRun(cap, t);
 
     switch (prev_what_next) {
 
@@ -495,6 +498,10 @@ run_thread:
     t->saved_winerror = GetLastError();
 #endif
 
+    cpuSample(cap, t);
+    schedStatsStopRun(cap, t, ret == ThreadBlocked ? t->why_blocked
+                                                   : NotBlocked);
+
     if (ret == ThreadBlocked) {
         if (t->why_blocked == BlockedOnBlackHole) {
             StgTSO *owner = blackHoleOwner(t->block_info.bh->bh);
@@ -592,6 +599,63 @@ promoteInRunQueue (Capability *cap, StgTSO *tso)
     pushOnRunQueue(cap, tso);
 }
 
+// Note [Thread priorities]
+//
+// The run queue is kept in non-increasing order of tso->priority
+// (apart from threads put at the front by pushOnRunQueue(), which
+// always run next: pushOnRunQueue() sets their rq_overtaken to
+// MAX_RUN_QUEUE_OVERTAKES, so insertInRunQueue() never puts a thread
+// ahead of them).  A thread is appended behind every thread of the
+// same or higher priority, so threads of equal priority are still
+// scheduled round-robin, and when all threads have the default
+// priority appendToRunQueue() never leaves its fast path.
+//
+// A plain priority queue would let a stream of high-priority threads
+// starve the rest indefinitely.  To prevent that, each time a thread
+// is overtaken by a higher-priority thread we bump its rq_overtaken
+// count, and once that reaches MAX_RUN_QUEUE_OVERTAKES no later thread
+// may overtake it.  This is a simple form of aging: a runnable thread
+// waits for at most MAX_RUN_QUEUE_OVERTAKES extra time slices.
+//
+// We use a single ordered list rather than one queue per priority
+// level because the GC, the sanity checker and schedulePushWork() all
+// walk cap->run_queue_hd directly.
+
+void
+insertInRunQueue (Capability *cap, StgTSO *tso)
+{
+    StgTSO *prev, *next;
+
+    ASSERT(tso->_link == END_TSO_QUEUE);
+
+    next = END_TSO_QUEUE;
+    prev = cap->run_queue_tl;
+    while (prev != END_TSO_QUEUE
+           && prev->priority < tso->priority
+           && prev->rq_overtaken < MAX_RUN_QUEUE_OVERTAKES) {
+        prev->rq_overtaken++;
+        next = prev;
+        prev = prev->block_info.prev;
+    }
+
+    if (prev == END_TSO_QUEUE) {
+        cap->run_queue_hd = tso;
+        tso->block_info.prev = END_TSO_QUEUE;
+    } else {
+        setTSOLink(cap, prev, tso);
+        setTSOPrev(cap, tso, prev);
+    }
+    if (next == END_TSO_QUEUE) {
+        cap->run_queue_tl = tso;
+    } else {
+        setTSOLink(cap, tso, next);
+        setTSOPrev(cap, next, tso);
+    }
+    cap->n_run_queue++;
+
+    IF_DEBUG(sanity, checkRunQueue(cap));
+}
+
 /* ----------------------------------------------------------------------------
  * Setting up the scheduler loop
  * ------------------------------------------------------------------------- */
@@ -706,7 +770,7 @@ schedulePushWork(Capability *cap USED_IF_THREADS,
 #if defined(THREADED_RTS)
 
     Capability *free_caps[n_capabilities], *cap0;
-    uint32_t i, n_wanted_caps, n_free_caps;
+    uint32_t i, n_wanted_caps, n_free_caps, pass;
 
     uint32_t spare_threads = cap->n_run_queue > 0 ? cap->n_run_queue - 1 : 0;
 
@@ -720,21 +784,31 @@ schedulePushWork(Capability *cap USED_IF_THREADS,
     n_wanted_caps = sparkPoolSizeCap(cap) + spare_threads;
     if (n_wanted_caps == 0) return;
 
-    // First grab as many free Capabilities as we can.  ToDo: we should use
-    // capabilities on the same NUMA node preferably, but not exclusively.
-    for (i = (cap->no + 1) % n_capabilities, n_free_caps=0;
-         n_free_caps < n_wanted_caps && i != cap->no;
-         i = (i + 1) % n_capabilities) {
-        cap0 = capabilities[i];
-        if (cap != cap0 && !cap0->disabled && tryGrabCapability(cap0,task)) {
-            if (!emptyRunQueue(cap0)
-                || cap0->n_returning_tasks != 0
-                || !emptyInbox(cap0)) {
-                // it already has some work, we just grabbed it at
-                // the wrong moment.  Or maybe it's deadlocked!
-                releaseCapability(cap0);
-            } else {
-                free_caps[n_free_caps++] = cap0;
+    // First grab as many free Capabilities as we can, preferring those
+    // that share a last-level cache with us (see CpuTopology.c), so that
+    // the threads we push keep their working set in a nearby cache.
+    // ToDo: we should use capabilities on the same NUMA node preferably,
+    // but not exclusively.
+    // With a single cache group the first pass visits them all.
+    n_free_caps = 0;
+    for (pass = 0; pass < (n_cache_groups > 1 ? 2 : 1); pass++) {
+        for (i = (cap->no + 1) % n_capabilities;
+             n_free_caps < n_wanted_caps && i != cap->no;
+             i = (i + 1) % n_capabilities) {
+            cap0 = capabilities[i];
+            if ((cap0->cache_group == cap->cache_group) != (pass == 0)) {
+                continue;
+            }
+            if (cap != cap0 && !cap0->disabled && tryGrabCapability(cap0,task)) {
+                if (!emptyRunQueue(cap0)
+                    || cap0->n_returning_tasks != 0
+                    || !emptyInbox(cap0)) {
+                    // it already has some work, we just grabbed it at
+                    // the wrong moment.  Or maybe it's deadlocked!
+                    releaseCapability(cap0);
+                } else {
+                    free_caps[n_free_caps++] = cap0;
+                }
             }
         }
     }
@@ -885,7 +959,7 @@ scheduleCheckBlockedThreads(Capability *cap USED_IF_NOT_THREADS)
     // run queue is empty, and there are no other tasks running, we
     // can wait indefinitely for something to happen.
     //
-    if ( !emptyQueue(blocked_queue_hd) || !emptyQueue(sleeping_queue) )
+    if ( !emptyBlockedQueue() || !emptySleepingQueue() )
     {
         awaitEvent (emptyRunQueue(cap));
     }
@@ -987,8 +1061,9 @@ static void
 scheduleProcessInbox (Capability **pcap USED_IF_THREADS)
 {
 #if defined(THREADED_RTS)
-    Message *m, *next;
+    Message *m, *next, *batch;
     PutMVar *p, *pnext;
+    StgWord n;
     int r;
     Capability *cap = *pcap;
 
@@ -999,26 +1074,59 @@ scheduleProcessInbox (Capability **pcap USED_IF_THREADS)
             cap = *pcap;
         }
 
-        // don't use a blocking acquire; if the lock is held by
-        // another thread then just carry on.  This seems to avoid
-        // getting stuck in a message ping-pong situation with other
-        // processors.  We'll check the inbox again later anyway.
-        //
-        // We should really use a more efficient queue data structure
-        // here.  The trickiness is that we must ensure a Capability
-        // never goes idle if the inbox is non-empty, which is why we
-        // use cap->lock (cap->lock is released as the last thing
-        // before going idle; see Capability.c:releaseCapability()).
-        r = TRY_ACQUIRE_LOCK(&cap->lock);
-        if (r != 0) return;
-
-        m = cap->inbox;
-        p = cap->putMVars;
-        cap->inbox = (Message*)END_TSO_QUEUE;
-        cap->putMVars = NULL;
+        // Take all the messages at once; see Note [Lock-free inbox] in
+        // Messages.c.
+        m = (Message*)xchg((StgPtr)(void *)&cap->inbox,
+                           (StgWord)END_TSO_QUEUE);
+
+        // The putMVars still need cap->lock.  Don't use a blocking
+        // acquire; if the lock is held by another thread then just
+        // carry on.  This seems to avoid getting stuck in a message
+        // ping-pong situation with other processors.  We'll check the
+        // inbox again later anyway.
+        p = NULL;
+        if (cap->putMVars != NULL) {
+            r = TRY_ACQUIRE_LOCK(&cap->lock);
+            if (r == 0) {
+                p = cap->putMVars;
+                cap->putMVars = NULL;
+                RELEASE_LOCK(&cap->lock);
+            } else if (m == (Message*)END_TSO_QUEUE) {
+                return;
+            }
+        }
 
-        RELEASE_LOCK(&cap->lock);
+        // The inbox is most-recent-first; reverse it so that we execute
+        // the messages in the order they were sent.  The links are not
+        // seen by the GC, which can't happen until we're done here.
+        batch = (Message*)END_TSO_QUEUE;
+        n = 0;
+        while (m != (Message*)END_TSO_QUEUE) {
+            next = m->link;
+            m->link = batch;
+            batch = m;
+            m = next;
+            n++;
+        }
 
+        if (n > 0) {
+            cap->message_stats.received += n;
+            cap->message_stats.batches++;
+#if defined(TRACING)
+            if (RTS_UNLIKELY(TRACE_sched)) {
+                StgWord64 now = getMonotonicNSec();
+                StgWord64 since = cap->inbox_since;
+                if (since != 0 && since < now) {
+                    cap->message_stats.latency_total += now - since;
+                    if (now - since > cap->message_stats.latency_max) {
+                        cap->message_stats.latency_max = now - since;
+                    }
+                }
+            }
+#endif
+        }
+
+        m = batch;
         while (m != (Message*)END_TSO_QUEUE) {
             next = m->link;
             executeMessage(cap, m);
@@ -1824,6 +1932,7 @@ delete_threads_and_gc:
 #endif
 
     traceSparkCounters(cap);
+    traceMessageCounters(cap);
 
     switch (recent_activity) {
     case ACTIVITY_INACTIVE:
@@ -2074,6 +2183,12 @@ forkProcess(HsStablePtr *entry
           }
         }
 
+#if !defined(THREADED_RTS)
+        // The threads blocked on I/O are gone, and an epoll instance
+        // would be shared with the parent: start again with a new one.
+        freeBlockedQueue();
+#endif
+
         discardTasksExcept(task);
 
         for (i=0; i < n_capabilities; i++) {
@@ -2275,6 +2390,36 @@ setNumCapabilities (uint32_t new_n_capabilities USED_IF_THREADS)
 }
 
 
+/* ---------------------------------------------------------------------------
+ * withAllCapabilitiesStopped()
+ *
+ * Like setNumCapabilities(), stop all Haskell execution, run an action,
+ * then let the capabilities go again.  Used to start and stop the
+ * eventlog at runtime (see Trace.c).
+ * ------------------------------------------------------------------------- */
+
+void
+withAllCapabilitiesStopped (void (*action)(void *arg), void *arg)
+{
+#if !defined(THREADED_RTS)
+    // Nothing else can be running Haskell code while we are here
+    action(arg);
+#else
+    Task *task;
+    Capability *cap;
+
+    cap = rts_lock();
+    task = cap->running_task;
+
+    stopAllCapabilities(&cap, task);
+
+    action(arg);
+
+    releaseAllCapabilities(n_capabilities, cap, task);
+
+    rts_unlock(cap);
+#endif
+}
 
 /* ---------------------------------------------------------------------------
  * Delete all the threads in the system
@@ -2303,8 +2448,8 @@ deleteAllThreads ( Capability *cap )
     // being GC'd, and we don't want the "main thread has been GC'd" panic.
 
 #if !defined(THREADED_RTS)
-    ASSERT(blocked_queue_hd == END_TSO_QUEUE);
-    ASSERT(sleeping_queue == END_TSO_QUEUE);
+    ASSERT(emptyBlockedQueue());
+    ASSERT(emptySleepingQueue());
 #endif
 }
 
@@ -2403,6 +2548,8 @@ suspendThread (StgRegTable *reg, bool interruptible)
     tso->why_blocked = BlockedOnCCall;
   }
 
+  schedStatsStopRun(cap, tso, tso->why_blocked);
+
   // Hand back capability
   task->incall->suspended_tso = tso;
   task->incall->suspended_cap = cap;
@@ -2461,6 +2608,7 @@ resumeThread (void *task_)
     tso->_link = END_TSO_QUEUE; // no write barrier reqd
 
     traceEventRunThread(cap, tso);
+    schedStatsStartRun(cap, tso);
 
     /* Reset blocking status */
     tso->why_blocked  = NotBlocked;
@@ -2622,7 +2770,7 @@ initScheduler(void)
 #if !defined(THREADED_RTS)
   blocked_queue_hd  = END_TSO_QUEUE;
   blocked_queue_tl  = END_TSO_QUEUE;
-  sleeping_queue    = END_TSO_QUEUE;
+  initSleepingQueue();
 #endif
 
   sched_state    = SCHED_RUNNING;
@@ -2701,6 +2849,10 @@ freeScheduler( void )
     if (still_running == 0) {
         freeCapabilities();
     }
+#if !defined(THREADED_RTS)
+    freeBlockedQueue();
+    freeSleepingQueue();
+#endif
     RELEASE_LOCK(&sched_mutex);
 #if defined(THREADED_RTS)
     closeMutex(&sched_mutex);
@@ -2711,9 +2863,8 @@ void markScheduler (evac_fn evac USED_IF_NOT_THREADS,
                     void *user USED_IF_NOT_THREADS)
 {
 #if !defined(THREADED_RTS)
-    evac(user, (StgClosure **)(void *)&blocked_queue_hd);
-    evac(user, (StgClosure **)(void *)&blocked_queue_tl);
-    evac(user, (StgClosure **)(void *)&sleeping_queue);
+    markBlockedQueue(evac, user);
+    markSleepingQueue(evac, user);
 #endif
 }
 
@@ -12,6 +12,8 @@
 
 #include "rts/OSThreads.h"
 #include "Capability.h"
+#include "SchedStats.h"
+#include "SleepingQueue.h"
 #include "Trace.h"
 
 #include "BeginPrivate.h"
@@ -50,6 +52,15 @@ StgWord findRetryFrameHelper (Capability *cap, StgTSO *tso);
 /* Entry point for a new worker */
 void scheduleWorker (Capability *cap, Task *task);
 
+/* withAllCapabilitiesStopped()
+ *
+ * Run an action while holding every Capability, to change global state
+ * that capabilities read without locking.
+ * Called from STG :  no (from a safe foreign call, or outside Haskell)
+ * Locks assumed   :  none
+ */
+void withAllCapabilitiesStopped (void (*action)(void *arg), void *arg);
+
 /* The state of the scheduler.  This is used to control the sequence
  * of events during shutdown.  See Note [shutdown] in Schedule.c.
  */
@@ -98,7 +109,16 @@ extern volatile StgWord recent_activity;
  */
 #if !defined(THREADED_RTS)
 extern  StgTSO *blocked_queue_hd, *blocked_queue_tl;
-extern  StgTSO *sleeping_queue;
+
+/* Threads blocked on I/O are put on blocked_queue.  With epoll,
+ * awaitEvent() moves them onto per-fd queues of its own, so the
+ * following must be used instead of looking at blocked_queue directly.
+ * Implemented in posix/Select.c and win32/AwaitEvent.c.
+ */
+bool emptyBlockedQueue      (void);
+void removeFromBlockedQueue (Capability *cap, StgTSO *tso);
+void markBlockedQueue       (evac_fn evac, void *user);
+void freeBlockedQueue       (void);
 #endif
 
 extern bool heap_overflow;
@@ -120,7 +140,15 @@ void resurrectThreads (StgTSO *);
 
 /* END_TSO_QUEUE and friends now defined in includes/stg/MiscClosures.h */
 
-/* Add a thread to the end of the run queue.
+/* Insert a thread into the run queue ahead of lower-priority threads.
+ * Used by appendToRunQueue() when the thread cannot simply go at the end.
+ */
+void insertInRunQueue (Capability *cap, StgTSO *tso);
+
+/* Add a thread to the end of the run queue, or rather to the end of
+ * the threads of the same or higher priority (see Note [Thread
+ * priorities] in Schedule.c).  When every thread has the default
+ * priority this is a plain FIFO append.
  * NOTE: tso->link should be END_TSO_QUEUE before calling this macro.
  * ASSUMES: cap->running_task is the current task.
  */
@@ -131,9 +159,16 @@ EXTERN_INLINE void
 appendToRunQueue (Capability *cap, StgTSO *tso)
 {
     ASSERT(tso->_link == END_TSO_QUEUE);
+    tso->rq_overtaken = 0;
+    if (RTS_UNLIKELY(RtsFlags.MiscFlags.schedStats)) {
+        schedStatsRunnable_(cap, tso);
+    }
     if (cap->run_queue_hd == END_TSO_QUEUE) {
         cap->run_queue_hd = tso;
         tso->block_info.prev = END_TSO_QUEUE;
+    } else if (RTS_UNLIKELY(tso->priority > cap->run_queue_tl->priority)) {
+        insertInRunQueue(cap, tso);
+        return;
     } else {
         setTSOLink(cap, cap->run_queue_tl, tso);
         setTSOPrev(cap, tso, cap->run_queue_tl);
@@ -151,6 +186,12 @@ pushOnRunQueue (Capability *cap, StgTSO *tso);
 EXTERN_INLINE void
 pushOnRunQueue (Capability *cap, StgTSO *tso)
 {
+    // Nothing may overtake a thread pushed on the front: it runs next
+    // (see Note [Thread priorities] in Schedule.c)
+    tso->rq_overtaken = MAX_RUN_QUEUE_OVERTAKES;
+    if (RTS_UNLIKELY(RtsFlags.MiscFlags.schedStats)) {
+        schedStatsRunnable_(cap, tso);
+    }
     setTSOLink(cap, tso, cap->run_queue_hd);
     tso->block_info.prev = END_TSO_QUEUE;
     if (cap->run_queue_hd != END_TSO_QUEUE) {
@@ -229,8 +270,8 @@ truncateRunQueue(Capability *cap)
 }
 
 #if !defined(THREADED_RTS)
-#define EMPTY_BLOCKED_QUEUE()  (emptyQueue(blocked_queue_hd))
-#define EMPTY_SLEEPING_QUEUE() (emptyQueue(sleeping_queue))
+#define EMPTY_BLOCKED_QUEUE()  (emptyBlockedQueue())
+#define EMPTY_SLEEPING_QUEUE() (emptySleepingQueue())
 #endif
 
 INLINE_HEADER bool
@@ -0,0 +1,180 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * Threads blocked in threadDelay, in the non-threaded RTS
+ *
+ * ---------------------------------------------------------------------------*/
+
+/*
+ * In the non-threaded RTS, threadDelay blocks the thread with
+ * BlockedOnDelay and puts it on the sleeping queue, and awaitEvent()
+ * (posix/Select.c) wakes up the threads whose target time has passed.
+ *
+ * The sleeping queue used to be a linked list sorted by target time,
+ * so every threadDelay was O(n) in the number of sleeping threads,
+ * which made programs with many concurrent timeouts quadratic.  It is
+ * now a binary min-heap of TSOs keyed on tso->block_info.target, held
+ * in an array allocated with stgMallocBytes().  Each thread records its
+ * position in the heap in tso->sleep_index, so that removing it (when
+ * it is sent an exception, e.g. by System.Timeout.timeout) is
+ * O(log n) as well as inserting it.
+ *
+ * The array is a GC root: markSleepingQueue() evacuates every entry.
+ * Evacuation does not change the target times, so the heap stays valid.
+ */
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "SleepingQueue.h"
+#include "RtsUtils.h"
+
+#if !defined(THREADED_RTS)
+
+static StgTSO **sleeping_heap = NULL;
+static uint32_t sleeping_heap_size = 0;
+
+uint32_t n_sleeping_threads = 0;
+
+#define INIT_SLEEPING_HEAP_SIZE 64
+
+// Whether a's target is before b's.  Like the wakeup test in
+// posix/Select.c, this works even if the LowResTime has wrapped around.
+INLINE_HEADER bool
+earlier (StgTSO *a, StgTSO *b)
+{
+    return ((long)a->block_info.target - (long)b->block_info.target) < 0;
+}
+
+INLINE_HEADER void
+setHeapEntry (uint32_t i, StgTSO *tso)
+{
+    sleeping_heap[i] = tso;
+    tso->sleep_index = i;
+}
+
+static void
+siftUp (uint32_t i)
+{
+    StgTSO *tso = sleeping_heap[i];
+
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!earlier(tso, sleeping_heap[parent])) break;
+        setHeapEntry(i, sleeping_heap[parent]);
+        i = parent;
+    }
+    setHeapEntry(i, tso);
+}
+
+static void
+siftDown (uint32_t i)
+{
+    StgTSO *tso = sleeping_heap[i];
+
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= n_sleeping_threads) break;
+        if (child + 1 < n_sleeping_threads
+            && earlier(sleeping_heap[child + 1], sleeping_heap[child])) {
+            child++;
+        }
+        if (!earlier(sleeping_heap[child], tso)) break;
+        setHeapEntry(i, sleeping_heap[child]);
+        i = child;
+    }
+    setHeapEntry(i, tso);
+}
+
+static void
+removeAt (uint32_t i)
+{
+    StgTSO *last;
+
+    ASSERT(i < n_sleeping_threads);
+    n_sleeping_threads--;
+    if (i == n_sleeping_threads) return;
+
+    last = sleeping_heap[n_sleeping_threads];
+    setHeapEntry(i, last);
+    if (i > 0 && earlier(last, sleeping_heap[(i - 1) / 2])) {
+        siftUp(i);
+    } else {
+        siftDown(i);
+    }
+}
+
+void
+initSleepingQueue (void)
+{
+    sleeping_heap_size = INIT_SLEEPING_HEAP_SIZE;
+    sleeping_heap = stgMallocBytes(sizeof(StgTSO *) * sleeping_heap_size,
+                                   "initSleepingQueue");
+    n_sleeping_threads = 0;
+}
+
+void
+freeSleepingQueue (void)
+{
+    if (sleeping_heap != NULL) {
+        stgFree(sleeping_heap);
+        sleeping_heap = NULL;
+    }
+    sleeping_heap_size = 0;
+    n_sleeping_threads = 0;
+}
+
+void
+markSleepingQueue (evac_fn evac, void *user)
+{
+    uint32_t i;
+
+    for (i = 0; i < n_sleeping_threads; i++) {
+        evac(user, (StgClosure **)(void *)&sleeping_heap[i]);
+        // the TSO may have moved; its sleep_index is still valid
+    }
+}
+
+void
+insertSleepingThread (StgTSO *tso)
+{
+    if (n_sleeping_threads == sleeping_heap_size) {
+        sleeping_heap_size *= 2;
+        sleeping_heap = stgReallocBytes(sleeping_heap,
+                                        sizeof(StgTSO *) * sleeping_heap_size,
+                                        "insertSleepingThread");
+    }
+
+    tso->_link = END_TSO_QUEUE;
+    sleeping_heap[n_sleeping_threads] = tso;
+    siftUp(n_sleeping_threads++);
+}
+
+void
+removeSleepingThread (StgTSO *tso)
+{
+    ASSERT(tso->sleep_index < n_sleeping_threads);
+    ASSERT(sleeping_heap[tso->sleep_index] == tso);
+    removeAt(tso->sleep_index);
+}
+
+StgTSO *
+peekSleepingThread (void)
+{
+    if (n_sleeping_threads == 0) return END_TSO_QUEUE;
+    return sleeping_heap[0];
+}
+
+StgTSO *
+popSleepingThread (void)
+{
+    StgTSO *tso;
+
+    if (n_sleeping_threads == 0) return END_TSO_QUEUE;
+    tso = sleeping_heap[0];
+    removeAt(0);
+    return tso;
+}
+
+#endif /* !THREADED_RTS */
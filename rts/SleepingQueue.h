@@ -0,0 +1,46 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * Threads blocked in threadDelay, in the non-threaded RTS
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SLEEPINGQUEUE_H
+#define SLEEPINGQUEUE_H
+
+#include "sm/GC.h" // for evac_fn
+
+#include "BeginPrivate.h"
+
+#if !defined(THREADED_RTS)
+
+void initSleepingQueue (void);
+void freeSleepingQueue (void);
+void markSleepingQueue (evac_fn evac, void *user);
+
+// tso->block_info.target must be set.  Called from stg_delayzh.
+void insertSleepingThread (StgTSO *tso);
+
+// Remove a thread that is on the sleeping queue
+void removeSleepingThread (StgTSO *tso);
+
+// The thread with the earliest target, or END_TSO_QUEUE if the queue
+// is empty
+StgTSO *peekSleepingThread (void);
+
+// Remove and return the thread with the earliest target
+StgTSO *popSleepingThread (void);
+
+extern uint32_t n_sleeping_threads;
+
+INLINE_HEADER bool emptySleepingQueue (void)
+{
+    return n_sleeping_threads == 0;
+}
+
+#endif /* !THREADED_RTS */
+
+#include "EndPrivate.h"
+
+#endif /* SLEEPINGQUEUE_H */
@@ -13,6 +13,7 @@
 #include "RtsUtils.h"
 #include "Schedule.h"
 #include "Stats.h"
+#include "STM.h"
 #include "Profiling.h"
 #include "GetTime.h"
 #include "sm/Storage.h"
@@ -908,6 +909,9 @@ void getRTSStats( RTSStats *s )
         PROF_VAL(RP_tot_time + HC_tot_time);
     s->mutator_elapsed_ns = current_elapsed - end_init_elapsed -
         stats.gc_elapsed_ns;
+
+    sumSchedStats(&s->sched);
+    sumStmStats(&s->stm);
 }
 
 /* -----------------------------------------------------------------------------
@@ -14,6 +14,7 @@
 #include "RtsUtils.h"
 #include "Task.h"
 #include "Capability.h"
+#include "CpuTopology.h"
 #include "Stats.h"
 #include "Schedule.h"
 #include "Hash.h"
@@ -424,7 +425,7 @@ workerStart(Task *task)
     RELEASE_LOCK(&task->lock);
 
     if (RtsFlags.ParFlags.setAffinity) {
-        setThreadAffinity(cap->no, n_capabilities);
+        setCapabilityAffinity(cap->no, n_capabilities);
     }
     if (RtsFlags.GcFlags.numa && !RtsFlags.DebugFlags.numa) {
         setThreadNode(numa_map[task->node]);
@@ -504,7 +505,7 @@ void rts_setInCallCapability (
 #ifdef THREADED_RTS
     if (affinity) {
         if (RtsFlags.ParFlags.setAffinity) {
-            setThreadAffinity(preferred_capability, n_capabilities);
+            setCapabilityAffinity(preferred_capability, n_capabilities);
         }
     }
 #endif
@@ -110,7 +110,16 @@ createThread(Capability *cap, W_ size)
 
     ASSIGN_Int64((W_*)&(tso->alloc_limit), 0);
 
+    tso->priority     = 0;
+    tso->rq_overtaken = 0;
+
+    tso->sched_blocked = NotBlocked;
+    tso->sched_stamp   = 0;
+    tso->sleep_index   = 0;
+
     tso->trec = NO_TREC;
+    tso->stm_aborts = 0;
+    tso->stm_woken_by = NO_WAKE_TVAR;
 
 #ifdef PROFILING
     tso->prof.cccs = CCS_MAIN;
@@ -189,6 +198,28 @@ void rts_disableThreadAllocationLimit(StgPtr tso)
     ((StgTSO *)tso)->flags &= ~TSO_ALLOC_LIMIT;
 }
 
+/* ---------------------------------------------------------------------------
+ * Getting & setting the thread priority
+ *
+ * The priority is consulted when the thread is next put on a run
+ * queue, so changing the priority of a thread that is already
+ * runnable takes effect after it has next been scheduled.
+ * ------------------------------------------------------------------------ */
+HsInt rts_getThreadPriority(StgPtr tso)
+{
+    return ((StgTSO *)tso)->priority;
+}
+
+void rts_setThreadPriority(StgPtr tso, HsInt priority)
+{
+    if (priority > MAX_THREAD_PRIORITY) {
+        priority = MAX_THREAD_PRIORITY;
+    } else if (priority < MIN_THREAD_PRIORITY) {
+        priority = MIN_THREAD_PRIORITY;
+    }
+    ((StgTSO *)tso)->priority = (StgInt16)priority;
+}
+
 /* -----------------------------------------------------------------------------
    Remove a thread from a queue.
    Fails fatally if the TSO is not on the queue.
@@ -20,6 +20,7 @@
 
 #include "Timer.h"
 #include "Proftimer.h"
+#include "CpuSample.h"
 #include "Schedule.h"
 #include "Ticker.h"
 #include "Capability.h"
@@ -42,6 +43,7 @@ void
 handle_tick(int unused STG_UNUSED)
 {
   handleProfTick();
+  handleCpuSampleTick();
   if (RtsFlags.ConcFlags.ctxtSwitchTicks > 0) {
       ticks_to_ctxt_switch--;
       if (ticks_to_ctxt_switch <= 0) {
@@ -12,6 +12,13 @@
 // internal headers
 #include "Trace.h"
 
+#if defined(DTRACE)
+// The DTrace probes may want any message
+int userEventsEnabled = 1;
+#else
+int userEventsEnabled = 0;
+#endif
+
 #ifdef TRACING
 
 #include "GetTime.h"
@@ -20,6 +27,8 @@
 #include "eventlog/EventLog.h"
 #include "Threads.h"
 #include "Printer.h"
+#include "Schedule.h"
+#include "CpuSample.h"
 
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -39,16 +48,14 @@ static Mutex trace_utx;
 
 static bool eventlog_enabled;
 
+static void traceInitialEvents (void);
+
 /* ---------------------------------------------------------------------------
    Starting up / shuttting down the tracing facilities
  --------------------------------------------------------------------------- */
 
-void initTracing (void)
+static void setTraceClasses (void)
 {
-#ifdef THREADED_RTS
-    initMutex(&trace_utx);
-#endif
-
     // -Ds turns on scheduler tracing too
     TRACE_sched =
         RtsFlags.TraceFlags.scheduler ||
@@ -73,6 +80,9 @@ void initTracing (void)
 
     TRACE_user =
         RtsFlags.TraceFlags.user;
+#if !defined(DTRACE)
+    userEventsEnabled = TRACE_user;
+#endif
 
     // We trace cap events if we're tracing anything else
     TRACE_cap =
@@ -81,44 +91,292 @@ void initTracing (void)
         TRACE_spark_sampled ||
         TRACE_spark_full ||
         TRACE_user;
+}
 
-    eventlog_enabled = RtsFlags.TraceFlags.tracing == TRACE_EVENTLOG;
+static void clearTraceClasses (void)
+{
+    TRACE_sched = 0;
+    TRACE_gc = 0;
+    TRACE_spark_sampled = 0;
+    TRACE_spark_full = 0;
+    TRACE_user = 0;
+#if !defined(DTRACE)
+    userEventsEnabled = 0;
+#endif
+    TRACE_cap = 0;
+}
+
+/* The writer selected by +RTS --eventlog-fd/--eventlog-pipe/...,
+   defaulting to <prog>.eventlog */
+static const EventLogWriter *flagsEventLogWriter (void)
+{
+    const EventLogWriter *writer;
+
+    switch (RtsFlags.TraceFlags.eventlogSink) {
+    case EVENTLOG_SINK_FD:
+        return fdEventLogWriter(RtsFlags.TraceFlags.eventlogFd, false);
+    case EVENTLOG_SINK_PIPE:
+        writer = pipeEventLogWriter(RtsFlags.TraceFlags.eventlogPath);
+        break;
+    case EVENTLOG_SINK_SOCKET:
+        writer = socketEventLogWriter(RtsFlags.TraceFlags.eventlogPath);
+        break;
+    default:
+        return &FileEventLogWriter;
+    }
+
+    if (writer == NULL) {
+        sysErrorBelch("initTracing: can't open eventlog sink %s",
+                      RtsFlags.TraceFlags.eventlogPath);
+        stg_exit(EXIT_FAILURE);
+    }
+    return writer;
+}
+
+void initTracing (void)
+{
+#ifdef THREADED_RTS
+    initMutex(&trace_utx);
+#endif
+
+    setTraceClasses();
 
     /* Note: we can have any of the TRACE_* flags turned on even when
        eventlog_enabled is off. In the DEBUG way we may be tracing to stderr.
      */
 
-    if (eventlog_enabled) {
-        initEventLogging();
+    // Always ready, so that startEventLogging() can be used later
+    initEventLogging();
+
+    if (RtsFlags.TraceFlags.tracing == TRACE_EVENTLOG) {
+#ifdef THREADED_RTS
+        // XXX n_capabilities hasn't been initialised yet
+        openEventLog(flagsEventLogWriter(),
+                     RtsFlags.ParFlags.nCapabilities);
+#else
+        openEventLog(flagsEventLogWriter(), 1);
+#endif
+        eventlog_enabled = true;
     }
 }
 
 void endTracing (void)
 {
     if (eventlog_enabled) {
-        endEventLogging();
+        closeEventLog();
+        eventlog_enabled = false;
     }
 }
 
 void freeTracing (void)
 {
-    if (eventlog_enabled) {
-        freeEventLogging();
-    }
+    freeEventLogging();
 }
 
 void resetTracing (void)
 {
+    const EventLogWriter *writer;
+
     if (eventlog_enabled) {
-        abortEventLogging(); // abort eventlog inherited from parent
-        initEventLogging(); // child starts its own eventlog
+        writer = abortEventLogging(); // abort eventlog inherited from parent
+        if (writer == &FileEventLogWriter) {
+            // child starts its own eventlog
+            openEventLog(writer, n_capabilities);
+        } else {
+            // other sinks belong to the parent's consumer
+            eventlog_enabled = false;
+            clearTraceClasses();
+        }
     }
 }
 
 void tracingAddCapapilities (uint32_t from, uint32_t to)
 {
+    moreCapEventBufs(from,to);
+}
+
+/* ---------------------------------------------------------------------------
+   Starting and stopping the eventlog at runtime
+
+   Capabilities test the TRACE_* flags and post to their own buffers
+   without locking, so the flags, the writer and the buffers only change
+   while we hold every capability (withAllCapabilitiesStopped()), just as
+   setNumCapabilities() does.  Stopping clears the TRACE_* flags, so a
+   stopped eventlog costs the same as one that was never started.
+ --------------------------------------------------------------------------- */
+
+typedef struct {
+    const EventLogWriter *writer;
+    bool started;
+} StartEventLogging;
+
+static void startEventLoggingAll (void *arg)
+{
+    StartEventLogging *start = arg;
+
+    // Tracing to stderr (-v) owns the TRACE_* flags
+    if (eventlog_enabled ||
+        RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        start->started = false;
+        return;
+    }
+
+    if (RtsFlags.TraceFlags.tracing == TRACE_NONE) {
+        // The default classes, as for a bare +RTS -l
+        RtsFlags.TraceFlags.tracing        = TRACE_EVENTLOG;
+        RtsFlags.TraceFlags.scheduler      = true;
+        RtsFlags.TraceFlags.gc             = true;
+        RtsFlags.TraceFlags.sparks_sampled = true;
+        RtsFlags.TraceFlags.user           = true;
+    }
+
+    openEventLog(start->writer, n_capabilities);
+    eventlog_enabled = true;
+    setTraceClasses();
+    traceInitialEvents();
+    start->started = true;
+}
+
+static void endEventLoggingAll (void *arg STG_UNUSED)
+{
+    if (eventlog_enabled) {
+        clearTraceClasses();
+        eventlog_enabled = false;
+        closeEventLog();
+        // A new eventlog needs the symbols again
+        resetCpuSampleSymbols();
+    }
+}
+
+bool startEventLogging (const EventLogWriter *writer)
+{
+    StartEventLogging start = { .writer = writer, .started = false };
+
     if (eventlog_enabled) {
-        moreCapEventBufs(from,to);
+        return false;
+    }
+    withAllCapabilitiesStopped(startEventLoggingAll, &start);
+    return start.started;
+}
+
+void endEventLogging (void)
+{
+    if (!eventlog_enabled) {
+        return;
+    }
+    withAllCapabilitiesStopped(endEventLoggingAll, NULL);
+}
+
+enum EventLogStatus eventLogStatus (void)
+{
+    return eventlog_enabled ? EVENTLOG_RUNNING : EVENTLOG_NOT_CONFIGURED;
+}
+
+/* ---------------------------------------------------------------------------
+   Changing the event classes at runtime
+
+   The selected classes live in RtsFlags.TraceFlags, where +RTS -l puts
+   them, and are copied to the TRACE_* flags only while something is
+   consuming events.  As with starting and stopping, the copy happens with
+   every capability stopped, so a disabled class costs no more than the
+   test in its Trace.h wrapper.
+ --------------------------------------------------------------------------- */
+
+uint32_t getEventLogClasses (void)
+{
+    uint32_t classes = 0;
+
+    if (RtsFlags.TraceFlags.scheduler) {
+        classes |= EVENTLOG_CLASS_SCHEDULER;
+    }
+    if (RtsFlags.TraceFlags.gc) {
+        classes |= EVENTLOG_CLASS_GC;
+    }
+    if (RtsFlags.TraceFlags.sparks_sampled) {
+        classes |= EVENTLOG_CLASS_SPARKS_SAMPLED;
+    }
+    if (RtsFlags.TraceFlags.sparks_full) {
+        classes |= EVENTLOG_CLASS_SPARKS_FULL;
+    }
+    if (RtsFlags.TraceFlags.user) {
+        classes |= EVENTLOG_CLASS_USER;
+    }
+    return classes;
+}
+
+static void setEventLogClassesAll (void *arg)
+{
+    uint32_t classes = *(uint32_t *)arg;
+    int was_tracing_gc = TRACE_gc;
+
+    RtsFlags.TraceFlags.scheduler =
+        (classes & EVENTLOG_CLASS_SCHEDULER) != 0;
+    RtsFlags.TraceFlags.gc =
+        (classes & EVENTLOG_CLASS_GC) != 0;
+    RtsFlags.TraceFlags.sparks_sampled =
+        (classes & EVENTLOG_CLASS_SPARKS_SAMPLED) != 0;
+    RtsFlags.TraceFlags.sparks_full =
+        (classes & EVENTLOG_CLASS_SPARKS_FULL) != 0;
+    RtsFlags.TraceFlags.user =
+        (classes & EVENTLOG_CLASS_USER) != 0;
+
+    // An explicit choice, so startEventLogging() must not replace it
+    // with the default classes
+    if (RtsFlags.TraceFlags.tracing == TRACE_NONE) {
+        RtsFlags.TraceFlags.tracing = TRACE_EVENTLOG;
+    }
+
+    if (eventlog_enabled || RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        setTraceClasses();
+    }
+
+    // Consumers need the heap parameters to make sense of the GC events
+    if (eventlog_enabled && TRACE_gc && !was_tracing_gc) {
+        traceEventHeapInfo_(CAPSET_HEAP_DEFAULT,
+                            RtsFlags.GcFlags.generations,
+                            RtsFlags.GcFlags.maxHeapSize * BLOCK_SIZE,
+                            RtsFlags.GcFlags.minAllocAreaSize * BLOCK_SIZE,
+                            MBLOCK_SIZE,
+                            BLOCK_SIZE);
+    }
+}
+
+uint32_t setEventLogClasses (uint32_t classes)
+{
+    uint32_t old = getEventLogClasses();
+
+    withAllCapabilitiesStopped(setEventLogClassesAll, &classes);
+    return old;
+}
+
+/* A consumer attaching to a running process has missed the events emitted
+   at startup that describe the process and its capabilities. */
+static void traceInitialEvents (void)
+{
+    uint32_t i;
+
+    traceCapsetEvent_(EVENT_CAPSET_CREATE, CAPSET_OSPROCESS_DEFAULT,
+                      CapsetTypeOsProcess);
+    traceCapsetEvent_(EVENT_CAPSET_CREATE, CAPSET_CLOCKDOMAIN_DEFAULT,
+                      CapsetTypeClockdomain);
+    for (i = 0; i < n_capabilities; i++) {
+        traceCapEvent_(capabilities[i], EVENT_CAP_CREATE);
+        traceCapsetEvent_(EVENT_CAPSET_ASSIGN_CAP, CAPSET_OSPROCESS_DEFAULT, i);
+        traceCapsetEvent_(EVENT_CAPSET_ASSIGN_CAP, CAPSET_CLOCKDOMAIN_DEFAULT,
+                          i);
+        if (capabilities[i]->disabled) {
+            traceCapEvent_(capabilities[i], EVENT_CAP_DISABLE);
+        }
+    }
+    traceWallClockTime_();
+    traceOSProcessInfo_();
+    if (TRACE_gc) {
+        traceEventHeapInfo_(CAPSET_HEAP_DEFAULT,
+                            RtsFlags.GcFlags.generations,
+                            RtsFlags.GcFlags.maxHeapSize * BLOCK_SIZE,
+                            RtsFlags.GcFlags.minAllocAreaSize * BLOCK_SIZE,
+                            MBLOCK_SIZE,
+                            BLOCK_SIZE);
     }
 }
 
@@ -544,6 +802,22 @@ void traceSparkCounters_ (Capability *cap,
     }
 }
 
+void traceMessageCounters_ (Capability *cap,
+                            MessageCounters counters)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        debugBelch("cap %d: %" FMT_Word " messages in %" FMT_Word " batches, "
+                   "latency total %" FMT_Word64 "ns, max %" FMT_Word64 "ns\n",
+                   cap->no, counters.received, counters.batches,
+                   counters.latency_total, counters.latency_max);
+    } else
+#endif
+    {
+        postMessageCountersEvent(cap, counters);
+    }
+}
+
 void traceTaskCreate_ (Task       *task,
                        Capability *cap)
 {
@@ -590,6 +864,71 @@ void traceTaskDelete_ (Task *task)
     }
 }
 
+void traceCapCpuPlacement_ (uint32_t capno,
+                            uint32_t cpu,
+                            uint32_t package,
+                            uint32_t core,
+                            uint32_t cache_group)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        debugBelch("cap %d: placed on cpu %d (package %d, core %d, "
+                   "cache group %d)\n",
+                   capno, cpu, package, core, cache_group);
+    } else
+#endif
+    {
+        postCapCpuPlacementEvent((EventCapNo)capno, cpu, package, core,
+                                 cache_group);
+    }
+}
+
+void traceSchedHistogram(Capability *cap, StgWord16 kind,
+                         const SchedHistogram *h)
+{
+    if (eventlog_enabled) {
+        postSchedHistogramEvent(cap, kind, h);
+    }
+}
+
+void traceStmAbort_(Capability *cap, StgTSO *tso, StgWord site,
+                    StgWord tvar, StgWord32 aborts)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        debugBelch("cap %d: thread %" FMT_Word " aborted STM transaction "
+                   "(site %p, tvar %p, %" FMT_Word32 " consecutive)\n",
+                   cap->no, (W_)tso->id, (void *)site, (void *)tvar, aborts);
+    } else
+#endif
+    {
+        postStmAbortEvent(cap, tso->id, site, tvar, aborts);
+    }
+}
+
+void traceStmSiteAborts(Capability *cap, StgWord site, StgWord64 aborts)
+{
+    if (eventlog_enabled) {
+        postStmSiteAbortsEvent(cap, site, aborts);
+    }
+}
+
+void traceCpuSample(Capability *cap, StgTSO *tso,
+                    const StgWord *frames, uint32_t n_frames)
+{
+    if (eventlog_enabled) {
+        postCpuSampleEvent(cap, tso->id, frames, n_frames);
+    }
+}
+
+void traceCpuSampleSymbol(Capability *cap, StgWord addr, StgWord32 line,
+                          const char *function, const char *file)
+{
+    if (eventlog_enabled) {
+        postCpuSampleSymbolEvent(cap, addr, line, function, file);
+    }
+}
+
 void traceHeapProfBegin(StgWord8 profile_id)
 {
     if (eventlog_enabled) {
@@ -791,6 +1130,35 @@ void traceEnd (void)
 }
 #endif /* DEBUG */
 
+#else /* !TRACING */
+
+/* The eventlog API, in an RTS built without eventlog support */
+
+bool startEventLogging (const EventLogWriter *writer STG_UNUSED)
+{
+    return false;
+}
+
+void endEventLogging (void)
+{
+    /* nothing */
+}
+
+enum EventLogStatus eventLogStatus (void)
+{
+    return EVENTLOG_NOT_SUPPORTED;
+}
+
+uint32_t getEventLogClasses (void)
+{
+    return 0;
+}
+
+uint32_t setEventLogClasses (uint32_t classes STG_UNUSED)
+{
+    return 0;
+}
+
 #endif /* TRACING */
 
 // If DTRACE is enabled, but neither DEBUG nor TRACING, we need a C land
@@ -69,7 +69,7 @@ extern int TRACE_sched;
 extern int TRACE_gc;
 extern int TRACE_spark_sampled;
 extern int TRACE_spark_full;
-/* extern int TRACE_user; */  // only used in Trace.c
+/* extern int TRACE_user; */  // only used in Trace.c and PrimOps.cmm
 extern int TRACE_cap;
 
 // -----------------------------------------------------------------------------
@@ -272,6 +272,9 @@ void traceSparkCounters_ (Capability *cap,
                           SparkCounters counters,
                           StgWord remaining);
 
+void traceMessageCounters_ (Capability *cap,
+                            MessageCounters counters);
+
 void traceTaskCreate_ (Task       *task,
                        Capability *cap);
 
@@ -281,6 +284,26 @@ void traceTaskMigrate_ (Task       *task,
 
 void traceTaskDelete_ (Task       *task);
 
+void traceCapCpuPlacement_ (uint32_t capno,
+                            uint32_t cpu,
+                            uint32_t package,
+                            uint32_t core,
+                            uint32_t cache_group);
+
+void traceSchedHistogram(Capability *cap, StgWord16 kind,
+                         const SchedHistogram *h);
+
+void traceStmAbort_(Capability *cap, StgTSO *tso, StgWord site,
+                    StgWord tvar, StgWord32 aborts);
+
+void traceStmSiteAborts(Capability *cap, StgWord site, StgWord64 aborts);
+
+void traceCpuSample(Capability *cap, StgTSO *tso,
+                    const StgWord *frames, uint32_t n_frames);
+
+void traceCpuSampleSymbol(Capability *cap, StgWord addr, StgWord32 line,
+                          const char *function, const char *file);
+
 void traceHeapProfBegin(StgWord8 profile_id);
 void traceHeapProfSampleBegin(StgInt era);
 void traceHeapProfSampleString(StgWord8 profile_id,
@@ -321,9 +344,16 @@ void traceHeapProfSampleCostCentre(StgWord8 profile_id,
 #define traceWallClockTime_() /* nothing */
 #define traceOSProcessInfo_() /* nothing */
 #define traceSparkCounters_(cap, counters, remaining) /* nothing */
+#define traceMessageCounters_(cap, counters) /* nothing */
 #define traceTaskCreate_(taskID, cap) /* nothing */
 #define traceTaskMigrate_(taskID, cap, new_cap) /* nothing */
 #define traceTaskDelete_(taskID) /* nothing */
+#define traceCapCpuPlacement_(capno, cpu, package, core, cache_group) /* nothing */
+#define traceSchedHistogram(cap, kind, h) /* nothing */
+#define traceStmAbort_(cap, tso, site, tvar, aborts) /* nothing */
+#define traceStmSiteAborts(cap, site, aborts) /* nothing */
+#define traceCpuSample(cap, tso, frames, n_frames) /* nothing */
+#define traceCpuSampleSymbol(cap, addr, line, function, file) /* nothing */
 #define traceHeapProfBegin(profile_id) /* nothing */
 #define traceHeapProfCostCentre(ccID, label, module, srcloc, is_caf) /* nothing */
 #define traceHeapProfSampleBegin(era) /* nothing */
@@ -781,6 +811,26 @@ INLINE_HEADER void traceSparkCounters(Capability *cap STG_UNUSED)
 #endif
 }
 
+INLINE_HEADER void traceMessageCounters(Capability *cap STG_UNUSED)
+{
+#ifdef THREADED_RTS
+    if (RTS_UNLIKELY(TRACE_sched)) {
+        traceMessageCounters_(cap, cap->message_stats);
+    }
+#endif
+}
+
+INLINE_HEADER void traceEventStmAbort(Capability *cap    STG_UNUSED,
+                                      StgTSO     *tso    STG_UNUSED,
+                                      StgWord     site   STG_UNUSED,
+                                      StgWord     tvar   STG_UNUSED,
+                                      StgWord32   aborts STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_sched)) {
+        traceStmAbort_(cap, tso, site, tvar, aborts);
+    }
+}
+
 INLINE_HEADER void traceEventSparkCreate(Capability *cap STG_UNUSED)
 {
     traceSparkEvent(cap, EVENT_SPARK_CREATE);
@@ -867,6 +917,18 @@ INLINE_HEADER void traceTaskDelete(Task *task STG_UNUSED)
     dtraceTaskDelete(serialisableTaskId(task));
 }
 
+INLINE_HEADER void traceCapCpuPlacement(uint32_t capno       STG_UNUSED,
+                                        uint32_t cpu         STG_UNUSED,
+                                        uint32_t package     STG_UNUSED,
+                                        uint32_t core        STG_UNUSED,
+                                        uint32_t cache_group STG_UNUSED)
+{
+    // A capability has been assigned a CPU by +RTS --affinity
+    if (RTS_UNLIKELY(TRACE_sched)) {
+        traceCapCpuPlacement_(capno, cpu, package, core, cache_group);
+    }
+}
+
 #include "EndPrivate.h"
 
 #endif /* TRACE_H */
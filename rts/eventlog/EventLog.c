@@ -26,13 +26,43 @@
 #include <unistd.h>
 #endif
 
-// PID of the process that writes to event_log_filename (#4512)
-static pid_t event_log_pid = -1;
-
-static char *event_log_filename = NULL;
+// The writer the eventlog is going to, or NULL if logging is stopped
+static const EventLogWriter *event_log_writer = NULL;
+#ifdef THREADED_RTS
+// Serialises calls into the writer: capabilities flush their own buffers
+static Mutex eventLogWriterMutex;
+#endif
+// Whether we have already complained about a failing writer
+static bool event_log_write_failed = false;
+// Whether the log being written uses the compact encoding (+RTS
+// --eventlog-compact); fixed from openEventLog() to closeEventLog()
+static bool event_log_compact = false;
 
-// File for logging events
-FILE *event_log_file = NULL;
+#ifdef THREADED_RTS
+// Whether full buffers go to the flusher thread (+RTS --eventlog-flush)
+static bool flush_in_background = false;
+
+// A full buffer waiting for the flusher thread
+typedef struct _EventsChunk {
+    StgInt8 *begin;
+    StgWord64 size;
+    EventCapNo capno;             // whose spare buffer it becomes again
+    struct _EventsChunk *link;
+} EventsChunk;
+
+// All protected by flushMutex
+static Mutex flushMutex;
+static Condition flushWork;       // the flusher waits for chunks here
+static Condition flushDone;       // and signals each chunk written here
+static EventsChunk *flush_queue_hd = NULL, *flush_queue_tl = NULL;
+static bool flusher_running = false;
+static bool flusher_busy = false;
+static bool flusher_stop = false;
+
+static void startEventLogFlusher(void);
+static void stopEventLogFlusher(void);
+static void drainEventLogFlusher(void);
+#endif
 
 #define EVENT_LOG_SIZE 2 * (1024 * 1024) // 2MB
 
@@ -45,9 +75,15 @@ typedef struct _EventsBuf {
   StgInt8 *marker;
   StgWord64 size;
   EventCapNo capno; // which capability this buffer belongs to, or -1
+  StgWord32 n_events; // events in the buffer, for the drop counters
+  StgInt8 *spare;   // the other half of the double buffer, NULL while
+                    // the flusher has it (see Note [Eventlog flusher])
+  EventTimestamp last_ts; // timestamp of the last event in the block, for
+                          // the compact encoding
 } EventsBuf;
 
 EventsBuf *capEventBuf; // one EventsBuf for each Capability
+static uint32_t n_cap_event_bufs = 0;
 
 EventsBuf eventBuf; // an EventsBuf not associated with any Capability
 #ifdef THREADED_RTS
@@ -111,6 +147,14 @@ char *EventDesc[] = {
   [EVENT_HEAP_PROF_SAMPLE_BEGIN]  = "Start of heap profile sample",
   [EVENT_HEAP_PROF_SAMPLE_STRING] = "Heap profile string sample",
   [EVENT_HEAP_PROF_SAMPLE_COST_CENTRE] = "Heap profile cost-centre sample",
+  [EVENT_CAP_CPU_PLACEMENT]   = "Capability CPU placement",
+  [EVENT_MESSAGE_COUNTERS]    = "Message counters",
+  [EVENT_SCHED_HISTOGRAM]     = "Scheduling latency histogram",
+  [EVENT_STM_ABORT]           = "STM transaction aborted",
+  [EVENT_STM_SITE_ABORTS]     = "STM aborts per atomically site",
+  [EVENT_EVENTLOG_DROPPED]    = "Eventlog events dropped",
+  [EVENT_CPU_SAMPLE]          = "CPU sample",
+  [EVENT_CPU_SAMPLE_SYMBOL]   = "CPU sample symbol",
 };
 
 // Event type.
@@ -119,6 +163,8 @@ typedef struct _EventType {
   EventTypeNum etNum;  // Event Type number.
   uint32_t   size;     // size of the payload in bytes
   char *desc;     // Description
+  uint32_t n_tid_fields;   // thread ids in the payload, and their offsets,
+  StgWord16 tid_fields[2]; // which are VarInts in the compact encoding
 } EventType;
 
 EventType eventTypes[NUM_GHC_EVENT_TAGS];
@@ -126,6 +172,7 @@ EventType eventTypes[NUM_GHC_EVENT_TAGS];
 static void initEventsBuf(EventsBuf* eb, StgWord64 size, EventCapNo capno);
 static void resetEventsBuf(EventsBuf* eb);
 static void printAndClearEventBuf (EventsBuf *eventsBuf);
+static bool writeEventLog (void *eventlog, size_t eventlog_size);
 
 static void postEventType(EventsBuf *eb, EventType *et);
 
@@ -163,6 +210,16 @@ static inline void postWord64(EventsBuf *eb, StgWord64 i)
     postWord32(eb, (StgWord32)i);
 }
 
+/* Post an unsigned LEB128 number, for the compact encoding. */
+static inline void postVarInt(EventsBuf *eb, StgWord64 i)
+{
+    while (i >= 0x80) {
+        postWord8(eb, (StgWord8)(i | 0x80));
+        i >>= 7;
+    }
+    postWord8(eb, (StgWord8)i);
+}
+
 static inline void postBuf(EventsBuf *eb, StgWord8 *buf, uint32_t size)
 {
     memcpy(eb->pos, buf, size);
@@ -194,8 +251,16 @@ static inline void postEventTypeNum(EventsBuf *eb, EventTypeNum etNum)
 static inline void postTimestamp(EventsBuf *eb)
 { postWord64(eb, time_ns()); }
 
+// Thread ids in variable-sized events are always a Word32: only use this
+// for fixed-size events, whose tid_fields say where the ids are.
 static inline void postThreadID(EventsBuf *eb, EventThreadID id)
-{ postWord32(eb,id); }
+{
+    if (event_log_compact) {
+        postVarInt(eb,id);
+    } else {
+        postWord32(eb,id);
+    }
+}
 
 static inline void postCapNo(EventsBuf *eb, EventCapNo no)
 { postWord16(eb,no); }
@@ -218,10 +283,25 @@ static inline void postTaskId(EventsBuf *eb, EventTaskId tUniq)
 static inline void postPayloadSize(EventsBuf *eb, EventPayloadSize size)
 { postWord16(eb,size); }
 
-static inline void postEventHeader(EventsBuf *eb, EventTypeNum type)
+static inline void postEventHeaderAt(EventsBuf *eb, EventTypeNum type,
+                                     EventTimestamp ts)
 {
+    eb->n_events++;
     postEventTypeNum(eb, type);
-    postTimestamp(eb);
+    if (event_log_compact) {
+        // zigzag-encoded difference from the previous event in the block;
+        // see "The compact encoding" in EventLogFormat.h
+        StgInt64 d = (StgInt64)(ts - eb->last_ts);
+        postVarInt(eb, ((StgWord64)d << 1) ^ (StgWord64)(d >> 63));
+        eb->last_ts = ts;
+    } else {
+        postWord64(eb, ts);
+    }
+}
+
+static inline void postEventHeader(EventsBuf *eb, EventTypeNum type)
+{
+    postEventHeaderAt(eb, type, time_ns());
 }
 
 static inline void postInt8(EventsBuf *eb, StgInt8 i)
@@ -232,86 +312,68 @@ static inline void postInt32(EventsBuf *eb, StgInt32 i)
 
 #define EVENT_SIZE_DYNAMIC (-1)
 
+// How much longer than in the normal encoding an event can be in the
+// compact one: the timestamp VarInt is up to 10 bytes rather than 8, and
+// each of at most two thread ids up to 5 rather than 4.
+#define EVENT_COMPACT_SLACK 4
+
 void
 initEventLogging(void)
 {
-    StgWord8 t, c;
-    uint32_t n_caps;
-    char *prog;
-
-    prog = stgMallocBytes(strlen(prog_name) + 1, "initEventLogging");
-    strcpy(prog, prog_name);
-#ifdef mingw32_HOST_OS
-    // on Windows, drop the .exe suffix if there is one
-    {
-        char *suff;
-        suff = strrchr(prog,'.');
-        if (suff != NULL && !strcmp(suff,".exe")) {
-            *suff = '\0';
-        }
-    }
-#endif
-
-    event_log_filename = stgMallocBytes(strlen(prog)
-                                        + 10 /* .%d */
-                                        + 10 /* .eventlog */,
-                                        "initEventLogging");
-
     if (sizeof(EventDesc) / sizeof(char*) != NUM_GHC_EVENT_TAGS) {
         barf("EventDesc array has the wrong number of elements");
     }
 
-    if (event_log_pid == -1) { // #4512
-        // Single process
-        sprintf(event_log_filename, "%s.eventlog", prog);
-        event_log_pid = getpid();
-    } else {
-        // Forked process, eventlog already started by the parent
-        // before fork
-        event_log_pid = getpid();
-        // We don't have a FMT* symbol for pid_t, so we go via Word64
-        // to be sure of not losing range. It would be nicer to have a
-        // FMT* symbol or similar, though.
-        sprintf(event_log_filename, "%s.%" FMT_Word64 ".eventlog",
-                prog, (StgWord64)event_log_pid);
-    }
-    stgFree(prog);
-
-    /* Open event log file for writing. */
-    if ((event_log_file = fopen(event_log_filename, "wb")) == NULL) {
-        sysErrorBelch("initEventLogging: can't open %s", event_log_filename);
-        stg_exit(EXIT_FAILURE);
-    }
-
     /*
-     * Allocate buffer(s) to store events.
-     * Create buffer large enough for the header begin marker, all event
+     * The buffer not associated with any capability.  It also holds the
+     * header, so it is large enough for the header begin marker, all event
      * types, and header end marker to prevent checking if buffer has room
-     * for each of these steps, and remove the need to flush the buffer to
-     * disk during initialization.
-     *
-     * Use a single buffer to store the header with event types, then flush
-     * the buffer so all buffers are empty for writing events.
+     * for each of these steps.  The capability buffers are allocated when
+     * logging first starts (openEventLog()).
      */
 #ifdef THREADED_RTS
-    // XXX n_capabilities hasn't been initislised yet
-    n_caps = RtsFlags.ParFlags.nCapabilities;
-#else
-    n_caps = 1;
+    flush_in_background =
+        RtsFlags.TraceFlags.eventlogFlush != EVENTLOG_FLUSH_SYNC;
 #endif
-    moreCapEventBufs(0,n_caps);
 
     initEventsBuf(&eventBuf, EVENT_LOG_SIZE, (EventCapNo)(-1));
 
+#ifdef THREADED_RTS
+    initMutex(&eventBufMutex);
+    initMutex(&eventLogWriterMutex);
+    initMutex(&flushMutex);
+    initCondition(&flushWork);
+    initCondition(&flushDone);
+#endif
+}
+
+/*
+ * Post the eventlog header: the event types, followed by the data begin
+ * marker.  A complete header is written every time logging starts, so a
+ * consumer attaching to a running process sees a well-formed stream.
+ */
+static void
+postHeaderEvents(EventsBuf *eb)
+{
+    StgWord8 t;
+
     // Write in buffer: the header begin marker.
-    postInt32(&eventBuf, EVENT_HEADER_BEGIN);
+    postInt32(eb, EVENT_HEADER_BEGIN);
+
+    // Flags, if there are any: older readers stop here, rather than
+    // misreading events in an encoding they do not know
+    if (event_log_compact) {
+        postInt32(eb, EVENT_HEADER_FLAGS);
+        postWord32(eb, EVENTLOG_FLAG_COMPACT);
+    }
 
     // Mark beginning of event types in the header.
-    postInt32(&eventBuf, EVENT_HET_BEGIN);
+    postInt32(eb, EVENT_HET_BEGIN);
     for (t = 0; t < NUM_GHC_EVENT_TAGS; ++t) {
 
         eventTypes[t].etNum = t;
         eventTypes[t].desc = EventDesc[t];
+        eventTypes[t].n_tid_fields = 0;
 
         switch (t) {
         case EVENT_CREATE_THREAD:   // (cap, thread)
@@ -319,18 +381,26 @@ initEventLogging(void)
         case EVENT_THREAD_RUNNABLE: // (cap, thread)
         case EVENT_CREATE_SPARK_THREAD: // (cap, spark_thread)
             eventTypes[t].size = sizeof(EventThreadID);
+            eventTypes[t].n_tid_fields = 1;
+            eventTypes[t].tid_fields[0] = 0;
             break;
 
         case EVENT_MIGRATE_THREAD:  // (cap, thread, new_cap)
         case EVENT_THREAD_WAKEUP:   // (cap, thread, other_cap)
             eventTypes[t].size =
                 sizeof(EventThreadID) + sizeof(EventCapNo);
+            eventTypes[t].n_tid_fields = 1;
+            eventTypes[t].tid_fields[0] = 0;
             break;
 
         case EVENT_STOP_THREAD:     // (cap, thread, status)
             eventTypes[t].size = sizeof(EventThreadID)
                                + sizeof(StgWord16)
                                + sizeof(EventThreadID);
+            eventTypes[t].n_tid_fields = 2;
+            eventTypes[t].tid_fields[0] = 0;
+            eventTypes[t].tid_fields[1] =
+                sizeof(EventThreadID) + sizeof(StgWord16);
             break;
 
         case EVENT_CAP_CREATE:      // (cap)
@@ -471,27 +541,92 @@ initEventLogging(void)
             eventTypes[t].size = EVENT_SIZE_DYNAMIC;
             break;
 
+        case EVENT_CAP_CPU_PLACEMENT: // (cap, cpu, package, core, cache_group)
+            eventTypes[t].size = sizeof(EventCapNo) + 4 * sizeof(StgWord32);
+            break;
+
+        case EVENT_MESSAGE_COUNTERS: // (cap, 4*counter)
+            eventTypes[t].size = 4 * sizeof(StgWord64);
+            break;
+
+        case EVENT_SCHED_HISTOGRAM: // (kind, count, total, max, buckets)
+            eventTypes[t].size = sizeof(StgWord16)
+                               + (3 + SCHED_HISTOGRAM_BUCKETS) * sizeof(StgWord64);
+            break;
+
+        case EVENT_STM_ABORT: // (thread, site, tvar, aborts)
+            eventTypes[t].size = sizeof(EventThreadID) + 2 * sizeof(StgWord64)
+                               + sizeof(StgWord32);
+            eventTypes[t].n_tid_fields = 1;
+            eventTypes[t].tid_fields[0] = 0;
+            break;
+
+        case EVENT_STM_SITE_ABORTS: // (site, aborts)
+            eventTypes[t].size = 2 * sizeof(StgWord64);
+            break;
+
+        case EVENT_EVENTLOG_DROPPED: // (events, bytes)
+            eventTypes[t].size = sizeof(StgWord32) + sizeof(StgWord64);
+            break;
+
+        case EVENT_CPU_SAMPLE:        // (thread, frames)
+        case EVENT_CPU_SAMPLE_SYMBOL: // (addr, line, function, file)
+            eventTypes[t].size = EVENT_SIZE_DYNAMIC;
+            break;
+
         default:
             continue; /* ignore deprecated events */
         }
 
         // Write in buffer: the start event type.
-        postEventType(&eventBuf, &eventTypes[t]);
+        postEventType(eb, &eventTypes[t]);
     }
 
     // Mark end of event types in the header.
-    postInt32(&eventBuf, EVENT_HET_END);
+    postInt32(eb, EVENT_HET_END);
 
     // Write in buffer: the header end marker.
-    postInt32(&eventBuf, EVENT_HEADER_END);
+    postInt32(eb, EVENT_HEADER_END);
 
     // Prepare event buffer for events (data).
-    postInt32(&eventBuf, EVENT_DATA_BEGIN);
+    postInt32(eb, EVENT_DATA_BEGIN);
+}
+
+void
+openEventLog(const EventLogWriter *writer, uint32_t n_caps)
+{
+    uint32_t c;
+
+    if (capEventBuf == NULL) {
+        capEventBuf = stgMallocBytes(n_caps * sizeof(EventsBuf),
+                                     "openEventLog");
+        for (c = 0; c < n_caps; ++c) {
+            initEventsBuf(&capEventBuf[c], EVENT_LOG_SIZE, c);
+        }
+        n_cap_event_bufs = n_caps;
+    }
+
+    if (writer->initEventLogWriter != NULL) {
+        writer->initEventLogWriter();
+    }
+
+    ACQUIRE_LOCK(&eventBufMutex);
+
+    // Drop anything left over from a previous run of the eventlog.
+    for (c = 0; c < n_caps; ++c) {
+        resetEventsBuf(&capEventBuf[c]);
+    }
+    resetEventsBuf(&eventBuf);
+
+    event_log_writer = writer;
+    event_log_write_failed = false;
+    event_log_compact = RtsFlags.TraceFlags.eventlogCompact;
+
+    postHeaderEvents(&eventBuf);
 
-    // Flush capEventBuf with header.
     /*
-     * Flush header and data begin marker to the file, thus preparing the
-     * file to have events written to it.
+     * Flush header and data begin marker to the writer, thus preparing
+     * it to have events written to it.
      */
     printAndClearEventBuf(&eventBuf);
 
@@ -499,20 +634,37 @@ initEventLogging(void)
         postBlockMarker(&capEventBuf[c]);
     }
 
+    RELEASE_LOCK(&eventBufMutex);
+
 #ifdef THREADED_RTS
-    initMutex(&eventBufMutex);
+    if (flush_in_background) {
+        startEventLogFlusher();
+    }
 #endif
 }
 
 void
-endEventLogging(void)
+closeEventLog(void)
 {
     uint32_t c;
 
+    if (event_log_writer == NULL) {
+        return;
+    }
+
+#ifdef THREADED_RTS
+    // Write out everything handed to the flusher, then write the rest
+    // from here
+    stopEventLogFlusher();
+#endif
+
     // Flush all events remaining in the buffers.
     for (c = 0; c < n_capabilities; ++c) {
         printAndClearEventBuf(&capEventBuf[c]);
     }
+
+    ACQUIRE_LOCK(&eventBufMutex);
+
     printAndClearEventBuf(&eventBuf);
     resetEventsBuf(&eventBuf); // we don't want the block marker
 
@@ -521,10 +673,81 @@ endEventLogging(void)
 
     // Flush the end of data marker.
     printAndClearEventBuf(&eventBuf);
+    resetEventsBuf(&eventBuf);
+
+    flushEventLog();
+    if (event_log_writer->stopEventLogWriter != NULL) {
+        event_log_writer->stopEventLogWriter();
+    }
+    event_log_writer = NULL;
+
+    RELEASE_LOCK(&eventBufMutex);
+}
+
+// Write out one buffer for closeEventLogAfterError(), with the writer
+// mutex already held
+static bool
+writeEventBufAfterError(EventsBuf *ebuf)
+{
+    bool ok = true;
 
-    if (event_log_file != NULL) {
-        fclose(event_log_file);
+    closeBlockMarker(ebuf);
+    if (ebuf->begin != NULL && ebuf->pos != ebuf->begin) {
+        ok = event_log_writer->writeEventLog(ebuf->begin,
+                                             ebuf->pos - ebuf->begin);
     }
+    resetEventsBuf(ebuf);
+    return ok;
+}
+
+void
+closeEventLogAfterError(void)
+{
+    uint32_t c;
+    bool ok = true;
+
+    if (event_log_writer == NULL) {
+        return;
+    }
+
+#ifdef THREADED_RTS
+    // The failing thread may hold either lock, so give up rather than
+    // wait.  We don't wait for the flusher either: what it has queued is
+    // lost.
+    if (TRY_ACQUIRE_LOCK(&eventBufMutex) != 0) {
+        return;
+    }
+    if (TRY_ACQUIRE_LOCK(&eventLogWriterMutex) != 0) {
+        RELEASE_LOCK(&eventBufMutex);
+        return;
+    }
+#endif
+
+    // A consumer that stopped reading must not keep us from aborting
+    stopWaitingForEventLogFd();
+
+    for (c = 0; ok && c < n_cap_event_bufs; ++c) {
+        ok = writeEventBufAfterError(&capEventBuf[c]);
+    }
+    if (ok) {
+        ok = writeEventBufAfterError(&eventBuf);
+    }
+    if (ok) {
+        postEventTypeNum(&eventBuf, EVENT_DATA_END);
+        ok = event_log_writer->writeEventLog(eventBuf.begin,
+                                             eventBuf.pos - eventBuf.begin);
+        resetEventsBuf(&eventBuf);
+    }
+    if (ok && event_log_writer->flushEventLog != NULL) {
+        event_log_writer->flushEventLog();
+    }
+    // Events posted from now on are discarded
+    event_log_writer = NULL;
+
+#ifdef THREADED_RTS
+    RELEASE_LOCK(&eventLogWriterMutex);
+    RELEASE_LOCK(&eventBufMutex);
+#endif
 }
 
 void
@@ -532,62 +755,95 @@ moreCapEventBufs (uint32_t from, uint32_t to)
 {
     uint32_t c;
 
-    if (from > 0) {
-        capEventBuf = stgReallocBytes(capEventBuf, to * sizeof(EventsBuf),
-                                      "moreCapEventBufs");
-    } else {
-        capEventBuf = stgMallocBytes(to * sizeof(EventsBuf),
-                                     "moreCapEventBufs");
+    // Not allocated yet: openEventLog() allocates one per capability.
+    if (capEventBuf == NULL) {
+        return;
     }
 
+    // The flusher hands spare buffers back through capEventBuf
+    ACQUIRE_LOCK(&flushMutex);
+    capEventBuf = stgReallocBytes(capEventBuf, to * sizeof(EventsBuf),
+                                  "moreCapEventBufs");
+
     for (c = from; c < to; ++c) {
         initEventsBuf(&capEventBuf[c], EVENT_LOG_SIZE, c);
     }
+    n_cap_event_bufs = to;
+    RELEASE_LOCK(&flushMutex);
 
-    // The from == 0 already covered in initEventLogging, so we are interested
-    // only in case when we are increasing capabilities number
-    if (from > 0) {
-        for (c = from; c < to; ++c) {
-           postBlockMarker(&capEventBuf[c]);
-        }
+    for (c = from; c < to; ++c) {
+       postBlockMarker(&capEventBuf[c]);
     }
-
 }
 
 
 void
 freeEventLogging(void)
 {
-    StgWord8 c;
+    uint32_t c;
 
     // Free events buffer.
-    for (c = 0; c < n_capabilities; ++c) {
-        if (capEventBuf[c].begin != NULL)
-            stgFree(capEventBuf[c].begin);
-    }
     if (capEventBuf != NULL)  {
+        for (c = 0; c < n_capabilities; ++c) {
+            if (capEventBuf[c].begin != NULL)
+                stgFree(capEventBuf[c].begin);
+            if (capEventBuf[c].spare != NULL)
+                stgFree(capEventBuf[c].spare);
+        }
         stgFree(capEventBuf);
-    }
-    if (event_log_filename != NULL) {
-        stgFree(event_log_filename);
+        capEventBuf = NULL;
+        n_cap_event_bufs = 0;
     }
 }
 
 void
 flushEventLog(void)
 {
-    if (event_log_file != NULL) {
-        fflush(event_log_file);
+    const EventLogWriter *writer = event_log_writer;
+
+#ifdef THREADED_RTS
+    drainEventLogFlusher();
+#endif
+
+    if (writer != NULL && writer->flushEventLog != NULL) {
+        ACQUIRE_LOCK(&eventLogWriterMutex);
+        writer->flushEventLog();
+        RELEASE_LOCK(&eventLogWriterMutex);
     }
 }
 
-void
+const EventLogWriter *
 abortEventLogging(void)
 {
-    freeEventLogging();
-    if (event_log_file != NULL) {
-        fclose(event_log_file);
+    const EventLogWriter *writer = event_log_writer;
+    uint32_t c;
+
+    // The parent flushed its writer before forking (flushEventLog()), so
+    // the buffered events belong to the parent: drop them.
+    if (capEventBuf != NULL) {
+        for (c = 0; c < n_capabilities; ++c) {
+            resetEventsBuf(&capEventBuf[c]);
+        }
+    }
+    resetEventsBuf(&eventBuf);
+
+#ifdef THREADED_RTS
+    initMutex(&eventBufMutex);
+    initMutex(&eventLogWriterMutex);
+    // The flusher thread did not survive the fork, and the parent drained
+    // its queue first (flushEventLog())
+    initMutex(&flushMutex);
+    initCondition(&flushWork);
+    initCondition(&flushDone);
+    flusher_running = false;
+#endif
+
+    if (writer != NULL && writer->stopEventLogWriter != NULL) {
+        writer->stopEventLogWriter();
     }
+    event_log_writer = NULL;
+
+    return writer;
 }
 
 /*
@@ -705,6 +961,147 @@ postSparkCountersEvent (Capability *cap,
     postWord64(eb,remaining);
 }
 
+void
+postMessageCountersEvent (Capability *cap, MessageCounters counters)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+    ensureRoomForEvent(eb, EVENT_MESSAGE_COUNTERS);
+
+    postEventHeader(eb, EVENT_MESSAGE_COUNTERS);
+    /* EVENT_MESSAGE_COUNTERS (received,batches,latency_total,latency_max) */
+    postWord64(eb,counters.received);
+    postWord64(eb,counters.batches);
+    postWord64(eb,counters.latency_total);
+    postWord64(eb,counters.latency_max);
+}
+
+void
+postSchedHistogramEvent (Capability *cap,
+                         StgWord16 kind,
+                         const SchedHistogram *h)
+{
+    EventsBuf *eb;
+    uint32_t b;
+
+    eb = &capEventBuf[cap->no];
+    ensureRoomForEvent(eb, EVENT_SCHED_HISTOGRAM);
+
+    postEventHeader(eb, EVENT_SCHED_HISTOGRAM);
+    /* EVENT_SCHED_HISTOGRAM (kind,count,total_ns,max_ns,buckets) */
+    postWord16(eb,kind);
+    postWord64(eb,h->count);
+    postWord64(eb,h->total_ns);
+    postWord64(eb,h->max_ns);
+    for (b = 0; b < SCHED_HISTOGRAM_BUCKETS; b++) {
+        postWord64(eb,h->buckets[b]);
+    }
+}
+
+void
+postStmAbortEvent (Capability *cap,
+                   StgThreadID thread,
+                   StgWord site,
+                   StgWord tvar,
+                   StgWord32 aborts)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+    ensureRoomForEvent(eb, EVENT_STM_ABORT);
+
+    postEventHeader(eb, EVENT_STM_ABORT);
+    /* EVENT_STM_ABORT (thread,site,tvar,aborts) */
+    postThreadID(eb,thread);
+    postWord64(eb,site);
+    postWord64(eb,tvar);
+    postWord32(eb,aborts);
+}
+
+void
+postStmSiteAbortsEvent (Capability *cap,
+                        StgWord site,
+                        StgWord64 aborts)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+    ensureRoomForEvent(eb, EVENT_STM_SITE_ABORTS);
+
+    postEventHeader(eb, EVENT_STM_SITE_ABORTS);
+    /* EVENT_STM_SITE_ABORTS (site,aborts) */
+    postWord64(eb,site);
+    postWord64(eb,aborts);
+}
+
+void
+postCpuSampleEvent (Capability *cap,
+                    StgThreadID thread,
+                    const StgWord *frames,
+                    uint32_t n_frames)
+{
+    EventsBuf *eb;
+    uint32_t i;
+    StgWord size = sizeof(EventThreadID) + n_frames * sizeof(StgWord64);
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForVariableEvent(eb, size)){
+        printAndClearEventBuf(eb);
+
+        if (!hasRoomForVariableEvent(eb, size)){
+            // Event size exceeds buffer size, bail out:
+            return;
+        }
+    }
+
+    postEventHeader(eb, EVENT_CPU_SAMPLE);
+    postPayloadSize(eb, size);
+    /* EVENT_CPU_SAMPLE (thread,frames) */
+    postWord32(eb, thread); // not postThreadID(): the payload size counts 4 bytes
+    for (i = 0; i < n_frames; i++) {
+        postWord64(eb, frames[i]);
+    }
+}
+
+void
+postCpuSampleSymbolEvent (Capability *cap,
+                          StgWord addr,
+                          StgWord32 line,
+                          const char *function,
+                          const char *file)
+{
+    EventsBuf *eb;
+    StgWord function_len = strlen(function);
+    StgWord file_len = strlen(file);
+    StgWord size = sizeof(StgWord64) + sizeof(StgWord32)
+                 + function_len + 1 + file_len + 1;
+
+    if (size > 0xffff) {
+        return; // does not fit in the payload size
+    }
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForVariableEvent(eb, size)){
+        printAndClearEventBuf(eb);
+
+        if (!hasRoomForVariableEvent(eb, size)){
+            // Event size exceeds buffer size, bail out:
+            return;
+        }
+    }
+
+    postEventHeader(eb, EVENT_CPU_SAMPLE_SYMBOL);
+    postPayloadSize(eb, size);
+    /* EVENT_CPU_SAMPLE_SYMBOL (addr,line,function,file) */
+    postWord64(eb, addr);
+    postWord32(eb, line);
+    postString(eb, function);
+    postString(eb, file);
+}
+
 void
 postCapEvent (EventTypeNum  tag,
               EventCapNo    capno)
@@ -867,8 +1264,7 @@ void postWallClockTime (EventCapsetID capset)
     /* Normally we'd call postEventHeader(), but that generates its own
        timestamp, so we go one level lower so we can write out the
        timestamp we already generated above. */
-    postEventTypeNum(&eventBuf, EVENT_WALL_CLOCK_TIME);
-    postWord64(&eventBuf, ts);
+    postEventHeaderAt(&eventBuf, EVENT_WALL_CLOCK_TIME, ts);
 
     /* EVENT_WALL_CLOCK_TIME (capset, unix_epoch_seconds, nanoseconds) */
     postCapsetID(&eventBuf, capset);
@@ -993,6 +1389,26 @@ void postTaskMigrateEvent (EventTaskId taskId,
     RELEASE_LOCK(&eventBufMutex);
 }
 
+void postCapCpuPlacementEvent (EventCapNo capno,
+                               StgWord32 cpu,
+                               StgWord32 package,
+                               StgWord32 core,
+                               StgWord32 cache_group)
+{
+    ACQUIRE_LOCK(&eventBufMutex);
+    ensureRoomForEvent(&eventBuf, EVENT_CAP_CPU_PLACEMENT);
+
+    postEventHeader(&eventBuf, EVENT_CAP_CPU_PLACEMENT);
+    /* EVENT_CAP_CPU_PLACEMENT (cap, cpu, package, core, cache_group) */
+    postCapNo(&eventBuf, capno);
+    postWord32(&eventBuf, cpu);
+    postWord32(&eventBuf, package);
+    postWord32(&eventBuf, core);
+    postWord32(&eventBuf, cache_group);
+
+    RELEASE_LOCK(&eventBufMutex);
+}
+
 void postTaskDeleteEvent (EventTaskId taskId)
 {
     ACQUIRE_LOCK(&eventBufMutex);
@@ -1026,8 +1442,7 @@ postEventAtTimestamp (Capability *cap, EventTimestamp ts, EventTypeNum tag)
     /* Normally we'd call postEventHeader(), but that generates its own
        timestamp, so we go one level lower so we can write out
        the timestamp we received as an argument. */
-    postEventTypeNum(eb, tag);
-    postWord64(eb, ts);
+    postEventHeaderAt(eb, tag, ts);
 }
 
 #define BUF 512
@@ -1104,7 +1519,7 @@ void postThreadLabel(Capability    *cap,
 
     postEventHeader(eb, EVENT_THREAD_LABEL);
     postPayloadSize(eb, size);
-    postThreadID(eb, id);
+    postWord32(eb, id); // not postThreadID(): the payload size counts 4 bytes
     postBuf(eb, (StgWord8*) label, strsize);
 }
 
@@ -1134,7 +1549,13 @@ void postBlockMarker (EventsBuf *eb)
     closeBlockMarker(eb);
 
     eb->marker = eb->pos;
-    postEventHeader(eb, EVENT_BLOCK_MARKER);
+    // Not postEventHeader(): even in the compact encoding, the block
+    // marker has a full timestamp, which the rest of the block is
+    // relative to.
+    eb->n_events++;
+    eb->last_ts = time_ns();
+    postEventTypeNum(eb, EVENT_BLOCK_MARKER);
+    postWord64(eb, eb->last_ts);
     postWord32(eb,0); // these get filled in later by closeBlockMarker();
     postWord64(eb,0);
     postCapNo(eb, eb->capno);
@@ -1281,28 +1702,261 @@ void postHeapProfSampleCostCentre(StgWord8 profile_id,
 }
 #endif /* PROFILING */
 
+/* Note [Eventlog flusher]
+   ~~~~~~~~~~~~~~~~~~~~~~~
+
+   By default a capability that fills its EventsBuf writes it out itself,
+   which stalls the mutator for as long as the writer takes.  With +RTS
+   --eventlog-flush=<policy> (threaded RTS only) each EventsBuf is double
+   buffered instead: a full buffer is swapped for its spare and queued for
+   a dedicated flusher thread, so posting events never waits for I/O
+   unless the flusher falls behind.  The swap needs no lock on the posting
+   side beyond the brief flushMutex handoff, once per buffer.
+
+   The flusher writes chunks in the order they were queued, so each
+   capability's blocks stay in order, and gives each buffer back as its
+   owner's spare.  If a buffer fills while its spare is still queued, the
+   policy decides:
+
+     block  wait for the flusher to give the spare back
+     drop   throw the full buffer away, and post EVENT_EVENTLOG_DROPPED
+            with the number of events and bytes lost, so the loss is
+            visible in the log itself
+     grow   allocate another buffer; buffers beyond the spare are freed
+            once written
+
+   The header and the end of the log are written synchronously:
+   openEventLog() starts the flusher after the header, and closeEventLog()
+   stops it, after it has drained the queue, before writing what is left.
+   flushEventLog() drains the queue too, so a forked child inherits no
+   queued chunks.
+*/
+
+#ifdef THREADED_RTS
+
+// Called with flushMutex held
+static EventsBuf *
+chunkOwner (EventCapNo capno)
+{
+    if (capno == (EventCapNo)(-1)) {
+        return &eventBuf;
+    } else if (capno < n_cap_event_bufs) {
+        return &capEventBuf[capno];
+    } else {
+        return NULL;
+    }
+}
+
+static void *
+eventLogFlusherLoop (void *arg STG_UNUSED)
+{
+    EventsChunk *chunk;
+    EventsBuf *owner;
+
+    ACQUIRE_LOCK(&flushMutex);
+    while (true) {
+        while (flush_queue_hd == NULL && !flusher_stop) {
+            waitCondition(&flushWork, &flushMutex);
+        }
+        if (flush_queue_hd == NULL) {
+            break; // asked to stop, and nothing left to write
+        }
+
+        chunk = flush_queue_hd;
+        flush_queue_hd = chunk->link;
+        if (flush_queue_hd == NULL) {
+            flush_queue_tl = NULL;
+        }
+        flusher_busy = true;
+        RELEASE_LOCK(&flushMutex);
+
+        if (!writeEventLog(chunk->begin, chunk->size) &&
+            !event_log_write_failed) {
+            debugBelch("eventlog flusher: could not write eventlog;"
+                       " tried to write numBytes=%" FMT_Word64 "\n",
+                       chunk->size);
+            event_log_write_failed = true;
+        }
+
+        ACQUIRE_LOCK(&flushMutex);
+        flusher_busy = false;
+        owner = chunkOwner(chunk->capno);
+        if (owner != NULL && owner->spare == NULL) {
+            owner->spare = chunk->begin;
+        } else {
+            stgFree(chunk->begin);
+        }
+        stgFree(chunk);
+        broadcastCondition(&flushDone);
+    }
+
+    flusher_running = false;
+    broadcastCondition(&flushDone);
+    RELEASE_LOCK(&flushMutex);
+    return NULL;
+}
+
+static void
+startEventLogFlusher (void)
+{
+    OSThreadId tid;
+
+    ACQUIRE_LOCK(&flushMutex);
+    flusher_stop = false;
+    flusher_running = true;
+    RELEASE_LOCK(&flushMutex);
+
+    if (createOSThread(&tid, "ghc_eventlog",
+                       (OSThreadProc*)eventLogFlusherLoop, NULL) != 0) {
+        sysErrorBelch("warning: cannot start the eventlog flusher");
+        flusher_running = false;
+    }
+}
+
+static void
+stopEventLogFlusher (void)
+{
+    ACQUIRE_LOCK(&flushMutex);
+    flusher_stop = true;
+    signalCondition(&flushWork);
+    while (flusher_running) {
+        waitCondition(&flushDone, &flushMutex);
+    }
+    RELEASE_LOCK(&flushMutex);
+}
+
+static void
+drainEventLogFlusher (void)
+{
+    ACQUIRE_LOCK(&flushMutex);
+    while (flusher_running && (flush_queue_hd != NULL || flusher_busy)) {
+        waitCondition(&flushDone, &flushMutex);
+    }
+    RELEASE_LOCK(&flushMutex);
+}
+
+static void
+postEventlogDropped (EventsBuf *eb, StgWord32 events, StgWord64 bytes)
+{
+    ensureRoomForEvent(eb, EVENT_EVENTLOG_DROPPED);
+    postEventHeader(eb, EVENT_EVENTLOG_DROPPED);
+    /* EVENT_EVENTLOG_DROPPED (events, bytes) */
+    postWord32(eb, events);
+    postWord64(eb, bytes);
+}
+
+/*
+ * Queue a full buffer for the flusher and carry on in its spare, or
+ * apply the overflow policy if the spare is still queued.
+ * See Note [Eventlog flusher].
+ */
+static void
+handOffEventBuf (EventsBuf *ebuf)
+{
+    EventsChunk *chunk;
+    StgInt8 *fresh;
+
+    chunk = stgMallocBytes(sizeof(EventsChunk), "handOffEventBuf");
+
+    ACQUIRE_LOCK(&flushMutex);
+    fresh = ebuf->spare;
+    if (fresh == NULL) {
+        switch (RtsFlags.TraceFlags.eventlogFlush) {
+        case EVENTLOG_FLUSH_BLOCK:
+            while (ebuf->spare == NULL && flusher_running) {
+                waitCondition(&flushDone, &flushMutex);
+            }
+            fresh = ebuf->spare;
+            break;
+        case EVENTLOG_FLUSH_GROW:
+            fresh = stgMallocBytes(ebuf->size, "handOffEventBuf");
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (fresh == NULL) {
+        StgWord32 events = ebuf->n_events;
+        StgWord64 bytes = ebuf->pos - ebuf->begin;
+
+        RELEASE_LOCK(&flushMutex);
+        stgFree(chunk);
+        resetEventsBuf(ebuf);
+        postBlockMarker(ebuf);
+        postEventlogDropped(ebuf, events, bytes);
+        return;
+    }
+
+    ebuf->spare = NULL;
+    chunk->begin = ebuf->begin;
+    chunk->size = ebuf->pos - ebuf->begin;
+    chunk->capno = ebuf->capno;
+    chunk->link = NULL;
+    if (flush_queue_tl == NULL) {
+        flush_queue_hd = chunk;
+    } else {
+        flush_queue_tl->link = chunk;
+    }
+    flush_queue_tl = chunk;
+    signalCondition(&flushWork);
+    RELEASE_LOCK(&flushMutex);
+
+    ebuf->begin = fresh;
+    resetEventsBuf(ebuf);
+    flushCount++;
+
+    postBlockMarker(ebuf);
+}
+
+#endif /* THREADED_RTS */
+
+static bool writeEventLog (void *eventlog, size_t eventlog_size)
+{
+    bool ret = true;
+
+    ACQUIRE_LOCK(&eventLogWriterMutex);
+    // With logging stopped, events posted by stragglers are discarded.
+    if (event_log_writer != NULL) {
+        ret = event_log_writer->writeEventLog(eventlog, eventlog_size);
+    }
+    RELEASE_LOCK(&eventLogWriterMutex);
+
+    return ret;
+}
+
 void printAndClearEventBuf (EventsBuf *ebuf)
 {
     closeBlockMarker(ebuf);
 
     if (ebuf->begin != NULL && ebuf->pos != ebuf->begin)
     {
-        StgInt8 *begin = ebuf->begin;
-        while (begin < ebuf->pos) {
-            StgWord64 remain = ebuf->pos - begin;
-            StgWord64 written = fwrite(begin, 1, remain, event_log_file);
-            if (written == 0) {
+        size_t elog_size = ebuf->pos - ebuf->begin;
+#ifdef THREADED_RTS
+        // Only changes while nothing is posting (openEventLog(),
+        // closeEventLog()), so no lock is needed to read it
+        if (flusher_running) {
+            handOffEventBuf(ebuf);
+            return;
+        }
+#endif
+        if (!writeEventLog(ebuf->begin, elog_size)) {
+            // A consumer that has gone away would make this fail for
+            // every buffer, so only complain once.
+            if (!event_log_write_failed) {
                 debugBelch(
-                    "printAndClearEventLog: fwrite() failed to write anything;"
-                    " tried to write numBytes=%" FMT_Word64, remain);
-                resetEventsBuf(ebuf);
-                return;
+                    "printAndClearEventLog: could not write eventlog;"
+                    " tried to write numBytes=%" FMT_Word64 "\n",
+                    (StgWord64)elog_size);
+                event_log_write_failed = true;
             }
-            begin += written;
+        } else {
+            flushCount++;
         }
 
+        // Start a new block even if the last one was lost: in the compact
+        // encoding, timestamps are relative to the block marker
         resetEventsBuf(ebuf);
-        flushCount++;
 
         postBlockMarker(ebuf);
     }
@@ -1314,19 +1968,29 @@ void initEventsBuf(EventsBuf* eb, StgWord64 size, EventCapNo capno)
     eb->size = size;
     eb->marker = NULL;
     eb->capno = capno;
+    eb->n_events = 0;
+    eb->last_ts = 0;
+    eb->spare = NULL;
+#ifdef THREADED_RTS
+    if (flush_in_background) {
+        eb->spare = stgMallocBytes(size, "initEventsBuf");
+    }
+#endif
 }
 
 void resetEventsBuf(EventsBuf* eb)
 {
     eb->pos = eb->begin;
     eb->marker = NULL;
+    eb->n_events = 0;
 }
 
 StgBool hasRoomForEvent(EventsBuf *eb, EventTypeNum eNum)
 {
   uint32_t size;
 
-  size = sizeof(EventTypeNum) + sizeof(EventTimestamp) + eventTypes[eNum].size;
+  size = sizeof(EventTypeNum) + sizeof(EventTimestamp) + eventTypes[eNum].size
+      + EVENT_COMPACT_SLACK;
 
   if (eb->pos + size > eb->begin + eb->size) {
       return 0; // Not enough space.
@@ -1340,7 +2004,7 @@ StgBool hasRoomForVariableEvent(EventsBuf *eb, uint32_t payload_bytes)
   uint32_t size;
 
   size = sizeof(EventTypeNum) + sizeof(EventTimestamp) +
-      sizeof(EventPayloadSize) + payload_bytes;
+      sizeof(EventPayloadSize) + payload_bytes + EVENT_COMPACT_SLACK;
 
   if (eb->pos + size > eb->begin + eb->size) {
       return 0; // Not enough space.
@@ -1372,7 +2036,7 @@ int ensureRoomForVariableEvent(EventsBuf *eb, StgWord16 size)
 void postEventType(EventsBuf *eb, EventType *et)
 {
     StgWord8 d;
-    uint32_t desclen;
+    uint32_t desclen, i;
 
     postInt32(eb, EVENT_ET_BEGIN);
     postEventTypeNum(eb, et->etNum);
@@ -1382,7 +2046,15 @@ void postEventType(EventsBuf *eb, EventType *et)
     for (d = 0; d < desclen; ++d) {
         postInt8(eb, (StgInt8)et->desc[d]);
     }
-    postWord32(eb, 0); // no extensions yet
+    if (event_log_compact) {
+        // where the VarInt thread ids are
+        postWord32(eb, et->n_tid_fields * sizeof(StgWord16));
+        for (i = 0; i < et->n_tid_fields; ++i) {
+            postWord16(eb, et->tid_fields[i]);
+        }
+    } else {
+        postWord32(eb, 0); // no extensions
+    }
     postInt32(eb, EVENT_ET_END);
 }
 
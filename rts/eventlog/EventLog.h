@@ -14,6 +14,18 @@
 
 #include "BeginPrivate.h"
 
+/*
+ * The writers behind the built-in sinks (EventLogWriter.c).  Each returns
+ * NULL, with errno set, if the sink cannot be opened.
+ */
+const EventLogWriter *fdEventLogWriter(int fd, bool owned);
+const EventLogWriter *pipeEventLogWriter(const char *path);
+const EventLogWriter *socketEventLogWriter(const char *path);
+
+// Make writes to the fd sink fail rather than block, when we are about
+// to abort (closeEventLogAfterError())
+void stopWaitingForEventLogFd(void);
+
 #ifdef TRACING
 
 /*
@@ -22,12 +34,30 @@
 extern char *EventTagDesc[];
 
 void initEventLogging(void);
-void endEventLogging(void);
 void freeEventLogging(void);
-void abortEventLogging(void); // #4512 - after fork child needs to abort
-void flushEventLog(void);     // event log inherited from parent
 void moreCapEventBufs (uint32_t from, uint32_t to);
 
+/*
+ * Start writing the eventlog (header first) to a writer, or flush
+ * everything and stop it.  The caller must make sure no capability is
+ * posting events meanwhile: these are used at startup and shutdown, and
+ * with all capabilities stopped by startEventLogging()/endEventLogging().
+ */
+void openEventLog(const EventLogWriter *writer, uint32_t n_caps);
+void closeEventLog(void);
+
+/*
+ * Write out what we can of the eventlog before the RTS aborts (barf()).
+ * Unlike closeEventLog(), this never waits: it gives up if a lock is
+ * held or the sink would block, and leaves the flusher thread alone.
+ */
+void closeEventLogAfterError(void);
+
+// #4512 - after fork the child drops the eventlog inherited from its
+// parent; returns the writer the parent was using.
+const EventLogWriter *abortEventLogging(void);
+void flushEventLog(void);     // so that the child won't inherit buffers
+
 /*
  * Post a scheduler event to the capability's event buffer (an event
  * that has an associated thread).
@@ -91,6 +121,47 @@ void postSparkCountersEvent (Capability *cap,
                              SparkCounters counters,
                              StgWord remaining);
 
+/*
+ * Post an event with the counters of messages received by a capability.
+ */
+void postMessageCountersEvent (Capability *cap, MessageCounters counters);
+
+/*
+ * Post a histogram of scheduling latencies (+RTS --sched-stats).
+ */
+void postSchedHistogramEvent (Capability *cap,
+                              StgWord16 kind,
+                              const SchedHistogram *h);
+
+/*
+ * Post an STM abort, naming the conflicting TVar if known, and the
+ * per-site abort totals at shutdown.
+ */
+void postStmAbortEvent (Capability *cap,
+                        StgThreadID thread,
+                        StgWord site,
+                        StgWord tvar,
+                        StgWord32 aborts);
+
+void postStmSiteAbortsEvent (Capability *cap,
+                             StgWord site,
+                             StgWord64 aborts);
+
+/*
+ * Post a sample of a thread's stack (+RTS --cpu-sample), innermost frame
+ * first, and the symbol of a sampled address.
+ */
+void postCpuSampleEvent (Capability *cap,
+                         StgThreadID thread,
+                         const StgWord *frames,
+                         uint32_t n_frames);
+
+void postCpuSampleSymbolEvent (Capability *cap,
+                               StgWord addr,
+                               StgWord32 line,
+                               const char *function,
+                               const char *file);
+
 /*
  * Post an event to annotate a thread with a label
  */
@@ -133,6 +204,12 @@ void postTaskMigrateEvent (EventTaskId taskId,
 
 void postTaskDeleteEvent (EventTaskId taskId);
 
+void postCapCpuPlacementEvent (EventCapNo capno,
+                               StgWord32 cpu,
+                               StgWord32 package,
+                               StgWord32 core,
+                               StgWord32 cache_group);
+
 void postHeapProfBegin(StgWord8 profile_id);
 
 void postHeapProfSampleBegin(StgInt era);
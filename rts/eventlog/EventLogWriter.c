@@ -0,0 +1,337 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2008-2017
+ *
+ * Built-in eventlog writers: the default <prog>.eventlog file, and
+ * file-descriptor sinks (an fd, a named pipe, a Unix socket) for streaming
+ * the eventlog to another process.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "RtsUtils.h"
+#include "eventlog/EventLog.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if !defined(mingw32_HOST_OS)
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+/* -----------------------------------------------------------------------------
+   The file writer
+   -------------------------------------------------------------------------- */
+
+// PID of the process that writes to event_log_filename (#4512)
+static pid_t event_log_pid = -1;
+
+static char *event_log_filename = NULL;
+
+// File for logging events
+static FILE *event_log_file = NULL;
+
+static void
+initEventLogFileWriter(void)
+{
+    char *prog;
+
+    prog = stgMallocBytes(strlen(prog_name) + 1, "initEventLogFileWriter");
+    strcpy(prog, prog_name);
+#ifdef mingw32_HOST_OS
+    // on Windows, drop the .exe suffix if there is one
+    {
+        char *suff;
+        suff = strrchr(prog,'.');
+        if (suff != NULL && !strcmp(suff,".exe")) {
+            *suff = '\0';
+        }
+    }
+#endif
+
+    if (event_log_filename != NULL) {
+        stgFree(event_log_filename);
+    }
+    event_log_filename = stgMallocBytes(strlen(prog)
+                                        + 10 /* .%d */
+                                        + 10 /* .eventlog */,
+                                        "initEventLogFileWriter");
+
+    if (event_log_pid == -1) { // #4512
+        // Single process
+        sprintf(event_log_filename, "%s.eventlog", prog);
+        event_log_pid = getpid();
+    } else if (event_log_pid == getpid()) {
+        // Logging restarted by the same process: start a fresh file
+        sprintf(event_log_filename, "%s.eventlog", prog);
+    } else {
+        // Forked process, eventlog already started by the parent
+        // before fork
+        event_log_pid = getpid();
+        // We don't have a FMT* symbol for pid_t, so we go via Word64
+        // to be sure of not losing range. It would be nicer to have a
+        // FMT* symbol or similar, though.
+        sprintf(event_log_filename, "%s.%" FMT_Word64 ".eventlog",
+                prog, (StgWord64)event_log_pid);
+    }
+    stgFree(prog);
+
+    /* Open event log file for writing. */
+    if ((event_log_file = fopen(event_log_filename, "wb")) == NULL) {
+        sysErrorBelch("initEventLogging: can't open %s", event_log_filename);
+        stg_exit(EXIT_FAILURE);
+    }
+}
+
+static bool
+writeEventLogFile(void *eventlog, size_t eventlog_size)
+{
+    unsigned char *begin = eventlog;
+    size_t remain = eventlog_size;
+
+    while (remain > 0) {
+        size_t written = fwrite(begin, 1, remain, event_log_file);
+        if (written == 0) {
+            return false;
+        }
+        remain -= written;
+        begin += written;
+    }
+
+    return true;
+}
+
+static void
+flushEventLogFile(void)
+{
+    if (event_log_file != NULL) {
+        fflush(event_log_file);
+    }
+}
+
+static void
+stopEventLogFileWriter(void)
+{
+    if (event_log_file != NULL) {
+        fclose(event_log_file);
+        event_log_file = NULL;
+    }
+    if (event_log_filename != NULL) {
+        stgFree(event_log_filename);
+        event_log_filename = NULL;
+    }
+}
+
+const EventLogWriter FileEventLogWriter = {
+    .initEventLogWriter = initEventLogFileWriter,
+    .writeEventLog = writeEventLogFile,
+    .flushEventLog = flushEventLogFile,
+    .stopEventLogWriter = stopEventLogFileWriter
+};
+
+/* -----------------------------------------------------------------------------
+   File-descriptor writers
+
+   The fd, pipe and socket sinks all end up writing to a file descriptor.
+   Only one writer runs at a time, so its state can live in statics; the
+   fd is closed on stop only if the RTS opened it.  A write to a pipe or
+   socket whose reader has gone away fails with EPIPE rather than killing
+   the process, because the RTS installs a handler for SIGPIPE.
+   -------------------------------------------------------------------------- */
+
+static int event_log_fd = -1;
+static bool event_log_fd_owned = false;
+
+static void
+initEventLogFdWriter(void)
+{
+    /* nothing: the fd was opened by fdEventLogWriter() */
+}
+
+static bool
+writeEventLogFd(void *eventlog, size_t eventlog_size)
+{
+    unsigned char *begin = eventlog;
+    size_t remain = eventlog_size;
+
+    if (event_log_fd < 0) {
+        return false;
+    }
+
+    while (remain > 0) {
+        ssize_t written = write(event_log_fd, begin, remain);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        remain -= written;
+        begin += written;
+    }
+
+    return true;
+}
+
+static void
+stopEventLogFdWriter(void)
+{
+    if (event_log_fd >= 0 && event_log_fd_owned) {
+        close(event_log_fd);
+    }
+    event_log_fd = -1;
+    event_log_fd_owned = false;
+}
+
+static const EventLogWriter FdEventLogWriter = {
+    .initEventLogWriter = initEventLogFdWriter,
+    .writeEventLog = writeEventLogFd,
+    .flushEventLog = NULL,
+    .stopEventLogWriter = stopEventLogFdWriter
+};
+
+const EventLogWriter *
+fdEventLogWriter(int fd, bool owned)
+{
+    event_log_fd = fd;
+    event_log_fd_owned = owned;
+    return &FdEventLogWriter;
+}
+
+void
+stopWaitingForEventLogFd(void)
+{
+#if !defined(mingw32_HOST_OS)
+    int flags;
+
+    if (event_log_fd >= 0) {
+        flags = fcntl(event_log_fd, F_GETFL);
+        if (flags != -1) {
+            fcntl(event_log_fd, F_SETFL, flags | O_NONBLOCK);
+        }
+    }
+#endif
+}
+
+const EventLogWriter *
+pipeEventLogWriter(const char *path)
+{
+#if defined(mingw32_HOST_OS)
+    (void)path;
+    errno = ENOSYS;
+    return NULL;
+#else
+    int fd;
+
+    if (mkfifo(path, 0600) != 0 && errno != EEXIST) {
+        return NULL;
+    }
+    // Blocks until a consumer opens the pipe for reading
+    do {
+        fd = open(path, O_WRONLY);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+        return NULL;
+    }
+    return fdEventLogWriter(fd, true);
+#endif
+}
+
+const EventLogWriter *
+socketEventLogWriter(const char *path)
+{
+#if defined(mingw32_HOST_OS)
+    (void)path;
+    errno = ENOSYS;
+    return NULL;
+#else
+    struct sockaddr_un addr;
+    int fd, r;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    do {
+        r = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    } while (r != 0 && errno == EINTR);
+    if (r != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    return fdEventLogWriter(fd, true);
+#endif
+}
+
+/* -----------------------------------------------------------------------------
+   Starting the built-in sinks at runtime
+   -------------------------------------------------------------------------- */
+
+static bool
+startFdSink(const EventLogWriter *writer)
+{
+    if (writer == NULL) {
+        return false;
+    }
+    if (!startEventLogging(writer)) {
+        stopEventLogFdWriter();
+        errno = EBUSY;
+        return false;
+    }
+    return true;
+}
+
+bool
+startEventLoggingToFd(int fd)
+{
+    if (eventLogStatus() == EVENTLOG_RUNNING) {
+        errno = EBUSY;
+        return false;
+    }
+    return startFdSink(fdEventLogWriter(fd, false));
+}
+
+bool
+startEventLoggingToPipe(const char *path)
+{
+    if (eventLogStatus() == EVENTLOG_RUNNING) {
+        errno = EBUSY;
+        return false;
+    }
+    return startFdSink(pipeEventLogWriter(path));
+}
+
+bool
+startEventLoggingToSocket(const char *path)
+{
+    if (eventLogStatus() == EVENTLOG_RUNNING) {
+        errno = EBUSY;
+        return false;
+    }
+    return startFdSink(socketEventLogWriter(path));
+}
@@ -24,6 +24,8 @@
 
 #if defined(linux_HOST_OS)
 #include <unistd.h>
+#include <limits.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
 #endif
@@ -117,6 +119,20 @@ waitCondition ( Condition* pCond, Mutex* pMut )
   return (pthread_cond_wait(pCond,pMut) == 0);
 }
 
+bool
+timedWaitCondition ( Condition* pCond, Mutex* pMut, Time timeout )
+{
+  struct timespec ts;
+  Time deadline;
+
+  // pthread_cond_timedwait() takes a CLOCK_REALTIME deadline
+  clock_gettime(CLOCK_REALTIME, &ts);
+  deadline = SecondsToTime(ts.tv_sec) + NSToTime(ts.tv_nsec) + timeout;
+  ts.tv_sec  = TimeToSeconds(deadline);
+  ts.tv_nsec = TimeToNS(deadline - SecondsToTime(ts.tv_sec));
+  return (pthread_cond_timedwait(pCond,pMut,&ts) == 0);
+}
+
 void
 yieldThread(void)
 {
@@ -214,6 +230,36 @@ freeThreadLocalKey (ThreadLocalKey *key)
     }
 }
 
+// The number of processors that are online, regardless of whether we
+// are allowed to use them.
+static uint32_t GNUC3_ATTRIBUTE(__unused__)
+getNumberOfOnlineProcessors (void)
+{
+    static uint32_t nproc = 0;
+
+    if (nproc == 0) {
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+        nproc = sysconf(_SC_NPROCESSORS_ONLN);
+#elif defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_CONF)
+        nproc = sysconf(_SC_NPROCESSORS_CONF);
+#elif defined(darwin_HOST_OS)
+        size_t size = sizeof(uint32_t);
+        if(sysctlbyname("hw.logicalcpu",&nproc,&size,NULL,0) != 0) {
+            if(sysctlbyname("hw.ncpu",&nproc,&size,NULL,0) != 0)
+                nproc = 1;
+        }
+#elif defined(freebsd_HOST_OS)
+        size_t size = sizeof(uint32_t);
+        if(sysctlbyname("hw.ncpu",&nproc,&size,NULL,0) != 0)
+            nproc = 1;
+#else
+        nproc = 1;
+#endif
+    }
+
+    return nproc;
+}
+
 #if defined(THREADED_RTS)
 
 static void *
@@ -239,28 +285,187 @@ forkOS_createThread ( HsStablePtr entry )
 
 void freeThreadingResources (void) { /* nothing */ }
 
+#if defined(linux_HOST_OS)
+/* -----------------------------------------------------------------------------
+ * cgroup CPU controller
+ *
+ * In a container the number of online processors says little about
+ * how much CPU we may actually use: the CPU controller of the cgroup
+ * may impose a quota of, say, 2 CPUs on a 64-core host.  We find the
+ * directory of our cgroup's CPU controller from /proc/self/cgroup,
+ * supporting both the unified (v2) and the legacy (v1) hierarchy.  If
+ * the cgroup path is not visible in our mount namespace we fall back
+ * to the root of the hierarchy, which is what a container with its own
+ * cgroup namespace sees.
+ * -------------------------------------------------------------------------- */
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+static bool
+readCgroupFile (const char *dir, const char *file, char *buf, size_t len)
+{
+    char path[PATH_MAX];
+    FILE *f;
+    size_t n;
+
+    if (snprintf(path, sizeof(path), "%s/%s", dir, file) >= (int)sizeof(path)) {
+        return false;
+    }
+    f = fopen(path, "r");
+    if (f == NULL) return false;
+    n = fread(buf, 1, len - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return n > 0;
+}
+
+// Find the directory of the CPU controller of our cgroup.  Sets *v2 if
+// it belongs to the unified hierarchy.
+static bool
+findCgroupCpuDir (char *dir, size_t len, bool *v2)
+{
+    char line[PATH_MAX];
+    char buf[64];
+    FILE *f;
+    bool found = false;
+
+    f = fopen("/proc/self/cgroup", "r");
+    if (f == NULL) return false;
+
+    while (!found && fgets(line, sizeof(line), f) != NULL) {
+        // Lines look like "<id>:<controllers>:<path>"
+        char *controllers, *path, *nl;
+
+        controllers = strchr(line, ':');
+        if (controllers == NULL) continue;
+        controllers++;
+        path = strchr(controllers, ':');
+        if (path == NULL) continue;
+        *path++ = '\0';
+        nl = strchr(path, '\n');
+        if (nl != NULL) *nl = '\0';
+        if (strcmp(path, "/") == 0) path = "";
+
+        if (controllers[0] == '\0') {
+            // v2: "0::<path>"
+            *v2 = true;
+            snprintf(dir, len, CGROUP_ROOT "%s", path);
+            if (!readCgroupFile(dir, "cpu.max", buf, sizeof(buf))) {
+                snprintf(dir, len, CGROUP_ROOT);
+            }
+            found = true;
+        } else {
+            // v1: look for the line whose controller list contains "cpu"
+            char *c, *save;
+            for (c = strtok_r(controllers, ",", &save); c != NULL;
+                 c = strtok_r(NULL, ",", &save)) {
+                if (strcmp(c, "cpu") == 0) {
+                    *v2 = false;
+                    snprintf(dir, len, CGROUP_ROOT "/cpu%s", path);
+                    if (!readCgroupFile(dir, "cpu.cfs_quota_us",
+                                        buf, sizeof(buf))) {
+                        snprintf(dir, len, CGROUP_ROOT "/cpu");
+                    }
+                    found = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    fclose(f);
+    return found;
+}
+
+// The CPU quota of our cgroup rounded up to whole processors, or 0 if
+// there is no quota.
+static uint32_t
+getCgroupCpuQuota (void)
+{
+    char dir[PATH_MAX];
+    char buf[64];
+    bool v2;
+    long long quota, period;
+
+    if (!findCgroupCpuDir(dir, sizeof(dir), &v2)) return 0;
+
+    if (v2) {
+        // cpu.max contains "<quota> <period>", or "max <period>"
+        if (!readCgroupFile(dir, "cpu.max", buf, sizeof(buf))) return 0;
+        if (sscanf(buf, "%lld %lld", &quota, &period) != 2) return 0;
+    } else {
+        if (!readCgroupFile(dir, "cpu.cfs_quota_us", buf, sizeof(buf))) {
+            return 0;
+        }
+        quota = strtoll(buf, NULL, 10);
+        if (!readCgroupFile(dir, "cpu.cfs_period_us", buf, sizeof(buf))) {
+            return 0;
+        }
+        period = strtoll(buf, NULL, 10);
+    }
+
+    if (quota <= 0 || period <= 0) return 0;
+    return (uint32_t)((quota + period - 1) / period);
+}
+
+bool
+getCPUThrottleCount (StgWord64 *count)
+{
+    char dir[PATH_MAX];
+    char buf[512];
+    char *p;
+    bool v2;
+
+    if (!findCgroupCpuDir(dir, sizeof(dir), &v2)) return false;
+    if (!readCgroupFile(dir, "cpu.stat", buf, sizeof(buf))) return false;
+
+    p = strstr(buf, "nr_throttled ");
+    if (p == NULL) return false;
+    *count = strtoull(p + strlen("nr_throttled "), NULL, 10);
+    return true;
+}
+
+#else
+
+bool
+getCPUThrottleCount (StgWord64 *count STG_UNUSED)
+{
+    return false;
+}
+
+#endif /* linux_HOST_OS */
+
+// The number of processors we can actually use: the online processors,
+// restricted by our CPU affinity mask (e.g. a cpuset) and by the CPU
+// quota of our cgroup.  This is the default for -N.
 uint32_t
 getNumberOfProcessors (void)
 {
     static uint32_t nproc = 0;
 
     if (nproc == 0) {
-#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
-        nproc = sysconf(_SC_NPROCESSORS_ONLN);
-#elif defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_CONF)
-        nproc = sysconf(_SC_NPROCESSORS_CONF);
-#elif defined(darwin_HOST_OS)
-        size_t size = sizeof(uint32_t);
-        if(sysctlbyname("hw.logicalcpu",&nproc,&size,NULL,0) != 0) {
-            if(sysctlbyname("hw.ncpu",&nproc,&size,NULL,0) != 0)
-                nproc = 1;
+        nproc = getNumberOfOnlineProcessors();
+
+#if defined(HAVE_SCHED_H) && defined(HAVE_SCHED_GETAFFINITY)
+        {
+            cpu_set_t cs;
+            uint32_t i, n = 0;
+
+            CPU_ZERO(&cs);
+            if (sched_getaffinity(0, sizeof(cpu_set_t), &cs) == 0) {
+                for (i = 0; i < CPU_SETSIZE; i++) {
+                    if (CPU_ISSET(i, &cs)) n++;
+                }
+                if (n > 0 && n < nproc) nproc = n;
+            }
+        }
+#endif
+
+#if defined(linux_HOST_OS)
+        {
+            uint32_t quota = getCgroupCpuQuota();
+            if (quota > 0 && quota < nproc) nproc = quota;
         }
-#elif defined(freebsd_HOST_OS)
-        size_t size = sizeof(uint32_t);
-        if(sysctlbyname("hw.ncpu",&nproc,&size,NULL,0) != 0)
-            nproc = 1;
-#else
-        nproc = 1;
 #endif
     }
 
@@ -282,6 +487,11 @@ uint32_t getNumberOfProcessors (void)
     return 1;
 }
 
+bool getCPUThrottleCount (StgWord64 *count STG_UNUSED)
+{
+    return false;
+}
+
 #endif /* defined(THREADED_RTS) */
 
 #if defined(HAVE_SCHED_H) && defined(HAVE_SCHED_SETAFFINITY)
@@ -295,7 +505,7 @@ setThreadAffinity (uint32_t n, uint32_t m)
     cpu_set_t cs;
     uint32_t i;
 
-    nproc = getNumberOfProcessors();
+    nproc = getNumberOfOnlineProcessors();
     CPU_ZERO(&cs);
     for (i = n; i < nproc; i+=m) {
         CPU_SET(i, &cs);
@@ -303,6 +513,17 @@ setThreadAffinity (uint32_t n, uint32_t m)
     sched_setaffinity(0, sizeof(cpu_set_t), &cs);
 }
 
+// Schedules the thread to run on CPU cpu only.
+void
+setThreadCpu (uint32_t cpu)
+{
+    cpu_set_t cs;
+
+    CPU_ZERO(&cs);
+    CPU_SET(cpu, &cs);
+    sched_setaffinity(0, sizeof(cpu_set_t), &cs);
+}
+
 #elif defined(darwin_HOST_OS) && defined(THREAD_AFFINITY_POLICY)
 // Schedules the current thread in the affinity set identified by tag n.
 void
@@ -317,6 +538,12 @@ setThreadAffinity (uint32_t n, uint32_t m GNUC3_ATTRIBUTE(__unused__))
                       THREAD_AFFINITY_POLICY_COUNT);
 }
 
+void
+setThreadCpu (uint32_t cpu)
+{
+    setThreadAffinity(cpu, 0);
+}
+
 #elif defined(HAVE_SYS_CPUSET_H) /* FreeBSD 7.1+ */
 void
 setThreadAffinity(uint32_t n, uint32_t m)
@@ -325,7 +552,7 @@ setThreadAffinity(uint32_t n, uint32_t m)
         cpuset_t cs;
         uint32_t i;
 
-        nproc = getNumberOfProcessors();
+        nproc = getNumberOfOnlineProcessors();
         CPU_ZERO(&cs);
 
         for (i = n; i < nproc; i += m)
@@ -335,12 +562,28 @@ setThreadAffinity(uint32_t n, uint32_t m)
                            -1, sizeof(cpuset_t), &cs);
 }
 
+void
+setThreadCpu (uint32_t cpu)
+{
+        cpuset_t cs;
+
+        CPU_ZERO(&cs);
+        CPU_SET(cpu, &cs);
+        cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_TID,
+                           -1, sizeof(cpuset_t), &cs);
+}
+
 #else
 void
 setThreadAffinity (uint32_t n STG_UNUSED,
                    uint32_t m STG_UNUSED)
 {
 }
+
+void
+setThreadCpu (uint32_t cpu STG_UNUSED)
+{
+}
 #endif
 
 #if HAVE_LIBNUMA
@@ -22,6 +22,7 @@
 #include "AwaitEvent.h"
 #include "Stats.h"
 #include "GetTime.h"
+#include "Threads.h"
 
 # ifdef HAVE_SYS_SELECT_H
 #  include <sys/select.h>
@@ -32,8 +33,14 @@
 # endif
 
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+#define USE_EPOLL 1
+#include <sys/epoll.h>
+#endif
+
 #include "Clock.h"
 
 #if !defined(THREADED_RTS)
@@ -98,12 +105,12 @@ static bool wakeUpSleepingThreads (LowResTime now)
     StgTSO *tso;
     bool flag = false;
 
-    while (sleeping_queue != END_TSO_QUEUE) {
-        tso = sleeping_queue;
+    while (!emptySleepingQueue()) {
+        tso = peekSleepingThread();
         if (((long)now - (long)tso->block_info.target) < 0) {
             break;
         }
-        sleeping_queue = tso->_link;
+        popSleepingThread();
         tso->why_blocked = NotBlocked;
         tso->_link = END_TSO_QUEUE;
         IF_DEBUG(scheduler, debugBelch("Waking up sleeping thread %lu\n",
@@ -203,21 +210,57 @@ static enum FdState fdPollWriteState (int fd)
         return RTS_FD_IS_READY;
 }
 
-/* Argument 'wait' says whether to wait for I/O to become available,
- * or whether to just check and return immediately.  If there are
- * other threads ready to run, we normally do the non-waiting variety,
- * otherwise we wait (see Schedule.c).
- *
- * SMP note: must be called with sched_mutex locked.
- *
- * Windows: select only works on sockets, so this doesn't really work,
- * though it makes things better than before. MsgWaitForMultipleObjects
- * should really be used, though it only seems to work for read handles,
- * not write handles.
- *
+/*
+ * How long to wait before the first sleeping thread is due.  The
+ * sleeping queue must not be empty, and its threads due at 'now' must
+ * have been woken.
  */
-void
-awaitEvent(bool wait)
+static Time sleepTime (LowResTime now)
+{
+    return LowResTimeToTime(peekSleepingThread()->block_info.target - now);
+}
+
+/*
+ * Called when select() or epoll_wait() was interrupted by a signal.
+ * Returns true if awaitEvent() should return to the scheduler.
+ */
+static bool interruptedWait (void)
+{
+    /* We got a signal; could be one of ours.  If so, we need
+     * to start up the signal handler straight away, otherwise
+     * we could block for a long time before the signal is
+     * serviced.
+     */
+#if defined(RTS_USER_SIGNALS)
+    if (RtsFlags.MiscFlags.install_signal_handlers && signals_pending()) {
+        startSignalHandlers(&MainCapability);
+        return true; /* still hold the lock */
+    }
+#endif
+
+    /* we were interrupted, return to the scheduler immediately.
+     */
+    if (sched_state >= SCHED_INTERRUPTING) {
+        return true; /* still hold the lock */
+    }
+
+    /* check for threads that need waking up
+     */
+    wakeUpSleepingThreads(getLowResTimeOfDay());
+
+    /* If new runnable threads have arrived, stop waiting for
+     * I/O and run them.
+     */
+    return !emptyRunQueue(&MainCapability);
+}
+
+/*
+ * awaitEvent() using select(), when epoll is not available.  The fds
+ * are collected from blocked_queue on every call, and must be below
+ * FD_SETSIZE.
+ */
+static void
+selectAwaitEvent (bool wait)
 {
     StgTSO *tso, *prev, *next;
     fd_set rfd,wfd;
@@ -227,14 +270,6 @@ awaitEvent(bool wait)
     struct timeval tv, *ptv;
     LowResTime now;
 
-    IF_DEBUG(scheduler,
-             debugBelch("scheduler: checking for threads blocked on I/O");
-             if (wait) {
-                 debugBelch(" (waiting)");
-             }
-             debugBelch("\n");
-             );
-
     /* loop until we've woken up some threads.  This loop is needed
      * because the select timing isn't accurate, we sometimes sleep
      * for a while but not long enough to wake up a thread in
@@ -293,7 +328,7 @@ awaitEvent(bool wait)
           tv.tv_sec  = 0;
           tv.tv_usec = 0;
           ptv = &tv;
-      } else if (sleeping_queue != END_TSO_QUEUE) {
+      } else if (!emptySleepingQueue()) {
           /* SUSv2 allows implementations to have an implementation defined
            * maximum timeout for select(2). The standard requires
            * implementations to silently truncate values exceeding this maximum
@@ -312,7 +347,7 @@ awaitEvent(bool wait)
            */
           const time_t max_seconds = 2678400; // 31 * 24 * 60 * 60
 
-          Time min = LowResTimeToTime(sleeping_queue->block_info.target - now);
+          Time min = sleepTime(now);
           tv.tv_sec  = TimeToSeconds(min);
           if (tv.tv_sec < max_seconds) {
               tv.tv_usec = TimeToUS(min) % 1000000;
@@ -338,32 +373,7 @@ awaitEvent(bool wait)
             }
           }
 
-          /* We got a signal; could be one of ours.  If so, we need
-           * to start up the signal handler straight away, otherwise
-           * we could block for a long time before the signal is
-           * serviced.
-           */
-#if defined(RTS_USER_SIGNALS)
-          if (RtsFlags.MiscFlags.install_signal_handlers && signals_pending()) {
-              startSignalHandlers(&MainCapability);
-              return; /* still hold the lock */
-          }
-#endif
-
-          /* we were interrupted, return to the scheduler immediately.
-           */
-          if (sched_state >= SCHED_INTERRUPTING) {
-              return; /* still hold the lock */
-          }
-
-          /* check for threads that need waking up
-           */
-          wakeUpSleepingThreads(getLowResTimeOfDay());
-
-          /* If new runnable threads have arrived, stop waiting for
-           * I/O and run them.
-           */
-          if (!emptyRunQueue(&MainCapability)) {
+          if (interruptedWait()) {
               return; /* still hold the lock */
           }
       }
@@ -450,4 +460,415 @@ awaitEvent(bool wait)
              && emptyRunQueue(&MainCapability));
 }
 
+#if defined(USE_EPOLL)
+
+/* Note [epoll in the non-threaded RTS]
+ *
+ * selectAwaitEvent() rebuilds its fd_sets from blocked_queue every time
+ * round the scheduler loop, so its cost is linear in the number of
+ * blocked threads, and it cannot wait on fds above FD_SETSIZE.  Where
+ * we have epoll we instead keep the interest in an epoll instance
+ * between calls to awaitEvent():
+ *
+ *   - waitRead# and waitWrite# still put the thread on blocked_queue.
+ *     awaitEvent() moves the new threads from there onto fd_queues[fd],
+ *     and arms the fd for the events they want if it isn't already.
+ *
+ *   - fds are armed with EPOLLONESHOT, so an fd that is ready but has
+ *     nobody waiting on it doesn't wake us up again and again.  When
+ *     an fd fires we wake the threads on its queue that wanted the
+ *     events, and re-arm it (EPOLL_CTL_MOD) for those that remain.  We
+ *     never remove an fd from the epoll set: the kernel does that when
+ *     it is closed, and we notice (ENOENT) if the number is reused.
+ *
+ * So the cost of awaitEvent() is proportional to the number of newly
+ * blocked threads and ready fds, not to the number of fds we wait on.
+ *
+ * A thread that is thrown an exception is removed from its fd queue
+ * but the fd stays armed; the worst that happens is one event that
+ * wakes nobody.
+ *
+ * epoll_ctl() fails with EPERM for fds that cannot be polled, such as
+ * regular files, which select() reports as always ready; we wake the
+ * thread straight away.  EBADF gets the thread a BlockedOnBadFD
+ * exception, as with select() (#4934).
+ */
+
+typedef struct {
+    StgTSO  *hd, *tl;     // threads blocked on the fd, linked by _link
+    uint32_t armed;       // the events the fd is armed for, if any
+    bool     registered;  // we have added the fd to the epoll set
+} FdQueue;
+
+#define MAX_EPOLL_EVENTS 256
+
+static int      epoll_fd = -1;
+static bool     epoll_failed = false;
+static FdQueue *fd_queues = NULL;
+static uint32_t n_fd_queues = 0;
+static uint32_t n_io_blocked = 0;   // threads on fd_queues
+
+static bool
+epollAvailable (void)
+{
+    if (epoll_fd >= 0) return true;
+    if (epoll_failed) return false;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        IF_DEBUG(scheduler, sysErrorBelch("epoll_create1, using select()"));
+        epoll_failed = true;
+        return false;
+    }
+    return true;
+}
+
+static FdQueue *
+getFdQueue (int fd)
+{
+    uint32_t i, n;
+
+    if ((uint32_t)fd >= n_fd_queues) {
+        n = stg_max(n_fd_queues * 2, stg_max((uint32_t)fd + 1, 64));
+        fd_queues = stgReallocBytes(fd_queues, n * sizeof(FdQueue),
+                                    "getFdQueue");
+        for (i = n_fd_queues; i < n; i++) {
+            fd_queues[i].hd = END_TSO_QUEUE;
+            fd_queues[i].tl = END_TSO_QUEUE;
+            fd_queues[i].armed = 0;
+            fd_queues[i].registered = false;
+        }
+        n_fd_queues = n;
+    }
+    return &fd_queues[fd];
+}
+
+static uint32_t
+fdEventWanted (StgTSO *tso)
+{
+    switch (tso->why_blocked) {
+    case BlockedOnRead:  return EPOLLIN;
+    case BlockedOnWrite: return EPOLLOUT;
+    default:             barf("fdEventWanted");
+    }
+}
+
+/*
+ * Arm fd for 'events', adding it to the epoll set if necessary.
+ */
+static enum FdState
+armFd (int fd, uint32_t events)
+{
+    FdQueue *q = &fd_queues[fd];
+    struct epoll_event ev;
+    int op, r;
+
+    ev.events = events | EPOLLONESHOT;
+    ev.data.u64 = 0;
+    ev.data.fd = fd;
+
+    op = q->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    r = epoll_ctl(epoll_fd, op, fd, &ev);
+    if (r < 0 && op == EPOLL_CTL_MOD && errno == ENOENT) {
+        // the fd has been closed and the number reused since we added it
+        r = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    } else if (r < 0 && op == EPOLL_CTL_ADD && errno == EEXIST) {
+        r = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    if (r == 0) {
+        q->registered = true;
+        q->armed = events;
+        return RTS_FD_IS_BLOCKING;
+    }
+
+    q->registered = false;
+    q->armed = 0;
+    switch (errno) {
+    case EPERM: return RTS_FD_IS_READY;
+    case EBADF: return RTS_FD_IS_INVALID;
+    default:
+        sysErrorBelch("epoll_ctl");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Wake the threads on fd's queue that are waiting for one of the
+ * 'ready' events, or all of them with a BlockedOnBadFD exception if
+ * 'invalid'.  Returns the events that the remaining threads want.
+ */
+static uint32_t
+wakeFdQueue (int fd, uint32_t ready, bool invalid)
+{
+    FdQueue *q = &fd_queues[fd];
+    StgTSO *tso, *prev, *next;
+    uint32_t wanted = 0, ev;
+
+    prev = NULL;
+    for (tso = q->hd; tso != END_TSO_QUEUE; tso = next) {
+        next = tso->_link;
+        ev = fdEventWanted(tso);
+
+        if (invalid) {
+            IF_DEBUG(scheduler,
+                debugBelch("Killing blocked thread %lu on bad fd=%i\n",
+                           (unsigned long)tso->id, fd));
+            tso->_link = END_TSO_QUEUE;
+            n_io_blocked--;
+            raiseAsync(&MainCapability, tso,
+                (StgClosure *)blockedOnBadFD_closure, false, NULL);
+        } else if (ready & ev) {
+            IF_DEBUG(scheduler,
+                debugBelch("Waking up blocked thread %lu\n",
+                           (unsigned long)tso->id));
+            tso->why_blocked = NotBlocked;
+            tso->_link = END_TSO_QUEUE;
+            n_io_blocked--;
+            pushOnRunQueue(&MainCapability,tso);
+        } else {
+            if (prev == NULL)
+                q->hd = tso;
+            else
+                setTSOLink(&MainCapability, prev, tso);
+            prev = tso;
+            wanted |= ev;
+        }
+    }
+
+    if (prev == NULL) {
+        q->hd = q->tl = END_TSO_QUEUE;
+    } else {
+        prev->_link = END_TSO_QUEUE;
+        q->tl = prev;
+    }
+    return wanted;
+}
+
+/*
+ * Wake the threads on fd's queue as for wakeFdQueue(), then make sure
+ * the fd is armed for the threads that remain.
+ */
+static void
+updateFd (int fd, uint32_t ready, bool invalid)
+{
+    uint32_t wanted;
+
+    for (;;) {
+        wanted = wakeFdQueue(fd, ready, invalid);
+        if ((wanted & ~fd_queues[fd].armed) == 0) return;
+
+        switch (armFd(fd, wanted | fd_queues[fd].armed)) {
+        case RTS_FD_IS_BLOCKING: return;
+        case RTS_FD_IS_READY:    ready = wanted; break;
+        case RTS_FD_IS_INVALID:  invalid = true; break;
+        }
+    }
+}
+
+/*
+ * Move the threads that have blocked since the last call from
+ * blocked_queue to their fd queues.
+ */
+static void
+registerBlockedThreads (void)
+{
+    StgTSO *tso, *next;
+    FdQueue *q;
+    int fd;
+
+    for (tso = blocked_queue_hd; tso != END_TSO_QUEUE; tso = next) {
+        next = tso->_link;
+        tso->_link = END_TSO_QUEUE;
+        fd = tso->block_info.fd;
+
+        if (fd < 0) {
+            IF_DEBUG(scheduler,
+                debugBelch("Killing blocked thread %lu on bad fd=%i\n",
+                           (unsigned long)tso->id, fd));
+            raiseAsync(&MainCapability, tso,
+                (StgClosure *)blockedOnBadFD_closure, false, NULL);
+            continue;
+        }
+
+        q = getFdQueue(fd);
+        if (q->hd == END_TSO_QUEUE) {
+            q->hd = tso;
+        } else {
+            setTSOLink(&MainCapability, q->tl, tso);
+        }
+        q->tl = tso;
+        n_io_blocked++;
+
+        if ((fdEventWanted(tso) & ~q->armed) != 0) {
+            updateFd(fd, 0, false);
+        }
+    }
+
+    blocked_queue_hd = blocked_queue_tl = END_TSO_QUEUE;
+}
+
+static void
+epollAwaitEvent (bool wait)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int i, numFound, timeout;
+    uint32_t ready;
+    LowResTime now;
+    Time t;
+
+    /* loop until we've woken up some threads, as in selectAwaitEvent() */
+    do {
+
+      now = getLowResTimeOfDay();
+      if (wakeUpSleepingThreads(now)) {
+          return;
+      }
+
+      registerBlockedThreads();
+
+      if (!wait || !emptyRunQueue(&MainCapability)) {
+          // just poll
+          timeout = 0;
+      } else if (!emptySleepingQueue()) {
+          // round up to milliseconds, and truncate, as in selectAwaitEvent()
+          t = sleepTime(now);
+          if (TimeToUS(t) / 1000 >= INT_MAX) {
+              timeout = INT_MAX;
+          } else {
+              timeout = (int)((TimeToUS(t) + 999) / 1000);
+          }
+      } else {
+          timeout = -1;
+      }
+
+      while ((numFound = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS,
+                                    timeout)) < 0) {
+          if (errno != EINTR) {
+              sysErrorBelch("epoll_wait");
+              stg_exit(EXIT_FAILURE);
+          }
+          if (interruptedWait()) {
+              return; /* still hold the lock */
+          }
+      }
+
+      for (i = 0; i < numFound; i++) {
+          int fd = events[i].data.fd;
+
+          // EPOLLONESHOT: the fd is no longer armed
+          fd_queues[fd].armed = 0;
+
+          ready = events[i].events & (EPOLLIN | EPOLLOUT);
+          if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+              // let the threads find out about the error when they
+              // next read or write, as they would with select()
+              ready = EPOLLIN | EPOLLOUT;
+          }
+          updateFd(fd, ready, false);
+      }
+
+    } while (wait && sched_state == SCHED_RUNNING
+             && emptyRunQueue(&MainCapability));
+}
+
+#endif /* USE_EPOLL */
+
+bool
+emptyBlockedQueue (void)
+{
+#if defined(USE_EPOLL)
+    if (n_io_blocked != 0) return false;
+#endif
+    return emptyQueue(blocked_queue_hd);
+}
+
+void
+removeFromBlockedQueue (Capability *cap, StgTSO *tso)
+{
+#if defined(USE_EPOLL)
+    int fd = tso->block_info.fd;
+    StgTSO *t;
+
+    if (fd >= 0 && (uint32_t)fd < n_fd_queues) {
+        FdQueue *q = &fd_queues[fd];
+        for (t = q->hd; t != END_TSO_QUEUE; t = t->_link) {
+            if (t == tso) {
+                removeThreadFromDeQueue(cap, &q->hd, &q->tl, tso);
+                n_io_blocked--;
+                return;
+            }
+        }
+    }
+#endif
+    removeThreadFromDeQueue(cap, &blocked_queue_hd, &blocked_queue_tl, tso);
+}
+
+void
+markBlockedQueue (evac_fn evac, void *user)
+{
+#if defined(USE_EPOLL)
+    uint32_t i;
+
+    for (i = 0; i < n_fd_queues; i++) {
+        if (fd_queues[i].hd != END_TSO_QUEUE) {
+            evac(user, (StgClosure **)(void *)&fd_queues[i].hd);
+            evac(user, (StgClosure **)(void *)&fd_queues[i].tl);
+        }
+    }
+#endif
+    evac(user, (StgClosure **)(void *)&blocked_queue_hd);
+    evac(user, (StgClosure **)(void *)&blocked_queue_tl);
+}
+
+void
+freeBlockedQueue (void)
+{
+#if defined(USE_EPOLL)
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    if (fd_queues != NULL) {
+        stgFree(fd_queues);
+        fd_queues = NULL;
+    }
+    n_fd_queues = 0;
+    n_io_blocked = 0;
+#endif
+}
+
+/* Argument 'wait' says whether to wait for I/O to become available,
+ * or whether to just check and return immediately.  If there are
+ * other threads ready to run, we normally do the non-waiting variety,
+ * otherwise we wait (see Schedule.c).
+ *
+ * SMP note: must be called with sched_mutex locked.
+ *
+ * Windows: select only works on sockets, so this doesn't really work,
+ * though it makes things better than before. MsgWaitForMultipleObjects
+ * should really be used, though it only seems to work for read handles,
+ * not write handles.
+ *
+ */
+void
+awaitEvent(bool wait)
+{
+    IF_DEBUG(scheduler,
+             debugBelch("scheduler: checking for threads blocked on I/O");
+             if (wait) {
+                 debugBelch(" (waiting)");
+             }
+             debugBelch("\n");
+             );
+
+#if defined(USE_EPOLL)
+    if (epollAvailable()) {
+        epollAwaitEvent(wait);
+        return;
+    }
+#endif
+    selectAwaitEvent(wait);
+}
+
 #endif /* THREADED_RTS */
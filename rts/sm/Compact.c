@@ -452,6 +452,7 @@ thread_TSO (StgTSO *tso)
     thread_(&tso->bq);
 
     thread_(&tso->trec);
+    thread_(&tso->stm_woken_by);
 
     thread_(&tso->stackobj);
     return (StgPtr)tso + sizeofW(StgTSO);
@@ -547,6 +547,7 @@ checkTSO(StgTSO *tso)
 
     ASSERT(LOOKS_LIKE_CLOSURE_PTR(tso->bq));
     ASSERT(LOOKS_LIKE_CLOSURE_PTR(tso->blocked_exceptions));
+    ASSERT(LOOKS_LIKE_CLOSURE_PTR(tso->stm_woken_by));
     ASSERT(LOOKS_LIKE_CLOSURE_PTR(tso->stackobj));
 
     // XXX are we checking the stack twice?
@@ -74,6 +74,7 @@ scavengeTSO (StgTSO *tso)
 
     // scavange current transaction record
     evacuate((StgClosure **)&tso->trec);
+    evacuate(&tso->stm_woken_by);
 
     evacuate((StgClosure **)&tso->stackobj);
 
@@ -15,6 +15,7 @@
  */
 #include "Rts.h"
 #include "Schedule.h"
+#include "Threads.h"
 #include "AwaitEvent.h"
 #include <windows.h>
 #include "win32/AsyncIO.h"
@@ -24,6 +25,31 @@
 // Protected by sched_mutex.
 static uint32_t workerWaitingForRequests = 0;
 
+bool
+emptyBlockedQueue (void)
+{
+    return emptyQueue(blocked_queue_hd);
+}
+
+void
+removeFromBlockedQueue (Capability *cap, StgTSO *tso)
+{
+    removeThreadFromDeQueue(cap, &blocked_queue_hd, &blocked_queue_tl, tso);
+}
+
+void
+markBlockedQueue (evac_fn evac, void *user)
+{
+    evac(user, (StgClosure **)(void *)&blocked_queue_hd);
+    evac(user, (StgClosure **)(void *)&blocked_queue_tl);
+}
+
+void
+freeBlockedQueue (void)
+{
+    /* nothing */
+}
+
 void
 awaitEvent(bool wait)
 {
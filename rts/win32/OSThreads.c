@@ -90,6 +90,17 @@ waitCondition ( Condition* pCond, Mutex* pMut )
   return true;
 }
 
+bool
+timedWaitCondition ( Condition* pCond, Mutex* pMut, Time timeout )
+{
+  DWORD r;
+
+  RELEASE_LOCK(pMut);
+  r = WaitForSingleObject(*pCond, TimeToUS(timeout) / 1000);
+  ACQUIRE_LOCK(pMut);
+  return r == WAIT_OBJECT_0;
+}
+
 void
 yieldThread()
 {
@@ -552,6 +563,13 @@ setThreadAffinity (uint32_t n, uint32_t m) // cap N of M
     free(mask);
 }
 
+void
+setThreadCpu (uint32_t cpu)
+{
+    // with m == number of processors, only processor cpu is selected
+    setThreadAffinity(cpu, getNumberOfProcessors());
+}
+
 typedef BOOL (WINAPI *PCSIO)(HANDLE);
 
 void
@@ -633,6 +651,11 @@ uint32_t getNumberOfProcessors (void)
 
 #endif /* !defined(THREADED_RTS) */
 
+bool getCPUThrottleCount (StgWord64 *count STG_UNUSED)
+{
+    return false;
+}
+
 KernelThreadId kernelThreadId (void)
 {
     DWORD tid = GetCurrentThreadId();
@@ -0,0 +1,50 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+-- The bit primitives in ghc-prim's cbits, which pick an implementation
+-- for the CPU at load time: popCount, countLeadingZeros and
+-- countTrailingZeros (which call them unless compiled with -msse4.2 or
+-- -mbmi2), and hs_pdep/hs_pext, called through the FFI
+
+module Main ( main ) where
+
+import Data.Bits
+import Data.Word
+
+foreign import ccall unsafe "hs_pdep64" pdep64 :: Word64 -> Word64 -> Word64
+foreign import ccall unsafe "hs_pext64" pext64 :: Word64 -> Word64 -> Word64
+foreign import ccall unsafe "hs_pdep8"  pdep8  :: Word -> Word -> Word
+foreign import ccall unsafe "hs_pext16" pext16 :: Word -> Word -> Word
+
+-- depositing the low bits of src at the set bits of mask, and back
+pdepRef, pextRef :: Int -> Word64 -> Word64 -> Word64
+pdepRef w src mask = go 0 0 0
+  where go i k r
+          | i >= w         = r
+          | testBit mask i = go (i + 1) (k + 1)
+                                (if testBit src k then setBit r i else r)
+          | otherwise      = go (i + 1) k r
+pextRef w src mask = go 0 0 0
+  where go i k r
+          | i >= w         = r
+          | testBit mask i = go (i + 1) (k + 1)
+                                (if testBit src i then setBit r k else r)
+          | otherwise      = go (i + 1) k r
+
+values :: [Word64]
+values = take 400 (iterate step 0x0123456789abcdef)
+         ++ [0, 1, maxBound, 0x8000000000000000, 0xff, 0xff00ff00]
+  where step x = x * 6364136223846793005 + 1442695040888963407
+
+main :: IO ()
+main = do
+  print [ (popCount x, countLeadingZeros x, countTrailingZeros x)
+        | x <- [0, 1, 0x80000000, maxBound :: Word64] ]
+  print [ (popCount x, countLeadingZeros x, countTrailingZeros x)
+        | x <- [0, 1, 0x80, maxBound :: Word8] ]
+  print $ and [ pdep64 s m == pdepRef 64 s m && pext64 s m == pextRef 64 s m
+              | s <- values, m <- take 50 values ]
+  print $ and [ fromIntegral (pdep8 (fromIntegral s) (fromIntegral m))
+                  == pdepRef 8 s (m .&. 0xff)
+                && fromIntegral (pext16 (fromIntegral s) (fromIntegral m))
+                  == pextRef 16 s (m .&. 0xffff)
+              | s <- values, m <- take 50 values ]
@@ -0,0 +1,31 @@
+-- Many threads blocked in threadDelay at once, half of which are killed
+-- while they are in the sleeping queue.  With the non-threaded RTS every
+-- insertion into, and removal from, the sleeping queue used to be linear
+-- in the number of sleepers.
+
+import Control.Concurrent
+import Control.Monad
+import GHC.Conc (ThreadStatus(..), threadStatus)
+
+-- Wait until the thread has gone to sleep
+waitBlocked :: ThreadId -> IO ()
+waitBlocked t = do
+  s <- threadStatus t
+  case s of
+    ThreadBlocked _ -> return ()
+    _               -> yield >> waitBlocked t
+
+main :: IO ()
+main = do
+  let n = 100000
+      m = 50000
+  done <- newEmptyMVar
+  forM_ [1..n] $ \i -> forkIO $ do
+    threadDelay (100000 + i)
+    putMVar done ()
+  sleepers <- replicateM m (forkIO (threadDelay 10000000))
+  mapM_ waitBlocked sleepers
+  mapM_ killThread sleepers
+  replicateM_ n (takeMVar done)
+  ss <- mapM threadStatus sleepers
+  print (n, length (filter (== ThreadFinished) ss))
@@ -0,0 +1,41 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+-- The io_uring backend with more fds ready at once than its rings hold:
+-- registering them fills the submission queue while the completion queue
+-- overflows, and every registration must still fire.
+
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import Foreign
+import Foreign.C
+import GHC.Event
+import System.Posix.Types
+
+foreign import ccall unsafe "pipe"  c_pipe  :: Ptr CInt -> IO CInt
+foreign import ccall unsafe "write" c_write :: CInt -> Ptr Word8 -> CSize -> IO CSsize
+foreign import ccall unsafe "raiseFdLimit" raiseFdLimit :: CInt -> IO CInt
+
+newPipe :: IO (Fd, Fd)
+newPipe = allocaArray 2 $ \p -> do
+  throwErrnoIfMinus1_ "pipe" (c_pipe p)
+  [r, w] <- peekArray 2 p
+  return (Fd r, Fd w)
+
+main :: IO ()
+main = do
+  -- the manager's rings have 256 and 512 entries
+  limit <- raiseFdLimit 4000
+  let n = min 1500 ((fromIntegral limit - 100) `div` 2)
+  pipes <- replicateM n newPipe
+  forM_ pipes $ \(_, Fd w) ->
+    with 0 $ \b -> throwErrnoIfMinus1_ "write" (c_write w b 1)
+
+  Just mgr <- getSystemEventManager
+  count <- newIORef (0 :: Int)
+  done <- newEmptyMVar
+  forM_ pipes $ \(r, _) ->
+    registerFdOnce mgr (\_ _ -> do
+                          k <- atomicModifyIORef' count (\k -> (k + 1, k + 1))
+                          when (k == n) $ putMVar done ()) r evtRead
+  takeMVar done
+  putStrLn "all fired"
@@ -0,0 +1,19 @@
+#include <sys/resource.h>
+
+// Raise the soft limit on open files towards want, and return the limit
+int raiseFdLimit(int want)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) {
+        return 0;
+    }
+    if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t)want) {
+        rl.rlim_cur = rl.rlim_max != RLIM_INFINITY &&
+                      rl.rlim_max < (rlim_t)want ? rl.rlim_max : (rlim_t)want;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    return rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > (rlim_t)want
+           ? want : (int)rl.rlim_cur;
+}
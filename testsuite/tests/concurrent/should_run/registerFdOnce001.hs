@@ -0,0 +1,38 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+-- One-shot registrations without a key, for a batch of ready fds
+
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import Foreign
+import Foreign.C
+import GHC.Event
+import System.Posix.Types
+
+foreign import ccall unsafe "pipe"  c_pipe  :: Ptr CInt -> IO CInt
+foreign import ccall unsafe "write" c_write :: CInt -> Ptr Word8 -> CSize -> IO CSsize
+
+newPipe :: IO (Fd, Fd)
+newPipe = allocaArray 2 $ \p -> do
+  throwErrnoIfMinus1_ "pipe" (c_pipe p)
+  [r, w] <- peekArray 2 p
+  return (Fd r, Fd w)
+
+main :: IO ()
+main = do
+  Just mgr <- getSystemEventManager
+  pipes <- replicateM 100 newPipe
+  fired <- newChan
+  count <- newIORef (0 :: Int)
+  forM_ pipes $ \(r, _) ->
+    registerFdOnce mgr (\_ e -> do atomicModifyIORef' count (\n -> (n + 1, ()))
+                                   writeChan fired e) r evtRead
+  forM_ pipes $ \(_, Fd w) ->
+    with 0 $ \b -> throwErrnoIfMinus1_ "write" (c_write w b 1)
+  evs <- replicateM (length pipes) (readChan fired)
+  print (length evs)
+  print (head evs)
+
+  -- the registrations are gone once they have fired
+  threadDelay 100000
+  readIORef count >>= print
@@ -0,0 +1,45 @@
+-- With +RTS --stm-clock a transaction never sees an inconsistent view of
+-- the TVars, not even one that it would fail to commit.
+
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import GHC.Conc
+
+n :: Int
+n = 16
+
+main :: IO ()
+main = do
+  tvs <- mapM newTVarIO (replicate n (100 :: Int))
+  seen <- newIORef (0 :: Int)
+  done <- newEmptyMVar
+
+  -- Writers move money around, keeping the total fixed
+  forM_ [1..4] $ \w -> forkIO $ do
+    forM_ [1..5000] $ \i -> atomically $ do
+      let a = tvs !! ((w * i) `mod` n)
+          b = tvs !! ((w * i + 7) `mod` n)
+      x <- readTVar a
+      writeTVar a (x - 1)
+      y <- readTVar b
+      writeTVar b (y + 1)
+    putMVar done ()
+
+  -- Readers sum the TVars, directly and in a nested transaction, and
+  -- count any total they see that is wrong
+  forM_ [1..4] $ \_ -> forkIO $ do
+    forM_ [1..2000 :: Int] $ \_ -> do
+      s <- atomically $ do
+        s1 <- sum `fmap` mapM readTVar tvs
+        s2 <- (sum `fmap` mapM readTVar (reverse tvs)) `orElse` return s1
+        when (s1 /= 100 * n || s2 /= s1) $
+          unsafeIOToSTM (atomicModifyIORef' seen (\c -> (c + 1, ())))
+        return s1
+      when (s /= 100 * n) $ putStrLn "committed an inconsistent total"
+    putMVar done ()
+
+  replicateM_ 8 (takeMVar done)
+  readIORef seen >>= print
+  total <- atomically $ sum `fmap` mapM readTVar tvs
+  print (total == 100 * n)
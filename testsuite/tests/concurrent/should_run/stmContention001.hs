@@ -0,0 +1,28 @@
+-- Many threads incrementing one TVar, with +RTS --stm-backoff and
+-- --stm-serialise, must not lose updates; the commits are counted by
+-- getRTSStats.
+
+import Control.Concurrent
+import Control.Monad
+import GHC.Conc
+import GHC.Stats
+
+threads, iters :: Int
+threads = 16
+iters = 2000
+
+main :: IO ()
+main = do
+  tv <- newTVarIO (0 :: Int)
+  done <- newEmptyMVar
+
+  forM_ [1..threads] $ \_ -> forkIO $ do
+    replicateM_ iters $ atomically $ do
+      x <- readTVar tv
+      writeTVar tv (x + 1)
+    putMVar done ()
+
+  replicateM_ threads (takeMVar done)
+  readTVarIO tv >>= print
+  s <- getRTSStats
+  print (stm_commits (stm s) >= fromIntegral (threads * iters))
@@ -0,0 +1,50 @@
+-- Transactions over enough TVars that the RTS indexes their TRecs, with
+-- GCs in the middle of them (which invalidate the indexes), nested
+-- transactions, and other threads committing to the same TVars.
+
+import Control.Concurrent
+import Control.Monad
+import GHC.Conc
+import System.Mem
+
+n :: Int
+n = 5000
+
+main :: IO ()
+main = do
+  tvs <- replicateM n (newTVarIO (1 :: Int))
+
+  -- Read and write every TVar, several times, in one transaction
+  s <- atomically $ do
+    forM_ tvs $ \tv -> readTVar tv >>= writeTVar tv . (+1)
+    unsafeIOToSTM performGC
+    forM_ (reverse tvs) $ \tv -> readTVar tv >>= writeTVar tv . (*2)
+    sum `fmap` mapM readTVar tvs
+  print (s == 4 * n)
+
+  -- A nested transaction that shadows most of its parent's TVars and
+  -- is then thrown away, and one that is merged into its parent
+  r <- atomically $ do
+    mapM_ readTVar tvs
+    (do forM_ (drop 100 tvs) $ \tv -> writeTVar tv 0
+        unsafeIOToSTM performGC
+        retry) `orElse` return ()
+    (do forM_ (take 1000 tvs) $ \tv -> modify tv (+1)
+        unsafeIOToSTM performGC) `orElse` return ()
+    sum `fmap` mapM readTVar tvs
+  print (r == 4 * n + 1000)
+
+  -- Concurrent transfers between random pairs preserve the total
+  done <- newEmptyMVar
+  forM_ [1..4] $ \t -> forkIO $ do
+    forM_ [1..200] $ \i -> atomically $ do
+      let k = (t * 7919 + i * 104729) `mod` n
+      forM_ (take 64 (drop k (cycle tvs))) $ \tv -> modify tv (+1)
+      forM_ (take 64 (drop (n - k) (cycle tvs))) $ \tv -> modify tv (subtract 1)
+    putMVar done ()
+  replicateM_ 4 (takeMVar done)
+  total <- atomically $ sum `fmap` mapM readTVar tvs
+  print (total == 4 * n + 1000)
+
+modify :: TVar a -> (a -> a) -> STM ()
+modify tv f = readTVar tv >>= writeTVar tv . f
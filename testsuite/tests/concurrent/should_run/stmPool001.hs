@@ -0,0 +1,33 @@
+-- TRecs and watch queue entries are recycled through per-capability
+-- pools that survive GC; make sure recycled records start out empty.
+
+import Control.Concurrent
+import Control.Monad
+import GHC.Conc
+import System.Mem
+
+main :: IO ()
+main = do
+  tvs <- mapM newTVarIO [1 .. 20 :: Int]
+  flag <- newTVarIO False
+  done <- newEmptyMVar
+
+  -- A waiter, whose watch queue entries are freed when it wakes
+  _ <- forkIO $ do
+    atomically $ readTVar flag >>= \b -> unless b retry
+    putMVar done ()
+
+  forM_ [1 .. 2000 :: Int] $ \i -> do
+    -- short, long and nested transactions
+    atomically $ modify (head tvs) (+ 1)
+    atomically $ forM_ tvs $ \tv -> modify tv (+ 1)
+    atomically $ (readTVar (tvs !! 1) >>= \x -> when (even x) retry)
+                 `orElse` modify (tvs !! 2) (+ 1)
+    when (i `mod` 100 == 0) performGC
+
+  atomically $ writeTVar flag True
+  takeMVar done
+  mapM readTVarIO tvs >>= print . take 3
+
+modify :: TVar a -> (a -> a) -> STM ()
+modify tv f = readTVar tv >>= \x -> writeTVar tv $! f x
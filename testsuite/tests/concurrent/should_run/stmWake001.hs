@@ -0,0 +1,58 @@
+-- With +RTS --stm-wake=1 an update wakes only one of the threads blocked
+-- on a TVar; the others must still be woken in turn, also when the woken
+-- thread only peeks at the TVar.  The consumers are spread over the
+-- capabilities, and we count how often their transaction runs: waking
+-- all of them for each item would run it about consumers^2/2 times.
+
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import GHC.Conc
+
+consumers :: Int
+consumers = 100
+
+main :: IO ()
+main = do
+  queue <- newTVarIO ([] :: [Int])
+  results <- newTVarIO (0 :: Int, 0 :: Int)
+  done <- newEmptyMVar
+  runs <- newIORef (0 :: Int)
+  caps <- getNumCapabilities
+
+  -- Consumers each take one item
+  forM_ [1..consumers] $ \i -> forkOn (i `mod` caps) $ do
+    x <- atomically $ do
+      unsafeIOToSTM $ atomicModifyIORef' runs (\n -> (n + 1, ()))
+      xs <- readTVar queue
+      case xs of
+        []     -> retry
+        (y:ys) -> writeTVar queue ys >> return y
+    atomically $ do
+      (n, s) <- readTVar results
+      writeTVar results (n + 1, s + x)
+    putMVar done ()
+
+  -- Peekers wait for an item but leave it in the queue
+  peeked <- newEmptyMVar
+  forM_ [1..10 :: Int] $ \_ -> forkIO $ do
+    atomically $ readTVar queue >>= \xs -> when (null xs) retry
+    putMVar peeked ()
+
+  threadDelay 100000
+  forM_ [1..consumers] $ \i -> do
+    atomically $ modifyTVar' queue (++ [i])
+    yield
+
+  replicateM_ consumers (takeMVar done)
+  readTVarIO results >>= print
+  n <- readIORef runs
+  putStrLn $ "few consumer runs: " ++ show (n < 10 * consumers)
+
+  -- Leave an item for the peekers that are still waiting
+  atomically $ writeTVar queue [0]
+  replicateM_ 10 (takeMVar peeked)
+  readTVarIO queue >>= print
+
+modifyTVar' :: TVar a -> (a -> a) -> STM ()
+modifyTVar' tv f = readTVar tv >>= \x -> writeTVar tv $! f x
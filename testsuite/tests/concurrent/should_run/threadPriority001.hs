@@ -0,0 +1,38 @@
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import GHC.Conc
+
+-- Threads woken up in the order low, high should nevertheless run in
+-- the order high, low.
+main = do
+  me <- myThreadId
+  getThreadPriority me >>= print
+
+  setThreadPriority me 100000
+  getThreadPriority me >>= print
+  setThreadPriority me 0
+
+  out <- newIORef []
+  done <- newEmptyMVar
+  lo_go <- newEmptyMVar
+  hi_go <- newEmptyMVar
+  lo <- forkIO $ do takeMVar lo_go; modifyIORef out ("low":); putMVar done ()
+  hi <- forkIO $ do takeMVar hi_go; modifyIORef out ("high":); putMVar done ()
+  setThreadPriority lo (-5)
+  setThreadPriority hi 5
+  waitBlocked lo
+  waitBlocked hi
+
+  putMVar lo_go ()
+  putMVar hi_go ()
+  takeMVar done
+  takeMVar done
+  readIORef out >>= print . reverse
+
+waitBlocked :: ThreadId -> IO ()
+waitBlocked t = do
+  s <- threadStatus t
+  case s of
+    ThreadBlocked _ -> return ()
+    _ -> yield >> waitBlocked t
@@ -0,0 +1,40 @@
+-- Timeouts kept in the timer wheel (+RTS --timer-wheel)
+
+import Control.Concurrent
+import Control.Monad
+import GHC.Event
+import System.Timeout
+
+main :: IO ()
+main = do
+  -- threads wake up in order of their deadlines
+  out <- newChan
+  forM_ [5,4,3,2,1] $ \i ->
+    forkIO $ threadDelay (i * 50000) >> writeChan out i
+  replicateM 5 (readChan out) >>= print
+
+  -- timeouts that are cancelled, and that fire
+  timeout 1000000 (return 'a') >>= print
+  timeout 10000 (threadDelay 1000000) >>= print
+
+  -- timeouts brought forward, postponed and unregistered
+  mgr <- getSystemTimerManager
+  fired <- newEmptyMVar
+  k1 <- registerTimeout mgr 2000000 (putMVar fired "k1")
+  k2 <- registerTimeout mgr 10000 (putMVar fired "k2")
+  k3 <- registerTimeout mgr 20000 (putMVar fired "k3")
+  updateTimeout mgr k1 50000
+  updateTimeout mgr k2 2000000
+  unregisterTimeout mgr k3
+  takeMVar fired >>= putStrLn
+  threadDelay 100000
+  tryTakeMVar fired >>= print
+  unregisterTimeout mgr k2
+
+  -- timeouts further away than a turn of the wheel
+  k4 <- registerTimeout mgr 1200000 (putMVar fired "k4")
+  k5 <- registerTimeout mgr 1100000 (putMVar fired "k5")
+  takeMVar fired >>= putStrLn
+  takeMVar fired >>= putStrLn
+  unregisterTimeout mgr k4
+  unregisterTimeout mgr k5
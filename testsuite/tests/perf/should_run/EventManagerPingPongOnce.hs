@@ -0,0 +1,51 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+-- EventManagerPingPong, with each thread waiting through
+-- registerFdOnce rather than threadWaitRead: one callback per thread,
+-- reused for every wait, and no key.
+
+import Control.Concurrent
+import Control.Monad
+import Foreign
+import Foreign.C
+import GHC.Event
+import System.Posix.Types
+
+foreign import ccall unsafe "pipe"  c_pipe  :: Ptr CInt -> IO CInt
+foreign import ccall unsafe "read"  c_read  :: CInt -> Ptr Word8 -> CSize -> IO CSsize
+foreign import ccall unsafe "write" c_write :: CInt -> Ptr Word8 -> CSize -> IO CSsize
+
+newPipe :: IO (Fd, Fd)
+newPipe = allocaArray 2 $ \p -> do
+  throwErrnoIfMinus1_ "pipe" (c_pipe p)
+  [r, w] <- peekArray 2 p
+  return (Fd r, Fd w)
+
+rounds :: Int
+rounds = 10000
+
+-- Wait for a byte on r and pass it on to w, n times
+relay :: EventManager -> Ptr Word8 -> Fd -> Fd -> Int -> IO ()
+relay mgr buf r@(Fd rfd) (Fd wfd) n = do
+  ready <- newEmptyMVar
+  let wake _ _ = putMVar ready ()
+  replicateM_ n $ do
+    registerFdOnce mgr wake r evtRead
+    takeMVar ready
+    throwErrnoIfMinus1_ "read" (c_read rfd buf 1)
+    throwErrnoIfMinus1_ "write" (c_write wfd buf 1)
+
+main :: IO ()
+main = do
+  Just mgr <- getSystemEventManager
+  (r1, w1@(Fd w1fd)) <- newPipe
+  (r2, w2) <- newPipe
+  done <- newEmptyMVar
+  _ <- forkIO $ allocaBytes 1 $ \buf -> do
+    relay mgr buf r1 w2 rounds
+    putMVar done ()
+  allocaBytes 1 $ \buf -> do
+    poke buf 0
+    throwErrnoIfMinus1_ "write" (c_write w1fd buf 1)
+    relay mgr buf r2 w1 rounds
+  takeMVar done
+  print rounds
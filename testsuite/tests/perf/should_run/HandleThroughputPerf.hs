@@ -0,0 +1,27 @@
+-- Throughput of text-mode Handle I/O: write and read back about 50MB of
+-- log lines, which are mostly ASCII, in UTF-8 and Latin-1.
+
+import Control.Monad
+import System.IO
+
+logLine :: Int -> String
+logLine i
+  | i `mod` 10 == 0 = "naïve café " ++ entry
+  | otherwise       = entry
+  where
+    entry = "GET /index.html?request=" ++ show i ++
+            " HTTP/1.1 200 OK 1234 bytes in 0.5ms"
+
+main :: IO ()
+main = do
+  let block = unlines (map logLine [1..100 :: Int])
+      reps  = 8000
+  forM_ [("UTF-8", utf8), ("ISO-8859-1", latin1)] $ \(name, enc) -> do
+    withFile "HandleThroughputPerf.data" WriteMode $ \h -> do
+      hSetEncoding h enc
+      replicateM_ reps (hPutStr h block)
+    n <- withFile "HandleThroughputPerf.data" ReadMode $ \h -> do
+      hSetEncoding h enc
+      s <- hGetContents h
+      return $! length s
+    print (name, n == reps * length block)
@@ -0,0 +1,22 @@
+-- Many threads blocked in threadDelay at once, a third of which are
+-- killed while they are in the sleeping queue.  With the non-threaded
+-- RTS every insertion into, and removal from, the sleeping queue used to
+-- be linear in the number of sleepers.
+
+import Control.Concurrent
+import Control.Monad
+
+main :: IO ()
+main = do
+  let n = 100000
+      m = 50000
+  done <- newEmptyMVar
+  forM_ [1..n] $ \i -> forkIO $ do
+    threadDelay (100000 + i)
+    putMVar done ()
+  sleepers <- replicateM m (forkIO (threadDelay 10000000))
+  -- every thread forked so far runs, and goes to sleep, before we wake
+  threadDelay 1000
+  mapM_ killThread sleepers
+  replicateM_ n (takeMVar done)
+  print (n, m)
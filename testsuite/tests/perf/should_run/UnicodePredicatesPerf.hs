@@ -0,0 +1,27 @@
+{-# LANGUAGE BangPatterns #-}
+-- Character predicates and case conversion over mixed-script text, as
+-- done by parsers and tokenisers.  The text is evaluated once and then
+-- walked again and again, so nothing is allocated per character: a
+-- predicate that allocated would show up in the allocation figure.
+
+import Data.Char
+
+text :: String
+text = "The quick brown fox, 42 times — Η γρήγορη καφέ αλεπού; " ++
+       "Быстрая бурая лиса! 敏捷的棕色狐狸。\n"
+
+-- Count over k passes of the text
+count :: Int -> Int -> Int -> Int -> Int -> String -> (Int, Int, Int, Int)
+count !k !a !u !p !s []
+  | k <= 1    = (a, u, p, s)
+  | otherwise = count (k - 1) a u p s text
+count !k !a !u !p !s (c:cs) =
+  count k
+        (if isAlpha c then a + 1 else a)
+        (if isUpper (toUpper c) then u + 1 else u)
+        (if generalCategory c == OtherPunctuation then p + 1 else p)
+        (if isSpace c then s + 1 else s)
+        cs
+
+main :: IO ()
+main = print (count 200000 0 0 0 0 text)
@@ -0,0 +1,22 @@
+-- Sample the stacks of an allocating loop with +RTS --cpu-sample, across
+-- a stop and restart of the eventlog.  The first log is moved to
+-- cpuSample001.first.eventlog, for the Makefile to check both.
+
+import Data.List (foldl')
+import GHC.RTS.Flags
+import System.Directory
+
+work :: Int -> Integer
+work n = foldl' (+) 0 [ fromIntegral (i * i) | i <- [1 .. n] ]
+
+main :: IO ()
+main = do
+  print . cpuSampleInterval . traceFlags =<< getRTSFlags
+  print (work 3000000)
+  stopEventlog
+  renameFile "cpuSample001.eventlog" "cpuSample001.first.eventlog"
+  print (work 1000000)
+  ok <- startEventlog
+  print ok
+  print (work 3000000)
+  stopEventlog
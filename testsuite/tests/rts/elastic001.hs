@@ -0,0 +1,22 @@
+-- +RTS -qe: once the program goes idle, the controller should disable
+-- capabilities, staying within 1 and -N.
+
+import Control.Concurrent
+import Control.Monad
+import Data.List (foldl')
+
+spin :: Int -> Int
+spin n = foldl' (+) 0 [ i `mod` 7 | i <- [1 .. n] ]
+
+main :: IO ()
+main = do
+  n0 <- getNumCapabilities
+  print n0
+  done <- newEmptyMVar
+  forM_ [1 .. 8 :: Int] $ \i -> forkIO $ do
+    _ <- return $! spin (2000000 + i)
+    putMVar done ()
+  replicateM_ 8 (takeMVar done)
+  threadDelay 1000000
+  n1 <- getNumCapabilities
+  print (n1 >= 1 && n1 < n0)
@@ -0,0 +1,4 @@
+-- hs_exit must not wait for the -qe controller's sampling interval.
+
+main :: IO ()
+main = putStrLn "done"
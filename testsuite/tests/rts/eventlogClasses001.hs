@@ -0,0 +1,33 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+-- Choose the event classes at runtime, in a program started without -l,
+-- and check that starting the eventlog keeps the choice, and that user
+-- events are logged only while their class is enabled
+-- (eventlogClasses001_c.c looks for the messages in the log).
+
+import Debug.Trace
+import Foreign.C
+import GHC.RTS.Flags
+import System.Mem
+
+foreign import ccall safe "startTestWriter" startTestWriter :: IO CInt
+foreign import ccall safe "endEventLogging" endEventLogging :: IO ()
+foreign import ccall unsafe "seenMessage" seenMessage :: CInt -> IO CInt
+
+main :: IO ()
+main = do
+  print =<< getEventlogClasses
+  setEventlogClasses [EventlogGc, EventlogUser]
+  print =<< getEventlogClasses
+  ok <- startTestWriter
+  traceEventIO "event shown"
+  setEventlogClasses [EventlogGc]
+  traceEventIO "event hidden"
+  traceMarkerIO "marker hidden"
+  setEventlogClasses [EventlogUser]
+  performGC
+  traceMarkerIO "marker shown"
+  endEventLogging
+  print ok
+  print =<< getEventlogClasses
+  -- event shown, marker shown, event hidden, marker hidden
+  print =<< mapM seenMessage [0 .. 3]
@@ -0,0 +1,49 @@
+#include "Rts.h"
+#include <string.h>
+
+// The messages eventlogClasses001 traces; each is logged whole inside
+// one buffer, so we look for them in each write
+static const char *messages[] = {
+    "event shown", "marker shown", "event hidden", "marker hidden"
+};
+#define N_MESSAGES (sizeof(messages) / sizeof(messages[0]))
+
+static int seen[N_MESSAGES];
+
+static void initTestWriter(void)
+{
+    memset(seen, 0, sizeof(seen));
+}
+
+static bool writeTestWriter(void *eventlog, size_t size)
+{
+    const char *p = eventlog;
+    size_t i, j, len;
+
+    for (i = 0; i < N_MESSAGES; i++) {
+        len = strlen(messages[i]);
+        for (j = 0; !seen[i] && j + len <= size; j++) {
+            if (memcmp(p + j, messages[i], len) == 0) {
+                seen[i] = 1;
+            }
+        }
+    }
+    return true;
+}
+
+static const EventLogWriter TestWriter = {
+    .initEventLogWriter = initTestWriter,
+    .writeEventLog = writeTestWriter,
+    .flushEventLog = NULL,
+    .stopEventLogWriter = NULL
+};
+
+int startTestWriter(void)
+{
+    return startEventLogging(&TestWriter);
+}
+
+int seenMessage(int i)
+{
+    return seen[i];
+}
@@ -0,0 +1,11 @@
+-- A scheduler-heavy program, to compare the sizes of the eventlog encodings
+
+import Control.Concurrent
+import Control.Monad
+
+main :: IO ()
+main = do
+  ping <- newEmptyMVar
+  pong <- newEmptyMVar
+  _ <- forkIO $ forever $ takeMVar ping >>= putMVar pong
+  forM_ [1 .. 20000 :: Int] $ \i -> putMVar ping i >> takeMVar pong
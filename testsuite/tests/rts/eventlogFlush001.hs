@@ -0,0 +1,16 @@
+-- Fill the eventlog buffers many times over from several threads, with
+-- full buffers written by the background flusher (+RTS --eventlog-flush).
+
+import Control.Concurrent
+import Control.Monad
+import Debug.Trace
+
+main :: IO ()
+main = do
+  done <- newEmptyMVar
+  forM_ [1..4 :: Int] $ \t -> forkIO $ do
+    forM_ [1..50000 :: Int] $ \i ->
+      traceEventIO ("thread " ++ show t ++ " event " ++ show i)
+    putMVar done t
+  ts <- replicateM 4 (takeMVar done)
+  print (sum ts)
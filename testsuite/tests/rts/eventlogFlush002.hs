@@ -0,0 +1,19 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+-- Log 400000 user events, about 10MB, to a writer much slower than the
+-- program (eventlogFlush002_c.c), for the Makefile to check what the
+-- --eventlog-flush policy kept.
+
+import Control.Monad
+import Debug.Trace
+import Foreign.C
+
+foreign import ccall safe "startSlowWriter"
+  startSlowWriter :: CString -> IO CInt
+foreign import ccall safe "endEventLogging" endEventLogging :: IO ()
+
+main :: IO ()
+main = do
+  ok <- withCString "eventlogFlush002.eventlog" startSlowWriter
+  when (ok == 0) $ error "could not start the eventlog"
+  forM_ [1 .. 400000 :: Int] $ \i -> traceEventIO ("event " ++ show i)
+  endEventLogging
@@ -0,0 +1,41 @@
+#include "Rts.h"
+#include <stdio.h>
+#include <unistd.h>
+
+// An EventLogWriter to a file that takes 300ms over each write, so that
+// the flusher thread falls behind a program that logs a lot
+
+static const char *slow_path;
+static FILE *slow_file;
+
+static void initSlowWriter(void)
+{
+    slow_file = fopen(slow_path, "wb");
+}
+
+static bool writeSlowWriter(void *eventlog, size_t size)
+{
+    usleep(300000);
+    return slow_file != NULL && fwrite(eventlog, 1, size, slow_file) == size;
+}
+
+static void stopSlowWriter(void)
+{
+    if (slow_file != NULL) {
+        fclose(slow_file);
+        slow_file = NULL;
+    }
+}
+
+static const EventLogWriter SlowWriter = {
+    .initEventLogWriter = initSlowWriter,
+    .writeEventLog = writeSlowWriter,
+    .flushEventLog = NULL,
+    .stopEventLogWriter = stopSlowWriter
+};
+
+int startSlowWriter(const char *path)
+{
+    slow_path = path;
+    return startEventLogging(&SlowWriter);
+}
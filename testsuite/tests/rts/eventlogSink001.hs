@@ -0,0 +1,12 @@
+-- Post some user events, for the Makefile to stream the eventlog through
+-- the built-in sinks and check what arrives.
+
+import Control.Monad
+import Debug.Trace
+import System.Mem
+
+main :: IO ()
+main = do
+  forM_ [1 .. 1000 :: Int] $ \i -> traceEventIO ("event " ++ show i)
+  performGC
+  putStrLn "done"
@@ -0,0 +1,30 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+-- Start and stop the eventlog at runtime with a custom EventLogWriter;
+-- each run must produce a complete stream (header ... data end marker).
+
+import Control.Concurrent
+import Control.Monad
+import Foreign.C
+
+foreign import ccall safe "startTestWriter" startTestWriter :: IO CInt
+foreign import ccall safe "endEventLogging" endEventLogging :: IO ()
+foreign import ccall unsafe "completeStreams" completeStreams :: IO CInt
+
+work :: IO ()
+work = do
+  mv <- newEmptyMVar
+  forM_ [1..10 :: Int] $ \i -> forkIO (putMVar mv i)
+  replicateM_ 10 (takeMVar mv)
+
+main :: IO ()
+main = do
+  ok1 <- startTestWriter
+  work
+  ok2 <- startTestWriter -- already running: refused
+  endEventLogging
+  ok3 <- startTestWriter
+  work
+  endEventLogging
+  streams <- completeStreams
+  print (ok1, ok2, ok3, streams)
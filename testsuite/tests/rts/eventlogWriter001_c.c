@@ -0,0 +1,52 @@
+#include "Rts.h"
+#include <string.h>
+
+static unsigned char first[4], last[2];
+static bool have_first;
+static int complete;
+
+static void initTestWriter(void)
+{
+    have_first = false;
+    memset(last, 0, sizeof(last));
+}
+
+static bool writeTestWriter(void *eventlog, size_t size)
+{
+    unsigned char *p = eventlog;
+
+    if (!have_first && size >= 4) {
+        memcpy(first, p, 4);
+        have_first = true;
+    }
+    if (size >= 2) {
+        memcpy(last, p + size - 2, 2);
+    }
+    return true;
+}
+
+static void stopTestWriter(void)
+{
+    // EVENT_HEADER_BEGIN ("hdrb") ... EVENT_DATA_END (0xffff)
+    if (have_first && memcmp(first, "hdrb", 4) == 0 &&
+        last[0] == 0xff && last[1] == 0xff) {
+        complete++;
+    }
+}
+
+static const EventLogWriter TestWriter = {
+    .initEventLogWriter = initTestWriter,
+    .writeEventLog = writeTestWriter,
+    .flushEventLog = NULL,
+    .stopEventLogWriter = stopTestWriter
+};
+
+int startTestWriter(void)
+{
+    return startEventLogging(&TestWriter);
+}
+
+int completeStreams(void)
+{
+    return complete;
+}
@@ -0,0 +1,41 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+-- Waiting on an fd above FD_SETSIZE in the non-threaded RTS, which select()
+-- cannot do: twice, since the fd is re-armed for the second wait.
+
+import Control.Concurrent
+import Control.Monad
+import Data.Maybe
+import Foreign
+import Foreign.C
+import qualified System.Posix.Internals as SPI
+import System.Posix.Types
+
+foreign import ccall unsafe "dupHighFd" dupHighFd :: CInt -> IO CInt
+
+pipe :: IO (CInt, CInt)
+pipe = allocaArray 2 $ \fds -> do
+  throwErrnoIfMinus1_ "pipe" $ SPI.c_pipe fds
+  rd <- peekElemOff fds 0
+  wr <- peekElemOff fds 1
+  return (rd, wr)
+
+main :: IO ()
+main = do
+  (r0, w) <- pipe
+  r <- dupHighFd r0
+  if r < 0
+    then -- the limit on open files is too low to test anything
+         replicateM_ 2 (putStrLn "woken")
+    else do
+      _ <- SPI.c_close r0
+      replicateM_ 2 $ do
+        woken <- newEmptyMVar
+        _ <- forkIO $ threadWaitRead (Fd r) >> putMVar woken ()
+        threadDelay 100000
+        early <- tryTakeMVar woken
+        when (isJust early) $ putStrLn "woken before the write"
+        allocaBytes 1 $ \buf -> do
+          throwErrnoIfMinus1_ "write" $ SPI.c_write w buf 1
+          takeMVar woken
+          throwErrnoIfMinus1_ "read" $ SPI.c_read r buf 1
+        putStrLn "woken"
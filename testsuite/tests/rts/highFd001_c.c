@@ -0,0 +1,26 @@
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+// Duplicate fd onto a descriptor above FD_SETSIZE, raising the soft limit
+// on open files if need be.  Returns the new descriptor, or -1 if the hard
+// limit is too low.
+int dupHighFd(int fd)
+{
+    int target = FD_SETSIZE + 100;
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) {
+        return -1;
+    }
+    if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur <= (rlim_t)target) {
+        if (rl.rlim_max != RLIM_INFINITY && rl.rlim_max <= (rlim_t)target) {
+            return -1;
+        }
+        rl.rlim_cur = target + 1;
+        if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+            return -1;
+        }
+    }
+    return dup2(fd, target);
+}
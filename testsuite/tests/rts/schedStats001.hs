@@ -0,0 +1,17 @@
+import Control.Concurrent
+import Control.Monad
+import GHC.Stats
+
+main :: IO ()
+main = do
+  mv <- newEmptyMVar
+  forM_ [1..10 :: Int] $ \_ -> forkIO $ threadDelay 1000 >> putMVar mv ()
+  replicateM_ 10 (takeMVar mv)
+  s <- sched <$> getRTSStats
+  print (schedhist_count (sched_run s) > 0)
+  print (schedhist_count (sched_runnable s) > 0)
+  -- the main thread blocked on the MVar (BlockedOnMVar == 1)
+  print (schedhist_count (sched_blocked s !! 1) > 0)
+  print (length (sched_blocked s))
+  print (all ((== 24) . length . schedhist_buckets)
+              (sched_run s : sched_runnable s : sched_blocked s))
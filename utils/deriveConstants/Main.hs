@@ -499,6 +499,8 @@ wanteds os = concat
           ,closureField C "StgAtomicInvariant" "code"
 
           ,closureField C "StgTRecHeader" "enclosing_trec"
+          ,closureField C "StgTRecHeader" "state"
+          ,constantWord C "TREC_CONDEMNED" "TREC_CONDEMNED"
 
           ,closureSize  C "StgCatchSTMFrame"
           ,closureField C "StgCatchSTMFrame" "handler"
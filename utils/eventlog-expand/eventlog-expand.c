@@ -0,0 +1,498 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * eventlog-expand: convert an eventlog written with +RTS --eventlog-compact
+ * into the normal encoding, which ghc-events and ThreadScope can read, and
+ * measure how much smaller and how fast to read the compact encoding is.
+ *
+ *     eventlog-expand [-s] [-t] [-b <n>] <in.eventlog> [<out.eventlog>]
+ *
+ *   -s      print the number of events, and the size of the log in its own
+ *           encoding and in the normal one
+ *   -t      print the number of events of each type that occurs
+ *   -b <n>  decode the log <n> times, and print the decoding throughput
+ *
+ * A log that is already in the normal encoding is copied unchanged.  The
+ * encodings are described in includes/rts/EventLogFormat.h.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#define EVENTLOG_CONSTANTS_ONLY
+#include "rts/EventLogFormat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define MAX_EVENT_TAGS 0x10000
+#define MAX_TID_FIELDS 8
+#define VARIABLE_SIZE  0xffff
+
+typedef struct {
+    bool known;
+    uint16_t size;                      // VARIABLE_SIZE if variable
+    uint32_t n_tids;
+    uint16_t tids[MAX_TID_FIELDS];      // offsets of VarInt thread ids
+} EventTypeInfo;
+
+static EventTypeInfo types[MAX_EVENT_TAGS];
+
+static const char *in_name;
+static FILE *in;
+static uint64_t in_pos;
+static FILE *out;                       // NULL: decode only
+static bool compact;
+
+static uint64_t n_events;
+static uint64_t n_events_of[MAX_EVENT_TAGS];
+static uint64_t out_bytes;
+
+// The block being expanded: its size field changes, so it is buffered
+// until its end and then patched.
+static bool in_block;
+static uint64_t block_end;              // input offset of the end
+static unsigned char *block;
+static size_t block_len, block_cap;
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "eventlog-expand: %s: %s at offset %llu\n",
+            in_name, msg, (unsigned long long)in_pos);
+    exit(1);
+}
+
+/* -----------------------------------------------------------------------------
+   Input
+   -------------------------------------------------------------------------- */
+
+static unsigned char in_buf[64 * 1024];
+static size_t in_buf_pos, in_buf_len;
+
+static void rewindInput(void)
+{
+    rewind(in);
+    in_pos = 0;
+    in_buf_pos = in_buf_len = 0;
+}
+
+static uint8_t get8(void)
+{
+    if (in_buf_pos == in_buf_len) {
+        in_buf_len = fread(in_buf, 1, sizeof(in_buf), in);
+        in_buf_pos = 0;
+        if (in_buf_len == 0) {
+            die("unexpected end of file");
+        }
+    }
+    in_pos++;
+    return in_buf[in_buf_pos++];
+}
+
+static uint16_t get16(void)
+{
+    uint16_t hi = get8();
+    return (uint16_t)(hi << 8 | get8());
+}
+
+static uint32_t get32(void)
+{
+    uint32_t hi = get16();
+    return hi << 16 | get16();
+}
+
+static uint64_t get64(void)
+{
+    uint64_t hi = get32();
+    return hi << 32 | get32();
+}
+
+static uint64_t getVarInt(void)
+{
+    uint64_t i = 0;
+    unsigned shift = 0;
+    uint8_t b;
+
+    do {
+        if (shift > 63) {
+            die("VarInt too long");
+        }
+        b = get8();
+        i |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return i;
+}
+
+/* -----------------------------------------------------------------------------
+   Output
+   -------------------------------------------------------------------------- */
+
+static void putBytes(const unsigned char *p, size_t n)
+{
+    out_bytes += n;
+    if (out == NULL) {
+        return;
+    }
+    if (in_block) {
+        if (block_len + n > block_cap) {
+            block_cap = (block_len + n) * 2;
+            block = realloc(block, block_cap);
+            if (block == NULL) {
+                fprintf(stderr, "eventlog-expand: out of memory\n");
+                exit(1);
+            }
+        }
+        memcpy(block + block_len, p, n);
+        block_len += n;
+    } else if (fwrite(p, 1, n, out) != n) {
+        perror("eventlog-expand: write");
+        exit(1);
+    }
+}
+
+static void put8(uint8_t i)
+{
+    putBytes(&i, 1);
+}
+
+static void put16(uint16_t i)
+{
+    unsigned char b[2] = { (unsigned char)(i >> 8), (unsigned char)i };
+    putBytes(b, 2);
+}
+
+static void put32(uint32_t i)
+{
+    put16((uint16_t)(i >> 16));
+    put16((uint16_t)i);
+}
+
+static void put64(uint64_t i)
+{
+    put32((uint32_t)(i >> 32));
+    put32((uint32_t)i);
+}
+
+static void copyBytes(uint32_t n)
+{
+    while (n-- > 0) {
+        put8(get8());
+    }
+}
+
+static void startBlock(void)
+{
+    in_block = true;
+    block_len = 0;
+    block_end = UINT64_MAX;             // until we have read its size
+}
+
+static void endBlock(void)
+{
+    uint32_t size = (uint32_t)block_len;
+    bool writing = out != NULL;
+
+    if (!in_block) {
+        return;
+    }
+    in_block = false;
+    if (writing) {
+        // (type:16, time:64, size:32, ...)
+        block[10] = (unsigned char)(size >> 24);
+        block[11] = (unsigned char)(size >> 16);
+        block[12] = (unsigned char)(size >> 8);
+        block[13] = (unsigned char)size;
+        if (fwrite(block, 1, block_len, out) != block_len) {
+            perror("eventlog-expand: write");
+            exit(1);
+        }
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   The log
+   -------------------------------------------------------------------------- */
+
+static void expandHeader(void)
+{
+    uint32_t marker, flags = 0;
+
+    if (get32() != EVENT_HEADER_BEGIN) {
+        die("not an eventlog");
+    }
+    put32(EVENT_HEADER_BEGIN);
+
+    marker = get32();
+    if (marker == EVENT_HEADER_FLAGS) {
+        flags = get32();
+        marker = get32();
+    }
+    if (flags & ~EVENTLOG_FLAG_COMPACT) {
+        die("unknown header flags");
+    }
+    compact = (flags & EVENTLOG_FLAG_COMPACT) != 0;
+
+    if (marker != EVENT_HET_BEGIN) {
+        die("expected the event types");
+    }
+    put32(EVENT_HET_BEGIN);
+
+    memset(types, 0, sizeof(types));
+    while ((marker = get32()) == EVENT_ET_BEGIN) {
+        uint16_t num = get16();
+        uint16_t size = get16();
+        uint32_t desclen, extlen, i;
+        EventTypeInfo *et = &types[num];
+
+        put32(EVENT_ET_BEGIN);
+        put16(num);
+        put16(size);
+        desclen = get32();
+        put32(desclen);
+        copyBytes(desclen);
+
+        et->known = true;
+        et->size = size;
+        extlen = get32();
+        if (compact) {
+            // the offsets of the VarInt thread ids, which we expand
+            if (extlen % 2 != 0 || extlen / 2 > MAX_TID_FIELDS) {
+                die("bad thread id offsets");
+            }
+            et->n_tids = extlen / 2;
+            for (i = 0; i < et->n_tids; i++) {
+                et->tids[i] = get16();
+                if (i > 0 && et->tids[i] < et->tids[i-1] + 4) {
+                    die("thread id offsets overlap");
+                }
+            }
+            put32(0);
+        } else {
+            put32(extlen);
+            copyBytes(extlen);
+        }
+
+        if (get32() != EVENT_ET_END) {
+            die("expected the end of an event type");
+        }
+        put32(EVENT_ET_END);
+    }
+
+    if (marker != EVENT_HET_END) {
+        die("expected the end of the event types");
+    }
+    put32(EVENT_HET_END);
+    if (get32() != EVENT_HEADER_END) {
+        die("expected the end of the header");
+    }
+    put32(EVENT_HEADER_END);
+    if (get32() != EVENT_DATA_BEGIN) {
+        die("expected the events");
+    }
+    put32(EVENT_DATA_BEGIN);
+}
+
+static void expandPayload(const EventTypeInfo *et)
+{
+    uint32_t pos = 0, i;
+
+    if (et->size == VARIABLE_SIZE) {
+        uint16_t size = get16();
+        put16(size);
+        copyBytes(size);
+        return;
+    }
+
+    for (i = 0; i < et->n_tids; i++) {
+        uint64_t tid;
+
+        if (et->tids[i] + 4 > et->size) {
+            die("thread id offset beyond the event");
+        }
+        copyBytes(et->tids[i] - pos);
+        tid = getVarInt();
+        if (tid > UINT32_MAX) {
+            die("thread id out of range");
+        }
+        put32((uint32_t)tid);
+        pos = et->tids[i] + 4;
+    }
+    copyBytes(et->size - pos);
+}
+
+static void expandEvents(void)
+{
+    uint64_t prev_ts = 0;
+
+    for (;;) {
+        uint64_t start = in_pos;
+        uint16_t type = get16();
+        const EventTypeInfo *et;
+        uint64_t ts;
+
+        if (type == EVENT_DATA_END) {
+            endBlock();
+            put16(EVENT_DATA_END);
+            return;
+        }
+        et = &types[type];
+        if (!et->known) {
+            die("event of unknown type");
+        }
+
+        if (type == EVENT_BLOCK_MARKER) {
+            // (size:32, end_time:64, cap:16), and always a full timestamp
+            uint32_t size;
+
+            endBlock();
+            startBlock();
+            ts = get64();
+            put16(type);
+            put64(ts);
+            size = get32();
+            put32(size); // patched by endBlock()
+            copyBytes(et->size - 4);
+            if (size != 0) {
+                block_end = start + size;
+            }
+        } else {
+            if (in_block && start >= block_end) {
+                endBlock();
+            }
+            if (compact) {
+                uint64_t z = getVarInt();
+                ts = prev_ts + (uint64_t)((int64_t)(z >> 1) ^ -(int64_t)(z & 1));
+            } else {
+                ts = get64();
+            }
+            put16(type);
+            put64(ts);
+            expandPayload(et);
+        }
+
+        prev_ts = ts;
+        n_events++;
+        n_events_of[type]++;
+    }
+}
+
+static void expand(void)
+{
+    rewindInput();
+    n_events = 0;
+    memset(n_events_of, 0, sizeof(n_events_of));
+    out_bytes = 0;
+    in_block = false;
+    expandHeader();
+    expandEvents();
+}
+
+/* -----------------------------------------------------------------------------
+   Main
+   -------------------------------------------------------------------------- */
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: eventlog-expand [-s] [-t] [-b <n>] <in.eventlog> [<out.eventlog>]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    bool stats = false;
+    bool by_type = false;
+    long runs = 0;
+    const char *out_name = NULL;
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "-s") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "-t") == 0) {
+            by_type = true;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            runs = strtol(argv[++i], NULL, 10);
+            if (runs <= 0) {
+                usage();
+            }
+        } else {
+            usage();
+        }
+    }
+    if (i == argc || argc - i > 2) {
+        usage();
+    }
+    in_name = argv[i];
+    if (i + 1 < argc) {
+        out_name = argv[i + 1];
+    }
+
+    in = fopen(in_name, "rb");
+    if (in == NULL) {
+        perror(in_name);
+        return 1;
+    }
+    if (out_name != NULL) {
+        out = fopen(out_name, "wb");
+        if (out == NULL) {
+            perror(out_name);
+            return 1;
+        }
+    }
+
+    expand();
+
+    if (out != NULL && fclose(out) != 0) {
+        perror(out_name);
+        return 1;
+    }
+    out = NULL;
+
+    if (stats) {
+        printf("encoding:       %s\n", compact ? "compact" : "normal");
+        printf("events:         %llu\n", (unsigned long long)n_events);
+        printf("bytes:          %llu (%.1f per event)\n",
+               (unsigned long long)in_pos,
+               n_events ? (double)in_pos / n_events : 0.0);
+        printf("normal bytes:   %llu (%.1f per event)\n",
+               (unsigned long long)out_bytes,
+               n_events ? (double)out_bytes / n_events : 0.0);
+    }
+
+    if (by_type) {
+        uint32_t t;
+        for (t = 0; t < MAX_EVENT_TAGS; t++) {
+            if (n_events_of[t] != 0) {
+                printf("type %u: %llu\n",
+                       (unsigned)t, (unsigned long long)n_events_of[t]);
+            }
+        }
+    }
+
+    if (runs > 0) {
+        clock_t begin, end;
+        double secs;
+        long r;
+
+        begin = clock();
+        for (r = 0; r < runs; r++) {
+            expand();
+        }
+        end = clock();
+        secs = (double)(end - begin) / CLOCKS_PER_SEC;
+        if (secs <= 0) {
+            secs = 1.0 / CLOCKS_PER_SEC;
+        }
+        printf("decoding:       %.1f MB/s, %.2f M events/s\n",
+               (double)in_pos * runs / secs / 1e6,
+               (double)n_events * runs / secs / 1e6);
+    }
+
+    fclose(in);
+    return 0;
+}
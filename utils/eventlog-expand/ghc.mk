@@ -0,0 +1,20 @@
+# -----------------------------------------------------------------------------
+#
+# (c) 2009 The University of Glasgow
+#
+# This file is part of the GHC build system.
+#
+# To understand how the build system works and how to modify it, see
+#      http://ghc.haskell.org/trac/ghc/wiki/Building/Architecture
+#      http://ghc.haskell.org/trac/ghc/wiki/Building/Modifying
+#
+# -----------------------------------------------------------------------------
+
+utils/eventlog-expand_dist_C_SRCS  = eventlog-expand.c
+utils/eventlog-expand_dist_PROGNAME = eventlog-expand
+utils/eventlog-expand_dist_INSTALL = YES
+utils/eventlog-expand_dist_INSTALL_INPLACE = YES
+
+utils/eventlog-expand_CC_OPTS += $(addprefix -I,$(GHC_INCLUDE_DIRS))
+
+$(eval $(call build-prog,utils/eventlog-expand,dist,0))